@@ -80,8 +80,6 @@ Test::Test(int width, int height)
 	box.translateX(-1.5f);
 	box.rotateOnAxis(glm::normalize(glm::vec3(1.0f, 1.0f, 0.0f)), 1.0f);
 	box.texture.load_file("../assets/textures/uv-test-bw.png", true);
-	box.init_lightmap(&renderer, 64);
-	lightmaps.push_back({ box.lightmap.get(), box.lightmap_target.get() });
 	scene.add(&box);
 
 	GeometryCreator::CreateSphere(&sphere.geometry, 1.0f, 32, 16);
@@ -91,16 +89,12 @@ Test::Test(int width, int height)
 	sphere.material.metallicFactor = 0.5f;
 	sphere.material.roughnessFactor = 0.5f;
 	sphere.material.update_uniform();
-	sphere.init_lightmap(&renderer, 64);
-	lightmaps.push_back({ sphere.lightmap.get(), sphere.lightmap_target.get() });
 	scene.add(&sphere);
 
 	GeometryCreator::CreatePlane(&ground.geometry, 10.0f, 10.0f);
 	ground.name = "ground";
 	ground.translateY(-1.7f);
 	ground.rotateX(-3.14159f * 0.5f);
-	ground.init_lightmap(&renderer, 64);
-	lightmaps.push_back({ ground.lightmap.get(), ground.lightmap_target.get() });
 	scene.add(&ground);
 
 	directional_light.intensity = 4.0;
@@ -110,6 +104,14 @@ Test::Test(int width, int height)
 	directional_light.SetShadowRadius(0.02f);
 	scene.add(&directional_light);
 
+	// one atlas for all models, each page is baked with a single dispatch chain
+	scene.init_lightmap(&renderer, 64);
+	for (size_t i = 0; i < scene.lightmap_targets.size(); i++)
+	{
+		renderer.probeLightmap(scene, *scene.lightmap_targets[i]);
+		lightmaps.push_back({ scene.lightmap.get(), scene.lightmap_targets[i].get() });
+	}
+
 	check_time = time_sec();
 }
 
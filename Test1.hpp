@@ -9,6 +9,8 @@
 #include "renderers/GLRenderer.h"
 #include "renderers/GLRenderTarget.h"
 #include "renderers/LightmapRenderTarget.h"
+#include "renderers/LightmapBakeSession.h"
+#include "renderers/GLUploadQueue.h"
 
 
 class Test
@@ -19,11 +21,13 @@ public:
 
 	ColorBackground background;
 
+	GLUploadQueue upload_queue;
 	GLTFModel model;
+	// declared after the model and the queue, so they outlive the loader and the atlas worker
+	GLTFAsyncLoad model_load;
+	std::future<std::unique_ptr<LightmapAtlas>> atlas_task;
 
-	int idx_texel = 0;	
-	int iter = 0;
-	int iterations = 6;
+	std::unique_ptr<LightmapBakeSession> bake;
 
 	double check_time;
 
@@ -32,6 +36,7 @@ public:
 	Test(int width, int height);
 
 	void Draw(int width, int height);
+	void init_bake();
 
 	bool mouse_down = false;
 	bool recieve_delta = false;
@@ -53,16 +58,38 @@ Test::Test(int width, int height)
 	background.color = glm::vec3(0.8f, 0.8f, 0.8f);
 	scene.background = &background;
 
-	GLTFLoader::LoadModelFromFile(&model, "../assets/models/fireplace_room.glb");
-	model.batch_primitives();
-	scene.add(&model);
+	// the scene renders the background until the model is uploaded, the bake starts after
+	model_load = GLTFLoader::LoadModelFromFileAsync(&model, "../assets/models/fireplace_room.glb", upload_queue, [this](bool ok)
+	{
+		if (!ok) return;
+		model.batch_primitives();
+		scene.add(&model);
 
-	model.init_lightmap(&renderer, 256);
+		// the atlas takes seconds on a large model, it runs on a worker instead of inside the drain budget
+		atlas_task = std::async(std::launch::async, [this]()
+		{
+			std::unique_ptr<LightmapAtlas> atlas(new LightmapAtlas);
+			model.compute_lightmap_atlas(*atlas, 256);
+			return atlas;
+		});
+	});
 
 	check_time = time_sec();
 	
 }
 
+void Test::init_bake()
+{
+	std::unique_ptr<LightmapAtlas> atlas = atlas_task.get();
+	model.init_lightmap(&renderer, *atlas);
+
+	// resumes an interrupted bake if a checkpoint of the same atlas is found
+	bake = std::unique_ptr<LightmapBakeSession>(new LightmapBakeSession(model.lightmap, model.lightmap_targets, 6));
+	bake->checkpoint_path = "bake_checkpoint.bin";
+	bake->checkpoint_interval = 60.0;
+	bake->load(bake->checkpoint_path.c_str());
+}
+
 void Test::set_mouse_down(bool down)
 {
 	if (down)
@@ -105,27 +132,24 @@ void Test::Draw(int width, int height)
 
 	renderer.render(scene, camera, render_target);
 
+	upload_queue.drain(0.004);
+	if (atlas_task.valid() && atlas_task.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		init_bake();
+	}
+	if (bake == nullptr) return;
+
 	double start = time_sec();	
 	
-	while (iter < iterations)
+	while (!bake->finished())
 	{
 		double t = time_sec();
 		if (t - check_time > 0.5)
 		{
-			printf("iter: %d, texel: %d\n", iter, idx_texel);
+			printf("iter: %d, texel: %d\n", bake->iter, bake->idx_texel);
 			check_time = t;
 		}
 		if (t - start > 0.010) break;		
-		Lightmap& lightmap = *model.lightmap;
-		LightmapRenderTarget& source = *model.lightmap_target;
-		int num_texels = source.count_valid;
-		int count = renderer.updateLightmap(scene, lightmap, source, idx_texel, 8 << iter);
-		idx_texel += count;
-		if (idx_texel >= num_texels)
-		{
-			renderer.filterLightmap(lightmap, source);
-			idx_texel = 0;
-			iter++;			
-		}
+		bake->step(scene, renderer);
 	}
 }
@@ -3,8 +3,12 @@
 #include <cstdint>
 #include <memory>
 #include <vector>
+#include <glm.hpp>
 #include "renderers/GLUtils.h"
 
+class ProbeVolume;
+class ReflectionProbe;
+
 struct Lights
 {
 	int num_directional_lights = 0;
@@ -16,6 +20,51 @@ struct Lights
 	std::unique_ptr<GLDynBuffer> constant_directional_shadows;
 
 	std::vector<unsigned> directional_shadow_texs;
+
+	// baked indirect light for the models without a lightmap
+	const ProbeVolume* probe_volume = nullptr;
+
+	// baked reflections, the nearest probe is used for each model
+	std::vector<const ReflectionProbe*> reflection_probes;
 	
 };
 
+// Light gathered by a lightmap bake. Direct: the sky and emissive surfaces seen from the texel, 
+// Indirect: the light bounced off the surfaces hit. A split bake takes the direct part at full 
+// density and the smooth indirect part at a reduced one, see GLRenderer::compositeLightmap()
+enum class LightmapPart
+{
+	All,
+	Direct,
+	Indirect
+};
+
+// One light setup of a multi-setup lightmap bake, e.g. a time of day.
+// Directional lights of the scene in scene order, empty intensities keep the current ones.
+struct LightSetup
+{
+	std::vector<glm::vec3> directional_positions;
+	std::vector<glm::vec3> directional_colors;
+	std::vector<float> directional_intensities;
+};
+
+// Light setups shaded together in one lightmap bake. Lights and shadows of setup k follow 
+// those of setup k-1 in the constant buffers, each shadow map array holds one layer per setup.
+struct LightConfigs
+{
+	int num_configs = 0;
+	int num_directional_lights = 0; // per setup
+	std::unique_ptr<GLDynBuffer> constant_directional_lights;
+
+	int num_directional_shadows = 0; // per setup
+	std::unique_ptr<GLDynBuffer> constant_directional_shadows;
+	std::vector<std::unique_ptr<GLTexture2DArray>> directional_shadow_arrays;
+
+	// bounce source, num_pages layers per setup, nullptr to bake direct light only
+	const GLTexture2DArray* lightmap = nullptr;
+
+	// setups are the layers of a relightable lightmap: the background and emissive surfaces 
+	// only go to the last setup
+	bool relight = false;
+};
+
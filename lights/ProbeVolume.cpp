@@ -0,0 +1,76 @@
+#include <vector>
+#include <GL/glew.h>
+#include "ProbeVolume.h"
+#include "renderers/LightmapRenderTarget.h"
+
+ProbeVolume::ProbeVolume(const glm::vec3& min_pos, const glm::vec3& max_pos, const glm::ivec3& dims)
+	: min_pos(min_pos)
+	, max_pos(max_pos)
+	, dims(glm::max(dims, glm::ivec3(1)))
+	, m_constant(sizeof(ConstProbeVolume), GL_UNIFORM_BUFFER)
+{
+	irradiance = std::unique_ptr<GLTexture3D>(new GLTexture3D);
+	glBindTexture(GL_TEXTURE_3D, irradiance->tex_id);
+	glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, this->dims.x, this->dims.y, this->dims.z * 9);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	const float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	glClearTexImage(irradiance->tex_id, 0, GL_RGBA, GL_FLOAT, zero);
+
+	// probe records in the texel record layout, the normal is unused as probes sample the whole sphere,
+	// the footprint code is 0 so the rays start at the probe centers
+	int count = num_probes();
+	glm::vec3 size = glm::max(max_pos - min_pos, glm::vec3(1e-6f));
+	glm::vec3 step = size / (float)((1 << 21) - 1);
+
+	std::vector<glm::uvec4> records(count);
+	for (int z = 0; z < this->dims.z; z++)
+	{
+		for (int y = 0; y < this->dims.y; y++)
+		{
+			for (int x = 0; x < this->dims.x; x++)
+			{
+				glm::vec3 pos = probe_position(x, y, z);
+				records[x + this->dims.x * (y + this->dims.y * z)] = LightmapRecords::pack_record(glm::ivec2(0), pos, glm::vec3(0.0f, 0.0f, 1.0f), 0, min_pos, step);
+			}
+		}
+	}
+
+	probes = std::unique_ptr<LightmapRecords>(new LightmapRecords);
+	probes->count_valid = count;
+	probes->record_pos_min = min_pos;
+	probes->record_pos_step = step;
+	probes->texel_records = std::unique_ptr<GLBuffer>(new GLBuffer(sizeof(glm::uvec4) * count, GL_SHADER_STORAGE_BUFFER));
+	probes->texel_records->upload(records.data());
+
+	updateConstant();
+}
+
+ProbeVolume::~ProbeVolume()
+{
+
+}
+
+glm::vec3 ProbeVolume::probe_position(int x, int y, int z) const
+{
+	glm::vec3 t = glm::vec3(0.5f);
+	if (dims.x > 1) t.x = (float)x / (float)(dims.x - 1);
+	if (dims.y > 1) t.y = (float)y / (float)(dims.y - 1);
+	if (dims.z > 1) t.z = (float)z / (float)(dims.z - 1);
+	return min_pos + (max_pos - min_pos) * t;
+}
+
+void ProbeVolume::updateConstant()
+{
+	ConstProbeVolume c;
+	c.min_pos = glm::vec4(min_pos, 1.0f);
+	c.max_pos = glm::vec4(max_pos, 1.0f);
+	c.dims = glm::ivec4(dims, 0);
+	m_constant.upload(&c);
+}
+
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <glm.hpp>
+#include "renderers/GLUtils.h"
+
+class LightmapRecords;
+
+struct ConstProbeVolume
+{
+	glm::vec4 min_pos;
+	glm::vec4 max_pos;
+	glm::ivec4 dims;
+};
+
+// Grid of irradiance probes for the models without a lightmap.
+// Probes sit on the grid corners from min_pos to max_pos, baked with GLRenderer::updateProbeVolume().
+class ProbeVolume
+{
+public:
+	ProbeVolume(const glm::vec3& min_pos, const glm::vec3& max_pos, const glm::ivec3& dims);
+	~ProbeVolume();
+
+	glm::vec3 min_pos;
+	glm::vec3 max_pos;
+	glm::ivec3 dims;
+
+	int num_probes() const { return dims.x * dims.y * dims.z; }
+	glm::vec3 probe_position(int x, int y, int z) const;
+
+	// RGBA16F, dims.x x dims.y x (dims.z * 9): slab k holds the SH L2 coefficient k of the
+	// irradiance / PI of each probe in rgb
+	std::unique_ptr<GLTexture3D> irradiance;
+
+	// one record per probe in x, y, z order, traced like lightmap texels
+	std::unique_ptr<LightmapRecords> probes;
+
+	GLDynBuffer m_constant;
+	void updateConstant();
+};
+
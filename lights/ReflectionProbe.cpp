@@ -0,0 +1,17 @@
+#include <cmath>
+#include "ReflectionProbe.h"
+
+ReflectionProbe::ReflectionProbe(const glm::vec3& position, int size)
+	: position(position)
+{
+	reflection.size = size;
+	reflection.num_levels = (int)std::log2((float)size) + 1;
+	if (reflection.num_levels > 7) reflection.num_levels = 7;
+	reflection.allocate();
+}
+
+ReflectionProbe::~ReflectionProbe()
+{
+
+}
+
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <glm.hpp>
+#include "renderers/GLUtils.h"
+
+// Cubemap of the scene seen from a point, traced with the BVH camera path and prefiltered with GGX: 
+// mip level i holds the reflection at roughness i / (num_levels - 1). Baked with GLRenderer::bakeReflectionProbe().
+class ReflectionProbe
+{
+public:
+	ReflectionProbe(const glm::vec3& position, int size = 128);
+	~ReflectionProbe();
+
+	glm::vec3 position;
+	float z_near = 0.01f;
+	float z_far = 1000.0f;
+
+	ReflectionMap reflection;
+	bool baked = false; // unbaked probes are not used for shading
+};
+
@@ -1,10 +1,16 @@
 #include <GL/glew.h>
+#include <cmath>
+#include <thread>
 #include <gtx/matrix_decompose.hpp>
 
 #include "GLTFLoader.h"
 
 #include "models/ModelComponents.h"
 #include "models/GLTFModel.h"
+#include "utils/Utils.h"
+#include "utils/MappedFile.h"
+#include "utils/Semaphore.h"
+#include "renderers/GLUploadQueue.h"
 
 #define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
@@ -180,18 +186,515 @@ inline void t_copy_joints(int num_pos, const T* p_in, glm::uvec4* p_out)
 
 inline void load_animations(tinygltf::Model& model, std::vector<AnimationClip>& animations);
 
-inline void load_model(tinygltf::Model& model, GLTFModel* model_out)
+// Images are decoded after parsing, on worker threads, instead of one by one inside tinygltf.
+// The callback only keeps the encoded bytes of images that don't come from a buffer view,
+// buffer view images are read from the buffer data in place.
+struct EncodedImages
 {
-	struct TexLoadOptions
+	std::vector<std::vector<uint8_t>> data;
+};
+
+static bool s_collect_image(tinygltf::Image* image, const int image_idx, std::string* err, std::string* warn, int req_width, int req_height, const unsigned char* bytes, int size, void* user_data)
+{
+	if (image->bufferView >= 0) return true;
+	EncodedImages* images = (EncodedImages*)user_data;
+	if ((size_t)image_idx >= images->data.size()) images->data.resize(image_idx + 1);
+	images->data[image_idx].assign(bytes, bytes + size);
+	return true;
+}
+
+inline void decode_image(const tinygltf::Model& model, const std::vector<const uint8_t*>& buffers, const EncodedImages& encoded, int idx, tinygltf::Image& image)
+{
+	const unsigned char* bytes = nullptr;
+	size_t size = 0;
+	if (image.bufferView >= 0)
 	{
-		bool is_srgb = true;
-		bool reverse = false;
-	};
+		const tinygltf::BufferView& view = model.bufferViews[image.bufferView];
+		bytes = buffers[view.buffer] + view.byteOffset;
+		size = view.byteLength;
+	}
+	else if ((size_t)idx < encoded.data.size())
+	{
+		bytes = encoded.data[idx].data();
+		size = encoded.data[idx].size();
+	}
+	if (size == 0) return;
+
+	int w, h, comp;
+	unsigned char* data = stbi_load_from_memory(bytes, (int)size, &w, &h, &comp, 4);
+	if (data == nullptr)
+	{
+		printf("Failed to decode image %d\n", idx);
+		return;
+	}
+	image.width = w;
+	image.height = h;
+	image.component = 4;
+	image.bits = 8;
+	image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+	image.image.assign(data, data + (size_t)w * (size_t)h * 4);
+	stbi_image_free(data);
+}
+
+// 2x2 box filter down to 1x1, sRGB colors are averaged in linear space like glGenerateMipmap
+inline void generate_mips_rgba(int width, int height, const uint8_t* data, bool is_srgb, std::vector<std::vector<uint8_t>>& levels)
+{
+	float to_linear[256];
+	for (int i = 0; i < 256; i++)
+	{
+		float c = (float)i / 255.0f;
+		to_linear[i] = is_srgb ? (c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f)) : c;
+	}
+
+	const uint8_t* src = data;
+	int src_w = width;
+	int src_h = height;
+	while (src_w > 1 || src_h > 1)
+	{
+		int dst_w = src_w > 1 ? src_w / 2 : 1;
+		int dst_h = src_h > 1 ? src_h / 2 : 1;
+		levels.emplace_back((size_t)dst_w * (size_t)dst_h * 4);
+		uint8_t* dst = levels.back().data();
+
+		for (int y = 0; y < dst_h; y++)
+		{
+			int y0 = glm::min(y * 2, src_h - 1);
+			int y1 = glm::min(y * 2 + 1, src_h - 1);
+			for (int x = 0; x < dst_w; x++)
+			{
+				int x0 = glm::min(x * 2, src_w - 1);
+				int x1 = glm::min(x * 2 + 1, src_w - 1);
+				const uint8_t* p[4] = {
+					src + ((size_t)x0 + (size_t)y0 * src_w) * 4,
+					src + ((size_t)x1 + (size_t)y0 * src_w) * 4,
+					src + ((size_t)x0 + (size_t)y1 * src_w) * 4,
+					src + ((size_t)x1 + (size_t)y1 * src_w) * 4
+				};
+				uint8_t* q = dst + ((size_t)x + (size_t)y * dst_w) * 4;
+				for (int c = 0; c < 3; c++)
+				{
+					float v = 0.25f * (to_linear[p[0][c]] + to_linear[p[1][c]] + to_linear[p[2][c]] + to_linear[p[3][c]]);
+					if (is_srgb) v = v <= 0.0031308f ? v * 12.92f : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+					q[c] = (uint8_t)glm::clamp((int)(v * 255.0f + 0.5f), 0, 255);
+				}
+				q[3] = (uint8_t)((p[0][3] + p[1][3] + p[2][3] + p[3][3] + 2) / 4);
+			}
+		}
+
+		src = dst;
+		src_w = dst_w;
+		src_h = dst_h;
+	}
+}
+
+struct TexLoadOptions
+{
+	bool is_srgb = true;
+	bool reverse = false;
+};
 
+// CPU side of a primitive: counts and cpu arrays are final, the GL buffers are created by upload_primitive()
+struct PrimitiveStaging
+{
+	Primitive primitive;
+	std::vector<glm::vec4> color;
+	std::vector<glm::vec4> tangent;
+	std::vector<glm::vec4> bitangent;
+};
+
+// A load is split into a CPU stage (parsing, decoding, mips, normals and tangents) that can run on any thread,
+// and a GL stage that creates and fills the GL objects on the context thread.
+struct GLTFLoadState
+{
+	tinygltf::Model model;
+	std::unique_ptr<MappedFile> file; // mapped .glb, the buffers point into it
+	std::vector<const uint8_t*> buffers; // data of each glTF buffer
+	EncodedImages encoded;
+
+	std::vector<TexLoadOptions> tex_opts;
+	std::vector<std::vector<std::vector<uint8_t>>> tex_mips;
+	std::vector<std::vector<PrimitiveStaging>> meshes;
+};
+
+inline void prepare_textures(GLTFLoadState& state)
+{
+	tinygltf::Model& model = state.model;
 	size_t num_textures = model.textures.size();
-	model_out->m_textures.resize(num_textures);
-	std::vector<TexLoadOptions> tex_opts(num_textures);
+	state.tex_opts.resize(num_textures);
+	for (size_t i = 0; i < model.materials.size(); i++)
+	{
+		const tinygltf::Material& material_in = model.materials[i];
+		int id_normal = material_in.normalTexture.index;
+		int id_mr = material_in.pbrMetallicRoughness.metallicRoughnessTexture.index;
+		if (id_normal >= 0) state.tex_opts[id_normal].is_srgb = false;
+		if (id_mr >= 0) state.tex_opts[id_mr].is_srgb = false;
+	}
+
+	int num_images = (int)model.images.size();
+	parallel_for(0, num_images, [&](int i)
+	{
+		decode_image(model, state.buffers, state.encoded, i, model.images[i]);
+	});
+	state.encoded.data.clear();
+
+	state.tex_mips.resize(num_textures);
+	parallel_for(0, (int)num_textures, [&](int i)
+	{
+		const tinygltf::Texture& tex_in = model.textures[i];
+		if (tex_in.source < 0) return;
+		const tinygltf::Image& img_in = model.images[tex_in.source];
+		if (img_in.image.empty()) return;
+		if (!state.tex_opts[i].reverse)
+		{
+			generate_mips_rgba(img_in.width, img_in.height, img_in.image.data(), state.tex_opts[i].is_srgb, state.tex_mips[i]);
+			return;
+		}
+
+		// BGRA source: the swizzled base level goes in front of its mips, the image may be shared with other textures
+		std::vector<uint8_t> base(img_in.image.size());
+		size_t num_pixels = base.size() / 4;
+		for (size_t j = 0; j < num_pixels; j++)
+		{
+			base[j * 4] = img_in.image[j * 4 + 2];
+			base[j * 4 + 1] = img_in.image[j * 4 + 1];
+			base[j * 4 + 2] = img_in.image[j * 4];
+			base[j * 4 + 3] = img_in.image[j * 4 + 3];
+		}
+		generate_mips_rgba(img_in.width, img_in.height, base.data(), state.tex_opts[i].is_srgb, state.tex_mips[i]);
+		state.tex_mips[i].insert(state.tex_mips[i].begin(), std::move(base));
+	});
+}
+
+inline void prepare_primitive(const GLTFLoadState& state, const tinygltf::Primitive& primitive_in, PrimitiveStaging& staging)
+{
+	const tinygltf::Model& model = state.model;
+	const std::vector<const uint8_t*>& buffers = state.buffers;
+	Primitive& primitive_out = staging.primitive;
+
+	int num_materials = (int)model.materials.size();
+	primitive_out.material_idx = primitive_in.material;
+	if (primitive_out.material_idx < 0)
+	{
+		primitive_out.material_idx = num_materials;
+	}
+	bool has_tangent = primitive_out.material_idx < num_materials && model.materials[primitive_out.material_idx].normalTexture.index >= 0;
+
+	primitive_out.geometry.resize(1);
+
+	int id_pos_in = primitive_in.attributes.at("POSITION");
+	const tinygltf::Accessor& acc_pos_in = model.accessors[id_pos_in];
+	primitive_out.num_pos = (int)acc_pos_in.count;
+	const tinygltf::BufferView& view_pos_in = model.bufferViews[acc_pos_in.bufferView];
+	const glm::vec3* p_pos = (const glm::vec3*)(buffers[view_pos_in.buffer] + view_pos_in.byteOffset + acc_pos_in.byteOffset);
+
+	primitive_out.min_pos = { acc_pos_in.minValues[0], acc_pos_in.minValues[1], acc_pos_in.minValues[2] };
+	primitive_out.max_pos = { acc_pos_in.maxValues[0], acc_pos_in.maxValues[1], acc_pos_in.maxValues[2] };
+
+	int id_indices_in = primitive_in.indices;
+	const void* p_indices = nullptr;
+	if (id_indices_in >= 0)
+	{
+		const tinygltf::Accessor& acc_indices_in = model.accessors[id_indices_in];
+		primitive_out.num_face = (int)(acc_indices_in.count / 3);
+		const tinygltf::BufferView& view_indices_in = model.bufferViews[acc_indices_in.bufferView];
+		p_indices = buffers[view_indices_in.buffer] + view_indices_in.byteOffset + acc_indices_in.byteOffset;
+		if (acc_indices_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)
+		{
+			primitive_out.type_indices = 1;
+		}
+		else if (acc_indices_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
+		{
+			primitive_out.type_indices = 2;
+		}
+		else if (acc_indices_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)
+		{
+			primitive_out.type_indices = 4;
+		}
+
+		size_t size_indices = (size_t)primitive_out.type_indices * (size_t)primitive_out.num_face * 3;
+		primitive_out.cpu_indices = std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(size_indices));
+		memcpy(primitive_out.cpu_indices->data(), p_indices, size_indices);
+	}
+	else
+	{
+		primitive_out.num_face = primitive_out.num_pos / 3;
+	}
+
+	primitive_out.cpu_pos = std::unique_ptr<std::vector<glm::vec4>>(new std::vector<glm::vec4>(primitive_out.num_pos));
+	for (int k = 0; k < primitive_out.num_pos; k++)
+		(*primitive_out.cpu_pos)[k] = glm::vec4(p_pos[k], 1.0f);
+
+	primitive_out.cpu_norm = std::unique_ptr<std::vector<glm::vec4>>(new std::vector<glm::vec4>(primitive_out.num_pos, glm::vec4(0.0f)));
+	if (primitive_in.attributes.find("NORMAL") != primitive_in.attributes.end())
+	{
+		int id_norm_in = primitive_in.attributes.at("NORMAL");
+		const tinygltf::Accessor& acc_norm_in = model.accessors[id_norm_in];
+		const tinygltf::BufferView& view_norm_in = model.bufferViews[acc_norm_in.bufferView];
+		const glm::vec3* p_norm = (const glm::vec3*)(buffers[view_norm_in.buffer] + view_norm_in.byteOffset + acc_norm_in.byteOffset);
+
+		for (int k = 0; k < primitive_out.num_pos; k++)
+			(*primitive_out.cpu_norm)[k] = glm::vec4(p_norm[k], 0.0f);
+	}
+	else
+	{
+		g_calc_normal(primitive_out.num_face, primitive_out.num_pos, primitive_out.type_indices, p_indices, primitive_out.cpu_pos->data(), primitive_out.cpu_norm->data());
+	}
 
+	if (primitive_in.attributes.find("COLOR_0") != primitive_in.attributes.end())
+	{
+		int id_color_in = primitive_in.attributes.at("COLOR_0");
+		const tinygltf::Accessor& acc_color_in = model.accessors[id_color_in];
+		const tinygltf::BufferView& view_color_in = model.bufferViews[acc_color_in.bufferView];
+		const uint8_t* p_color = buffers[view_color_in.buffer] + view_color_in.byteOffset + acc_color_in.byteOffset;
+
+		std::vector<glm::vec4>& tmp = staging.color;
+		tmp.resize(primitive_out.num_pos);
+		if (acc_color_in.type == TINYGLTF_TYPE_VEC4)
+		{
+			if (acc_color_in.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
+			{
+				memcpy(tmp.data(), p_color, sizeof(glm::vec4) * primitive_out.num_pos);
+			}
+			else if (acc_color_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
+			{
+				const glm::u16vec4* p_in = (const glm::u16vec4*)p_color;
+				for (int k = 0; k < primitive_out.num_pos; k++)
+				{
+					tmp[k] = glm::vec4(p_in[k]) / 65535.0f;
+				}
+			}
+			else if (acc_color_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)
+			{
+				const glm::u8vec4* p_in = (const glm::u8vec4*)p_color;
+				for (int k = 0; k < primitive_out.num_pos; k++)
+				{
+					tmp[k] = glm::vec4(p_in[k]) / 255.0f;
+				}
+			}
+		}
+		else if (acc_color_in.type == TINYGLTF_TYPE_VEC3)
+		{
+			if (acc_color_in.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
+			{
+				const glm::vec3* p_in = (const glm::vec3*)p_color;
+				for (int k = 0; k < primitive_out.num_pos; k++)
+				{
+					tmp[k] = glm::vec4(p_in[k], 1.0f);
+				}
+			}
+			else if (acc_color_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
+			{
+				const glm::u16vec3* p_in = (const glm::u16vec3*)p_color;
+				for (int k = 0; k < primitive_out.num_pos; k++)
+				{
+					tmp[k] = glm::vec4(glm::vec3(p_in[k]) / 65535.0f, 1.0f);
+				}
+			}
+			else if (acc_color_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)
+			{
+				const glm::u8vec3* p_in = (const glm::u8vec3*)p_color;
+				for (int k = 0; k < primitive_out.num_pos; k++)
+				{
+					tmp[k] = glm::vec4(glm::vec3(p_in[k]) / 255.0f, 1.0f);
+				}
+			}
+		}
+	}
+
+	if (primitive_in.attributes.find("TEXCOORD_0") != primitive_in.attributes.end())
+	{
+		int id_uv_in = primitive_in.attributes.at("TEXCOORD_0");
+		const tinygltf::Accessor& acc_uv_in = model.accessors[id_uv_in];
+		const tinygltf::BufferView& view_uv_in = model.bufferViews[acc_uv_in.bufferView];
+
+		const glm::vec2* p_uv = (const glm::vec2*)(buffers[view_uv_in.buffer] + view_uv_in.byteOffset + acc_uv_in.byteOffset);
+		primitive_out.cpu_uv = std::unique_ptr<std::vector<glm::vec2>>(new std::vector<glm::vec2>(p_uv, p_uv + primitive_out.num_pos));
+	}
+
+	// authored lightmap uv, validated and used in place of xatlas charts by Lightmap
+	if (primitive_in.attributes.find("TEXCOORD_1") != primitive_in.attributes.end())
+	{
+		int id_uv1_in = primitive_in.attributes.at("TEXCOORD_1");
+		const tinygltf::Accessor& acc_uv1_in = model.accessors[id_uv1_in];
+		const tinygltf::BufferView& view_uv1_in = model.bufferViews[acc_uv1_in.bufferView];
+
+		// float, or normalized unsigned byte / short
+		int type_uv1 = acc_uv1_in.componentType;
+		bool valid_uv1 = type_uv1 == TINYGLTF_COMPONENT_TYPE_FLOAT
+			|| (acc_uv1_in.normalized && (type_uv1 == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE || type_uv1 == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT));
+		if (!valid_uv1)
+		{
+			printf("Ignoring TEXCOORD_1 of unsupported component type %d, the lightmap uv is generated.\n", type_uv1);
+		}
+		else
+		{
+			const uint8_t* p_uv1 = buffers[view_uv1_in.buffer] + view_uv1_in.byteOffset + acc_uv1_in.byteOffset;
+			int elem_size = 2 * tinygltf::GetComponentSizeInBytes(type_uv1);
+			int stride = view_uv1_in.byteStride > 0 ? (int)view_uv1_in.byteStride : elem_size;
+
+			primitive_out.cpu_lightmap_uv = std::unique_ptr<std::vector<glm::vec2>>(new std::vector<glm::vec2>(primitive_out.num_pos));
+			std::vector<glm::vec2>& lightmap_uv = *primitive_out.cpu_lightmap_uv;
+			for (int k = 0; k < primitive_out.num_pos; k++)
+			{
+				const uint8_t* p_in = p_uv1 + (size_t)k * stride;
+				if (type_uv1 == TINYGLTF_COMPONENT_TYPE_FLOAT)
+				{
+					memcpy(&lightmap_uv[k], p_in, sizeof(glm::vec2));
+				}
+				else if (type_uv1 == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
+				{
+					const uint16_t* p_short = (const uint16_t*)p_in;
+					lightmap_uv[k] = glm::vec2((float)p_short[0], (float)p_short[1]) / 65535.0f;
+				}
+				else
+				{
+					lightmap_uv[k] = glm::vec2((float)p_in[0], (float)p_in[1]) / 255.0f;
+				}
+			}
+
+			int num_indices = primitive_out.num_face * 3;
+			primitive_out.cpu_lightmap_indices = std::unique_ptr<std::vector<int>>(new std::vector<int>(num_indices));
+			std::vector<int>& lightmap_indices = *primitive_out.cpu_lightmap_indices;
+			for (int k = 0; k < num_indices; k++)
+			{
+				if (p_indices == nullptr)
+				{
+					lightmap_indices[k] = k;
+				}
+				else if (primitive_out.type_indices == 1)
+				{
+					lightmap_indices[k] = (int)((const uint8_t*)p_indices)[k];
+				}
+				else if (primitive_out.type_indices == 2)
+				{
+					lightmap_indices[k] = (int)((const uint16_t*)p_indices)[k];
+				}
+				else if (primitive_out.type_indices == 4)
+				{
+					lightmap_indices[k] = (int)((const uint32_t*)p_indices)[k];
+				}
+			}
+			primitive_out.authored_lightmap_uv = true;
+		}
+	}
+
+	if (has_tangent)
+	{
+		staging.tangent.resize(primitive_out.num_pos, glm::vec4(0.0f));
+		staging.bitangent.resize(primitive_out.num_pos, glm::vec4(0.0f));
+		g_calc_tangent(primitive_out.num_face, primitive_out.num_pos, primitive_out.type_indices, p_indices, primitive_out.cpu_pos->data(), primitive_out.cpu_uv->data(), staging.tangent.data(), staging.bitangent.data());
+	}
+}
+
+inline void prepare_meshes(GLTFLoadState& state)
+{
+	const tinygltf::Model& model = state.model;
+	size_t num_meshes = model.meshes.size();
+	state.meshes.resize(num_meshes);
+
+	std::vector<glm::ivec2> prim_list;
+	for (size_t i = 0; i < num_meshes; i++)
+	{
+		size_t num_primitives = model.meshes[i].primitives.size();
+		state.meshes[i].resize(num_primitives);
+		for (size_t j = 0; j < num_primitives; j++)
+		{
+			prim_list.push_back({ (int)i, (int)j });
+		}
+	}
+
+	// normal and tangent generation dominate, primitives are independent
+	parallel_for(0, (int)prim_list.size(), [&](int k)
+	{
+		glm::ivec2 idx = prim_list[k];
+		prepare_primitive(state, model.meshes[idx.x].primitives[idx.y], state.meshes[idx.x][idx.y]);
+	});
+}
+
+// node hierarchy only touches CPU data of the model
+inline void load_nodes(const GLTFLoadState& state, GLTFModel* model_out)
+{
+	const tinygltf::Model& model = state.model;
+	size_t num_nodes = model.nodes.size();
+	model_out->m_nodes.resize(num_nodes);
+	for (size_t i = 0; i < num_nodes; i++)
+	{
+		const tinygltf::Node& node_in = model.nodes[i];
+		Node& node_out = model_out->m_nodes[i];		
+		node_out.children = node_in.children;
+
+		if (node_in.matrix.size() > 0)
+		{
+			glm::mat4 matrix;
+			for (int c = 0; c < 16; c++)
+			{
+				matrix[c/4][c%4] = (float)node_in.matrix[c];
+			}
+			glm::quat rot;
+			glm::vec3 skew;
+			glm::vec4 persp;
+			glm::decompose(matrix, node_out.scale, node_out.rotation, node_out.translation, skew, persp);
+		}
+		else
+		{
+			if (node_in.translation.size() > 0)
+			{
+				node_out.translation.x = (float)node_in.translation[0];
+				node_out.translation.y = (float)node_in.translation[1];
+				node_out.translation.z = (float)node_in.translation[2];
+			}
+			else
+			{
+				node_out.translation = { 0.0f, 0.0f, 0.0f };
+			}
+
+			if (node_in.rotation.size() > 0)
+			{
+				node_out.rotation.x = (float)node_in.rotation[0];
+				node_out.rotation.y = (float)node_in.rotation[1];
+				node_out.rotation.z = (float)node_in.rotation[2];
+				node_out.rotation.w = (float)node_in.rotation[3];
+			}
+			else
+			{
+				node_out.rotation = glm::identity<glm::quat>();
+			}
+
+			if (node_in.scale.size() > 0)
+			{
+				node_out.scale.x = (float)node_in.scale[0];
+				node_out.scale.y = (float)node_in.scale[1];
+				node_out.scale.z = (float)node_in.scale[2];
+			}
+			else
+			{
+				node_out.scale = { 1.0f, 1.0f, 1.0f };
+			}
+		}
+
+		std::string name = node_in.name;
+		if (name == "")
+		{
+			char node_name[32];
+			sprintf(node_name, "node_%d", (int)i);
+			name = node_name;
+		}
+
+		model_out->m_node_dict[name] = i;
+	}
+	model_out->m_roots = model.scenes[0].nodes;
+}
+
+inline void prepare_model(GLTFLoadState& state, GLTFModel* model_out)
+{
+	prepare_textures(state);
+	prepare_meshes(state);
+	load_nodes(state, model_out);
+}
+
+inline void create_materials(GLTFLoadState& state, GLTFModel* model_out)
+{
+	tinygltf::Model& model = state.model;
 	size_t num_materials = model.materials.size();
 	model_out->m_materials.resize(num_materials+1);
 	for (size_t i = 0; i < num_materials; i++)
@@ -220,7 +723,6 @@ inline void load_model(tinygltf::Model& model, GLTFModel* model_out)
 
 		if (material_in.normalTexture.index >= 0)
 		{
-			tex_opts[material_in.normalTexture.index].is_srgb = false;
 			material_out->tex_idx_normalMap = material_in.normalTexture.index;
 			float scale = (float)material_in.normalTexture.scale;
 			material_out->normalScale = { scale, scale };
@@ -243,7 +745,6 @@ inline void load_model(tinygltf::Model& model, GLTFModel* model_out)
 		int id_mr = pbr.metallicRoughnessTexture.index;
 		if (id_mr >= 0)
 		{
-			tex_opts[id_mr].is_srgb = false;
 			material_out->tex_idx_metalnessMap = id_mr;
 			material_out->tex_idx_roughnessMap = id_mr;
 		}
@@ -304,349 +805,507 @@ inline void load_model(tinygltf::Model& model, GLTFModel* model_out)
 		material_out->update_uniform();
 	}
 
-	for (size_t i = 0; i < num_textures; i++)
-	{
-		tinygltf::Texture& tex_in = model.textures[i];
-		GLTexture2D* tex_out = new GLTexture2D();
-		model_out->m_textures[i] = std::unique_ptr<GLTexture2D>(tex_out);
-
-		tinygltf::Image& img_in = model.images[tex_in.source];
-		model_out->m_tex_dict[img_in.name] = i;
-		const TexLoadOptions& opts = tex_opts[i];
+	model_out->m_textures.resize(model.textures.size());
+}
 
-		bool has_alpha = img_in.component > 3;
-		if (opts.reverse)
-		{
-			if (has_alpha)
-			{
-				tex_out->load_memory_bgra(img_in.width, img_in.height, img_in.image.data(), opts.is_srgb);
-			}
-			else
-			{
-				tex_out->load_memory_bgr(img_in.width, img_in.height, img_in.image.data(), opts.is_srgb);
-			}
-		}
-		else
-		{
-			if (has_alpha)
-			{
-				tex_out->load_memory_rgba(img_in.width, img_in.height, img_in.image.data(), opts.is_srgb);
-			}
-			else
-			{
-				tex_out->load_memory_rgb(img_in.width, img_in.height, img_in.image.data(), opts.is_srgb);
-			}
-		}
+inline void create_texture(GLTFLoadState& state, size_t i, GLTFModel* model_out)
+{
+	tinygltf::Model& model = state.model;
+	tinygltf::Texture& tex_in = model.textures[i];
+	GLTexture2D* tex_out = new GLTexture2D();
+	model_out->m_textures[i] = std::unique_ptr<GLTexture2D>(tex_out);
+	if (tex_in.source < 0) return;
+
+	tinygltf::Image& img_in = model.images[tex_in.source];
+	model_out->m_tex_dict[img_in.name] = i;
+	if (img_in.image.empty()) return;
+	const TexLoadOptions& opts = state.tex_opts[i];
+
+	// a reversed texture has its swizzled base level in tex_mips
+	std::vector<const uint8_t*> levels;
+	if (!opts.reverse) levels.push_back(img_in.image.data());
+	for (size_t j = 0; j < state.tex_mips[i].size(); j++)
+	{
+		levels.push_back(state.tex_mips[i][j].data());
 	}
+	tex_out->load_memory_rgba_mips(img_in.width, img_in.height, (int)levels.size(), levels.data(), opts.is_srgb);
+	state.tex_mips[i].clear();
+}
+
+inline void create_meshes(GLTFLoadState& state, GLTFModel* model_out)
+{
+	tinygltf::Model& model = state.model;
+	size_t num_meshes = state.meshes.size();
+	size_t num_nodes = model.nodes.size();
 
-	size_t num_meshes = model.meshes.size();
-	size_t num_nodes = model.nodes.size();	
-	
 	model_out->m_meshs.resize(num_meshes);
 	for (size_t i = 0; i < num_meshes; i++)
 	{
-		tinygltf::Mesh& mesh_in = model.meshes[i];
-		Mesh& mesh_out = model_out->m_meshs[i];	
-
-		size_t num_primitives = mesh_in.primitives.size();
-		mesh_out.primitives.resize(num_primitives);
-
-		for (size_t j = 0; j < num_primitives; j++)
-		{
-			tinygltf::Primitive& primitive_in = mesh_in.primitives[j];
-			Primitive& primitive_out = mesh_out.primitives[j];
-			primitive_out.material_idx = primitive_in.material;
-			if (primitive_out.material_idx < 0)
-			{
-				primitive_out.material_idx = num_materials;
-			}
-
-			MeshStandardMaterial* material = model_out->m_materials[primitive_out.material_idx].get();
-			bool has_tangent = material->tex_idx_normalMap >= 0;		
-
-			int num_geo_sets = 1;			
-			primitive_out.geometry.resize(num_geo_sets);
-
-			int id_pos_in = primitive_in.attributes["POSITION"];
-			tinygltf::Accessor& acc_pos_in = model.accessors[id_pos_in];
-			primitive_out.num_pos = (int)acc_pos_in.count;
-			tinygltf::BufferView& view_pos_in = model.bufferViews[acc_pos_in.bufferView];
-			const glm::vec3* p_pos = (const glm::vec3*)(model.buffers[view_pos_in.buffer].data.data() + view_pos_in.byteOffset + acc_pos_in.byteOffset);
-
-			primitive_out.min_pos = { acc_pos_in.minValues[0], acc_pos_in.minValues[1], acc_pos_in.minValues[2] };
-			primitive_out.max_pos = { acc_pos_in.maxValues[0], acc_pos_in.maxValues[1], acc_pos_in.maxValues[2] };
+		model_out->m_meshs[i].primitives.resize(state.meshes[i].size());
+	}
 
-			int id_indices_in = primitive_in.indices;
-			const void* p_indices = nullptr;
-			if (id_indices_in >= 0)
-			{
-				tinygltf::Accessor& acc_indices_in = model.accessors[id_indices_in];
-				primitive_out.num_face = (int)(acc_indices_in.count / 3);
-				tinygltf::BufferView& view_indices_in = model.bufferViews[acc_indices_in.bufferView];
-				p_indices = model.buffers[view_indices_in.buffer].data.data() + view_indices_in.byteOffset + acc_indices_in.byteOffset;
+	for (size_t i = 0; i < num_nodes; i++)
+	{
+		tinygltf::Node& node_in = model.nodes[i];
+		int j = node_in.mesh;
 
-				if (acc_indices_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)
-				{
-					primitive_out.type_indices = 1;
-				}
-				else if (acc_indices_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
-				{
-					primitive_out.type_indices = 2;
-				}
-				else if (acc_indices_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)
-				{
-					primitive_out.type_indices = 4;
-				}
-				primitive_out.index_buf = Index(new IndexTextureBuffer((size_t)primitive_out.type_indices * (size_t)primitive_out.num_face * 3, primitive_out.type_indices));
-				primitive_out.index_buf->upload(p_indices);
+		if (j >= 0)
+		{	
+			Mesh& mesh_out = model_out->m_meshs[j];
+			mesh_out.node_id = i;
+			mesh_out.skin_id = node_in.skin;
 
-				primitive_out.cpu_indices = std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(primitive_out.index_buf->m_size));
-				memcpy(primitive_out.cpu_indices->data(), p_indices, primitive_out.index_buf->m_size);
-			}
-			else
+			std::string name = node_in.name;
+			if (name == "")
 			{
-				primitive_out.num_face = primitive_out.num_pos / 3;
+				char mesh_name[32];
+				sprintf(mesh_name, "mesh_%d", j);
+				name = mesh_name;
 			}
+			model_out->m_mesh_dict[name] = j;
+		}
+	}	
+}
 
-			GeometrySet& geometry = primitive_out.geometry[0];
-			primitive_out.cpu_pos = std::unique_ptr<std::vector<glm::vec4>>(new std::vector<glm::vec4>(primitive_out.num_pos));
+inline void upload_primitive(PrimitiveStaging& staging, Primitive& primitive_out)
+{
+	primitive_out = std::move(staging.primitive);
+	GeometrySet& geometry = primitive_out.geometry[0];
 
-			for (int k = 0; k < primitive_out.num_pos; k++)
-				(*primitive_out.cpu_pos)[k] = glm::vec4(p_pos[k], 1.0f);
-			
-			geometry.pos_buf = Attribute(new TextureBuffer(sizeof(glm::vec4) * primitive_out.num_pos, GL_RGBA32F));
-			geometry.pos_buf->upload(primitive_out.cpu_pos->data());
+	if (primitive_out.cpu_indices != nullptr)
+	{
+		primitive_out.index_buf = Index(new IndexTextureBuffer(primitive_out.cpu_indices->size(), primitive_out.type_indices));
+		primitive_out.index_buf->upload(primitive_out.cpu_indices->data());
+	}
 
-			primitive_out.cpu_norm = std::unique_ptr<std::vector<glm::vec4>>(new std::vector<glm::vec4>(primitive_out.num_pos, glm::vec4(0.0f)));
+	geometry.pos_buf = Attribute(new TextureBuffer(sizeof(glm::vec4) * primitive_out.num_pos, GL_RGBA32F));
+	geometry.pos_buf->upload(primitive_out.cpu_pos->data());
 
-			geometry.normal_buf = Attribute(new TextureBuffer(sizeof(glm::vec4) * primitive_out.num_pos, GL_RGBA32F));
-			if (primitive_in.attributes.find("NORMAL") != primitive_in.attributes.end())
-			{
-				int id_norm_in = primitive_in.attributes["NORMAL"];
-				tinygltf::Accessor& acc_norm_in = model.accessors[id_norm_in];
-				tinygltf::BufferView& view_norm_in = model.bufferViews[acc_norm_in.bufferView];
-				const glm::vec3* p_norm = (const glm::vec3*)(model.buffers[view_norm_in.buffer].data.data() + view_norm_in.byteOffset + acc_norm_in.byteOffset);
+	geometry.normal_buf = Attribute(new TextureBuffer(sizeof(glm::vec4) * primitive_out.num_pos, GL_RGBA32F));
+	geometry.normal_buf->upload(primitive_out.cpu_norm->data());
 
-				for (int k = 0; k < primitive_out.num_pos; k++)
-					(*primitive_out.cpu_norm)[k] = glm::vec4(p_norm[k], 0.0f);
-			}
-			else
-			{
-				g_calc_normal(primitive_out.num_face, primitive_out.num_pos, primitive_out.type_indices, p_indices, primitive_out.cpu_pos->data(), primitive_out.cpu_norm->data());
-			}
-			geometry.normal_buf->upload(primitive_out.cpu_norm->data());
+	if (!staging.color.empty())
+	{
+		primitive_out.color_buf = Attribute(new TextureBuffer(sizeof(glm::vec4) * primitive_out.num_pos, GL_RGBA32F));
+		primitive_out.color_buf->upload(staging.color.data());
+	}
 
-			if (primitive_in.attributes.find("COLOR_0") != primitive_in.attributes.end())
-			{
-				int id_color_in = primitive_in.attributes["COLOR_0"];
-				tinygltf::Accessor& acc_color_in = model.accessors[id_color_in];
-				tinygltf::BufferView& view_color_in = model.bufferViews[acc_color_in.bufferView];
-
-				primitive_out.color_buf = Attribute(new TextureBuffer(sizeof(glm::vec4) * primitive_out.num_pos, GL_RGBA32F));
-				
-				if (acc_color_in.type == TINYGLTF_TYPE_VEC4)
-				{					
-					if (acc_color_in.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
-					{
-						primitive_out.color_buf->upload(model.buffers[view_color_in.buffer].data.data() + view_color_in.byteOffset + acc_color_in.byteOffset);
-					}
-					else if (acc_color_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
-					{
-						glm::u16vec4* p_in = (glm::u16vec4*)(model.buffers[view_color_in.buffer].data.data() + view_color_in.byteOffset + acc_color_in.byteOffset);
-						std::vector<glm::vec4> tmp(primitive_out.num_pos);
-						for (int k = 0; k < primitive_out.num_pos; k++)
-						{
-							tmp[k] = glm::vec4(p_in[k]) / 65535.0f;
-						}
-						primitive_out.color_buf->upload(tmp.data());
-					}
-					else if (acc_color_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)
-					{
-						glm::u8vec4* p_in = (glm::u8vec4*)(model.buffers[view_color_in.buffer].data.data() + view_color_in.byteOffset + acc_color_in.byteOffset);
-						std::vector<glm::vec4> tmp(primitive_out.num_pos);
-						for (int k = 0; k < primitive_out.num_pos; k++)
-						{
-							tmp[k] = glm::vec4(p_in[k]) / 255.0f;
-						}
-						primitive_out.color_buf->upload(tmp.data());
-					}
-				}
-				else if (acc_color_in.type == TINYGLTF_TYPE_VEC3)
-				{	
-					if (acc_color_in.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
-					{
-						glm::vec3* p_in = (glm::vec3*)(model.buffers[view_color_in.buffer].data.data() + view_color_in.byteOffset + acc_color_in.byteOffset);
-						std::vector<glm::vec4> tmp(primitive_out.num_pos);
-						for (int k = 0; k < primitive_out.num_pos; k++)
-						{
-							tmp[k] = glm::vec4(p_in[k], 1.0f);
-						}
-						primitive_out.color_buf->upload(tmp.data());
-					}
-					else if (acc_color_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
-					{
-						glm::u16vec3* p_in = (glm::u16vec3*)(model.buffers[view_color_in.buffer].data.data() + view_color_in.byteOffset + acc_color_in.byteOffset);
-						std::vector<glm::vec4> tmp(primitive_out.num_pos);
-						for (int k = 0; k < primitive_out.num_pos; k++)
-						{
-							tmp[k] = glm::vec4(glm::vec3(p_in[k])/65535.0f, 1.0f);
-						}
-						primitive_out.color_buf->upload(tmp.data());
-					}
-					else if (acc_color_in.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)
-					{
-						glm::u8vec3* p_in = (glm::u8vec3*)(model.buffers[view_color_in.buffer].data.data() + view_color_in.byteOffset + acc_color_in.byteOffset);
-						std::vector<glm::vec4> tmp(primitive_out.num_pos);
-						for (int k = 0; k < primitive_out.num_pos; k++)
-						{
-							tmp[k] = glm::vec4(glm::vec3(p_in[k]) / 255.0f, 1.0f);
-						}
-						primitive_out.color_buf->upload(tmp.data());
-					}
-				}
-			}		
+	if (primitive_out.cpu_uv != nullptr)
+	{
+		primitive_out.uv_buf = Attribute(new TextureBuffer(sizeof(glm::vec2) * primitive_out.num_pos, GL_RG32F));
+		primitive_out.uv_buf->upload(primitive_out.cpu_uv->data());
+	}
 
-			if (primitive_in.attributes.find("TEXCOORD_0") != primitive_in.attributes.end())
-			{
-				int id_uv_in = primitive_in.attributes["TEXCOORD_0"];
-				tinygltf::Accessor& acc_uv_in = model.accessors[id_uv_in];
-				tinygltf::BufferView& view_uv_in = model.bufferViews[acc_uv_in.bufferView];		
+	if (!staging.tangent.empty())
+	{
+		geometry.tangent_buf = Attribute(new TextureBuffer(sizeof(glm::vec4) * primitive_out.num_pos, GL_RGBA32F));
+		geometry.bitangent_buf = Attribute(new TextureBuffer(sizeof(glm::vec4) * primitive_out.num_pos, GL_RGBA32F));
+		geometry.tangent_buf->upload(staging.tangent.data());
+		geometry.bitangent_buf->upload(staging.bitangent.data());
+	}
 
-				const glm::vec2* p_uv = (const glm::vec2*)(model.buffers[view_uv_in.buffer].data.data() + view_uv_in.byteOffset + acc_uv_in.byteOffset);
-				primitive_out.uv_buf = Attribute(new TextureBuffer(sizeof(glm::vec2) * primitive_out.num_pos, GL_RG32F));
-				primitive_out.uv_buf->upload(p_uv);
+	staging = PrimitiveStaging();
+}
 
-				primitive_out.cpu_uv = std::unique_ptr<std::vector<glm::vec2>>(new std::vector<glm::vec2>(primitive_out.num_pos));
-				memcpy(primitive_out.cpu_uv->data(), p_uv, primitive_out.uv_buf->m_size);
-			}
+inline void finish_model(GLTFModel* model_out)
+{
+	model_out->updateNodes();
+	model_out->calculate_bounding_box();
+}
 
-			std::vector<glm::vec4> tangent;
-			std::vector<glm::vec4> bitangent;
-			if (has_tangent)
-			{
-				tangent.resize(primitive_out.num_pos, glm::vec4(0.0f));
-				bitangent.resize(primitive_out.num_pos, glm::vec4(0.0f));
-				g_calc_tangent(primitive_out.num_face, primitive_out.num_pos, primitive_out.type_indices, p_indices, primitive_out.cpu_pos->data(), primitive_out.cpu_uv->data(), tangent.data(), bitangent.data());
-				geometry.tangent_buf = Attribute(new TextureBuffer(sizeof(glm::vec4) * primitive_out.num_pos, GL_RGBA32F));
-				geometry.bitangent_buf = Attribute(new TextureBuffer(sizeof(glm::vec4) * primitive_out.num_pos, GL_RGBA32F));
-				geometry.tangent_buf->upload(tangent.data());
-				geometry.bitangent_buf->upload(bitangent.data());
-			}
-			
-		}		
+// GL stage in one go, on the calling thread
+inline void create_model(GLTFLoadState& state, GLTFModel* model_out)
+{
+	create_materials(state, model_out);
+	for (size_t i = 0; i < state.model.textures.size(); i++)
+	{
+		create_texture(state, i, model_out);
 	}
-	
-	model_out->m_nodes.resize(num_nodes);
-	for (size_t i = 0; i < num_nodes; i++)
+	create_meshes(state, model_out);
+	for (size_t i = 0; i < state.meshes.size(); i++)
 	{
-		tinygltf::Node& node_in = model.nodes[i];
-		Node& node_out = model_out->m_nodes[i];		
-		node_out.children = node_in.children;
-
-		if (node_in.matrix.size() > 0)
+		for (size_t j = 0; j < state.meshes[i].size(); j++)
 		{
-			glm::mat4 matrix;
-			for (int c = 0; c < 16; c++)
-			{
-				matrix[c/4][c%4] = (float)node_in.matrix[c];
-			}
-			glm::quat rot;
-			glm::vec3 skew;
-			glm::vec4 persp;
-			glm::decompose(matrix, node_out.scale, node_out.rotation, node_out.translation, skew, persp);
+			upload_primitive(state.meshes[i][j], model_out->m_meshs[i].primitives[j]);
 		}
-		else
+	}
+	finish_model(model_out);
+}
+
+inline std::vector<const uint8_t*> buffer_table(const tinygltf::Model& model)
+{
+	std::vector<const uint8_t*> buffers(model.buffers.size());
+	for (size_t i = 0; i < model.buffers.size(); i++)
+	{
+		buffers[i] = model.buffers[i].data.data();
+	}
+	return buffers;
+}
+
+struct JsonMember
+{
+	std::string key;
+	size_t begin; // start of the key
+	size_t value_begin;
+	size_t value_end;
+};
+
+// Splits the top-level object of a JSON text into its members without building a DOM.
+// Only the structure is scanned, the values are left to whoever parses them.
+static bool s_json_members(const char* json, size_t size, std::vector<JsonMember>& members)
+{
+	size_t pos = 0;
+	auto skip_space = [&]()
+	{
+		while (pos < size && (json[pos] == ' ' || json[pos] == '\t' || json[pos] == '\n' || json[pos] == '\r')) pos++;
+	};
+	auto skip_string = [&]()
+	{
+		pos++;
+		while (pos < size && json[pos] != '"')
 		{
-			if (node_in.translation.size() > 0)
-			{
-				node_out.translation.x = (float)node_in.translation[0];
-				node_out.translation.y = (float)node_in.translation[1];
-				node_out.translation.z = (float)node_in.translation[2];
-			}
-			else
-			{
-				node_out.translation = { 0.0f, 0.0f, 0.0f };
-			}
+			if (json[pos] == '\\') pos++;
+			pos++;
+		}
+		pos++;
+	};
 
-			if (node_in.rotation.size() > 0)
-			{
-				node_out.rotation.x = (float)node_in.rotation[0];
-				node_out.rotation.y = (float)node_in.rotation[1];
-				node_out.rotation.z = (float)node_in.rotation[2];
-				node_out.rotation.w = (float)node_in.rotation[3];
-			}
-			else
-			{
-				node_out.rotation = glm::identity<glm::quat>();
-			}
+	skip_space();
+	if (pos >= size || json[pos] != '{') return false;
+	pos++;
+	skip_space();
+	if (pos < size && json[pos] == '}') return true;
 
-			if (node_in.scale.size() > 0)
+	while (pos < size)
+	{
+		JsonMember member;
+		skip_space();
+		if (pos >= size || json[pos] != '"') return false;
+		member.begin = pos;
+		skip_string();
+		if (pos > size) return false;
+		member.key.assign(json + member.begin + 1, pos - member.begin - 2);
+
+		skip_space();
+		if (pos >= size || json[pos] != ':') return false;
+		pos++;
+		skip_space();
+
+		member.value_begin = pos;
+		int depth = 0;
+		while (pos < size)
+		{
+			char c = json[pos];
+			if (c == '"')
 			{
-				node_out.scale.x = (float)node_in.scale[0];
-				node_out.scale.y = (float)node_in.scale[1];
-				node_out.scale.z = (float)node_in.scale[2];
+				skip_string();
+				continue;
 			}
-			else
+			if (c == '{' || c == '[') depth++;
+			else if (c == '}' || c == ']')
 			{
-				node_out.scale = { 1.0f, 1.0f, 1.0f };
+				if (depth == 0) break;
+				depth--;
 			}
+			else if (c == ',' && depth == 0) break;
+			pos++;
 		}
+		if (pos >= size) return false;
+		member.value_end = pos;
+		members.push_back(member);
 
-		std::string name = node_in.name;
-		if (name == "")
-		{
-			char node_name[32];
-			sprintf(node_name, "node_%d", (int)i);
-			name = node_name;
-		}
+		if (json[pos] == '}') return true;
+		pos++;
+	}
+	return false;
+}
 
-		model_out->m_node_dict[name] = i;
+// The mapped path reads the accessors and images straight from the BIN chunk, so every range has to lie inside it.
+static bool s_check_ranges(const tinygltf::Model& model, const std::vector<size_t>& buffer_sizes, size_t num_images)
+{
+	for (size_t i = 0; i < model.bufferViews.size(); i++)
+	{
+		const tinygltf::BufferView& view = model.bufferViews[i];
+		if (view.buffer < 0 || view.buffer >= (int)buffer_sizes.size()) return false;
+		size_t buffer_size = buffer_sizes[view.buffer];
+		if (view.byteOffset > buffer_size || view.byteLength > buffer_size - view.byteOffset) return false;
 	}
-	model_out->m_roots = model.scenes[0].nodes;
 
-	for (size_t i = 0; i < num_nodes; i++)
+	for (size_t i = 0; i < model.accessors.size(); i++)
 	{
-		tinygltf::Node& node_in = model.nodes[i];
-		Node& node_out = model_out->m_nodes[i];
-		int j = node_in.mesh;
+		const tinygltf::Accessor& acc = model.accessors[i];
+		if (acc.sparse.isSparse) return false;
+		if (acc.bufferView < 0 || acc.bufferView >= (int)model.bufferViews.size()) return false;
+		if (acc.count == 0) continue;
+
+		const tinygltf::BufferView& view = model.bufferViews[acc.bufferView];
+		int stride = acc.ByteStride(view);
+		if (stride <= 0) return false;
+		size_t elem_size = (size_t)tinygltf::GetComponentSizeInBytes((uint32_t)acc.componentType) * (size_t)tinygltf::GetNumComponentsInType((uint32_t)acc.type);
+		if (acc.byteOffset > view.byteLength) return false;
+		size_t avail = view.byteLength - acc.byteOffset;
+		if (elem_size > avail || (acc.count - 1) > (avail - elem_size) / (size_t)stride) return false;
+	}
 
-		if (j >= 0)
-		{	
-			Mesh& mesh_out = model_out->m_meshs[j];
-			mesh_out.node_id = i;
-			mesh_out.skin_id = node_in.skin;
+	for (size_t i = 0; i < num_images; i++)
+	{
+		int view = model.images[i].bufferView;
+		if (view < 0 || view >= (int)model.bufferViews.size()) return false;
+	}
+	return true;
+}
 
-			std::string name = node_in.name;
-			if (name == "")
+// Parses a self-contained .glb straight from a file mapping. tinygltf copies every buffer into a std::vector,
+// so it only gets the JSON chunk with the "buffers" and "images" members cut out of the text, and the accessors 
+// and images are read from the mapped BIN chunk, which the state keeps mapped. Returns false for anything else, 
+// e.g. data in external files or ranges outside the BIN chunk, the caller then falls back to tinygltf.
+static bool s_parse_mapped_glb(GLTFLoadState& state, const char* filename)
+{
+	std::unique_ptr<MappedFile> file(new MappedFile(filename));
+	if (!file->is_open() || file->size() < 20) return false;
+
+	const uint8_t* bytes = file->data();
+	uint32_t version, length, json_length, json_format;
+	memcpy(&version, bytes + 4, 4);
+	memcpy(&length, bytes + 8, 4);
+	memcpy(&json_length, bytes + 12, 4);
+	memcpy(&json_format, bytes + 16, 4);
+	if (memcmp(bytes, "glTF", 4) != 0 || version != 2 || length > file->size()) return false;
+	if (json_format != 0x4E4F534A || 20 + (size_t)json_length > length) return false;
+
+	const uint8_t* bin = nullptr;
+	size_t bin_size = 0;
+	size_t bin_offset = 20 + (size_t)json_length;
+	if (bin_offset + 8 <= length)
+	{
+		uint32_t chunk_length, chunk_format;
+		memcpy(&chunk_length, bytes + bin_offset, 4);
+		memcpy(&chunk_format, bytes + bin_offset + 4, 4);
+		if (chunk_format == 0x004E4942 && bin_offset + 8 + chunk_length <= length)
+		{
+			bin = bytes + bin_offset + 8;
+			bin_size = chunk_length;
+		}
+	}
+
+	const char* json = (const char*)bytes + 20;
+	std::vector<JsonMember> members;
+	if (!s_json_members(json, json_length, members)) return false;
+
+	// only the small "buffers" and "images" arrays are parsed here, the rest of the text goes to tinygltf once
+	std::string json_string = "{";
+	std::vector<const uint8_t*> buffers;
+	std::vector<size_t> buffer_sizes;
+	std::vector<tinygltf::Image> images;
+	for (size_t i = 0; i < members.size(); i++)
+	{
+		const JsonMember& member = members[i];
+		if (member.key == "buffers")
+		{
+			nlohmann::json buffers_in = nlohmann::json::parse(json + member.value_begin, json + member.value_end, nullptr, false);
+			if (buffers_in.is_discarded() || !buffers_in.is_array()) return false;
+			for (const nlohmann::json& buffer : buffers_in)
 			{
-				char mesh_name[32];
-				sprintf(mesh_name, "mesh_%d", j);
-				name = mesh_name;
+				if (!buffer.is_object() || buffer.contains("uri") || bin == nullptr) return false;
+				size_t byte_length = buffer.value("byteLength", (size_t)0);
+				if (byte_length > bin_size) return false;
+				buffers.push_back(bin);
+				buffer_sizes.push_back(byte_length);
 			}
-			model_out->m_mesh_dict[name] = j;
 		}
-	}	
+		else if (member.key == "images")
+		{
+			nlohmann::json images_in = nlohmann::json::parse(json + member.value_begin, json + member.value_end, nullptr, false);
+			if (images_in.is_discarded() || !images_in.is_array()) return false;
+			for (const nlohmann::json& image_in : images_in)
+			{
+				if (!image_in.is_object() || !image_in.contains("bufferView") || !image_in["bufferView"].is_number_integer()) return false;
+				tinygltf::Image image;
+				image.name = image_in.value("name", std::string());
+				image.mimeType = image_in.value("mimeType", std::string());
+				image.bufferView = image_in["bufferView"].get<int>();
+				images.push_back(image);
+			}
+		}
+		else
+		{
+			if (json_string.size() > 1) json_string += ',';
+			json_string.append(json + member.begin, member.value_end - member.begin);
+		}
+	}
+	json_string += '}';
 
-	model_out->updateNodes();
-	model_out->calculate_bounding_box();
+	std::string err;
+	std::string warn;
+	tinygltf::TinyGLTF loader;
+	tinygltf::Model model;
+	if (!loader.LoadASCIIFromString(&model, &err, &warn, json_string.c_str(), (unsigned)json_string.size(), "")) return false;
+	model.images.swap(images);
+	if (!s_check_ranges(model, buffer_sizes, model.images.size())) return false;
+
+	state.model = std::move(model);
+	state.file = std::move(file);
+	state.buffers = buffers;
+	return true;
 }
 
-void GLTFLoader::LoadModelFromFile(GLTFModel* model_out, const char* filename)
+static bool s_parse_file(GLTFLoadState& state, const char* filename)
 {
+	if (s_parse_mapped_glb(state, filename)) return true;
+
 	std::string err;
 	std::string warn;
 	tinygltf::TinyGLTF loader;
-	tinygltf::Model model;
-	loader.LoadBinaryFromFile(&model, &err, &warn, filename);
-	load_model(model, model_out);
+	loader.SetImageLoader(s_collect_image, &state.encoded);
+	if (!loader.LoadBinaryFromFile(&state.model, &err, &warn, filename))
+	{
+		printf("Failed to load %s: %s\n", filename, err.c_str());
+		return false;
+	}
+	state.buffers = buffer_table(state.model);
+	return true;
+}
+
+void GLTFLoader::LoadModelFromFile(GLTFModel* model_out, const char* filename)
+{
+	GLTFLoadState state;
+	if (!s_parse_file(state, filename)) return;
+	prepare_model(state, model_out);
+	create_model(state, model_out);
 }
 
 void GLTFLoader::LoadModelFromMemory(GLTFModel* model_out, unsigned char* data, size_t size)
 {
+	GLTFLoadState state;
 	std::string err;
 	std::string warn;
 	tinygltf::TinyGLTF loader;
-	tinygltf::Model model;
-	loader.LoadBinaryFromMemory(&model, &err, &warn, data, size);
-	load_model(model, model_out);
+	loader.SetImageLoader(s_collect_image, &state.encoded);
+	if (!loader.LoadBinaryFromMemory(&state.model, &err, &warn, data, (unsigned)size))
+	{
+		printf("Failed to load model: %s\n", err.c_str());
+		return;
+	}
+	state.buffers = buffer_table(state.model);
+	prepare_model(state, model_out);
+	create_model(state, model_out);
+}
+
+// number of models in the CPU stage at the same time, each one already spreads its work over all cores
+static Semaphore s_load_slots(2);
+
+GLTFAsyncLoad::GLTFAsyncLoad(GLTFAsyncLoad&& other)
+	: ready(std::move(other.ready))
+	, m_cancelled(std::move(other.m_cancelled))
+	, m_thread(std::move(other.m_thread))
+{
+}
+
+GLTFAsyncLoad& GLTFAsyncLoad::operator=(GLTFAsyncLoad&& other)
+{
+	if (this != &other)
+	{
+		cancel();
+		join();
+		ready = std::move(other.ready);
+		m_cancelled = std::move(other.m_cancelled);
+		m_thread = std::move(other.m_thread);
+	}
+	return *this;
+}
+
+GLTFAsyncLoad::~GLTFAsyncLoad()
+{
+	cancel();
+	join();
+}
+
+void GLTFAsyncLoad::cancel()
+{
+	if (m_cancelled != nullptr) *m_cancelled = true;
+}
+
+void GLTFAsyncLoad::join()
+{
+	if (m_thread.joinable()) m_thread.join();
+}
+
+GLTFAsyncLoad GLTFLoader::LoadModelFromFileAsync(GLTFModel* model_out, const char* filename, GLUploadQueue& queue, const std::function<void(bool)>& on_ready)
+{
+	std::shared_ptr<std::promise<bool>> promise(new std::promise<bool>);
+	std::shared_ptr<std::atomic<bool>> cancelled(new std::atomic<bool>(false));
+	std::string path = filename;
+
+	GLTFAsyncLoad load;
+	load.ready = promise->get_future();
+	load.m_cancelled = cancelled;
+
+	// every command checks the flag first, so a cancelled load leaves the model to its owner
+	load.m_thread = std::thread([model_out, path, &queue, on_ready, promise, cancelled]()
+	{
+		std::shared_ptr<GLTFLoadState> state(new GLTFLoadState);
+
+		s_load_slots.wait();
+		bool ok = !*cancelled && s_parse_file(*state, path.c_str());
+		if (ok && !*cancelled) prepare_model(*state, model_out);
+		s_load_slots.notify();
+
+		if (!ok || *cancelled)
+		{
+			queue.push([on_ready, promise, cancelled]()
+			{
+				if (on_ready && !*cancelled) on_ready(false);
+				promise->set_value(false);
+			});
+			return;
+		}
+
+		// one command per GL object, so a frame only pays for the uploads that fit its budget
+		queue.push([state, model_out, cancelled]()
+		{
+			if (*cancelled) return;
+			create_materials(*state, model_out);
+		});
+
+		for (size_t i = 0; i < state->model.textures.size(); i++)
+		{
+			queue.push([state, i, model_out, cancelled]()
+			{
+				if (*cancelled) return;
+				create_texture(*state, i, model_out);
+			});
+		}
+
+		queue.push([state, model_out, cancelled]()
+		{
+			if (*cancelled) return;
+			create_meshes(*state, model_out);
+		});
+
+		for (size_t i = 0; i < state->meshes.size(); i++)
+		{
+			for (size_t j = 0; j < state->meshes[i].size(); j++)
+			{
+				queue.push([state, i, j, model_out, cancelled]()
+				{
+					if (*cancelled) return;
+					upload_primitive(state->meshes[i][j], model_out->m_meshs[i].primitives[j]);
+				});
+			}
+		}
+
+		queue.push([state, model_out, on_ready, promise, cancelled]()
+		{
+			if (*cancelled)
+			{
+				promise->set_value(false);
+				return;
+			}
+			finish_model(model_out);
+			if (on_ready) on_ready(true);
+			promise->set_value(true);
+		});
+	});
+
+	return load;
 }
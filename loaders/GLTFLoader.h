@@ -1,13 +1,54 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <functional>
 
 class GLTFModel;
 class AnimationClip;
+class GLUploadQueue;
+
+// Handle of a load started by GLTFLoader::LoadModelFromFileAsync().
+// Destroying the handle cancels the load and joins the loader thread, so the owner declares it after the model
+// and the queue. Once cancelled, the commands already pushed run as no-ops: they leave the model alone, on_ready
+// is not called and the future gets false. Cancel on the draining thread, or while the queue is not drained.
+class GLTFAsyncLoad
+{
+public:
+	GLTFAsyncLoad() {}
+	GLTFAsyncLoad(GLTFAsyncLoad&& other);
+	GLTFAsyncLoad& operator=(GLTFAsyncLoad&& other);
+	~GLTFAsyncLoad();
+
+	void cancel();
+	// waits for the loader thread to push its last command, not for the commands to run
+	void join();
+
+	// true once the model is ready, false if the load failed or was cancelled.
+	// Set by the draining thread, which must not wait on it.
+	std::future<bool> ready;
+
+private:
+	friend class GLTFLoader;
+	std::shared_ptr<std::atomic<bool>> m_cancelled;
+	std::thread m_thread;
+
+	GLTFAsyncLoad(const GLTFAsyncLoad&);
+};
+
 class GLTFLoader
 {
 public:
 	static void LoadModelFromFile(GLTFModel* model, const char* filename);
 	static void LoadModelFromMemory(GLTFModel* model, unsigned char* data, size_t size);
+
+	// Parsing, image decoding, mips, normals and tangents run on a loader thread, the GL objects are created
+	// by commands pushed to queue, so the render thread keeps drawing while it drains them.
+	// The model must not be used until the load is ready, the handle must not outlive the model or the queue.
+	// on_ready runs on the draining thread once the last command ran.
+	static GLTFAsyncLoad LoadModelFromFileAsync(GLTFModel* model, const char* filename, GLUploadQueue& queue, const std::function<void(bool)>& on_ready = nullptr);
 	
-};
\ No newline at end of file
+};
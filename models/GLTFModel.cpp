@@ -6,6 +6,7 @@
 #include "utils/Utils.h"
 #include "renderers/bvh_routines/PrimitiveBatch.h"
 #include "renderers/LightmapRenderTarget.h"
+#include "renderers/AtlasRasterizerCPU.h"
 #include "renderers/GLRenderer.h"
 
 GLTFModel::GLTFModel()
@@ -385,6 +386,7 @@ void GLTFModel::batch_lightmap()
 
 		prim_batch.cpu_lightmap_uv = std::unique_ptr<std::vector<glm::vec2>>(new std::vector<glm::vec2>(num_light_uv_batch));
 		prim_batch.cpu_lightmap_indices = std::unique_ptr<std::vector<int>>(new std::vector<int>(prim_batch.num_face * 3));
+		prim_batch.cpu_lightmap_page = std::unique_ptr<std::vector<int>>(new std::vector<int>(num_light_uv_batch));
 
 		int uv_offset = 0;
 		int face_offset = 0;
@@ -403,6 +405,7 @@ void GLTFModel::batch_lightmap()
 			{
 				glm::vec2 uv = (*prim.cpu_lightmap_uv)[j];				
 				(*prim_batch.cpu_lightmap_uv)[uv_offset + j] = uv;
+				(*prim_batch.cpu_lightmap_page)[uv_offset + j] = prim.cpu_lightmap_page != nullptr ? (*prim.cpu_lightmap_page)[j] : 0;
 			}
 
 			int num_face = prim.num_face;
@@ -415,16 +418,65 @@ void GLTFModel::batch_lightmap()
 		prim_batch.lightmap_indices = Index(new IndexTextureBuffer(sizeof(int)*prim_batch.cpu_lightmap_indices->size(), 4));
 		prim_batch.lightmap_indices->upload(prim_batch.cpu_lightmap_indices->data());
 
-		prim_batch.lightmap_uv_buf = Attribute(new TextureBuffer(sizeof(glm::vec2) * num_light_uv_batch, GL_RG32F));
-		prim_batch.lightmap_uv_buf->upload(prim_batch.cpu_lightmap_uv->data());
+		prim_batch.upload_lightmap_uv();
 	}
 }
 
-void GLTFModel::init_lightmap(GLRenderer* renderer, int texelsPerUnit)
+void GLTFModel::batch_vertex_gi()
 {
-	std::vector<Primitive*> primitives;
-	std::vector<glm::mat4> trans;
+	if (batched_mesh == nullptr) return;
+
+	std::unordered_map<int, std::vector<glm::ivec2>> primitive_map;
+
+	size_t num_meshes = m_meshs.size();
+	for (size_t i = 0; i < num_meshes; i++)
+	{
+		Mesh& mesh = m_meshs[i];
+		size_t num_prims = mesh.primitives.size();
+		for (size_t j = 0; j < num_prims; j++)
+		{
+			Primitive& prim = mesh.primitives[j];
+			primitive_map[prim.material_idx].push_back({ i,j });
+		}
+	}
 
+	int num_batched_prims = (int)batched_mesh->primitives.size();
+	for (int i = 0; i < num_batched_prims; i++)
+	{
+		Primitive& prim_batch = batched_mesh->primitives[i];
+		const std::vector<glm::ivec2>& indices = primitive_map[prim_batch.material_idx];
+
+		// vertices of the batch follow the primitives in the same order as batch_primitives()
+		bool has_gi = true;
+		for (size_t k = 0; k < indices.size(); k++)
+		{
+			has_gi = has_gi && m_meshs[indices[k].x].primitives[indices[k].y].vertex_gi_buf != nullptr;
+		}
+		if (!has_gi)
+		{
+			prim_batch.vertex_gi_buf = nullptr;
+			continue;
+		}
+
+		prim_batch.vertex_gi_buf = Attribute(new TextureBuffer(sizeof(glm::vec4) * prim_batch.num_pos, GL_RGBA32F));
+
+		size_t offset = 0;
+		for (size_t k = 0; k < indices.size(); k++)
+		{
+			Primitive& prim = m_meshs[indices[k].x].primitives[indices[k].y];
+			size_t size = sizeof(glm::vec4) * prim.num_pos;
+			glBindBuffer(GL_COPY_READ_BUFFER, prim.vertex_gi_buf->m_id);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, prim_batch.vertex_gi_buf->m_id);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, offset, size);
+			offset += size;
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+}
+
+void GLTFModel::get_lightmap_primitives(std::vector<Primitive*>& primitives, std::vector<glm::mat4>& trans, std::vector<int>& mesh_ids)
+{
 	size_t num_meshes = m_meshs.size();	
 	for (size_t i = 0; i < num_meshes; i++)
 	{
@@ -441,43 +493,137 @@ void GLTFModel::init_lightmap(GLRenderer* renderer, int texelsPerUnit)
 			}
 			primitives.push_back(&prim);
 			trans.push_back(model_mat);
+			mesh_ids.push_back((int)i);
 		}
 	}
+}
 
-	lightmap = std::unique_ptr<Lightmap>(new Lightmap(primitives, trans, texelsPerUnit));
-	if (batched_mesh != nullptr)
-	{		
-		batch_lightmap();		
+void GLTFModel::init_lightmap(GLRenderer* renderer, int texelsPerUnit, int pageSize)
+{
+	std::vector<Primitive*> primitives;
+	std::vector<glm::mat4> trans;
+	std::vector<int> mesh_ids;
+	get_lightmap_primitives(primitives, trans, mesh_ids);
+
+	lightmap = std::shared_ptr<Lightmap>(new Lightmap(primitives, trans, texelsPerUnit, pageSize));
+	_init_lightmap_target(renderer);
+}
+
+void GLTFModel::compute_lightmap_atlas(LightmapAtlas& atlas, int texelsPerUnit, int pageSize)
+{
+	std::vector<Primitive*> primitives;
+	std::vector<glm::mat4> trans;
+	std::vector<int> mesh_ids;
+	get_lightmap_primitives(primitives, trans, mesh_ids);
+
+	Lightmap::compute_atlas(primitives, trans, texelsPerUnit, pageSize, atlas);
+}
+
+void GLTFModel::init_lightmap(GLRenderer* renderer, LightmapAtlas& atlas)
+{
+	std::vector<Primitive*> primitives;
+	std::vector<glm::mat4> trans;
+	std::vector<int> mesh_ids;
+	get_lightmap_primitives(primitives, trans, mesh_ids);
+
+	lightmap = std::shared_ptr<Lightmap>(new Lightmap(primitives, atlas));
+	_init_lightmap_target(renderer);
+}
+
+void GLTFModel::init_lightmap(GLRenderer* renderer, const LightmapBudget& budget, const std::vector<float>& mesh_weights)
+{
+	std::vector<Primitive*> primitives;
+	std::vector<glm::mat4> trans;
+	std::vector<int> mesh_ids;
+	get_lightmap_primitives(primitives, trans, mesh_ids);
+
+	std::vector<float> weights(primitives.size(), 1.0f);
+	for (size_t i = 0; i < primitives.size(); i++)
+	{
+		int mesh_id = mesh_ids[i];
+		if (mesh_id < (int)mesh_weights.size())
+		{
+			weights[i] = mesh_weights[mesh_id];
+		}
 	}
 
-	lightmap_target = std::unique_ptr<LightmapRenderTarget>(new LightmapRenderTarget);
-	lightmap_target->update_framebuffer(lightmap->width, lightmap->height);
-	renderer->rasterize_atlas(this);
-	
-	glm::vec4 zero = { 0.0f, 0.0f, 0.0f, 0.0f};
-	glClearTexImage(lightmap->lightmap->tex_id, 0, GL_RGBA, GL_FLOAT, &zero);
+	lightmap = std::shared_ptr<Lightmap>(new Lightmap(primitives, trans, budget, weights));
+	_init_lightmap_target(renderer);
+}
 
-	std::vector<float> alpha_mask(lightmap->width * lightmap->height);
+void GLTFModel::set_lightmap(const std::shared_ptr<Lightmap>& lm, const std::vector<std::shared_ptr<LightmapRenderTarget>>& targets)
+{
+	lightmap = lm;
+	lightmap_targets = targets;
+	if (batched_mesh != nullptr)
+	{
+		batch_lightmap();
+	}
+}
 
-	glBindTexture(GL_TEXTURE_2D, lightmap_target->m_tex_position->tex_id);
-	glGetTexImage(GL_TEXTURE_2D, 0, GL_ALPHA, GL_FLOAT, alpha_mask.data());
-	glBindTexture(GL_TEXTURE_2D, 0);
+void GLTFModel::add_lightmap_primitives(AtlasRasterizerCPU& rasterizer, int page)
+{
+	updateWorldMatrix(false, false);
+	for (size_t i = 0; i < m_meshs.size(); i++)
+	{
+		Mesh& mesh = m_meshs[i];
+		glm::mat4 model_mat = matrixWorld;
+		if (mesh.node_id >= 0 && mesh.skin_id < 0)
+		{
+			Node& node = m_nodes[mesh.node_id];
+			model_mat *= node.g_trans;
+		}
+		for (size_t j = 0; j < mesh.primitives.size(); j++)
+		{
+			rasterizer.add_primitive(mesh.primitives[j], model_mat, page);
+		}
+	}
+}
 
-	std::vector<glm::u16vec2> lst_valid;
+// normal maps can only be sampled by the GL path
+bool GLTFModel::has_normal_map() const
+{
+	for (size_t i = 0; i < m_materials.size(); i++)
+	{
+		if (m_materials[i]->tex_idx_normalMap >= 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
 
-	for (int i = 0; i < lightmap->width * lightmap->height; i++)
+void GLTFModel::_init_lightmap_target(GLRenderer* renderer)
+{
+	if (batched_mesh != nullptr)
+	{		
+		batch_lightmap();		
+	}
+
+	lightmap_targets.resize(lightmap->num_pages);
+	for (int page = 0; page < lightmap->num_pages; page++)
 	{
-		float f = alpha_mask[i];
-		if (f > 0.5f)
-		{			
-			uint16_t x = (uint16_t)(i % lightmap->width);
-			uint16_t y = (uint16_t)(i / lightmap->width);
-			lst_valid.push_back({ x,y });
-		}	
-	}	
+		lightmap_targets[page] = std::shared_ptr<LightmapRenderTarget>(new LightmapRenderTarget);
+		LightmapRenderTarget& target = *lightmap_targets[page];
+		target.page = page;
+		target.update_framebuffer(lightmap->width, lightmap->height);
+
+		if (has_normal_map())
+		{
+			renderer->rasterize_atlas(this, page);
+		}
+		else
+		{
+			AtlasRasterizerCPU rasterizer(lightmap->width, lightmap->height);
+			add_lightmap_primitives(rasterizer, page);
+			rasterizer.rasterize();
+			rasterizer.upload(target);
+		}
+
+		renderer->compact_atlas(target);
+	}
 
-	lightmap_target->count_valid = (int)lst_valid.size();
-	lightmap_target->valid_list = std::unique_ptr<TextureBuffer>(new TextureBuffer(sizeof(glm::u16vec2) * lightmap_target->count_valid, GL_RG16UI));
-	lightmap_target->valid_list->upload(lst_valid.data());
+	glm::vec4 zero = { 0.0f, 0.0f, 0.0f, 0.0f};
+	glClearTexImage(lightmap->lightmap->tex_id, 0, GL_RGBA, GL_FLOAT, &zero);
 }
 
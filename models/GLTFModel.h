@@ -10,6 +10,7 @@
 #include "models/ModelComponents.h"
 
 class LightmapRenderTarget;
+class AtlasRasterizerCPU;
 class GLRenderer;
 class Mesh;
 class GLTFModel : public Object3D
@@ -41,11 +42,30 @@ public:
 
 	std::vector<std::vector<int>> batch_map;
 
-	std::unique_ptr<Lightmap> lightmap;
-	std::unique_ptr<LightmapRenderTarget> lightmap_target;
-	void init_lightmap(GLRenderer* renderer, int texelsPerUnit = 128);
+	// can be shared with other models of the scene, see Scene::init_lightmap()
+	std::shared_ptr<Lightmap> lightmap;
+	std::vector<std::shared_ptr<LightmapRenderTarget>> lightmap_targets; // one per lightmap page
+	void init_lightmap(GLRenderer* renderer, int texelsPerUnit = 128, int pageSize = 0);
+	// mesh_weights: importance of each entry of m_meshs, missing entries default to 1
+	void init_lightmap(GLRenderer* renderer, const LightmapBudget& budget, const std::vector<float>& mesh_weights = std::vector<float>());
+	// the first init_lightmap() in two steps, so the atlas does not stall the context thread: 
+	// compute_lightmap_atlas() on any thread, then init_lightmap() with its result on the context thread
+	void compute_lightmap_atlas(LightmapAtlas& atlas, int texelsPerUnit = 128, int pageSize = 0);
+	void init_lightmap(GLRenderer* renderer, LightmapAtlas& atlas);
+
+	// static primitives that go into the lightmap, with their transforms relative to the model
+	void get_lightmap_primitives(std::vector<Primitive*>& primitives, std::vector<glm::mat4>& trans, std::vector<int>& mesh_ids);
+
+	// used when baking a shared atlas
+	void set_lightmap(const std::shared_ptr<Lightmap>& lm, const std::vector<std::shared_ptr<LightmapRenderTarget>>& targets);
+	void add_lightmap_primitives(AtlasRasterizerCPU& rasterizer, int page);
+	bool has_normal_map() const;
+
+	// copies the vertex_gi_buf of the primitives into the batched mesh
+	void batch_vertex_gi();
 
 private:
 	void batch_lightmap();
+	void _init_lightmap_target(GLRenderer* renderer);
 	
 };
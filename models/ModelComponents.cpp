@@ -1,6 +1,12 @@
 #include <GL/glew.h>
 #include <gtx/hash.hpp>
 #include <unordered_set>
+#include <string>
+#include <cmath>
+#include <filesystem>
+#include "crc64/crc64.h"
+#include "utils/Utils.h"
+#include "utils/BinaryFile.h"
 #include "ModelComponents.h"
 
 inline unsigned internalFormat(int type_indices)
@@ -44,157 +50,786 @@ Mesh::Mesh()
 
 #include "xatlas.h"
 
-Lightmap::Lightmap(int width, int height)
-	:width(width), height(height)
+Lightmap::Lightmap(int width, int height, int num_pages)
+	:width(width), height(height), num_pages(num_pages)
 {
-	lightmap = std::unique_ptr<GLTexture2D>(new GLTexture2D);
-	glBindTexture(GL_TEXTURE_2D, lightmap->tex_id);
-	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, width, height);	
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	_allocate();
+}
+
+void Primitive::upload_lightmap_uv()
+{
+	size_t vertex_count = cpu_lightmap_uv->size();
+	std::vector<glm::vec4> uv_page(vertex_count);
+	for (size_t i = 0; i < vertex_count; i++)
+	{
+		int page = cpu_lightmap_page != nullptr ? (*cpu_lightmap_page)[i] : 0;
+		uv_page[i] = glm::vec4((*cpu_lightmap_uv)[i], float(page), 0.0f);
+	}
+	lightmap_uv_buf = (Attribute)(new TextureBuffer(sizeof(glm::vec4) * vertex_count, GL_RGBA32F));
+	lightmap_uv_buf->upload(uv_page.data());
 }
 
 
-Lightmap::Lightmap(const std::vector<Primitive*>& primitives, const std::vector<glm::mat4>& trans, int texelsPerUnit)
+struct AtlasMeshInput
 {
-	int num_prims = (int)primitives.size();
+	std::vector<glm::vec3> pos;
+	std::vector<glm::vec3> norm;
+	std::vector<glm::ivec3> faces;
+};
 
-	xatlas::Atlas* atlas = xatlas::Create();
+typedef LightmapAtlas::MeshOutput AtlasMeshOutput;
 
-	for (int i = 0; i < num_prims; i++)
+// weight scales the mesh, so that it receives weight times the texel density of the rest of the atlas
+static void s_prepare_atlas_mesh(const Primitive* prim, const glm::mat4& model_mat, float weight, AtlasMeshInput& input)
+{
+	glm::mat4 norm_mat = glm::transpose(glm::inverse(model_mat));
+
+	int num_pos = prim->num_pos;
+	input.pos.resize(num_pos);
+	input.norm.resize(num_pos);
+
+	for (int j = 0; j < num_pos; j++)
 	{
-		glm::mat4 model_mat = trans[i];
-		glm::mat4 norm_mat = glm::transpose(glm::inverse(model_mat));
+		input.pos[j] = glm::vec3(model_mat * (*prim->cpu_pos)[j]) * weight;
+		input.norm[j] = glm::vec3(norm_mat * (*prim->cpu_norm)[j]);
+	}
 
-		Primitive* prim = primitives[i];
-		int num_pos = prim->num_pos;
-				
-		std::vector<glm::vec3> pos(num_pos);
-		std::vector<glm::vec3> norm(num_pos);		
-		
-		for (int j = 0; j < num_pos; j++)
+	std::vector<glm::ivec3>& faces = input.faces;
+	if (prim->index_buf != nullptr)
+	{
+		int num_face = prim->num_face;
+		faces.resize(num_face);
+		if (prim->type_indices == 1)
 		{
-			pos[j] = glm::vec3(model_mat * (*prim->cpu_pos)[j]);
-			norm[j] = glm::vec3(norm_mat * (*prim->cpu_norm)[j]);
+			const glm::u8vec3* faces_in = (const glm::u8vec3*)prim->cpu_indices->data();
+			for (int j = 0; j < num_face; j++)
+			{
+				faces[j] = glm::ivec3(faces_in[j]);
+			}
 		}
-
-		std::vector<glm::ivec3> faces;
-		if (prim->index_buf != nullptr)
+		else if (prim->type_indices == 2)
 		{
-			int num_face = prim->num_face;
-			faces.resize(num_face);
-			if (prim->type_indices == 1)
+			const glm::u16vec3* faces_in = (const glm::u16vec3*)prim->cpu_indices->data();
+			for (int j = 0; j < num_face; j++)
 			{
-				const glm::u8vec3* faces_in = (const glm::u8vec3*)prim->cpu_indices->data();
-				for (int j = 0; j < num_face; j++)
-				{
-					faces[j] = glm::ivec3(faces_in[j]);
-				}
+				faces[j] = glm::ivec3(faces_in[j]);
 			}
-			else if (prim->type_indices == 2)
+		}
+		else if (prim->type_indices == 4)
+		{
+			const glm::u32vec3* faces_in = (const glm::u32vec3*)prim->cpu_indices->data();
+			for (int j = 0; j < num_face; j++)
 			{
-				const glm::u16vec3* faces_in = (const glm::u16vec3*)prim->cpu_indices->data();
-				for (int j = 0; j < num_face; j++)
-				{
-					faces[j] = glm::ivec3(faces_in[j]);
-				}
+				faces[j] = glm::ivec3(faces_in[j]);
 			}
-			else if (prim->type_indices == 4)
+		}
+	}
+	else
+	{
+		int num_face = num_pos / 3;
+		faces.resize(num_face);
+		int* ind = (int*)faces.data();
+		for (int i = 0; i < num_face * 3; i++)
+		{
+			ind[i] = i;
+		}
+	}
+}
+
+// bump when the chart/pack options change, so that stale cache files are ignored
+static const uint32_t s_atlas_cache_version = 3;
+
+static uint64_t s_hash_atlas_input(const std::vector<Primitive*>& primitives, const std::vector<AtlasMeshInput>& inputs, float texelsPerUnit, int pageSize, const LightmapBudget* budget)
+{
+	uint64_t hash = crc64(0, (const unsigned char*)&s_atlas_cache_version, sizeof(uint32_t));
+	hash = crc64(hash, (const unsigned char*)&texelsPerUnit, sizeof(float));
+	hash = crc64(hash, (const unsigned char*)&pageSize, sizeof(int));
+	if (budget != nullptr)
+	{
+		uint64_t max_bytes = budget->max_bytes;
+		hash = crc64(hash, (const unsigned char*)&budget->max_size, sizeof(int));
+		hash = crc64(hash, (const unsigned char*)&max_bytes, sizeof(uint64_t));
+	}
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		const AtlasMeshInput& input = inputs[i];
+		hash = crc64(hash, (const unsigned char*)input.pos.data(), sizeof(glm::vec3) * input.pos.size());
+		hash = crc64(hash, (const unsigned char*)input.norm.data(), sizeof(glm::vec3) * input.norm.size());
+		hash = crc64(hash, (const unsigned char*)input.faces.data(), sizeof(glm::ivec3) * input.faces.size());
+		if (primitives[i]->cpu_uv != nullptr)
+		{
+			const std::vector<glm::vec2>& uv = *primitives[i]->cpu_uv;
+			hash = crc64(hash, (const unsigned char*)uv.data(), sizeof(glm::vec2) * uv.size());
+		}
+	}
+	return hash;
+}
+
+static std::string s_atlas_cache_filename(uint64_t hash)
+{
+	char filename[64];
+	sprintf(filename, "atlas_%016llx.bin", (unsigned long long)hash);
+	return Lightmap::s_cache_dir + "/" + filename;
+}
+
+static bool s_load_atlas_cache(uint64_t hash, size_t num_prims, int& width, int& height, int& num_pages, float& texelsPerUnit, std::vector<AtlasMeshOutput>& outputs)
+{
+	std::string filename = s_atlas_cache_filename(hash);
+	BinaryFileReader reader(filename.c_str());
+	if (!reader.is_open()) return false;
+
+	bool ok = reader.read_expect(hash);
+	ok = ok && reader.read(width);
+	ok = ok && reader.read(height);
+	ok = ok && reader.read(num_pages);
+	ok = ok && reader.read(texelsPerUnit);
+	ok = ok && reader.read_expect((uint32_t)num_prims);
+
+	outputs.resize(num_prims);
+	for (size_t i = 0; ok && i < num_prims; i++)
+	{
+		AtlasMeshOutput& output = outputs[i];
+		uint32_t index_count, vertex_count;
+		ok = ok && reader.read(index_count);
+		ok = ok && reader.read(vertex_count);
+		if (!ok) break;
+		output.indices.resize(index_count);
+		output.uv.resize(vertex_count);
+		output.page.resize(vertex_count);
+		ok = ok && reader.read(output.indices.data(), sizeof(int), index_count);
+		ok = ok && reader.read(output.uv.data(), sizeof(glm::vec2), vertex_count);
+		ok = ok && reader.read(output.page.data(), sizeof(int), vertex_count);
+	}
+
+	if (!ok)
+	{
+		printf("Ignoring corrupted atlas cache %s\n", filename.c_str());
+	}
+	return ok;
+}
+
+static void s_save_atlas_cache(uint64_t hash, int width, int height, int num_pages, float texelsPerUnit, const std::vector<AtlasMeshOutput>& outputs)
+{
+	std::error_code ec;
+	std::filesystem::create_directories(Lightmap::s_cache_dir, ec);
+
+	std::string filename = s_atlas_cache_filename(hash);
+	BinaryFileWriter writer(filename.c_str());
+	if (!writer.is_open())
+	{
+		printf("Failed to write atlas cache %s\n", filename.c_str());
+		return;
+	}
+
+	uint32_t num_prims = (uint32_t)outputs.size();
+	writer.write(hash);
+	writer.write(width);
+	writer.write(height);
+	writer.write(num_pages);
+	writer.write(texelsPerUnit);
+	writer.write(num_prims);
+	for (size_t i = 0; i < outputs.size(); i++)
+	{
+		const AtlasMeshOutput& output = outputs[i];
+		uint32_t index_count = (uint32_t)output.indices.size();
+		uint32_t vertex_count = (uint32_t)output.uv.size();
+		writer.write(index_count);
+		writer.write(vertex_count);
+		writer.write(output.indices.data(), sizeof(int), index_count);
+		writer.write(output.uv.data(), sizeof(glm::vec2), vertex_count);
+		writer.write(output.page.data(), sizeof(int), vertex_count);
+	}
+	writer.commit();
+}
+
+static bool s_atlas_progress(xatlas::ProgressCategory category, int progress, void* userData)
+{
+	printf("\r%s: %d%%", xatlas::StringForEnum(category), progress);
+	if (progress >= 100) printf("\n");
+	return true;
+}
+
+static void s_read_atlas_output(const xatlas::Atlas* atlas, int& width, int& height, int& num_pages, std::vector<AtlasMeshOutput>& outputs)
+{
+	width = atlas->width;
+	height = atlas->height;
+	num_pages = atlas->atlasCount > 0 ? (int)atlas->atlasCount : 1;
+
+	glm::vec2 img_size = glm::vec2(width, height);
+
+	outputs.resize(atlas->meshCount);
+	for (uint32_t i = 0; i < atlas->meshCount; i++)
+	{
+		AtlasMeshOutput& output = outputs[i];
+		const xatlas::Mesh& atlas_mesh = atlas->meshes[i];
+
+		output.indices.resize(atlas_mesh.indexCount);
+		for (uint32_t j = 0; j < atlas_mesh.indexCount; j++)
+		{
+			output.indices[j] = (int)atlas_mesh.indexArray[j];
+		}
+
+		output.uv.resize(atlas_mesh.vertexCount);
+		output.page.resize(atlas_mesh.vertexCount);
+		for (uint32_t j = 0; j < atlas_mesh.vertexCount; j++)
+		{
+			const xatlas::Vertex& vertex = atlas_mesh.vertexArray[j];
+			output.uv[j] = (glm::vec2(vertex.uv[0], vertex.uv[1]) + 0.5f) / img_size;
+			output.page[j] = vertex.atlasIndex > 0 ? vertex.atlasIndex : 0;
+		}
+	}
+}
+
+// RGBA16F
+static const size_t s_lightmap_bytes_per_texel = 8;
+
+// hard limits of the density search, whatever the budget
+static const int s_max_atlas_size = 8192;
+static const size_t s_max_atlas_bytes = (size_t)1 << 31;
+
+// Only a size limit on a single-page atlas or a byte limit stop the search:
+// with pages, a higher density only adds pages of the same size.
+static bool s_budget_is_bounded(const LightmapBudget& budget)
+{
+	if (budget.max_bytes > 0) return true;
+	return budget.max_size > 0 && (budget.page_size <= 0 || budget.page_size > budget.max_size);
+}
+
+static bool s_fits_budget(int width, int height, int num_pages, const LightmapBudget& budget)
+{
+	if (width > s_max_atlas_size || height > s_max_atlas_size) return false;
+	if ((size_t)width * (size_t)height * (size_t)num_pages * s_lightmap_bytes_per_texel > s_max_atlas_bytes) return false;
+	if (budget.max_size > 0 && (width > budget.max_size || height > budget.max_size)) return false;
+	if (budget.max_bytes > 0 && (size_t)width * (size_t)height * (size_t)num_pages * s_lightmap_bytes_per_texel > budget.max_bytes) return false;
+	return true;
+}
+
+// Repacks the charts of the atlas with different densities, searching the highest one that fits.
+// Charts are computed once, only PackCharts runs during the search.
+static float s_pack_to_budget(xatlas::Atlas* atlas, xatlas::PackOptions packOptions, const LightmapBudget& budget, float texelsPerUnit)
+{
+	auto pack = [&](float tpu)
+	{
+		packOptions.texelsPerUnit = tpu;
+		xatlas::PackCharts(atlas, packOptions);
+		return s_fits_budget((int)atlas->width, (int)atlas->height, glm::max((int)atlas->atlasCount, 1), budget);
+	};
+
+	float lo = 0.0f;
+	float hi = 0.0f;
+	float tpu = texelsPerUnit > 0.0f ? texelsPerUnit : 128.0f;
+	if (pack(tpu))
+	{
+		lo = tpu;
+		for (int i = 0; i < 16 && hi == 0.0f; i++)
+		{
+			tpu *= 2.0f;
+			if (pack(tpu)) lo = tpu;
+			else hi = tpu;
+		}
+	}
+	else
+	{
+		hi = tpu;
+		for (int i = 0; i < 16 && lo == 0.0f; i++)
+		{
+			tpu *= 0.5f;
+			if (pack(tpu)) lo = tpu;
+			else hi = tpu;
+		}
+		if (lo == 0.0f)
+		{
+			printf("Lightmap budget cannot be met, using %f texels per unit.\n", tpu);
+			lo = tpu;
+		}
+	}
+
+	if (hi > 0.0f)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			float mid = 0.5f * (lo + hi);
+			if (pack(mid)) lo = mid;
+			else hi = mid;
+		}
+	}
+
+	pack(lo);
+	printf("Selected %f texels per unit, atlas %dx%d.\n", lo, (int)atlas->width, (int)atlas->height);
+	return lo;
+}
+
+// Authored lightmap uvs (e.g. glTF TEXCOORD_1) are used as they are when they stay inside [0,1]
+// and no texel is claimed by two triangles. Otherwise their charts are only repacked by xatlas,
+// chart generation is skipped in both cases.
+static bool s_has_authored_uv(const std::vector<Primitive*>& primitives)
+{
+	if (primitives.empty()) return false;
+	for (size_t i = 0; i < primitives.size(); i++)
+	{
+		const Primitive* prim = primitives[i];
+		if (!prim->authored_lightmap_uv || prim->cpu_lightmap_uv == nullptr || prim->cpu_lightmap_indices == nullptr) return false;
+		if (prim->cpu_lightmap_indices->size() != prim->num_face * 3) return false;
+	}
+	return true;
+}
+
+// ratio between world-space and uv-space edge lengths
+static float s_authored_uv_scale(const std::vector<Primitive*>& primitives, const std::vector<AtlasMeshInput>& inputs)
+{
+	double world_area = 0.0;
+	double uv_area = 0.0;
+	for (size_t i = 0; i < primitives.size(); i++)
+	{
+		const std::vector<glm::vec2>& uv = *primitives[i]->cpu_lightmap_uv;
+		const std::vector<int>& uv_indices = *primitives[i]->cpu_lightmap_indices;
+		const AtlasMeshInput& input = inputs[i];
+		for (size_t j = 0; j < input.faces.size(); j++)
+		{
+			glm::ivec3 face = input.faces[j];
+			glm::vec3 p0 = input.pos[face.x];
+			glm::vec3 p1 = input.pos[face.y];
+			glm::vec3 p2 = input.pos[face.z];
+			world_area += 0.5 * (double)glm::length(glm::cross(p1 - p0, p2 - p0));
+
+			glm::vec2 t0 = uv[uv_indices[j * 3]];
+			glm::vec2 t1 = uv[uv_indices[j * 3 + 1]];
+			glm::vec2 t2 = uv[uv_indices[j * 3 + 2]];
+			glm::vec2 e1 = t1 - t0;
+			glm::vec2 e2 = t2 - t0;
+			uv_area += 0.5 * fabs((double)(e1.x * e2.y - e1.y * e2.x));
+		}
+	}
+	if (uv_area <= 0.0) return 0.0f;
+	return (float)sqrt(world_area / uv_area);
+}
+
+static bool s_validate_authored_uv(const std::vector<Primitive*>& primitives, int width, int height)
+{
+	const float eps = 1e-4f;
+	glm::vec2 img_size = glm::vec2(width, height);
+	std::vector<int> owner((size_t)width * (size_t)height, -1);
+	size_t num_covered = 0;
+	size_t num_overlapped = 0;
+	int tri_id = 0;
+
+	for (size_t i = 0; i < primitives.size(); i++)
+	{
+		const std::vector<glm::vec2>& uv = *primitives[i]->cpu_lightmap_uv;
+		const std::vector<int>& uv_indices = *primitives[i]->cpu_lightmap_indices;
+		size_t num_face = uv_indices.size() / 3;
+		for (size_t j = 0; j < num_face; j++, tri_id++)
+		{
+			glm::vec2 v[3];
+			for (int k = 0; k < 3; k++)
 			{
-				const glm::u32vec3* faces_in = (const glm::u32vec3*)prim->cpu_indices->data();
-				for (int j = 0; j < num_face; j++)
+				int idx = uv_indices[j * 3 + k];
+				if (idx < 0 || idx >= (int)uv.size()) return false;
+				glm::vec2 t = uv[idx];
+				if (t.x < -eps || t.y < -eps || t.x > 1.0f + eps || t.y > 1.0f + eps)
 				{
-					faces[j] = glm::ivec3(faces_in[j]);
+					printf("Authored lightmap uv out of range.\n");
+					return false;
 				}
+				v[k] = t * img_size;
 			}
-		}
-		else
-		{
-			int num_face = num_pos / 3;
-			faces.resize(num_face);
-			int* ind = (int*)faces.data();
-			for (int i = 0; i < num_face; i++)
+
+			glm::vec2 e1 = v[1] - v[0];
+			glm::vec2 e2 = v[2] - v[0];
+			float area2 = e1.x * e2.y - e1.y * e2.x;
+			if (area2 == 0.0f) continue;
+
+			glm::vec2 uv_min = glm::min(glm::min(v[0], v[1]), v[2]);
+			glm::vec2 uv_max = glm::max(glm::max(v[0], v[1]), v[2]);
+			int x0 = glm::max((int)floorf(uv_min.x), 0);
+			int y0 = glm::max((int)floorf(uv_min.y), 0);
+			int x1 = glm::min((int)ceilf(uv_max.x), width);
+			int y1 = glm::min((int)ceilf(uv_max.y), height);
+
+			for (int y = y0; y < y1; y++)
 			{
-				ind[i] = i;
+				for (int x = x0; x < x1; x++)
+				{
+					glm::vec2 p = glm::vec2(float(x) + 0.5f, float(y) + 0.5f) - v[0];
+					float b1 = (p.x * e2.y - p.y * e2.x) / area2;
+					float b2 = (e1.x * p.y - e1.y * p.x) / area2;
+					if (b1 <= 0.0f || b2 <= 0.0f || b1 + b2 >= 1.0f) continue;
+
+					int& o = owner[(size_t)x + (size_t)y * (size_t)width];
+					if (o < 0)
+					{
+						o = tri_id;
+						num_covered++;
+					}
+					else if (o != tri_id)
+					{
+						num_overlapped++;
+					}
+				}
 			}
 		}
+	}
 
-		xatlas::MeshDecl meshDecl;
-		meshDecl.vertexCount = (unsigned)pos.size();
-		meshDecl.vertexPositionData = pos.data();
-		meshDecl.vertexPositionStride = sizeof(float) * 3;
-		meshDecl.vertexNormalData = norm.data();
-		meshDecl.vertexNormalStride = sizeof(float) * 3;
+	// tolerate a few texel centers falling on numerically shared edges
+	if (num_overlapped > num_covered / 1000)
+	{
+		printf("Authored lightmap uv has overlapping charts.\n");
+		return false;
+	}
+	return true;
+}
+
+static bool s_pack_authored_uv(const std::vector<Primitive*>& primitives, float uv_scale, float& texelsPerUnit, int pageSize, const LightmapBudget* budget, int& width, int& height, int& num_pages, std::vector<AtlasMeshOutput>& outputs)
+{
+	xatlas::Atlas* atlas = xatlas::Create();
+	xatlas::SetProgressCallback(atlas, s_atlas_progress);
 
-		if (prim->cpu_uv!=nullptr)
+	// scale uvs to world units, so that texelsPerUnit keeps its meaning
+	std::vector<std::vector<glm::vec2>> scaled_uvs(primitives.size());
+	for (size_t i = 0; i < primitives.size(); i++)
+	{
+		const std::vector<glm::vec2>& uv = *primitives[i]->cpu_lightmap_uv;
+		const std::vector<int>& uv_indices = *primitives[i]->cpu_lightmap_indices;
+		std::vector<glm::vec2>& scaled = scaled_uvs[i];
+		scaled.resize(uv.size());
+		for (size_t j = 0; j < uv.size(); j++)
 		{
-			meshDecl.vertexUvData = prim->cpu_uv->data();
-			meshDecl.vertexUvStride = sizeof(float) * 2;
+			scaled[j] = uv[j] * uv_scale;
 		}
 
-		meshDecl.indexCount = (uint32_t)(faces.size() * 3);
-		meshDecl.indexData = faces.data();
+		xatlas::UvMeshDecl meshDecl;
+		meshDecl.vertexUvData = scaled.data();
+		meshDecl.vertexStride = sizeof(float) * 2;
+		meshDecl.vertexCount = (uint32_t)scaled.size();
+		meshDecl.indexData = uv_indices.data();
+		meshDecl.indexCount = (uint32_t)uv_indices.size();
 		meshDecl.indexFormat = xatlas::IndexFormat::UInt32;
 
-		xatlas::AddMeshError error = xatlas::AddMesh(atlas, meshDecl, 1);
-		if (error != xatlas::AddMeshError::Success) {
+		xatlas::AddMeshError error = xatlas::AddUvMesh(atlas, meshDecl);
+		if (error != xatlas::AddMeshError::Success)
+		{
+			printf("\rError adding uv mesh: %s\n", xatlas::StringForEnum(error));
 			xatlas::Destroy(atlas);
-			printf("\rError adding mesh: %s\n", xatlas::StringForEnum(error));
+			return false;
 		}
 	}
 
 	xatlas::ChartOptions chartOptions;
 	xatlas::PackOptions packOptions;
 	packOptions.padding = 1;
-	packOptions.texelsPerUnit = float(texelsPerUnit);
+	packOptions.texelsPerUnit = texelsPerUnit;
+	packOptions.resolution = (uint32_t)pageSize;
 
-	printf("Generating atlas...\n");
-	xatlas::Generate(atlas, chartOptions, packOptions);
+	printf("Packing authored lightmap uv...\n");
+	xatlas::ComputeCharts(atlas, chartOptions);
+	if (budget != nullptr)
+	{
+		texelsPerUnit = s_pack_to_budget(atlas, packOptions, *budget, texelsPerUnit);
+	}
+	else
+	{
+		xatlas::PackCharts(atlas, packOptions);
+	}
 	printf("Done.\n");
 
-	width = atlas->width;
-	height = atlas->height;
-	texels_per_unit = texelsPerUnit;
+	s_read_atlas_output(atlas, width, height, num_pages, outputs);
+	xatlas::Destroy(atlas);
+	return true;
+}
 
-	glm::vec2 img_size = glm::vec2(width, height);
+static bool s_init_authored_uv(const std::vector<Primitive*>& primitives, const std::vector<AtlasMeshInput>& inputs, float& texelsPerUnit, int pageSize, const LightmapBudget* budget, int& width, int& height, int& num_pages, std::vector<AtlasMeshOutput>& outputs)
+{
+	float uv_scale = s_authored_uv_scale(primitives, inputs);
+	if (uv_scale <= 0.0f) return false;
 
-	for (int i = 0; i < num_prims; i++)
+	int size = (int)ceilf(uv_scale * texelsPerUnit);
+	if (budget != nullptr)
 	{
-		Primitive* prim = primitives[i];
-		const xatlas::Mesh& atlas_mesh = atlas->meshes[i];
+		// the authored layout is fixed, the budget can only lower the density
+		int max_size = s_max_atlas_size;
+		while (max_size > 16 && !s_fits_budget(max_size, max_size, 1, *budget)) max_size--;
+		if (size > max_size) size = max_size;
+	}
+	if (size < 16) size = 16;
+	if (size > s_max_atlas_size) size = s_max_atlas_size;
 
-		prim->cpu_lightmap_indices = std::unique_ptr<std::vector<int>>(new std::vector<int>(atlas_mesh.indexCount));
-		for (int j = 0; j < atlas_mesh.indexCount; j++)
+	// an authored layout is a single page, it is repacked when it has to be split
+	bool fits_page = pageSize <= 0 || size <= pageSize;
+	if (fits_page && s_validate_authored_uv(primitives, size, size))
+	{
+		width = size;
+		height = size;
+		num_pages = 1;
+		outputs.resize(primitives.size());
+		for (size_t i = 0; i < primitives.size(); i++)
 		{
-			(*prim->cpu_lightmap_indices)[j] = (int)atlas_mesh.indexArray[j];
+			outputs[i].indices = *primitives[i]->cpu_lightmap_indices;
+			outputs[i].uv = *primitives[i]->cpu_lightmap_uv;
+			outputs[i].page.assign(outputs[i].uv.size(), 0);
 		}
-		prim->lightmap_indices = Index(new IndexTextureBuffer(sizeof(int) * atlas_mesh.indexCount, 4));
-		prim->lightmap_indices->upload(prim->cpu_lightmap_indices->data());
-		
-		prim->cpu_lightmap_uv = std::unique_ptr<std::vector<glm::vec2>>(new std::vector<glm::vec2>(atlas_mesh.vertexCount));
-		for (int j = 0; j < atlas_mesh.vertexCount; j++)
+		texelsPerUnit = float(size) / uv_scale;
+		printf("Using authored lightmap uv.\n");
+		return true;
+	}
+
+	return s_pack_authored_uv(primitives, uv_scale, texelsPerUnit, pageSize, budget, width, height, num_pages, outputs);
+}
+
+std::string Lightmap::s_cache_dir = "atlas_cache";
+
+Lightmap::Lightmap(const std::vector<Primitive*>& primitives, const std::vector<glm::mat4>& trans, int texelsPerUnit, int pageSize)
+{
+	_create(primitives, trans, float(texelsPerUnit), pageSize, nullptr, std::vector<float>());
+}
+
+Lightmap::Lightmap(const std::vector<Primitive*>& primitives, const std::vector<glm::mat4>& trans, const LightmapBudget& budget, const std::vector<float>& weights)
+{
+	_create(primitives, trans, budget.texels_per_unit, budget.page_size, &budget, weights);
+}
+
+Lightmap::Lightmap(const std::vector<Primitive*>& primitives, LightmapAtlas& atlas)
+{
+	_apply_atlas(primitives, atlas);
+}
+
+void Lightmap::compute_atlas(const std::vector<Primitive*>& primitives, const std::vector<glm::mat4>& trans, int texelsPerUnit, int pageSize, LightmapAtlas& atlas)
+{
+	_compute_atlas(primitives, trans, float(texelsPerUnit), pageSize, nullptr, std::vector<float>(), atlas);
+}
+
+void Lightmap::_create(const std::vector<Primitive*>& primitives, const std::vector<glm::mat4>& trans, float texelsPerUnit, int pageSize, const LightmapBudget* budget, const std::vector<float>& weights)
+{
+	LightmapAtlas atlas;
+	_compute_atlas(primitives, trans, texelsPerUnit, pageSize, budget, weights, atlas);
+	_apply_atlas(primitives, atlas);
+}
+
+void Lightmap::_compute_atlas(const std::vector<Primitive*>& primitives, const std::vector<glm::mat4>& trans, float texelsPerUnit, int pageSize, const LightmapBudget* budget, const std::vector<float>& weights, LightmapAtlas& atlas)
+{
+	int num_prims = (int)primitives.size();
+	int& width = atlas.width;
+	int& height = atlas.height;
+	int& num_pages = atlas.num_pages;
+	std::vector<AtlasMeshOutput>& outputs = atlas.meshes;
+
+	if (budget != nullptr && !s_budget_is_bounded(*budget))
+	{
+		printf("Lightmap budget has no size or byte limit, using %f texels per unit.\n", texelsPerUnit);
+		budget = nullptr;
+	}
+
+	// transform the meshes to world space in parallel, xatlas copies them on AddMesh
+	std::vector<AtlasMeshInput> inputs(num_prims);
+	parallel_for(0, num_prims, [&](int i)
+	{
+		float weight = i < (int)weights.size() ? weights[i] : 1.0f;
+		s_prepare_atlas_mesh(primitives[i], trans[i], weight, inputs[i]);
+	});
+
+	bool has_atlas = s_has_authored_uv(primitives) && s_init_authored_uv(primitives, inputs, texelsPerUnit, pageSize, budget, width, height, num_pages, outputs);
+
+	uint64_t hash = 0;
+	if (!has_atlas && !s_cache_dir.empty())
+	{
+		hash = s_hash_atlas_input(primitives, inputs, texelsPerUnit, pageSize, budget);
+		has_atlas = s_load_atlas_cache(hash, num_prims, width, height, num_pages, texelsPerUnit, outputs);
+		if (has_atlas)
 		{
-			const float* p_uv = atlas_mesh.vertexArray[j].uv;
-			(*prim->cpu_lightmap_uv)[j] = (glm::vec2(p_uv[0], p_uv[1]) + 0.5f)/ img_size;
+			printf("Loaded atlas from cache.\n");
 		}
-		prim->lightmap_uv_buf = (Attribute)(new TextureBuffer(sizeof(glm::vec2) * atlas_mesh.vertexCount, GL_RG32F));
-		prim->lightmap_uv_buf->upload(prim->cpu_lightmap_uv->data());
 	}
 
-	xatlas::Destroy(atlas);
-	
+	if (!has_atlas)
+	{
+		xatlas::Atlas* atlas = xatlas::Create();
+		xatlas::SetProgressCallback(atlas, s_atlas_progress);
+
+		// AddMesh returns immediately, mesh processing runs on the xatlas task scheduler.
+		// A rejected mesh is not added, so the atlas meshes are mapped back to the primitives.
+		std::vector<int> atlas_mesh_ids(num_prims, -1);
+		int num_atlas_meshes = 0;
+		for (int i = 0; i < num_prims; i++)
+		{
+			const AtlasMeshInput& input = inputs[i];
 
-	lightmap = std::unique_ptr<GLTexture2D>(new GLTexture2D);
-	glBindTexture(GL_TEXTURE_2D, lightmap->tex_id);
-	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, width, height);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
+			xatlas::MeshDecl meshDecl;
+			meshDecl.vertexCount = (unsigned)input.pos.size();
+			meshDecl.vertexPositionData = input.pos.data();
+			meshDecl.vertexPositionStride = sizeof(float) * 3;
+			meshDecl.vertexNormalData = input.norm.data();
+			meshDecl.vertexNormalStride = sizeof(float) * 3;
 
+			Primitive* prim = primitives[i];
+			if (prim->cpu_uv != nullptr)
+			{
+				meshDecl.vertexUvData = prim->cpu_uv->data();
+				meshDecl.vertexUvStride = sizeof(float) * 2;
+			}
+
+			meshDecl.indexCount = (uint32_t)(input.faces.size() * 3);
+			meshDecl.indexData = input.faces.data();
+			meshDecl.indexFormat = xatlas::IndexFormat::UInt32;
+
+			xatlas::AddMeshError error = xatlas::AddMesh(atlas, meshDecl, (uint32_t)num_prims);
+			if (error != xatlas::AddMeshError::Success) 
+			{
+				printf("\rError adding mesh %d: %s, it gets no lightmap texels\n", i, xatlas::StringForEnum(error));
+				continue;
+			}
+			atlas_mesh_ids[i] = num_atlas_meshes++;
+		}
+		xatlas::AddMeshJoin(atlas);
+
+		xatlas::ChartOptions chartOptions;
+		xatlas::PackOptions packOptions;
+		packOptions.padding = 1;
+		packOptions.texelsPerUnit = texelsPerUnit;
+		// with a resolution, xatlas spreads the charts over as many pages of that size as needed
+		packOptions.resolution = (uint32_t)pageSize;
+
+		printf("Generating atlas...\n");
+		xatlas::ComputeCharts(atlas, chartOptions);
+		if (budget != nullptr)
+		{
+			texelsPerUnit = s_pack_to_budget(atlas, packOptions, *budget, texelsPerUnit);
+		}
+		else
+		{
+			xatlas::PackCharts(atlas, packOptions);
+		}
+		printf("Done.\n");
+
+		std::vector<AtlasMeshOutput> atlas_outputs;
+		s_read_atlas_output(atlas, width, height, num_pages, atlas_outputs);
+		xatlas::Destroy(atlas);
+
+		// rejected meshes keep their faces with all corners at the origin, zero-area triangles are never rasterized
+		outputs.resize(num_prims);
+		for (int i = 0; i < num_prims; i++)
+		{
+			AtlasMeshOutput& output = outputs[i];
+			if (atlas_mesh_ids[i] >= 0)
+			{
+				output = std::move(atlas_outputs[atlas_mesh_ids[i]]);
+				continue;
+			}
+			const AtlasMeshInput& input = inputs[i];
+			output.indices.assign((const int*)input.faces.data(), (const int*)input.faces.data() + input.faces.size() * 3);
+			output.uv.assign(input.pos.size(), glm::vec2(0.0f));
+			output.page.assign(input.pos.size(), 0);
+		}
+
+		if (!s_cache_dir.empty())
+		{
+			s_save_atlas_cache(hash, width, height, num_pages, texelsPerUnit, outputs);
+		}
+	}
+
+	// with weights this is the density of unit-weight primitives
+	atlas.texels_per_unit = texelsPerUnit;
+}
+
+void Lightmap::_apply_atlas(const std::vector<Primitive*>& primitives, LightmapAtlas& atlas)
+{
+	width = atlas.width;
+	height = atlas.height;
+	num_pages = atlas.num_pages;
+	texels_per_unit = atlas.texels_per_unit;
+
+	int num_prims = (int)primitives.size();
+	for (int i = 0; i < num_prims; i++)
+	{
+		Primitive* prim = primitives[i];
+		AtlasMeshOutput& output = atlas.meshes[i];
+		size_t index_count = output.indices.size();
+		size_t vertex_count = output.uv.size();
+
+		prim->cpu_lightmap_indices = std::unique_ptr<std::vector<int>>(new std::vector<int>);
+		prim->cpu_lightmap_indices->swap(output.indices);
+		prim->lightmap_indices = Index(new IndexTextureBuffer(sizeof(int) * index_count, 4));
+		prim->lightmap_indices->upload(prim->cpu_lightmap_indices->data());
+
+		prim->cpu_lightmap_uv = std::unique_ptr<std::vector<glm::vec2>>(new std::vector<glm::vec2>);
+		prim->cpu_lightmap_uv->swap(output.uv);
+		prim->cpu_lightmap_page = std::unique_ptr<std::vector<int>>(new std::vector<int>);
+		prim->cpu_lightmap_page->swap(output.page);
+		prim->upload_lightmap_uv();
+	}
+
+	_allocate();
 }
 
+void Lightmap::_allocate()
+{
+	format = LightmapFormat::RGBA16F;
+	lightmap = std::unique_ptr<GLTexture2DArray>(new GLTexture2DArray);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, lightmap->tex_id);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA16F, width, height, num_layers());
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void Lightmap::setLightLayers(int num_lights)
+{
+	if (num_lights == num_light_layers) return;
+	num_light_layers = num_lights;
+	_allocate();
+}
+
+void Lightmap::setDirectional(bool directional)
+{
+	if (directional == sh_l1) return;
+	sh_l1 = directional;
+	_allocate();
+}
+
+int Lightmap::num_layers() const
+{
+	return num_pages * (num_light_layers + 1 + (sh_l1 ? 3 : 0));
+}
+
+void Lightmap::page_layers(int page, std::vector<int>& layers) const
+{
+	layers.clear();
+	for (int i = 0; i <= num_light_layers; i++)
+	{
+		layers.push_back(i * num_pages + page);
+	}
+	if (sh_l1)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			layers.push_back(num_pages * (num_light_layers + 1) + page * 3 + i);
+		}
+	}
+}
+
+bool Lightmap::check_bakeable(const char* user) const
+{
+	if (format == LightmapFormat::RGBA16F) return true;
+	printf("%s: lightmap is compressed, RGBA16F expected\n", user);
+	return false;
+}
+
+bool Lightmap::readTexels(std::vector<uint16_t>& texels) const
+{
+	if (!check_bakeable("Lightmap::readTexels")) return false;
+	texels.resize((size_t)width * (size_t)height * (size_t)num_layers() * 4);
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, lightmap->tex_id);
+	glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_HALF_FLOAT, texels.data());
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return true;
+}
+
+bool Lightmap::writeTexels(const std::vector<uint16_t>& texels)
+{
+	if (!check_bakeable("Lightmap::writeTexels")) return false;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, lightmap->tex_id);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, width, height, num_layers(), GL_RGBA, GL_HALF_FLOAT, texels.data());
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return true;
+}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 #include <glm.hpp>
 #include <gtx/quaternion.hpp>
@@ -51,22 +53,114 @@ public:
 
 	std::unique_ptr<CWBVH> cwbvh;
 
-	Attribute lightmap_uv_buf;
+	Attribute lightmap_uv_buf; // (u, v, page, 0)
 	Index lightmap_indices;
 	std::unique_ptr<std::vector<glm::vec2>> cpu_lightmap_uv;
 	std::unique_ptr<std::vector<int>> cpu_lightmap_indices;
+	std::unique_ptr<std::vector<int>> cpu_lightmap_page; // per lightmap vertex, null means page 0
+	bool authored_lightmap_uv = false; // cpu_lightmap_uv came with the asset
+
+	void upload_lightmap_uv();
+
+	// Per-vertex baked light for targets that cannot afford lightmap textures, in the layout of color_buf:
+	// RGBA32F, irradiance / PI in rgb, baked with GLRenderer::updateVertexGI()
+	Attribute vertex_gi_buf;
 
 };
 
+// Size limits for an automatically sized lightmap, 0 means unconstrained
+struct LightmapBudget
+{
+	// At least one limit is needed, and max_size alone only limits a single-page atlas.
+	// Budgets without a limit are ignored and texels_per_unit is used as is.
+	int max_size = 0; // max width and height of the atlas in texels
+	size_t max_bytes = 0; // max size of the RGBA16F lightmap texture, all pages included
+	float texels_per_unit = 128.0f; // starting point of the density search
+	int page_size = 0; // split the atlas into pages of page_size x page_size, 0 for a single page
+};
+
+// Texture format of a lightmap. Bakes write RGBA16F, the others are produced by LightmapCompressor for the runtime
+enum class LightmapFormat
+{
+	RGBA16F = 0,
+	BC6H = 1, // unsigned BPTC float, 1 byte per texel
+	RGBM8 = 2 // RGBA8, rgb * a * LightmapCompressor::s_rgbm_range
+};
+
+// Layout of a lightmap atlas, computed by Lightmap::compute_atlas() without any GL call
+struct LightmapAtlas
+{
+	struct MeshOutput
+	{
+		std::vector<int> indices;
+		std::vector<glm::vec2> uv;
+		std::vector<int> page;
+	};
+
+	int width = 0;
+	int height = 0;
+	int num_pages = 1;
+	float texels_per_unit = 128.0f;
+	std::vector<MeshOutput> meshes; // one per primitive
+};
+
 class Lightmap
 {
 public:
-	Lightmap(int width, int height);
-	Lightmap(const std::vector<Primitive*>& primitives, const std::vector<glm::mat4>& trans, int texelsPerUnit = 128);
+	Lightmap(int width, int height, int num_pages = 1);
+	Lightmap(const std::vector<Primitive*>& primitives, const std::vector<glm::mat4>& trans, int texelsPerUnit = 128, int pageSize = 0);
+
+	// Searches the highest texel density whose packed atlas fits the budget. 
+	// Optional per-primitive weights scale the density of individual primitives.
+	Lightmap(const std::vector<Primitive*>& primitives, const std::vector<glm::mat4>& trans, const LightmapBudget& budget, const std::vector<float>& weights = std::vector<float>());
+
+	// The atlas step of the constructors alone. It only reads the CPU arrays of the primitives, so it can run 
+	// on a worker thread, the lightmap is then constructed from the result on the context thread.
+	static void compute_atlas(const std::vector<Primitive*>& primitives, const std::vector<glm::mat4>& trans, int texelsPerUnit, int pageSize, LightmapAtlas& atlas);
+	// atlas: computed for the same primitives, its meshes are moved into them
+	Lightmap(const std::vector<Primitive*>& primitives, LightmapAtlas& atlas);
 
+	// size of each page
 	int width, height;
-	int texels_per_unit = 128;
-	std::unique_ptr<GLTexture2D> lightmap;
+	int num_pages = 1;
+	float texels_per_unit = 128.0f;
+	std::unique_ptr<GLTexture2DArray> lightmap;
+	LightmapFormat format = LightmapFormat::RGBA16F;
+
+	// Relightable lightmap: one group of num_pages layers per directional light followed by one for 
+	// the sky and emissive surfaces, 0 for a single summed lightmap. See GLRenderer::prepareRelightConfigs()
+	int num_light_layers = 0;
+	// reallocates the lightmap texture for num_lights light layers, the content is lost
+	void setLightLayers(int num_lights);
+
+	// Directional lightmap: 3 extra layers per page after the irradiance layers, holding the L1 
+	// coefficients of the red, green and blue channels. Only baked into a single summed lightmap
+	bool sh_l1 = false;
+	// reallocates the lightmap texture with or without the L1 layers, the content is lost
+	void setDirectional(bool directional);
+
+	int num_layers() const;
+
+	// layers holding the bake of one page: its light layers, its summed layer and its L1 layers
+	void page_layers(int page, std::vector<int>& layers) const;
+
+	// Bakes, filters and checkpoints work on RGBA16F only, a lightmap compressed by LightmapCompressor 
+	// has to be reallocated (setLightLayers()/setDirectional()) or reloaded first. Prints who failed if not.
+	bool check_bakeable(const char* user) const;
+
+	// all num_layers() layers as RGBA half floats, for bake checkpoints. false if the lightmap is compressed
+	bool readTexels(std::vector<uint16_t>& texels) const;
+	bool writeTexels(const std::vector<uint16_t>& texels);
+
+	// directory of the on-disk atlas layout cache, created on first write. Defaults to atlas_cache in the
+	// working directory (the build directory for the samples), empty disables caching
+	static std::string s_cache_dir;
+
+private:
+	void _create(const std::vector<Primitive*>& primitives, const std::vector<glm::mat4>& trans, float texelsPerUnit, int pageSize, const LightmapBudget* budget, const std::vector<float>& weights);
+	static void _compute_atlas(const std::vector<Primitive*>& primitives, const std::vector<glm::mat4>& trans, float texelsPerUnit, int pageSize, const LightmapBudget* budget, const std::vector<float>& weights, LightmapAtlas& atlas);
+	void _apply_atlas(const std::vector<Primitive*>& primitives, LightmapAtlas& atlas);
+	void _allocate();
 };
 
 class Node
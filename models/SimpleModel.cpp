@@ -2,6 +2,7 @@
 #include "SimpleModel.h"
 #include "materials/MeshStandardMaterial.h"
 #include "renderers/LightmapRenderTarget.h"
+#include "renderers/AtlasRasterizerCPU.h"
 #include "renderers/GLRenderer.h"
 
 struct ModelConst
@@ -53,70 +54,102 @@ void SimpleModel::set_roughness(float roughness)
 	material.update_uniform();
 }
 
-void SimpleModel::init_lightmap(GLRenderer* renderer, int texelsPerUnit)
+void SimpleModel::init_lightmap(GLRenderer* renderer, int texelsPerUnit, int pageSize)
 {
-	std::vector<Primitive*> primitives(1);
-	std::vector<glm::mat4> trans(1);
-	primitives[0] = &geometry;
-	trans[0] = glm::identity<glm::mat4>();
+	std::vector<Primitive*> primitives;
+	std::vector<glm::mat4> trans;
+	get_lightmap_primitives(primitives, trans);
 
-	lightmap = std::unique_ptr<Lightmap>(new Lightmap(primitives, trans, texelsPerUnit));
+	lightmap = std::shared_ptr<Lightmap>(new Lightmap(primitives, trans, texelsPerUnit, pageSize));
+	_init_lightmap_target(renderer);
+}
 
-	lightmap_target = std::unique_ptr<LightmapRenderTarget>(new LightmapRenderTarget);
-	lightmap_target->update_framebuffer(lightmap->width, lightmap->height);
-	renderer->rasterize_atlas(this);
+void SimpleModel::init_lightmap(GLRenderer* renderer, const LightmapBudget& budget)
+{
+	std::vector<Primitive*> primitives;
+	std::vector<glm::mat4> trans;
+	get_lightmap_primitives(primitives, trans);
 
-#if 0
-	{
-		std::vector<glm::vec3> dump(lightmap->width * lightmap->height);
+	lightmap = std::shared_ptr<Lightmap>(new Lightmap(primitives, trans, budget));
+	_init_lightmap_target(renderer);
+}
+
+void SimpleModel::get_lightmap_primitives(std::vector<Primitive*>& primitives, std::vector<glm::mat4>& trans)
+{
+	primitives.push_back(&geometry);
+	trans.push_back(glm::identity<glm::mat4>());
+}
 
-		glBindTexture(GL_TEXTURE_2D, lightmap_target->m_tex_normal->tex_id);
-		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, dump.data());
-		glBindTexture(GL_TEXTURE_2D, 0);
+void SimpleModel::set_lightmap(const std::shared_ptr<Lightmap>& lm, const std::vector<std::shared_ptr<LightmapRenderTarget>>& targets)
+{
+	lightmap = lm;
+	lightmap_targets = targets;
+}
 
-		char filename[64];
-		sprintf(filename, "dump_%s.raw", name.c_str());
+void SimpleModel::add_lightmap_primitives(AtlasRasterizerCPU& rasterizer, int page)
+{
+	updateWorldMatrix(false, false);
+	rasterizer.add_primitive(geometry, matrixWorld, page);
+}
 
-		printf("%s %d %d\n", filename, lightmap->width, lightmap->height);
+bool SimpleModel::has_normal_map() const
+{
+	return material.tex_idx_normalMap >= 0;
+}
 
-		FILE* fp = fopen(filename, "wb");
+void SimpleModel::_init_lightmap_target(GLRenderer* renderer)
+{
+	lightmap_targets.resize(lightmap->num_pages);
+	for (int page = 0; page < lightmap->num_pages; page++)
+	{
+		lightmap_targets[page] = std::shared_ptr<LightmapRenderTarget>(new LightmapRenderTarget);
+		LightmapRenderTarget& target = *lightmap_targets[page];
+		target.page = page;
+		target.update_framebuffer(lightmap->width, lightmap->height);
 
-		for (int i = 0; i < lightmap->width * lightmap->height; i++)
+		if (has_normal_map())
 		{
-			glm::u8vec3 value_u8 = glm::u8vec3((dump[i] * 0.5f + 0.5f) * 255.0f + 0.5f);
-			fwrite(&value_u8, 3, 1, fp);
+			renderer->rasterize_atlas(this, page);
+		}
+		else
+		{
+			AtlasRasterizerCPU rasterizer(lightmap->width, lightmap->height);
+			add_lightmap_primitives(rasterizer, page);
+			rasterizer.rasterize();
+			rasterizer.upload(target);
 		}
 
-		fclose(fp);
+#if 0
+		{
+			std::vector<glm::vec3> dump(lightmap->width * lightmap->height);
 
-	}
-#endif
+			glBindTexture(GL_TEXTURE_2D, target.m_tex_normal->tex_id);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, dump.data());
+			glBindTexture(GL_TEXTURE_2D, 0);
 
-	glm::vec4 zero = { 0.0f, 0.0f, 0.0f, 0.0f };
-	glClearTexImage(lightmap->lightmap->tex_id, 0, GL_RGBA, GL_FLOAT, &zero);
+			char filename[64];
+			sprintf(filename, "dump_%s_%d.raw", name.c_str(), page);
 
-	std::vector<float> alpha_mask(lightmap->width * lightmap->height);
+			printf("%s %d %d\n", filename, lightmap->width, lightmap->height);
 
-	glBindTexture(GL_TEXTURE_2D, lightmap_target->m_tex_position->tex_id);
-	glGetTexImage(GL_TEXTURE_2D, 0, GL_ALPHA, GL_FLOAT, alpha_mask.data());
-	glBindTexture(GL_TEXTURE_2D, 0);
+			FILE* fp = fopen(filename, "wb");
 
-	std::vector<glm::u16vec2> lst_valid;
+			for (int i = 0; i < lightmap->width * lightmap->height; i++)
+			{
+				glm::u8vec3 value_u8 = glm::u8vec3((dump[i] * 0.5f + 0.5f) * 255.0f + 0.5f);
+				fwrite(&value_u8, 3, 1, fp);
+			}
+
+			fclose(fp);
 
-	for (int i = 0; i < lightmap->width * lightmap->height; i++)
-	{
-		float f = alpha_mask[i];
-		if (f > 0.5f)
-		{
-			uint16_t x = (uint16_t)(i % lightmap->width);
-			uint16_t y = (uint16_t)(i / lightmap->width);
-			lst_valid.push_back({ x,y });
 		}
-	}
+#endif
 
-	lightmap_target->count_valid = (int)lst_valid.size();
-	lightmap_target->valid_list = std::unique_ptr<TextureBuffer>(new TextureBuffer(sizeof(glm::u16vec2) * lightmap_target->count_valid, GL_RG16UI));
-	lightmap_target->valid_list->upload(lst_valid.data());
+		// the raster targets are released here
+		renderer->compact_atlas(target);
+	}
 
+	glm::vec4 zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+	glClearTexImage(lightmap->lightmap->tex_id, 0, GL_RGBA, GL_FLOAT, &zero);
 }
 
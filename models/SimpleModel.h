@@ -6,6 +6,7 @@
 #include "renderers/GLUtils.h"
 
 class LightmapRenderTarget;
+class AtlasRasterizerCPU;
 class GLRenderer;
 class MeshStandardMaterial;
 class SimpleModel : public Object3D
@@ -26,9 +27,21 @@ public:
 	void set_metalness(float metalness);
 	void set_roughness(float roughness);	
 
-	std::unique_ptr<Lightmap> lightmap;
-	std::unique_ptr<LightmapRenderTarget> lightmap_target;
-	void init_lightmap(GLRenderer* renderer, int texelsPerUnit = 128);
+	// can be shared with other models of the scene, see Scene::init_lightmap()
+	std::shared_ptr<Lightmap> lightmap;
+	std::vector<std::shared_ptr<LightmapRenderTarget>> lightmap_targets; // one per lightmap page
+	void init_lightmap(GLRenderer* renderer, int texelsPerUnit = 128, int pageSize = 0);
+	void init_lightmap(GLRenderer* renderer, const LightmapBudget& budget);
+
+	// static primitives that go into the lightmap, with their transforms relative to the model
+	void get_lightmap_primitives(std::vector<Primitive*>& primitives, std::vector<glm::mat4>& trans);
+	// used when baking a shared atlas
+	void set_lightmap(const std::shared_ptr<Lightmap>& lm, const std::vector<std::shared_ptr<LightmapRenderTarget>>& targets);
+	void add_lightmap_primitives(AtlasRasterizerCPU& rasterizer, int page);
+	bool has_normal_map() const;
+
+private:
+	void _init_lightmap_target(GLRenderer* renderer);
 };
 
 
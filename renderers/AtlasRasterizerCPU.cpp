@@ -0,0 +1,301 @@
+#include <GL/glew.h>
+#include <cfloat>
+#include <cmath>
+#include "utils/Utils.h"
+#include "models/ModelComponents.h"
+#include "renderers/LightmapRenderTarget.h"
+#include "AtlasRasterizerCPU.h"
+
+inline float cross2(const glm::vec2& a, const glm::vec2& b)
+{
+	return a.x * b.y - a.y * b.x;
+}
+
+// separating axis test between a triangle and the texel square [x, x+1]x[y, y+1]
+// only a positive-area overlap counts, texels merely sharing an edge with the triangle are rejected
+inline bool triangle_overlaps_texel(const glm::vec2 v[3], int x, int y)
+{
+	glm::vec2 center = glm::vec2(float(x) + 0.5f, float(y) + 0.5f);
+	for (int i = 0; i < 3; i++)
+	{
+		glm::vec2 e = v[(i + 1) % 3] - v[i];
+		glm::vec2 n = glm::vec2(-e.y, e.x);
+		float d0 = glm::dot(n, v[i]);
+		float d1 = glm::dot(n, v[(i + 2) % 3]);
+		float tri_min = glm::min(d0, d1);
+		float tri_max = glm::max(d0, d1);
+		float c = glm::dot(n, center);
+		float r = 0.5f * (fabsf(n.x) + fabsf(n.y));
+		if (c + r <= tri_min || c - r >= tri_max) return false;
+	}
+	return true;
+}
+
+inline glm::vec3 barycentric(const glm::vec2 v[3], float inv_area2, const glm::vec2& p)
+{
+	float b1 = cross2(p - v[0], v[2] - v[0]) * inv_area2;
+	float b2 = cross2(v[1] - v[0], p - v[0]) * inv_area2;
+	return glm::vec3(1.0f - b1 - b2, b1, b2);
+}
+
+// barycentric coordinates of the point of the triangle closest to p
+inline glm::vec3 closest_barycentric(const glm::vec2 v[3], float inv_area2, const glm::vec2& p)
+{
+	glm::vec3 bary = barycentric(v, inv_area2, p);
+	if (bary.x >= 0.0f && bary.y >= 0.0f && bary.z >= 0.0f) return bary;
+
+	float min_dis2 = FLT_MAX;
+	for (int i = 0; i < 3; i++)
+	{
+		int j = (i + 1) % 3;
+		glm::vec2 e = v[j] - v[i];
+		float len2 = glm::dot(e, e);
+		float t = len2 > 0.0f ? glm::clamp(glm::dot(p - v[i], e) / len2, 0.0f, 1.0f) : 0.0f;
+		glm::vec2 q = v[i] + e * t;
+		float dis2 = glm::dot(p - q, p - q);
+		if (dis2 < min_dis2)
+		{
+			min_dis2 = dis2;
+			bary = glm::vec3(0.0f);
+			bary[i] = 1.0f - t;
+			bary[j] = t;
+		}
+	}
+	return bary;
+}
+
+AtlasRasterizerCPU::AtlasRasterizerCPU(int width, int height, int samples_per_axis)
+	: m_width(width), m_height(height), m_samples_per_axis(samples_per_axis < 1 ? 1 : samples_per_axis)
+{
+	m_position.resize((size_t)width * (size_t)height, glm::vec4(0.0f));
+	m_normal.resize((size_t)width * (size_t)height, glm::vec4(0.0f));
+	m_dpdx.resize((size_t)width * (size_t)height, glm::vec4(0.0f));
+	m_dpdy.resize((size_t)width * (size_t)height, glm::vec4(0.0f));
+	m_owner_samples.resize((size_t)width * (size_t)height, -1);
+	m_owner_chart.resize((size_t)width * (size_t)height, -1);
+}
+
+void AtlasRasterizerCPU::add_primitive(const Primitive& prim, const glm::mat4& model_mat, int page)
+{
+	if (prim.cpu_lightmap_uv == nullptr || prim.cpu_lightmap_indices == nullptr) return;
+
+	glm::mat4 norm_mat = glm::transpose(glm::inverse(model_mat));
+	glm::vec2 img_size = glm::vec2(m_width, m_height);
+
+	const std::vector<glm::vec2>& atlas_uv = *prim.cpu_lightmap_uv;
+	const std::vector<int>& atlas_indices = *prim.cpu_lightmap_indices;
+	const std::vector<int>* atlas_pages = prim.cpu_lightmap_page.get();
+
+	int num_face = prim.index_buf != nullptr ? prim.num_face : prim.num_pos / 3;
+
+	// the atlas splits vertices along chart borders, so the charts are the components connected through atlas vertices
+	std::vector<int> parent(atlas_uv.size());
+	for (size_t i = 0; i < parent.size(); i++) parent[i] = (int)i;
+	auto find = [&parent](int i)
+	{
+		while (parent[i] != i)
+		{
+			parent[i] = parent[parent[i]];
+			i = parent[i];
+		}
+		return i;
+	};
+	for (int i = 0; i < num_face; i++)
+	{
+		int a = find(atlas_indices[i * 3]);
+		for (int k = 1; k < 3; k++)
+		{
+			int b = find(atlas_indices[i * 3 + k]);
+			if (a != b) parent[b] = a;
+		}
+	}
+
+	for (int i = 0; i < num_face; i++)
+	{
+		int tri_page = atlas_pages != nullptr ? (*atlas_pages)[atlas_indices[i * 3]] : 0;
+		if (tri_page != page) continue;
+
+		Triangle tri;
+		for (int k = 0; k < 3; k++)
+		{
+			int idx = i * 3 + k;
+			int vert_idx = idx;
+			if (prim.index_buf != nullptr)
+			{
+				if (prim.type_indices == 1)
+				{
+					vert_idx = (int)((const uint8_t*)prim.cpu_indices->data())[idx];
+				}
+				else if (prim.type_indices == 2)
+				{
+					vert_idx = (int)((const uint16_t*)prim.cpu_indices->data())[idx];
+				}
+				else if (prim.type_indices == 4)
+				{
+					vert_idx = (int)((const uint32_t*)prim.cpu_indices->data())[idx];
+				}
+			}
+			tri.uv[k] = atlas_uv[atlas_indices[idx]] * img_size;
+			tri.pos[k] = glm::vec3(model_mat * (*prim.cpu_pos)[vert_idx]);
+			tri.norm[k] = glm::vec3(norm_mat * (*prim.cpu_norm)[vert_idx]);
+		}
+
+		glm::vec3 N = glm::cross(tri.pos[1] - tri.pos[0], tri.pos[2] - tri.pos[0]);
+		float len = glm::length(N);
+		tri.face_norm = len > 0.0f ? N / len : glm::vec3(0.0f);
+		tri.chart = m_num_charts + find(atlas_indices[i * 3]);
+
+		m_triangles.push_back(tri);
+	}
+	m_num_charts += (int)atlas_uv.size();
+}
+
+void AtlasRasterizerCPU::_rasterize_tile(int tile_x, int tile_y, const std::vector<int>& bin)
+{
+	int x0 = tile_x * s_tile_size;
+	int y0 = tile_y * s_tile_size;
+	int x1 = glm::min(x0 + s_tile_size, m_width);
+	int y1 = glm::min(y0 + s_tile_size, m_height);
+
+	int n = m_samples_per_axis;
+	int total_samples = n * n;
+
+	for (size_t t = 0; t < bin.size(); t++)
+	{
+		const Triangle& tri = m_triangles[bin[t]];
+		float area2 = cross2(tri.uv[1] - tri.uv[0], tri.uv[2] - tri.uv[0]);
+		if (area2 == 0.0f) continue;
+		float inv_area2 = 1.0f / area2;
+
+		// position is affine in the texel coordinate, so its derivatives are constant over the triangle
+		glm::vec2 e1 = tri.uv[1] - tri.uv[0];
+		glm::vec2 e2 = tri.uv[2] - tri.uv[0];
+		glm::vec3 p1 = tri.pos[1] - tri.pos[0];
+		glm::vec3 p2 = tri.pos[2] - tri.pos[0];
+		glm::vec3 dpdx = (p1 * e2.y - p2 * e1.y) * inv_area2;
+		glm::vec3 dpdy = (p2 * e1.x - p1 * e2.x) * inv_area2;
+
+		glm::vec2 uv_min = glm::min(glm::min(tri.uv[0], tri.uv[1]), tri.uv[2]);
+		glm::vec2 uv_max = glm::max(glm::max(tri.uv[0], tri.uv[1]), tri.uv[2]);
+
+		int bx0 = glm::max(x0, (int)floorf(uv_min.x));
+		int by0 = glm::max(y0, (int)floorf(uv_min.y));
+		int bx1 = glm::min(x1, (int)ceilf(uv_max.x));
+		int by1 = glm::min(y1, (int)ceilf(uv_max.y));
+
+		for (int y = by0; y < by1; y++)
+		{
+			for (int x = bx0; x < bx1; x++)
+			{
+				if (!triangle_overlaps_texel(tri.uv, x, y)) continue;
+
+				size_t idx = (size_t)x + (size_t)y * (size_t)m_width;
+
+				int& chart = m_owner_chart[idx];
+				if (chart == -1) chart = tri.chart;
+				else if (chart != tri.chart) chart = -2;
+
+				int count = 0;
+				glm::vec3 sum_pos = glm::vec3(0.0f);
+				glm::vec3 sum_norm = glm::vec3(0.0f);
+				for (int sy = 0; sy < n; sy++)
+				{
+					for (int sx = 0; sx < n; sx++)
+					{
+						glm::vec2 p = glm::vec2(float(x) + (float(sx) + 0.5f) / float(n), float(y) + (float(sy) + 0.5f) / float(n));
+						glm::vec3 bary = barycentric(tri.uv, inv_area2, p);
+						if (bary.x < 0.0f || bary.y < 0.0f || bary.z < 0.0f) continue;
+						sum_pos += tri.pos[0] * bary.x + tri.pos[1] * bary.y + tri.pos[2] * bary.z;
+						sum_norm += tri.norm[0] * bary.x + tri.norm[1] * bary.y + tri.norm[2] * bary.z;
+						count++;
+					}
+				}
+
+				float coverage = glm::min(m_normal[idx].w + float(count) / float(total_samples), 1.0f);
+				if (count > m_owner_samples[idx])
+				{
+					glm::vec3 pos, norm;
+					if (count > 0)
+					{
+						pos = sum_pos / float(count);
+						norm = sum_norm;
+					}
+					else
+					{
+						// touched but no sample inside: snap the texel center onto the triangle
+						glm::vec3 bary = closest_barycentric(tri.uv, inv_area2, glm::vec2(float(x) + 0.5f, float(y) + 0.5f));
+						pos = tri.pos[0] * bary.x + tri.pos[1] * bary.y + tri.pos[2] * bary.z;
+						norm = tri.norm[0] * bary.x + tri.norm[1] * bary.y + tri.norm[2] * bary.z;
+					}
+
+					float len = glm::length(norm);
+					norm = len > 0.0f ? norm / len : tri.face_norm;
+
+					m_position[idx] = glm::vec4(pos + tri.face_norm * 0.001f, 1.0f);
+					m_normal[idx] = glm::vec4(norm, 0.0f);
+					m_dpdx[idx] = glm::vec4(dpdx, 0.0f);
+					m_dpdy[idx] = glm::vec4(dpdy, 0.0f);
+					m_owner_samples[idx] = count;
+				}
+				m_normal[idx].w = coverage;
+			}
+		}
+	}
+}
+
+void AtlasRasterizerCPU::rasterize(int num_threads)
+{
+	int tiles_x = (m_width + s_tile_size - 1) / s_tile_size;
+	int tiles_y = (m_height + s_tile_size - 1) / s_tile_size;
+	int num_tiles = tiles_x * tiles_y;
+
+	std::vector<std::vector<int>> bins(num_tiles);
+	for (size_t i = 0; i < m_triangles.size(); i++)
+	{
+		const Triangle& tri = m_triangles[i];
+		glm::vec2 uv_min = glm::min(glm::min(tri.uv[0], tri.uv[1]), tri.uv[2]);
+		glm::vec2 uv_max = glm::max(glm::max(tri.uv[0], tri.uv[1]), tri.uv[2]);
+
+		int tx0 = glm::clamp((int)floorf(uv_min.x) / s_tile_size, 0, tiles_x - 1);
+		int ty0 = glm::clamp((int)floorf(uv_min.y) / s_tile_size, 0, tiles_y - 1);
+		int tx1 = glm::clamp(((int)ceilf(uv_max.x) - 1) / s_tile_size, 0, tiles_x - 1);
+		int ty1 = glm::clamp(((int)ceilf(uv_max.y) - 1) / s_tile_size, 0, tiles_y - 1);
+
+		for (int ty = ty0; ty <= ty1; ty++)
+			for (int tx = tx0; tx <= tx1; tx++)
+				bins[tx + ty * tiles_x].push_back((int)i);
+	}
+
+	// tiles own disjoint texels, so workers never write to the same location
+	parallel_for(num_threads, num_tiles, [&](int tile)
+	{
+		if (bins[tile].empty()) return;
+		_rasterize_tile(tile % tiles_x, tile / tiles_x, bins[tile]);
+	});
+
+	if (mask_shared_texels)
+	{
+		for (size_t i = 0; i < m_owner_chart.size(); i++)
+		{
+			if (m_owner_chart[i] != -2) continue;
+			m_position[i] = glm::vec4(0.0f);
+			m_normal[i] = glm::vec4(0.0f);
+			m_dpdx[i] = glm::vec4(0.0f);
+			m_dpdy[i] = glm::vec4(0.0f);
+		}
+	}
+}
+
+void AtlasRasterizerCPU::upload(LightmapRenderTarget& target) const
+{
+	glBindTexture(GL_TEXTURE_2D, target.m_tex_position->tex_id);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_FLOAT, m_position.data());
+	glBindTexture(GL_TEXTURE_2D, target.m_tex_normal->tex_id);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_FLOAT, m_normal.data());
+	glBindTexture(GL_TEXTURE_2D, target.m_tex_dpdx->tex_id);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_FLOAT, m_dpdx.data());
+	glBindTexture(GL_TEXTURE_2D, target.m_tex_dpdy->tex_id);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_FLOAT, m_dpdy.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
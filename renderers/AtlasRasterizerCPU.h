@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+#include <glm.hpp>
+
+class Primitive;
+class LightmapRenderTarget;
+
+// Conservative software rasterizer for the lightmap atlas.
+// Every texel touched by a triangle is marked as covered, so thin slivers and chart borders
+// don't need the wide-line pass of the GL path. Normal maps are not applied.
+class AtlasRasterizerCPU
+{
+public:
+	AtlasRasterizerCPU(int width, int height, int samples_per_axis = 1);
+
+	int m_width, m_height;
+	int m_samples_per_axis;
+
+	// w = 1.0 for covered texels
+	std::vector<glm::vec4> m_position;
+	// w = fraction of the texel footprint covered by geometry
+	std::vector<glm::vec4> m_normal;
+	// world-space position change over one texel step in x and y
+	std::vector<glm::vec4> m_dpdx;
+	std::vector<glm::vec4> m_dpdy;
+
+	// Drops texels touched by more than one chart. For an atlas rasterized below the density it was packed for, 
+	// where the padding between charts is less than a texel and a texel would mix the surfaces of both.
+	bool mask_shared_texels = false;
+
+	// only triangles on the given lightmap page are added
+	void add_primitive(const Primitive& prim, const glm::mat4& model_mat, int page = 0);
+	void rasterize(int num_threads = 0);
+	void upload(LightmapRenderTarget& target) const;
+
+private:
+	struct Triangle
+	{
+		glm::vec2 uv[3];
+		glm::vec3 pos[3];
+		glm::vec3 norm[3];
+		glm::vec3 face_norm;
+		int chart;
+	};
+	std::vector<Triangle> m_triangles;
+	int m_num_charts = 0;
+
+	// number of samples inside the triangle that currently owns each texel, -1 if untouched
+	std::vector<int> m_owner_samples;
+	// first chart touching each texel, -1 if untouched, -2 if touched by several
+	std::vector<int> m_owner_chart;
+
+	static const int s_tile_size = 32;
+	void _rasterize_tile(int tile_x, int tile_y, const std::vector<int>& bin);
+};
+
@@ -38,6 +38,8 @@ bool BVHRenderTarget::update(int width, int height, bool color, bool depth)
 			glBindTexture(GL_TEXTURE_2D, 0);
 		}
 
+		m_tex_video_configs = nullptr;
+
 		m_width = width;
 		m_height = height;
 
@@ -46,6 +48,19 @@ bool BVHRenderTarget::update(int width, int height, bool color, bool depth)
 	return false;
 }
 
+void BVHRenderTarget::update_configs(int num_configs)
+{
+	if (m_tex_video_configs != nullptr && m_num_configs == num_configs) return;
+
+	m_tex_video_configs = std::unique_ptr<GLTexture2DArray>(new GLTexture2DArray);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_tex_video_configs->tex_id);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA16F, m_width, m_height, num_configs);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	m_num_configs = num_configs;
+}
+
 void BVHRenderTarget::update_oit_buffers()
 {
 	m_OITBuffers.update(m_width, m_height);
@@ -18,6 +18,11 @@ public:
 
 	bool update(int width, int height, bool color = true, bool depth = true);
 
+	// one color layer per light setup of a multi-setup lightmap bake
+	int m_num_configs = 0;
+	std::unique_ptr<GLTexture2DArray> m_tex_video_configs;
+	void update_configs(int num_configs);
+
 	CompWeightedOIT::Buffers m_OITBuffers;
 	void update_oit_buffers();
 };
@@ -13,6 +13,7 @@
 #include "lights/DirectionalLight.h"
 #include "lights/DirectionalLightShadow.h"
 #include "renderers/LightmapRenderTarget.h"
+#include "renderers/LightmapRayList.h"
 
 void BVHRenderer::check_bvh(SimpleModel* model)
 {
@@ -136,6 +137,8 @@ void BVHRenderer::render_primitive(const BVHRoutine::RenderParams& params, Pass
 	options.has_glossiness_map = material->tex_idx_glossinessMap >= 0;
 	options.num_directional_lights = lights->num_directional_lights;
 	options.num_directional_shadows = lights->num_directional_shadows;	
+	options.lightmap_light_layers = params.lightmap_light_layers;
+	options.lightmap_rgbm = options.has_lightmap && params.lightmap_rgbm;
 	BVHRoutine* routine = get_routine(options);
 	routine->render(params);
 }
@@ -170,6 +173,8 @@ void BVHRenderer::render_model(Camera* p_camera, const Lights& lights, SimpleMod
 	if (model->lightmap != nullptr)
 	{
 		params.tex_lightmap = model->lightmap->lightmap.get();
+		params.lightmap_light_layers = model->lightmap->num_light_layers;
+		params.lightmap_rgbm = model->lightmap->format == LightmapFormat::RGBM8;
 	}
 
 	params.target = &target;
@@ -228,6 +233,8 @@ void BVHRenderer::render_model(Camera* p_camera, const Lights& lights, GLTFModel
 			if (model->lightmap != nullptr)
 			{
 				params.tex_lightmap = model->lightmap->lightmap.get();
+				params.lightmap_light_layers = model->lightmap->num_light_layers;
+				params.lightmap_rgbm = model->lightmap->format == LightmapFormat::RGBM8;
 			}
 
 			params.target = &target;
@@ -388,9 +395,19 @@ void BVHRenderer::render(Scene& scene, Camera& camera, BVHRenderTarget& target)
 	}
 }
 
-void BVHRenderer::render_lightmap_depth_primitive(const BVHDepthOnly::RenderParams& params)
+void BVHRenderer::render_lightmap_depth_primitive(const BVHDepthOnly::RenderParams& params, bool probe)
 {
 	const Primitive* prim = params.primitive;
+	if (probe)
+	{
+		if (LightmapProbeRenderer == nullptr)
+		{
+			LightmapProbeRenderer = std::unique_ptr<BVHDepthOnly>(new BVHDepthOnly(3));
+		}
+		LightmapProbeRenderer->render(params);
+		return;
+	}
+
 	if (LightmapDepthRenderer == nullptr)
 	{
 		LightmapDepthRenderer = std::unique_ptr<BVHDepthOnly>(new BVHDepthOnly(2));
@@ -398,7 +415,7 @@ void BVHRenderer::render_lightmap_depth_primitive(const BVHDepthOnly::RenderPara
 	LightmapDepthRenderer->render(params);
 }
 
-void BVHRenderer::render_lightmap_depth_model(LightmapRayList& lmrl, SimpleModel* model, BVHRenderTarget& target)
+void BVHRenderer::render_lightmap_depth_model(LightmapRayList& lmrl, SimpleModel* model, BVHRenderTarget& target, bool probe)
 {
 	const MeshStandardMaterial* material = &model->material;
 	if (material->alphaMode != AlphaMode::Opaque) return;
@@ -408,10 +425,10 @@ void BVHRenderer::render_lightmap_depth_model(LightmapRayList& lmrl, SimpleModel
 	params.primitive = &model->geometry;
 	params.target = &target;
 	params.lmrl = &lmrl;
-	render_lightmap_depth_primitive(params);
+	render_lightmap_depth_primitive(params, probe);
 }
 
-void BVHRenderer::render_lightmap_depth_model(LightmapRayList& lmrl, GLTFModel* model, BVHRenderTarget& target)
+void BVHRenderer::render_lightmap_depth_model(LightmapRayList& lmrl, GLTFModel* model, BVHRenderTarget& target, bool probe)
 {
 	std::vector<const MeshStandardMaterial*> material_lst(model->m_materials.size());
 	for (size_t i = 0; i < material_lst.size(); i++)
@@ -434,7 +451,7 @@ void BVHRenderer::render_lightmap_depth_model(LightmapRayList& lmrl, GLTFModel*
 			params.primitive = &primitive;
 			params.target = &target;
 			params.lmrl = &lmrl;
-			render_lightmap_depth_primitive(params);
+			render_lightmap_depth_primitive(params, probe);
 		}
 	}
 }
@@ -471,11 +488,36 @@ void BVHRenderer::render_lightmap_primitive(const BVHRoutine::RenderParams& para
 	options.has_glossiness_map = material->tex_idx_glossinessMap >= 0;
 	options.num_directional_lights = lights->num_directional_lights;
 	options.num_directional_shadows = lights->num_directional_shadows;	
+	if (params.light_configs != nullptr)
+	{
+		options.num_light_configs = params.light_configs->num_configs;
+		options.num_directional_lights = params.light_configs->num_directional_lights;
+		options.num_directional_shadows = params.light_configs->num_directional_shadows;
+		options.relight_layers = params.light_configs->relight;
+	}
+	else
+	{
+		options.lightmap_light_layers = params.lightmap_light_layers;
+	}
+	options.lightmap_rgbm = options.has_lightmap && params.lightmap_rgbm;
+	if (params.lmrl->part == LightmapPart::Direct)
+	{
+		// only emissive light from the hits, no need to shade them
+		options.has_lightmap = false;
+		options.num_directional_lights = 0;
+		options.num_directional_shadows = 0;
+		options.lightmap_light_layers = 0;
+		options.lightmap_rgbm = false;
+	}
+	else if (params.lmrl->part == LightmapPart::Indirect)
+	{
+		options.indirect_only = true;
+	}
 	BVHRoutine* routine = get_lightmap_routine(options);
 	routine->render(params);
 }
 
-void BVHRenderer::render_lightmap_model(LightmapRayList& lmrl, const Lights& lights, SimpleModel* model, Pass pass, BVHRenderTarget& target)
+void BVHRenderer::render_lightmap_model(LightmapRayList& lmrl, const Lights& lights, SimpleModel* model, Pass pass, BVHRenderTarget& target, const LightConfigs* configs)
 {
 	const GLTexture2D* tex = &model->texture;
 	if (model->repl_texture != nullptr)
@@ -504,15 +546,24 @@ void BVHRenderer::render_lightmap_model(LightmapRayList& lmrl, const Lights& lig
 	if (model->lightmap != nullptr)
 	{		
 		params.tex_lightmap = model->lightmap->lightmap.get();
+		params.lightmap_light_layers = model->lightmap->num_light_layers;
+		params.lightmap_rgbm = model->lightmap->format == LightmapFormat::RGBM8;
+		if (configs != nullptr)
+		{
+			params.tex_lightmap = configs->lightmap;
+			params.lightmap_light_layers = 0;
+			params.lightmap_rgbm = false;
+		}
 	}
 
 	params.target = &target;
 	params.lmrl = &lmrl;
+	params.light_configs = configs;
 
 	render_lightmap_primitive(params, pass);
 }
 
-void BVHRenderer::render_lightmap_model(LightmapRayList& lmrl, const Lights& lights, GLTFModel* model, Pass pass, BVHRenderTarget& target)
+void BVHRenderer::render_lightmap_model(LightmapRayList& lmrl, const Lights& lights, GLTFModel* model, Pass pass, BVHRenderTarget& target, const LightConfigs* configs)
 {
 	std::vector<const GLTexture2D*> tex_lst(model->m_textures.size());
 	for (size_t i = 0; i < tex_lst.size(); i++)
@@ -561,10 +612,19 @@ void BVHRenderer::render_lightmap_model(LightmapRayList& lmrl, const Lights& lig
 			if (model->lightmap != nullptr)
 			{
 				params.tex_lightmap = model->lightmap->lightmap.get();
+				params.lightmap_light_layers = model->lightmap->num_light_layers;
+				params.lightmap_rgbm = model->lightmap->format == LightmapFormat::RGBM8;
+				if (configs != nullptr)
+				{
+					params.tex_lightmap = configs->lightmap;
+					params.lightmap_light_layers = 0;
+					params.lightmap_rgbm = false;
+				}
 			}
 
 			params.target = &target;
 			params.lmrl = &lmrl;
+			params.light_configs = configs;
 
 			render_lightmap_primitive(params, pass);
 		}
@@ -572,7 +632,7 @@ void BVHRenderer::render_lightmap_model(LightmapRayList& lmrl, const Lights& lig
 }
 
 
-void BVHRenderer::render_lightmap(Scene& scene, LightmapRayList& lmrl, BVHRenderTarget& target)
+void BVHRenderer::render_lightmap(Scene& scene, LightmapRayList& lmrl, BVHRenderTarget& target, const LightConfigs* configs)
 {
 	bool has_alpha = false;
 	bool has_opaque = false;
@@ -609,7 +669,7 @@ void BVHRenderer::render_lightmap(Scene& scene, LightmapRayList& lmrl, BVHRender
 		}
 	}
 
-	while (scene.background != nullptr)
+	while (scene.background != nullptr && lmrl.part != LightmapPart::Indirect)
 	{
 		{
 			ColorBackground* bg = dynamic_cast<ColorBackground*>(scene.background);
@@ -648,6 +708,12 @@ void BVHRenderer::render_lightmap(Scene& scene, LightmapRayList& lmrl, BVHRender
 		break;
 	}
 
+	if (lmrl.part == LightmapPart::Indirect)
+	{
+		// the sky is direct light, misses gather nothing
+		glm::vec4 zero = { 0.0f, 0.0f, 0.0f, 1.0f };
+		glClearTexImage(target.m_tex_video->tex_id, 0, GL_RGBA, GL_FLOAT, &zero);
+	}
 
 	for (size_t i = 0; i < scene.simple_models.size(); i++)
 	{
@@ -666,6 +732,29 @@ void BVHRenderer::render_lightmap(Scene& scene, LightmapRayList& lmrl, BVHRender
 	float max_depth = FLT_MAX;
 	glClearTexImage(target.m_tex_depth->tex_id, 0, GL_RED, GL_FLOAT, &max_depth);
 
+	if (configs != nullptr)
+	{
+		// misses keep the background in every setup, or only in the last one for relightable layers
+		target.update_configs(configs->num_configs);
+		// the background is written with image stores, and no barrier bit covers glCopyImageSubData alone
+		glMemoryBarrier(GL_ALL_BARRIER_BITS);
+		for (int i = 0; i < configs->num_configs; i++)
+		{
+			if (configs->relight && i < configs->num_configs - 1)
+			{
+				const float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				glClearTexSubImage(target.m_tex_video_configs->tex_id, 0, 0, 0, i, target.m_width, target.m_height, 1, GL_RGBA, GL_FLOAT, zero);
+				continue;
+			}
+			glCopyImageSubData(target.m_tex_video->tex_id, GL_TEXTURE_2D, 0, 0, 0, 0,
+				target.m_tex_video_configs->tex_id, GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, target.m_width, target.m_height, 1);
+		}
+
+		// blended surfaces go through the single-output OIT path, they are left out of multi-setup bakes.
+		// Documented at GLRenderer::updateLightmapConfigs()
+		has_alpha = false;
+	}
+
 	if (has_opaque)
 	{
 		// depth-prepass
@@ -685,13 +774,13 @@ void BVHRenderer::render_lightmap(Scene& scene, LightmapRayList& lmrl, BVHRender
 		for (size_t i = 0; i < scene.simple_models.size(); i++)
 		{
 			SimpleModel* model = scene.simple_models[i];
-			render_lightmap_model(lmrl, lights, model, Pass::Opaque, target);
+			render_lightmap_model(lmrl, lights, model, Pass::Opaque, target, configs);
 		}
 
 		for (size_t i = 0; i < scene.gltf_models.size(); i++)
 		{
 			GLTFModel* model = scene.gltf_models[i];
-			render_lightmap_model(lmrl, lights, model, Pass::Opaque, target);
+			render_lightmap_model(lmrl, lights, model, Pass::Opaque, target, configs);
 		}
 	}
 
@@ -721,7 +810,7 @@ void BVHRenderer::render_lightmap(Scene& scene, LightmapRayList& lmrl, BVHRender
 	}
 }
 
-void BVHRenderer::update_lightmap(const BVHRenderTarget& source, const LightmapRayList& lmrl, const Lightmap& lightmap, int id_start_texel, float mix_rate)
+void BVHRenderer::update_lightmap(const BVHRenderTarget& source, const LightmapRayList& lmrl, const Lightmap& lightmap, int id_start_texel, float mix_rate, int layer)
 {
 	if (LightmapUpdater == nullptr)
 	{
@@ -733,11 +822,90 @@ void BVHRenderer::update_lightmap(const BVHRenderTarget& source, const LightmapR
 	params.source = &source;
 	params.lmrl = &lmrl;
 	params.target = &lightmap;
+	params.layer = layer >= 0 ? layer : lmrl.source->page;
+	params.sh_layer = -1;
+	if (layer < 0 && lightmap.sh_l1 && lightmap.num_light_layers == 0)
+	{
+		params.sh_layer = lightmap.num_pages + lmrl.source->page * 3;
+	}
 	LightmapUpdater->update(params);
 }
 
-void BVHRenderer::filter_lightmap(const LightmapRenderTarget& atlas, const Lightmap& lightmap)
+void BVHRenderer::update_probe_volume(const BVHRenderTarget& source, const LightmapRayList& lmrl, const ProbeVolume& volume, float mix_rate)
 {
+	if (ProbeVolumeUpdater == nullptr)
+	{
+		ProbeVolumeUpdater = std::unique_ptr<ProbeVolumeUpdate>(new ProbeVolumeUpdate);
+	}
+
+	ProbeVolumeUpdate::RenderParams params;
+	params.mix_rate = mix_rate;
+	params.source = &source;
+	params.lmrl = &lmrl;
+	params.target = &volume;
+	ProbeVolumeUpdater->update(params);
+}
+
+void BVHRenderer::prefilter_reflection(const GLCubemap& source, int source_size, const ReflectionMap& target, int num_samples)
+{
+	if (ReflectionPrefiltering == nullptr)
+	{
+		ReflectionPrefiltering = std::unique_ptr<ReflectionPrefilter>(new ReflectionPrefilter);
+	}
+
+	ReflectionPrefilter::RenderParams params;
+	params.source = &source;
+	params.source_size = source_size;
+	params.target = &target;
+	params.num_samples = num_samples;
+	ReflectionPrefiltering->filter(params);
+}
+
+void BVHRenderer::update_vertex_gi(const BVHRenderTarget& source, const LightmapRayList& lmrl, const GLBuffer& target, float mix_rate)
+{
+	if (VertexGIUpdater == nullptr)
+	{
+		VertexGIUpdater = std::unique_ptr<VertexGIUpdate>(new VertexGIUpdate);
+	}
+
+	VertexGIUpdate::RenderParams params;
+	params.mix_rate = mix_rate;
+	params.source = &source;
+	params.lmrl = &lmrl;
+	params.target = &target;
+	VertexGIUpdater->update(params);
+}
+
+void BVHRenderer::composite_lightmap(const LightmapRenderTarget& atlas, const Lightmap& direct, const LightmapRenderTarget& atlas_low, const Lightmap& indirect, const Lightmap& target)
+{
+	if (LightmapUpsampling == nullptr)
+	{
+		LightmapUpsampling = std::unique_ptr<LightmapUpsample>(new LightmapUpsample);
+	}
+
+	LightmapUpsample::RenderParams params;
+	params.atlas = &atlas;
+	params.direct = &direct;
+	params.atlas_low = &atlas_low;
+	params.indirect = &indirect;
+	params.target = &target;
+	params.layer = atlas.page;
+	params.layer_low = atlas_low.page;
+	LightmapUpsampling->composite(params);
+}
+
+void BVHRenderer::filter_lightmap(const LightmapRenderTarget& atlas, const Lightmap& lightmap, int layer)
+{
+	std::vector<int> layers;
+	if (layer < 0)
+	{
+		lightmap.page_layers(atlas.page, layers);
+	}
+	else
+	{
+		layers.push_back(layer);
+	}
+
 	int width = lightmap.width;
 	int height = lightmap.height;
 	float texel_size = 1.0f / (float)(lightmap.texels_per_unit);
@@ -747,26 +915,136 @@ void BVHRenderer::filter_lightmap(const LightmapRenderTarget& atlas, const Light
 	{
 		LightmapFiltering = std::unique_ptr<LightmapFilter>(new LightmapFilter);
 	}
-	
+
+	for (int l : layers)
+	{
+		{
+			LightmapFilter::RenderParams params;
+			params.width = width;
+			params.height = height;
+			params.texel_size = texel_size;
+			params.light_map_in = lightmap.lightmap.get();
+			params.page_in = l;
+			params.light_map_out = tmp.lightmap.get();
+			params.page_out = 0;
+			params.atlas_record_index = atlas.m_tex_record_index.get();
+			params.texel_records = atlas.texel_records.get();
+			params.record_pos_min = atlas.record_pos_min;
+			params.record_pos_step = atlas.record_pos_step;
+			LightmapFiltering->filter(params);
+		}
+
+		{
+			LightmapFilter::RenderParams params;
+			params.width = width;
+			params.height = height;
+			params.texel_size = texel_size;
+			params.light_map_in = tmp.lightmap.get();
+			params.page_in = 0;
+			params.light_map_out = lightmap.lightmap.get();
+			params.page_out = l;
+			params.atlas_record_index = atlas.m_tex_record_index.get();
+			params.texel_records = atlas.texel_records.get();
+			params.record_pos_min = atlas.record_pos_min;
+			params.record_pos_step = atlas.record_pos_step;
+			LightmapFiltering->filter(params);
+		}
+	}
+}
+void BVHRenderer::compact_atlas(LightmapRenderTarget& atlas)
+{
+	if (LightmapCompacting == nullptr)
+	{
+		LightmapCompacting = std::unique_ptr<LightmapCompact>(new LightmapCompact);
+	}
+
+	LightmapCompact::RenderParams params;
+	params.width = atlas.m_width;
+	params.height = atlas.m_height;
+	params.atlas_position = atlas.m_tex_position.get();
+	params.atlas_normal = atlas.m_tex_normal.get();
+	params.atlas_dpdx = atlas.m_tex_dpdx.get();
+	params.atlas_dpdy = atlas.m_tex_dpdy.get();
+
+	LightmapCompact::Output output;
+	output.texel_records = &atlas.texel_records;
+	output.tex_record_index = &atlas.m_tex_record_index;
+	output.pos_min = &atlas.record_pos_min;
+	output.pos_step = &atlas.record_pos_step;
+	atlas.count_valid = LightmapCompacting->compact(params, output);
+
+	// everything the bake needs is in the records now
+	atlas.release_framebuffer();
+}
+
+void BVHRenderer::probe_lightmap(Scene& scene, LightmapRayList& lmrl, BVHRenderTarget& target)
+{
+	glm::vec4 zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+	glClearTexImage(target.m_tex_video->tex_id, 0, GL_RGBA, GL_FLOAT, &zero);
+
+	float max_depth = FLT_MAX;
+	glClearTexImage(target.m_tex_depth->tex_id, 0, GL_RED, GL_FLOAT, &max_depth);
+
+	// only opaque geometry can hide a texel
+	for (size_t i = 0; i < scene.simple_models.size(); i++)
+	{
+		SimpleModel* model = scene.simple_models[i];
+		check_bvh(model);
+		render_lightmap_depth_model(lmrl, model, target, true);
+	}
+
+	for (size_t i = 0; i < scene.gltf_models.size(); i++)
 	{
-		LightmapFilter::RenderParams params;
-		params.width = width;
-		params.height = height;
-		params.texel_size = texel_size;
-		params.light_map_in = lightmap.lightmap.get();
-		params.light_map_out = tmp.lightmap.get();
-		params.atlas_position = atlas.m_tex_position.get();
-		LightmapFiltering->filter(params);
+		GLTFModel* model = scene.gltf_models[i];
+		check_bvh(model);
+		render_lightmap_depth_model(lmrl, model, target, true);
 	}
+}
 
+void BVHRenderer::reduce_lightmap_probe(const BVHRenderTarget& source, const LightmapRayList& lmrl, const GLBuffer& keep_flags, float threshold)
+{
+	if (LightmapProbing == nullptr)
 	{
-		LightmapFilter::RenderParams params;
-		params.width = width;
-		params.height = height;
-		params.texel_size = texel_size;
-		params.light_map_in = tmp.lightmap.get();
-		params.light_map_out = lightmap.lightmap.get(); 
-		params.atlas_position = atlas.m_tex_position.get();
-		LightmapFiltering->filter(params);
+		LightmapProbing = std::unique_ptr<LightmapProbe>(new LightmapProbe);
 	}
-}
\ No newline at end of file
+
+	LightmapProbe::RenderParams params;
+	params.threshold = threshold;
+	params.source = &source;
+	params.lmrl = &lmrl;
+	params.keep_flags = &keep_flags;
+	LightmapProbing->reduce(params);
+}
+
+int BVHRenderer::drop_lightmap_texels(LightmapRenderTarget& atlas, const GLBuffer& keep_flags)
+{
+	if (LightmapProbing == nullptr)
+	{
+		LightmapProbing = std::unique_ptr<LightmapProbe>(new LightmapProbe);
+	}
+	return LightmapProbing->drop(atlas, keep_flags);
+}
+
+int BVHRenderer::select_lightmap_texels(const LightmapRenderTarget& atlas, const std::vector<glm::vec3>& boxes, LightmapRenderTarget& selection)
+{
+	if (LightmapSelecting == nullptr)
+	{
+		LightmapSelecting = std::unique_ptr<LightmapSelect>(new LightmapSelect);
+	}
+
+	// one spare box so the buffer is never empty
+	int num_boxes = (int)(boxes.size() / 2);
+	std::vector<glm::vec4> box_data(num_boxes * 2 + 2);
+	for (int i = 0; i < num_boxes * 2; i++)
+	{
+		box_data[i] = glm::vec4(boxes[i], 0.0f);
+	}
+	GLBuffer buf_boxes(sizeof(glm::vec4) * box_data.size(), GL_SHADER_STORAGE_BUFFER);
+	buf_boxes.upload(box_data.data());
+
+	LightmapSelect::RenderParams params;
+	params.atlas = &atlas;
+	params.boxes = &buf_boxes;
+	params.num_boxes = num_boxes;
+	return LightmapSelecting->select(params, selection);
+}
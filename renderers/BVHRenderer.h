@@ -9,6 +9,13 @@
 #include "renderers/bvh_routines/BVHRoutine.h"
 #include "renderers/bvh_routines/LightmapUpdate.h"
 #include "renderers/bvh_routines/LightmapFilter.h"
+#include "renderers/bvh_routines/LightmapCompact.h"
+#include "renderers/bvh_routines/LightmapProbe.h"
+#include "renderers/bvh_routines/LightmapSelect.h"
+#include "renderers/bvh_routines/ProbeVolumeUpdate.h"
+#include "renderers/bvh_routines/ReflectionPrefilter.h"
+#include "renderers/bvh_routines/VertexGIUpdate.h"
+#include "renderers/bvh_routines/LightmapUpsample.h"
 
 class Scene;
 class Camera;
@@ -21,14 +28,31 @@ class DirectionalLightShadow;
 class Lightmap;
 class LightmapRenderTarget;
 class LightmapRayList;
+class ProbeVolume;
 
 class BVHRenderer
 {
 public:
 	void render(Scene& scene, Camera& camera, BVHRenderTarget& target);
-	void render_lightmap(Scene& scene, LightmapRayList& lmrl, BVHRenderTarget& target);
-	void update_lightmap(const BVHRenderTarget& source, const LightmapRayList& lmrl, const Lightmap& lightmap, int id_start_texel, float mix_rate = 1.0f);
-	void filter_lightmap(const LightmapRenderTarget& atlas, const Lightmap& lightmap);
+	// with light configs, opaque hits are shaded for every setup into target.m_tex_video_configs
+	void render_lightmap(Scene& scene, LightmapRayList& lmrl, BVHRenderTarget& target, const LightConfigs* configs = nullptr);
+	// layer -1 writes the page of the atlas
+	void update_lightmap(const BVHRenderTarget& source, const LightmapRayList& lmrl, const Lightmap& lightmap, int id_start_texel, float mix_rate = 1.0f, int layer = -1);
+	// layer -1 filters every layer of the page of the atlas (irradiance, light layers and L1)
+	void filter_lightmap(const LightmapRenderTarget& atlas, const Lightmap& lightmap, int layer = -1);
+	// target = direct + indirect upsampled from atlas_low, for the page of atlas
+	void composite_lightmap(const LightmapRenderTarget& atlas, const Lightmap& direct, const LightmapRenderTarget& atlas_low, const Lightmap& indirect, const Lightmap& target);
+	void compact_atlas(LightmapRenderTarget& atlas);
+	void probe_lightmap(Scene& scene, LightmapRayList& lmrl, BVHRenderTarget& target);
+	void reduce_lightmap_probe(const BVHRenderTarget& source, const LightmapRayList& lmrl, const GLBuffer& keep_flags, float threshold);
+	int drop_lightmap_texels(LightmapRenderTarget& atlas, const GLBuffer& keep_flags);
+	int select_lightmap_texels(const LightmapRenderTarget& atlas, const std::vector<glm::vec3>& boxes, LightmapRenderTarget& selection);
+	// lmrl runs over volume.probes with sphere directions
+	void update_probe_volume(const BVHRenderTarget& source, const LightmapRayList& lmrl, const ProbeVolume& volume, float mix_rate = 1.0f);
+	// source: RGBA16F radiance cubemap of source_size with the full mip chain
+	void prefilter_reflection(const GLCubemap& source, int source_size, const ReflectionMap& target, int num_samples = 256);
+	// lmrl runs over per-vertex records, target holds a vec4 per vertex
+	void update_vertex_gi(const BVHRenderTarget& source, const LightmapRayList& lmrl, const GLBuffer& target, float mix_rate = 1.0f);
 
 private:
 	std::unique_ptr<CompWeightedOIT> oit_resolver;
@@ -63,17 +87,25 @@ private:
 	std::unique_ptr<CompHemisphere> LightmapHemisphereDraw;
 
 	std::unique_ptr<BVHDepthOnly> LightmapDepthRenderer;
-	void render_lightmap_depth_primitive(const BVHDepthOnly::RenderParams& params);
-	void render_lightmap_depth_model(LightmapRayList& lmrl, SimpleModel* model, BVHRenderTarget& target);
-	void render_lightmap_depth_model(LightmapRayList& lmrl, GLTFModel* model, BVHRenderTarget& target);
+	std::unique_ptr<BVHDepthOnly> LightmapProbeRenderer;
+	void render_lightmap_depth_primitive(const BVHDepthOnly::RenderParams& params, bool probe = false);
+	void render_lightmap_depth_model(LightmapRayList& lmrl, SimpleModel* model, BVHRenderTarget& target, bool probe = false);
+	void render_lightmap_depth_model(LightmapRayList& lmrl, GLTFModel* model, BVHRenderTarget& target, bool probe = false);
 
 	std::unordered_map<uint64_t, std::unique_ptr<BVHRoutine>> lightmap_routine_map;
 	BVHRoutine* get_lightmap_routine(const BVHRoutine::Options& options);
 
 	void render_lightmap_primitive(const BVHRoutine::RenderParams& params, Pass pass);
-	void render_lightmap_model(LightmapRayList& lmrl, const Lights& lights, SimpleModel* model, Pass pass, BVHRenderTarget& target);
-	void render_lightmap_model(LightmapRayList& lmrl, const Lights& lights, GLTFModel* model, Pass pass, BVHRenderTarget& target);
+	void render_lightmap_model(LightmapRayList& lmrl, const Lights& lights, SimpleModel* model, Pass pass, BVHRenderTarget& target, const LightConfigs* configs = nullptr);
+	void render_lightmap_model(LightmapRayList& lmrl, const Lights& lights, GLTFModel* model, Pass pass, BVHRenderTarget& target, const LightConfigs* configs = nullptr);
 
 	std::unique_ptr<LightmapUpdate> LightmapUpdater;
 	std::unique_ptr<LightmapFilter> LightmapFiltering;
+	std::unique_ptr<LightmapCompact> LightmapCompacting;
+	std::unique_ptr<LightmapProbe> LightmapProbing;
+	std::unique_ptr<LightmapSelect> LightmapSelecting;
+	std::unique_ptr<ProbeVolumeUpdate> ProbeVolumeUpdater;
+	std::unique_ptr<ReflectionPrefilter> ReflectionPrefiltering;
+	std::unique_ptr<VertexGIUpdate> VertexGIUpdater;
+	std::unique_ptr<LightmapUpsample> LightmapUpsampling;
 };
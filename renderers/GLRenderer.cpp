@@ -1,4 +1,6 @@
+#include <cmath>
 #include <GL/glew.h>
+#include <gtc/packing.hpp>
 #include "crc64/crc64.h"
 #include "scenes/Scene.h"
 #include "cameras/Camera.h"
@@ -15,6 +17,8 @@
 #include "materials/MeshStandardMaterial.h"
 #include "lights/DirectionalLight.h"
 #include "lights/DirectionalLightShadow.h"
+#include "lights/ProbeVolume.h"
+#include "lights/ReflectionProbe.h"
 
 #include "LightmapRayList.h"
 
@@ -126,6 +130,12 @@ void GLRenderer::render_primitive(const StandardRoutine::RenderParams& params, P
 	options.has_glossiness_map = material->tex_idx_glossinessMap >= 0;
 	options.num_directional_lights = lights->num_directional_lights;
 	options.num_directional_shadows = lights->num_directional_shadows;	
+	options.lightmap_light_layers = params.lightmap_light_layers;
+	options.has_lightmap_sh = options.has_lightmap && options.has_normal_map && params.lightmap_sh && params.lightmap_light_layers == 0;
+	options.lightmap_rgbm = options.has_lightmap && params.lightmap_rgbm;
+	options.has_vertex_gi = !options.has_lightmap && params.primitive->vertex_gi_buf != nullptr;
+	options.has_probe_volume = !options.has_lightmap && !options.has_vertex_gi && lights->probe_volume != nullptr;
+	options.has_reflection_map = params.tex_reflection != nullptr;
 	StandardRoutine* routine = get_routine(options);
 	routine->render(params);
 }
@@ -152,12 +162,36 @@ void GLRenderer::render_primitives(const StandardRoutine::RenderParams& params,
 	options.has_glossiness_map = material->tex_idx_glossinessMap >= 0;
 	options.num_directional_lights = lights->num_directional_lights;
 	options.num_directional_shadows = lights->num_directional_shadows;	
+	options.lightmap_light_layers = params.lightmap_light_layers;
+	options.has_lightmap_sh = options.has_lightmap && options.has_normal_map && params.lightmap_sh && params.lightmap_light_layers == 0;
+	options.lightmap_rgbm = options.has_lightmap && params.lightmap_rgbm;
+	options.has_vertex_gi = !options.has_lightmap && params.primitive->vertex_gi_buf != nullptr;
+	options.has_probe_volume = !options.has_lightmap && !options.has_vertex_gi && lights->probe_volume != nullptr;
+	options.has_reflection_map = params.tex_reflection != nullptr;
 	StandardRoutine* routine = get_routine(options);
 	routine->render_batched(params, first_lst, count_lst);
 
 }
 
 
+static const ReflectionMap* nearest_reflection(const Lights& lights, const glm::vec3& pos)
+{
+	const ReflectionMap* ret = nullptr;
+	float min_dis2 = FLT_MAX;
+	for (size_t i = 0; i < lights.reflection_probes.size(); i++)
+	{
+		const ReflectionProbe* probe = lights.reflection_probes[i];
+		glm::vec3 d = probe->position - pos;
+		float dis2 = glm::dot(d, d);
+		if (dis2 < min_dis2)
+		{
+			min_dis2 = dis2;
+			ret = &probe->reflection;
+		}
+	}
+	return ret;
+}
+
 void GLRenderer::render_model(Camera* p_camera, const Lights& lights, SimpleModel* model, GLRenderTarget& target, Pass pass)
 {
 	const GLTexture2D* tex = &model->texture;
@@ -167,6 +201,7 @@ void GLRenderer::render_model(Camera* p_camera, const Lights& lights, SimpleMode
 	}
 
 	const MeshStandardMaterial* material = &model->material;
+	const ReflectionMap* tex_reflection = nearest_reflection(lights, model->matrixWorld[3]);
 
 	if (pass == Pass::Opaque)
 	{
@@ -184,10 +219,14 @@ void GLRenderer::render_model(Camera* p_camera, const Lights& lights, SimpleMode
 	params.constant_model = &model->m_constant;
 	params.primitive = &model->geometry;
 	params.lights = &lights;
+	params.tex_reflection = tex_reflection;
 	params.tex_lightmap = nullptr;
 	if (model->lightmap != nullptr)
 	{
 		params.tex_lightmap = model->lightmap->lightmap.get();
+		params.lightmap_light_layers = model->lightmap->num_light_layers;
+		params.lightmap_sh = model->lightmap->sh_l1;
+		params.lightmap_rgbm = model->lightmap->format == LightmapFormat::RGBM8;
 	}
 
 	render_primitive(params, pass);
@@ -214,6 +253,8 @@ void GLRenderer::render_model(Camera* p_camera, const Lights& lights, GLTFModel*
 	for (size_t i = 0; i < material_lst.size(); i++)
 		material_lst[i] = model->m_materials[i].get();
 
+	const ReflectionMap* tex_reflection = nearest_reflection(lights, model->matrixWorld[3]);
+
 	if (model->batched_mesh != nullptr)
 	{
 		std::vector<std::vector<int>> first_lists(material_lst.size());
@@ -268,10 +309,14 @@ void GLRenderer::render_model(Camera* p_camera, const Lights& lights, GLTFModel*
 				params.constant_model = mesh.model_constant.get();
 				params.primitive = &primitive;
 				params.lights = &lights;
+				params.tex_reflection = tex_reflection;
 				params.tex_lightmap = nullptr;
 				if (model->lightmap != nullptr)
 				{
 					params.tex_lightmap = model->lightmap->lightmap.get();
+					params.lightmap_light_layers = model->lightmap->num_light_layers;
+					params.lightmap_sh = model->lightmap->sh_l1;
+					params.lightmap_rgbm = model->lightmap->format == LightmapFormat::RGBM8;
 				}
 
 				render_primitives(params, pass, material_firsts, material_counts);
@@ -315,10 +360,14 @@ void GLRenderer::render_model(Camera* p_camera, const Lights& lights, GLTFModel*
 				params.constant_model = mesh.model_constant.get();
 				params.primitive = &primitive;
 				params.lights = &lights;
+				params.tex_reflection = tex_reflection;
 				params.tex_lightmap = nullptr;
 				if (model->lightmap != nullptr)
 				{					
 					params.tex_lightmap = model->lightmap->lightmap.get();
+					params.lightmap_light_layers = model->lightmap->num_light_layers;
+					params.lightmap_sh = model->lightmap->sh_l1;
+					params.lightmap_rgbm = model->lightmap->format == LightmapFormat::RGBM8;
 				}
 				render_primitive(params, pass);
 			}
@@ -675,37 +724,18 @@ void GLRenderer::_pre_render(Scene& scene)
 	}
 
 	// update lights
-	for (size_t i = 0; i < scene.directional_lights.size(); i++)
-	{
-		DirectionalLight* light = scene.directional_lights[i];
-		if (light->shadow != nullptr)
-		{
-			light->shadow->updateMatrices();
-
-			
-			glBindFramebuffer(GL_FRAMEBUFFER, light->shadow->m_lightFBO);
-			glViewport(0, 0, light->shadow->m_map_width, light->shadow->m_map_height);
-			const float one = 1.0f;
-			glDepthMask(GL_TRUE);
-			glClearBufferfv(GL_DEPTH, 0, &one);			
-
-			for (size_t j = 0; j < scene.simple_models.size(); j++)
-			{
-				SimpleModel* model = scene.simple_models[j];
-				render_shadow_model(light->shadow.get(), model);
-			}
-			for (size_t j = 0; j < scene.gltf_models.size(); j++)
-			{
-				GLTFModel* model = scene.gltf_models[j];
-				render_shadow_model(light->shadow.get(), model);
-			}
-
-		}
-	}
+	_render_shadow_maps(scene);
 
 	// update light constants
 	Lights& lights = scene.lights;
 	lights.directional_shadow_texs.clear();
+	lights.probe_volume = scene.probe_volume.get();
+	lights.reflection_probes.clear();
+	for (size_t i = 0; i < scene.reflection_probes.size(); i++)
+	{
+		const ReflectionProbe* probe = scene.reflection_probes[i].get();
+		if (probe->baked) lights.reflection_probes.push_back(probe);
+	}
 
 	std::vector<ConstDirectionalLight> const_directional_lights(scene.directional_lights.size());
 	std::vector<ConstDirectionalShadow> const_directional_shadows;
@@ -771,6 +801,37 @@ void GLRenderer::_pre_render(Scene& scene)
 
 }
 
+void GLRenderer::_render_shadow_maps(Scene& scene)
+{
+	for (size_t i = 0; i < scene.directional_lights.size(); i++)
+	{
+		DirectionalLight* light = scene.directional_lights[i];
+		if (light->shadow != nullptr)
+		{
+			light->shadow->updateMatrices();
+
+			
+			glBindFramebuffer(GL_FRAMEBUFFER, light->shadow->m_lightFBO);
+			glViewport(0, 0, light->shadow->m_map_width, light->shadow->m_map_height);
+			const float one = 1.0f;
+			glDepthMask(GL_TRUE);
+			glClearBufferfv(GL_DEPTH, 0, &one);			
+
+			for (size_t j = 0; j < scene.simple_models.size(); j++)
+			{
+				SimpleModel* model = scene.simple_models[j];
+				render_shadow_model(light->shadow.get(), model);
+			}
+			for (size_t j = 0; j < scene.gltf_models.size(); j++)
+			{
+				GLTFModel* model = scene.gltf_models[j];
+				render_shadow_model(light->shadow.get(), model);
+			}
+
+		}
+	}
+}
+
 void GLRenderer::_render_scene(Scene& scene, Camera& camera, GLRenderTarget& target)
 {
 	camera.updateMatrixWorld(false);
@@ -1023,20 +1084,26 @@ void GLRenderer::rasterize_atlas_primitive(const RasterizeAtlas::RenderParams &
 	routine->render(params);
 }
 
-void GLRenderer::rasterize_atlas(SimpleModel* model)
+void GLRenderer::rasterize_atlas(SimpleModel* model, int page, bool clear)
 {
 	model->updateWorldMatrix(false, false);
 	update_model(model);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, model->lightmap_target->m_fbo);
+	LightmapRenderTarget& target = *model->lightmap_targets[page];
+	glBindFramebuffer(GL_FRAMEBUFFER, target.m_fbo);
 
-	const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-	glDrawBuffers(2, drawBuffers);
-	glViewport(0, 0, model->lightmap_target->m_width, model->lightmap_target->m_height);
+	const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+	glDrawBuffers(4, drawBuffers);
+	glViewport(0, 0, target.m_width, target.m_height);
 
-	float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	glClearBufferfv(GL_COLOR, 0, zero);
-	glClearBufferfv(GL_COLOR, 1, zero);
+	if (clear)
+	{
+		float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		glClearBufferfv(GL_COLOR, 0, zero);
+		glClearBufferfv(GL_COLOR, 1, zero);
+		glClearBufferfv(GL_COLOR, 2, zero);
+		glClearBufferfv(GL_COLOR, 3, zero);
+	}
 
 	const GLTexture2D* tex = &model->texture;
 	if (model->repl_texture != nullptr)
@@ -1051,23 +1118,30 @@ void GLRenderer::rasterize_atlas(SimpleModel* model)
 	params.material_list = &material;
 	params.constant_model = &model->m_constant;
 	params.primitive = &model->geometry;
+	params.page = page;
 	rasterize_atlas_primitive(params);
 }
 
-void GLRenderer::rasterize_atlas(GLTFModel* model)
+void GLRenderer::rasterize_atlas(GLTFModel* model, int page, bool clear)
 {
 	model->updateWorldMatrix(false, false);
 	update_model(model);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, model->lightmap_target->m_fbo);
+	LightmapRenderTarget& target = *model->lightmap_targets[page];
+	glBindFramebuffer(GL_FRAMEBUFFER, target.m_fbo);
 
-	const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-	glDrawBuffers(2, drawBuffers);
-	glViewport(0, 0, model->lightmap_target->m_width, model->lightmap_target->m_height);
+	const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+	glDrawBuffers(4, drawBuffers);
+	glViewport(0, 0, target.m_width, target.m_height);
 
-	float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	glClearBufferfv(GL_COLOR, 0, zero);
-	glClearBufferfv(GL_COLOR, 1, zero);
+	if (clear)
+	{
+		float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		glClearBufferfv(GL_COLOR, 0, zero);
+		glClearBufferfv(GL_COLOR, 1, zero);
+		glClearBufferfv(GL_COLOR, 2, zero);
+		glClearBufferfv(GL_COLOR, 3, zero);
+	}
 
 	std::vector<const GLTexture2D*> tex_lst(model->m_textures.size());
 	for (size_t i = 0; i < tex_lst.size(); i++)
@@ -1099,6 +1173,7 @@ void GLRenderer::rasterize_atlas(GLTFModel* model)
 			params.material_list = material_lst.data();
 			params.constant_model = mesh.model_constant.get();
 			params.primitive = &primitive;
+			params.page = page;
 			rasterize_atlas_primitive(params);
 		}
 	}
@@ -1116,12 +1191,18 @@ void GLRenderer::rasterize_atlas(GLTFModel* model)
 				params.material_list = material_lst.data();				
 				params.constant_model = mesh.model_constant.get();
 				params.primitive = &primitive;
+				params.page = page;
 				rasterize_atlas_primitive(params);
 			}
 		}
 	}
 }
 
+void GLRenderer::compact_atlas(LightmapRenderTarget& atlas)
+{
+	bvh_renderer.compact_atlas(atlas);
+}
+
 void GLRenderer::renderTexture(GLTexture2D* tex, int x, int y, int width, int height, GLRenderTarget& target, bool flipY, float alpha)
 {
 	if (TextureDraw == nullptr)
@@ -1144,13 +1225,16 @@ void GLRenderer::_render_bvh(Scene& scene, Camera& camera, GLRenderTarget& targe
 }
 
 
-int GLRenderer::updateLightmap(Scene& scene, Lightmap& lm, LightmapRenderTarget& src, int start_texel, int num_directions)
+int GLRenderer::updateLightmap(Scene& scene, Lightmap& lm, LightmapRecords& src, int start_texel, int num_directions, int jitter, LightmapPart part)
 {
+	if (!lm.check_bakeable("updateLightmap")) return 0;
+
 	int max_texels = (1 << 17) / num_directions;
 	if (max_texels < 1) max_texels = 1;
 
 	int num_texels = src.count_valid - start_texel;
 	if (num_texels > max_texels) num_texels = max_texels;
+	if (num_texels <= 0) return 0;
 
 	int width = 512;
 	if (width < num_directions) width = num_directions;
@@ -1163,6 +1247,12 @@ int GLRenderer::updateLightmap(Scene& scene, Lightmap& lm, LightmapRenderTarget&
 	bvh_target.update(width, height);
 
 	LightmapRayList lmrl(&src, &bvh_target, start_texel, start_texel + num_texels, num_directions);
+	lmrl.part = part;
+	if (jitter >= 0)
+	{
+		lmrl.jitter = jitter;
+		lmrl.updateConstant();
+	}
 	bvh_renderer.render_lightmap(scene, lmrl, bvh_target);
 
 	bvh_renderer.update_lightmap(bvh_target, lmrl, lm, start_texel, 1.0f);
@@ -1176,7 +1266,433 @@ int GLRenderer::updateLightmap(Scene& scene, Lightmap& lm, LightmapRenderTarget&
 
 }
 
-void GLRenderer::filterLightmap(Lightmap& lm, LightmapRenderTarget& src)
+int GLRenderer::updateProbeVolume(Scene& scene, ProbeVolume& volume, int start_probe, int num_directions, int jitter)
+{
+	int max_probes = (1 << 17) / num_directions;
+	if (max_probes < 1) max_probes = 1;
+
+	int num_probes = volume.num_probes() - start_probe;
+	if (num_probes > max_probes) num_probes = max_probes;
+	if (num_probes <= 0) return 0;
+
+	int width = 512;
+	if (width < num_directions) width = num_directions;
+
+	int probes_per_row = width / num_directions;
+
+	int height = (num_probes + probes_per_row - 1) / probes_per_row;
+
+	BVHRenderTarget bvh_target;
+	bvh_target.update(width, height);
+
+	LightmapRayList lmrl(volume.probes.get(), &bvh_target, start_probe, start_probe + num_probes, num_directions);
+	lmrl.sphere = true;
+	if (jitter >= 0)
+	{
+		lmrl.jitter = jitter;
+	}
+	lmrl.updateConstant();
+	bvh_renderer.render_lightmap(scene, lmrl, bvh_target);
+
+	bvh_renderer.update_probe_volume(bvh_target, lmrl, volume, 1.0f);
+
+	return num_probes;
+}
+
+void GLRenderer::bakeReflectionProbe(Scene& scene, ReflectionProbe& probe, int num_samples)
+{
+	int size = probe.reflection.size;
+	int num_levels = (int)std::log2((float)size) + 1;
+
+	GLCubemap radiance;
+	glBindTexture(GL_TEXTURE_CUBE_MAP, radiance.tex_id);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexStorage2D(GL_TEXTURE_CUBE_MAP, num_levels, GL_RGBA16F, size, size);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	// +X, -X, +Y, -Y, +Z, -Z. The rows of the BVH target go bottom-up, 
+	// so the up vectors are those of the cubemap faces flipped
+	static const glm::vec3 dirs[6] = { {1.0f, 0.0f, 0.0f}, {-1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, -1.0f} };
+	static const glm::vec3 ups[6] = { {0.0f, -1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, -1.0f, 0.0f} };
+
+	BVHRenderTarget face_target;
+	face_target.update(size, size);
+
+	for (int face = 0; face < 6; face++)
+	{
+		PerspectiveCamera camera(90.0f, 1.0f, probe.z_near, probe.z_far);
+		camera.position = probe.position;
+		camera.up = ups[face];
+		camera.lookAt(probe.position + dirs[face]);
+		camera.updateMatrixWorld(false);
+		camera.updateConstant();
+
+		bvh_renderer.render(scene, camera, face_target);
+
+		// the face is written with image stores, and no barrier bit covers glCopyImageSubData alone
+		glMemoryBarrier(GL_ALL_BARRIER_BITS);
+		glCopyImageSubData(face_target.m_tex_video->tex_id, GL_TEXTURE_2D, 0, 0, 0, 0,
+			radiance.tex_id, GL_TEXTURE_CUBE_MAP, 0, 0, 0, face, size, size, 1);
+	}
+
+	glBindTexture(GL_TEXTURE_CUBE_MAP, radiance.tex_id);
+	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	bvh_renderer.prefilter_reflection(radiance, size, probe.reflection, num_samples);
+	probe.baked = true;
+}
+
+void GLRenderer::bakeReflectionProbes(Scene& scene, int num_samples)
+{
+	_pre_render(scene);
+	for (size_t i = 0; i < scene.reflection_probes.size(); i++)
+	{
+		bakeReflectionProbe(scene, *scene.reflection_probes[i], num_samples);
+	}
+}
+
+int GLRenderer::_update_vertex_gi(Scene& scene, Primitive& primitive, const glm::mat4& trans, int num_directions, int jitter, float mix_rate)
+{
+	int num_verts = primitive.num_pos;
+	if (num_verts <= 0 || primitive.cpu_pos == nullptr || primitive.cpu_norm == nullptr) return 0;
+
+	// one record per vertex in the texel record layout, rays start at the vertices
+	glm::mat4 norm_mat = glm::transpose(glm::inverse(trans));
+	std::vector<glm::vec3> positions(num_verts);
+	std::vector<glm::vec3> normals(num_verts);
+	glm::vec3 min_pos = { FLT_MAX, FLT_MAX, FLT_MAX };
+	glm::vec3 max_pos = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int i = 0; i < num_verts; i++)
+	{
+		glm::vec4 pos = (*primitive.cpu_pos)[i];
+		positions[i] = glm::vec3(trans * glm::vec4(glm::vec3(pos), 1.0f));
+		normals[i] = glm::vec3(norm_mat * glm::vec4(glm::vec3((*primitive.cpu_norm)[i]), 0.0f));
+		min_pos = glm::min(min_pos, positions[i]);
+		max_pos = glm::max(max_pos, positions[i]);
+	}
+
+	LightmapRecords records;
+	records.count_valid = num_verts;
+	records.record_pos_min = min_pos;
+	records.record_pos_step = glm::max(max_pos - min_pos, glm::vec3(1e-6f)) / (float)((1 << 21) - 1);
+
+	std::vector<glm::uvec4> texel_records(num_verts);
+	for (int i = 0; i < num_verts; i++)
+	{
+		// footprint code 0, a vertex has no area to spread the origins over
+		texel_records[i] = LightmapRecords::pack_record(glm::ivec2(0), positions[i], normals[i], 0, min_pos, records.record_pos_step);
+	}
+	records.texel_records = std::unique_ptr<GLBuffer>(new GLBuffer(sizeof(glm::uvec4) * num_verts, GL_SHADER_STORAGE_BUFFER));
+	records.texel_records->upload(texel_records.data());
+
+	if (primitive.vertex_gi_buf == nullptr)
+	{
+		primitive.vertex_gi_buf = Attribute(new TextureBuffer(sizeof(glm::vec4) * num_verts, GL_RGBA32F));
+		mix_rate = 1.0f;
+	}
+
+	int max_verts = (1 << 17) / num_directions;
+	if (max_verts < 1) max_verts = 1;
+
+	int width = 512;
+	if (width < num_directions) width = num_directions;
+	int verts_per_row = width / num_directions;
+
+	BVHRenderTarget bvh_target;
+	for (int start_vert = 0; start_vert < num_verts; start_vert += max_verts)
+	{
+		int count = num_verts - start_vert;
+		if (count > max_verts) count = max_verts;
+
+		int height = (count + verts_per_row - 1) / verts_per_row;
+		bvh_target.update(width, height);
+
+		LightmapRayList lmrl(&records, &bvh_target, start_vert, start_vert + count, num_directions);
+		if (jitter >= 0)
+		{
+			lmrl.jitter = jitter;
+			lmrl.updateConstant();
+		}
+		bvh_renderer.render_lightmap(scene, lmrl, bvh_target);
+		bvh_renderer.update_vertex_gi(bvh_target, lmrl, *primitive.vertex_gi_buf, mix_rate);
+	}
+
+	return num_verts;
+}
+
+int GLRenderer::updateVertexGI(Scene& scene, SimpleModel* model, int num_directions, int jitter, float mix_rate)
+{
+	model->updateWorldMatrix(false, false);
+	return _update_vertex_gi(scene, model->geometry, model->matrixWorld, num_directions, jitter, mix_rate);
+}
+
+int GLRenderer::updateVertexGI(Scene& scene, GLTFModel* model, int num_directions, int jitter, float mix_rate)
+{
+	model->updateWorldMatrix(false, false);
+
+	std::vector<Primitive*> primitives;
+	std::vector<glm::mat4> trans;
+	std::vector<int> mesh_ids;
+	model->get_lightmap_primitives(primitives, trans, mesh_ids);
+
+	int count = 0;
+	for (size_t i = 0; i < primitives.size(); i++)
+	{
+		count += _update_vertex_gi(scene, *primitives[i], model->matrixWorld * trans[i], num_directions, jitter, mix_rate);
+	}
+
+	if (model->batched_mesh != nullptr)
+	{
+		model->batch_vertex_gi();
+	}
+	return count;
+}
+
+void GLRenderer::compositeLightmap(Lightmap& lm, const Lightmap& direct, const LightmapRenderTarget& src, const Lightmap& indirect, const LightmapRenderTarget& src_low)
+{
+	if (!lm.check_bakeable("compositeLightmap") || !direct.check_bakeable("compositeLightmap") || !indirect.check_bakeable("compositeLightmap")) return;
+	bvh_renderer.composite_lightmap(src, direct, src_low, indirect, lm);
+}
+
+void GLRenderer::filterLightmap(Lightmap& lm, LightmapRenderTarget& src, int layer)
+{
+	if (!lm.check_bakeable("filterLightmap")) return;
+	bvh_renderer.filter_lightmap(src, lm, layer);
+}
+
+void GLRenderer::prepareLightConfigs(Scene& scene, const std::vector<LightSetup>& setups, LightConfigs& configs, const Lightmap* lm)
+{
+	int num_configs = (int)setups.size();
+	int num_lights = (int)scene.directional_lights.size();
+
+	std::vector<glm::vec3> positions(num_lights);
+	std::vector<glm::vec3> colors(num_lights);
+	std::vector<float> intensities(num_lights);
+	std::vector<DirectionalLightShadow*> shadows;
+	for (int i = 0; i < num_lights; i++)
+	{
+		DirectionalLight* light = scene.directional_lights[i];
+		positions[i] = light->position;
+		colors[i] = light->color;
+		intensities[i] = light->intensity;
+		if (light->shadow != nullptr)
+		{
+			shadows.push_back(light->shadow.get());
+		}
+	}
+	int num_shadows = (int)shadows.size();
+
+	configs.num_configs = num_configs;
+	configs.num_directional_lights = num_lights;
+	configs.num_directional_shadows = num_shadows;
+	configs.lightmap = nullptr;
+	configs.relight = false;
+	if (lm != nullptr)
+	{
+		// the shader finds the layers of setup k at k * num_layers / num_configs
+		if (lm->num_layers() == num_configs * lm->num_pages)
+		{
+			configs.lightmap = lm->lightmap.get();
+		}
+		else
+		{
+			printf("prepareLightConfigs: bounce lightmap has %d layers, %d setups of %d pages expected. Baking without bounce.\n", lm->num_layers(), num_configs, lm->num_pages);
+		}
+	}
+
+	configs.directional_shadow_arrays.resize(num_shadows);
+	for (int i = 0; i < num_shadows; i++)
+	{
+		DirectionalLightShadow* shadow = shadows[i];
+		std::unique_ptr<GLTexture2DArray> tex(new GLTexture2DArray);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tex->tex_id);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, shadow->m_map_width, shadow->m_map_height, num_configs);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		configs.directional_shadow_arrays[i] = std::move(tex);
+	}
+
+	std::vector<ConstDirectionalLight> const_directional_lights(num_configs * num_lights);
+	std::vector<ConstDirectionalShadow> const_directional_shadows(num_configs * num_shadows);
+
+	for (int k = 0; k < num_configs; k++)
+	{
+		const LightSetup& setup = setups[k];
+		for (int i = 0; i < num_lights; i++)
+		{
+			DirectionalLight* light = scene.directional_lights[i];
+			if (i < (int)setup.directional_positions.size())
+			{
+				light->position = setup.directional_positions[i];
+			}
+			if (i < (int)setup.directional_colors.size())
+			{
+				light->color = setup.directional_colors[i];
+			}
+			if (i < (int)setup.directional_intensities.size())
+			{
+				light->intensity = setup.directional_intensities[i];
+			}
+			light->lookAtTarget();
+			light->updateWorldMatrix(false, false);
+		}
+
+		_render_shadow_maps(scene);
+
+		for (int i = 0; i < num_lights; i++)
+		{
+			scene.directional_lights[i]->makeConst(const_directional_lights[k * num_lights + i]);
+		}
+
+		for (int i = 0; i < num_shadows; i++)
+		{
+			DirectionalLightShadow* shadow = shadows[i];
+			shadow->makeConst(const_directional_shadows[k * num_shadows + i]);
+			glCopyImageSubData(shadow->m_lightTex, GL_TEXTURE_2D, 0, 0, 0, 0,
+				configs.directional_shadow_arrays[i]->tex_id, GL_TEXTURE_2D_ARRAY, 0, 0, 0, k, shadow->m_map_width, shadow->m_map_height, 1);
+		}
+	}
+
+	configs.constant_directional_lights = nullptr;
+	if (num_configs * num_lights > 0)
+	{
+		configs.constant_directional_lights = std::unique_ptr<GLDynBuffer>(new GLDynBuffer(const_directional_lights.size() * sizeof(ConstDirectionalLight), GL_UNIFORM_BUFFER));
+		configs.constant_directional_lights->upload(const_directional_lights.data());
+	}
+
+	configs.constant_directional_shadows = nullptr;
+	if (num_configs * num_shadows > 0)
+	{
+		configs.constant_directional_shadows = std::unique_ptr<GLDynBuffer>(new GLDynBuffer(const_directional_shadows.size() * sizeof(ConstDirectionalShadow), GL_UNIFORM_BUFFER));
+		configs.constant_directional_shadows->upload(const_directional_shadows.data());
+	}
+
+	// restore the scene lights
+	for (int i = 0; i < num_lights; i++)
+	{
+		DirectionalLight* light = scene.directional_lights[i];
+		light->position = positions[i];
+		light->color = colors[i];
+		light->intensity = intensities[i];
+		light->lookAtTarget();
+		light->updateWorldMatrix(false, false);
+	}
+	_render_shadow_maps(scene);
+}
+
+void GLRenderer::prepareRelightConfigs(Scene& scene, LightConfigs& configs, Lightmap& lm)
+{
+	int num_lights = (int)scene.directional_lights.size();
+	lm.setDirectional(false);
+	lm.setLightLayers(num_lights);
+
+	// one white light of unit intensity per setup, the last setup has none
+	std::vector<LightSetup> setups(num_lights + 1);
+	for (int k = 0; k <= num_lights; k++)
+	{
+		LightSetup& setup = setups[k];
+		setup.directional_colors.resize(num_lights, glm::vec3(1.0f));
+		setup.directional_intensities.resize(num_lights, 0.0f);
+		if (k < num_lights)
+		{
+			setup.directional_intensities[k] = 1.0f;
+		}
+	}
+
+	prepareLightConfigs(scene, setups, configs, &lm);
+	configs.relight = true;
+}
+
+int GLRenderer::updateLightmapConfigs(Scene& scene, const LightConfigs& configs, Lightmap& lm, LightmapRenderTarget& src, int start_texel, int num_directions, int jitter)
+{
+	if (!lm.check_bakeable("updateLightmapConfigs")) return 0;
+	if (lm.num_layers() < configs.num_configs * lm.num_pages)
+	{
+		printf("updateLightmapConfigs: lightmap has %d layers, %d setups of %d pages expected\n", lm.num_layers(), configs.num_configs, lm.num_pages);
+		return 0;
+	}
+
+	int max_texels = (1 << 17) / num_directions;
+	if (max_texels < 1) max_texels = 1;
+
+	int num_texels = src.count_valid - start_texel;
+	if (num_texels > max_texels) num_texels = max_texels;
+	if (num_texels <= 0) return 0;
+
+	int width = 512;
+	if (width < num_directions) width = num_directions;
+
+	int texels_per_row = width / num_directions;
+
+	int height = (num_texels + texels_per_row - 1) / texels_per_row;	
+	
+	BVHRenderTarget bvh_target;
+	bvh_target.update(width, height);
+
+	LightmapRayList lmrl(&src, &bvh_target, start_texel, start_texel + num_texels, num_directions);
+	if (jitter >= 0)
+	{
+		lmrl.jitter = jitter;
+		lmrl.updateConstant();
+	}
+	bvh_renderer.render_lightmap(scene, lmrl, bvh_target, &configs);
+
+	// the setups are written with image stores, and no barrier bit covers glCopyImageSubData alone
+	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	for (int k = 0; k < configs.num_configs; k++)
+	{
+		glCopyImageSubData(bvh_target.m_tex_video_configs->tex_id, GL_TEXTURE_2D_ARRAY, 0, 0, 0, k,
+			bvh_target.m_tex_video->tex_id, GL_TEXTURE_2D, 0, 0, 0, 0, width, height, 1);
+		bvh_renderer.update_lightmap(bvh_target, lmrl, lm, start_texel, 1.0f, k * lm.num_pages + src.page);
+	}
+
+	return num_texels;
+}
+
+int GLRenderer::probeLightmap(Scene& scene, LightmapRenderTarget& src, int num_directions, float threshold)
+{
+	int count = src.count_valid;
+	if (count <= 0) return 0;
+
+	GLBuffer keep_flags(sizeof(unsigned) * count, GL_SHADER_STORAGE_BUFFER);
+
+	int max_texels = (1 << 17) / num_directions;
+	if (max_texels < 1) max_texels = 1;
+
+	int width = 512;
+	if (width < num_directions) width = num_directions;
+
+	int texels_per_row = width / num_directions;
+
+	BVHRenderTarget bvh_target;
+	for (int start_texel = 0; start_texel < count; start_texel += max_texels)
+	{
+		int num_texels = count - start_texel;
+		if (num_texels > max_texels) num_texels = max_texels;
+
+		int height = (num_texels + texels_per_row - 1) / texels_per_row;
+		bvh_target.update(width, height);
+
+		LightmapRayList lmrl(&src, &bvh_target, start_texel, start_texel + num_texels, num_directions);
+		bvh_renderer.probe_lightmap(scene, lmrl, bvh_target);
+		bvh_renderer.reduce_lightmap_probe(bvh_target, lmrl, keep_flags, threshold);
+	}
+
+	int count_keep = bvh_renderer.drop_lightmap_texels(src, keep_flags);
+	return count - count_keep;
+}
+
+int GLRenderer::selectLightmapTexels(const LightmapRenderTarget& src, const std::vector<glm::vec3>& boxes, LightmapRenderTarget& selection)
 {
-	bvh_renderer.filter_lightmap(src, lm);
+	return bvh_renderer.select_lightmap_texels(src, boxes, selection);
 }
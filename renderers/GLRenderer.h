@@ -19,7 +19,11 @@ class Camera;
 class GLRenderTarget;
 class Lightmap;
 class LightmapRenderTarget;
+class LightmapRecords;
+class ProbeVolume;
+class ReflectionProbe;
 class SimpleModel;
+class Primitive;
 class GLTFModel;
 class DirectionalLight;
 class DirectionalLightShadow;
@@ -31,11 +35,46 @@ public:
 	~GLRenderer();
 
 	void render(Scene& scene, Camera& camera, GLRenderTarget& target);
-	void rasterize_atlas(SimpleModel* model);
-	void rasterize_atlas(GLTFModel* model);
-
-	int updateLightmap(Scene& scene, Lightmap& lm, LightmapRenderTarget& src, int start_texel, int num_directions = 64);
-	void filterLightmap(Lightmap& lm, LightmapRenderTarget& src);
+	// clear = false to add the model to an atlas shared with previously rasterized models
+	void rasterize_atlas(SimpleModel* model, int page = 0, bool clear = true);
+	void rasterize_atlas(GLTFModel* model, int page = 0, bool clear = true);
+	void compact_atlas(LightmapRenderTarget& atlas);
+
+	// jitter seeds the ray directions of the batch, -1 for a random seed. 
+	// part selects the light gathered, for a split bake composited with compositeLightmap()
+	int updateLightmap(Scene& scene, Lightmap& lm, LightmapRecords& src, int start_texel, int num_directions = 64, int jitter = -1, LightmapPart part = LightmapPart::All);
+	// lm = direct + indirect bilaterally upsampled from the reduced density atlas src_low, for the page of src. 
+	// direct and indirect are baked with updateLightmap() and LightmapPart::Direct / Indirect, lm must not be direct
+	void compositeLightmap(Lightmap& lm, const Lightmap& direct, const LightmapRenderTarget& src, const Lightmap& indirect, const LightmapRenderTarget& src_low);
+	// layer: layer of lm to filter, -1 for every layer of src.page
+	void filterLightmap(Lightmap& lm, LightmapRenderTarget& src, int layer = -1);
+	// drops texels whose probe rays hit backfaces more often than threshold, returns the number dropped
+	int probeLightmap(Scene& scene, LightmapRenderTarget& src, int num_directions = 16, float threshold = 0.1f);
+	// gathers the texels of src inside the world-space boxes (min/max pairs) into selection, to be re-baked with updateLightmap()
+	int selectLightmapTexels(const LightmapRenderTarget& src, const std::vector<glm::vec3>& boxes, LightmapRenderTarget& selection);
+
+	// renders the shadow maps and light constants of each setup into configs, the scene lights are restored afterwards.
+	// lm: bounce source of the bake, holding exactly num_pages layers per setup, as allocated by lm.setLightLayers(setups.size() - 1)
+	// without L1 layers. Any other layer count is reported and the setups are baked without bounce.
+	void prepareLightConfigs(Scene& scene, const std::vector<LightSetup>& setups, LightConfigs& configs, const Lightmap* lm);
+	// bakes a batch of probes of the volume, returns the number of probes baked
+	int updateProbeVolume(Scene& scene, ProbeVolume& volume, int start_probe, int num_directions = 256, int jitter = -1);
+	// traces the six faces of the probe with the BVH camera path, shaded with the baked lightmaps, then prefilters the GGX levels.
+	// expects the scene lists of a previous render(), bakeReflectionProbes() updates them itself
+	void bakeReflectionProbe(Scene& scene, ReflectionProbe& probe, int num_samples = 256);
+	void bakeReflectionProbes(Scene& scene, int num_samples = 256);
+	// per-vertex bake: traces from the vertices of the model instead of atlas texels into Primitive::vertex_gi_buf, 
+	// mix_rate < 1 blends with the previous result for progressive passes. Returns the number of vertices baked
+	int updateVertexGI(Scene& scene, SimpleModel* model, int num_directions = 256, int jitter = -1, float mix_rate = 1.0f);
+	int updateVertexGI(Scene& scene, GLTFModel* model, int num_directions = 256, int jitter = -1, float mix_rate = 1.0f);
+
+	// configs for a relightable lightmap: one setup per directional light plus one for the sky and emissive surfaces.
+	// lm is reallocated with the light layers and without L1 layers, then baked with updateLightmapConfigs()
+	void prepareRelightConfigs(Scene& scene, LightConfigs& configs, Lightmap& lm);
+	// bakes a batch of texels of src for every setup of configs with one traversal per ray.
+	// setup k of page p is written to layer k * lm.num_pages + p of lm, which needs num_configs * num_pages layers.
+	// Blended (alpha) surfaces are not baked into multi-setup configs: rays pass through them as if absent.
+	int updateLightmapConfigs(Scene& scene, const LightConfigs& configs, Lightmap& lm, LightmapRenderTarget& src, int start_texel, int num_directions = 64, int jitter = -1);
 	
 	void renderTexture(GLTexture2D* tex, int x, int y, int width, int height, GLRenderTarget& target, bool flipY = true, float alpha = 1.0f);
 
@@ -79,6 +118,7 @@ private:
 	void render_depth_model(Camera* p_camera, GLTFModel* model);
 
 	void _pre_render(Scene& scene);
+	void _render_shadow_maps(Scene& scene);
 
 	void _render_scene(Scene& scene, Camera& camera, GLRenderTarget& target);
 	void _render(Scene& scene, Camera& camera, GLRenderTarget& target);
@@ -94,5 +134,7 @@ private:
 	BVHRenderTarget bvh_target;
 	void _render_bvh(Scene& scene, Camera& camera, GLRenderTarget& target);
 
+	int _update_vertex_gi(Scene& scene, Primitive& primitive, const glm::mat4& trans, int num_directions, int jitter, float mix_rate);
+
 };
 
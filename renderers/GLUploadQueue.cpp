@@ -0,0 +1,60 @@
+#include "GLUploadQueue.h"
+#include "utils/Utils.h"
+
+GLUploadQueue::GLUploadQueue()
+{
+	Node* stub = new Node;
+	stub->next.store(nullptr, std::memory_order_relaxed);
+	m_head.store(stub, std::memory_order_relaxed);
+	m_tail = stub;
+}
+
+GLUploadQueue::~GLUploadQueue()
+{
+	std::function<void()> command;
+	while (_pop(command));
+	delete m_tail;
+}
+
+void GLUploadQueue::push(const std::function<void()>& command)
+{
+	Node* node = new Node;
+	node->command = command;
+	node->next.store(nullptr, std::memory_order_relaxed);
+	Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+	prev->next.store(node, std::memory_order_release);
+}
+
+bool GLUploadQueue::_pop(std::function<void()>& command)
+{
+	Node* tail = m_tail;
+	Node* next = tail->next.load(std::memory_order_acquire);
+	if (next == nullptr) return false;
+
+	// next becomes the new consumed node
+	command = std::move(next->command);
+	next->command = nullptr;
+	m_tail = next;
+	delete tail;
+	return true;
+}
+
+int GLUploadQueue::drain(double budget_sec)
+{
+	double start = time_sec();
+	int count = 0;
+	std::function<void()> command;
+	while (_pop(command))
+	{
+		command();
+		command = nullptr;
+		count++;
+		if (time_sec() - start >= budget_sec) break;
+	}
+	return count;
+}
+
+bool GLUploadQueue::empty() const
+{
+	return m_tail->next.load(std::memory_order_acquire) == nullptr;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+// Commands that have to run on the thread owning the GL context, pushed by loader threads.
+// Multi-producer / single-consumer queue without locks: any thread can push, only the context thread drains.
+class GLUploadQueue
+{
+public:
+	GLUploadQueue();
+	~GLUploadQueue(); // pending commands are dropped without running
+
+	void push(const std::function<void()>& command);
+
+	// Runs queued commands in push order until the queue is empty or budget_sec has passed.
+	// At least one command runs per call, so a long command can overrun the budget but never stalls the queue.
+	// Returns the number of commands run.
+	int drain(double budget_sec);
+
+	bool empty() const;
+
+private:
+	GLUploadQueue(const GLUploadQueue&);
+
+	struct Node
+	{
+		std::function<void()> command;
+		std::atomic<Node*> next;
+	};
+
+	// producers append at m_head, the consumer reads after m_tail, which is always a consumed node
+	std::atomic<Node*> m_head;
+	Node* m_tail;
+
+	bool _pop(std::function<void()>& command);
+};
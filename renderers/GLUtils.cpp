@@ -147,6 +147,26 @@ void GLTexture2D::load_memory_rgba(int width, int height, const uint8_t* data, b
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+void GLTexture2D::load_memory_rgba_mips(int width, int height, int num_levels, const uint8_t* const* levels, bool is_srgb)
+{
+	glBindTexture(GL_TEXTURE_2D, tex_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, num_levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int i = 0; i < num_levels; i++)
+	{
+		int w = width >> i;
+		int h = height >> i;
+		if (w < 1) w = 1;
+		if (h < 1) h = 1;
+		glTexImage2D(GL_TEXTURE_2D, i, is_srgb ? GL_SRGB_ALPHA : GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, levels[i]);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 void GLTexture2D::load_memory_bgr(int width, int height, const uint8_t* data, bool is_srgb)
 {
 	glBindTexture(GL_TEXTURE_2D, tex_id);
@@ -223,6 +243,23 @@ void GLTexture3D::unload()
 	glGenTextures(1, &tex_id);
 }
 
+GLTexture2DArray::GLTexture2DArray()
+{
+	glGenTextures(1, &tex_id);
+}
+
+GLTexture2DArray::~GLTexture2DArray()
+{
+	glDeleteTextures(1, &tex_id);
+}
+
+void GLTexture2DArray::unload()
+{
+	glDeleteTextures(1, &tex_id);
+	glGenTextures(1, &tex_id);
+}
+
+
 
 GLCubemap::GLCubemap()
 {
@@ -290,7 +327,7 @@ void ReflectionMap::allocate()
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-		glTexStorage2D(GL_TEXTURE_CUBE_MAP, 7, GL_RGBA8, 128, 128);
+		glTexStorage2D(GL_TEXTURE_CUBE_MAP, num_levels, GL_RGBA16F, size, size);
 		allocated = true;
 	}
 
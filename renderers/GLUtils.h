@@ -37,6 +37,8 @@ public:
 	void load_memory_rgba(int width, int height, const uint8_t* data, bool is_srgb);
 	void load_memory_bgr(int width, int height, const uint8_t* data, bool is_srgb);
 	void load_memory_bgra(int width, int height, const uint8_t* data, bool is_srgb);
+	// RGBA with a mip chain prepared on the CPU, levels[i] is (width >> i) x (height >> i), at least 1x1
+	void load_memory_rgba_mips(int width, int height, int num_levels, const uint8_t* const* levels, bool is_srgb);
 	void load_file(const char* filename, bool is_srgb);
 
 	void unload();
@@ -59,6 +61,19 @@ private:
 	GLTexture3D(const GLTexture3D&);
 };
 
+class GLTexture2DArray
+{
+public:
+	unsigned tex_id;
+	GLTexture2DArray();
+	~GLTexture2DArray();
+
+	void unload();
+
+private:
+	GLTexture2DArray(const GLTexture2DArray&);
+};
+
 class GLCubemap
 {
 public:
@@ -81,6 +96,8 @@ public:
 	ReflectionMap();
 	~ReflectionMap();
 
+	int size = 128;
+	int num_levels = 7;
 	bool allocated = false;
 	void allocate();
 
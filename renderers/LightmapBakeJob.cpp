@@ -0,0 +1,361 @@
+#include <GL/glew.h>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include "LightmapBakeJob.h"
+#include "LightmapRenderTarget.h"
+#include "GLRenderer.h"
+#include "scenes/Scene.h"
+#include "models/ModelComponents.h"
+#include "utils/Utils.h"
+#include "utils/BinaryFile.h"
+
+static const char s_magic_partial[4] = { 'L', 'M', 'B', 'P' };
+static const char s_magic_merged[4] = { 'L', 'M', 'B', 'M' };
+static const uint32_t s_version = 1;
+
+inline unsigned hash_combine(unsigned h, unsigned v)
+{
+	return hash_u32(h ^ v);
+}
+
+inline unsigned hash_combine(unsigned h, float v)
+{
+	unsigned u;
+	memcpy(&u, &v, sizeof(unsigned));
+	return hash_u32(h ^ u);
+}
+
+LightmapBakeJob::LightmapBakeJob(std::shared_ptr<Lightmap> lightmap, const std::vector<std::shared_ptr<LightmapRenderTarget>>& targets, const char* dir, int num_shards, int iterations, unsigned seed)
+	: lightmap(lightmap)
+	, targets(targets)
+	, dir(dir)
+	, num_shards(num_shards)
+	, iterations(iterations)
+	, seed(seed)
+{
+
+}
+
+void LightmapBakeJob::shard_range(int count, int shard, int num_shards, int& begin, int& end)
+{
+	begin = (int)((int64_t)count * shard / num_shards);
+	end = (int)((int64_t)count * (shard + 1) / num_shards);
+}
+
+unsigned LightmapBakeJob::_atlas_hash() const
+{
+	unsigned h = hash_combine(0u, (unsigned)lightmap->width);
+	h = hash_combine(h, (unsigned)lightmap->height);
+	h = hash_combine(h, (unsigned)lightmap->num_layers());
+	for (size_t i = 0; i < targets.size(); i++)
+	{
+		const LightmapRenderTarget& atlas = *targets[i];
+		h = hash_combine(h, (unsigned)atlas.count_valid);
+		for (int j = 0; j < 3; j++)
+		{
+			h = hash_combine(h, atlas.record_pos_min[j]);
+			h = hash_combine(h, atlas.record_pos_step[j]);
+		}
+	}
+	return h;
+}
+
+bool LightmapBakeJob::_write_partial_header(BinaryFileWriter& writer, int iter, int shard) const
+{
+	int num_pages = (int)targets.size();
+	int num_rays = 8 << iter;
+	unsigned atlas_hash = _atlas_hash();
+	writer.write_header(s_magic_partial, s_version);
+	writer.write(iter);
+	writer.write(shard);
+	writer.write(num_shards);
+	writer.write(num_rays);
+	writer.write(seed);
+	writer.write(atlas_hash);
+	return writer.write(num_pages);
+}
+
+bool LightmapBakeJob::_read_partial_header(BinaryFileReader& reader, int iter, int shard) const
+{
+	int num_pages = (int)targets.size();
+	int num_rays = 8 << iter;
+	unsigned atlas_hash = _atlas_hash();
+	bool ok = reader.read_header(s_magic_partial, s_version);
+	ok = ok && reader.read_expect(iter);
+	ok = ok && reader.read_expect(shard);
+	ok = ok && reader.read_expect(num_shards);
+	ok = ok && reader.read_expect(num_rays);
+	ok = ok && reader.read_expect(seed);
+	ok = ok && reader.read_expect(atlas_hash);
+	ok = ok && reader.read_expect(num_pages);
+	return ok;
+}
+
+bool LightmapBakeJob::_check_partial(int iter, int shard) const
+{
+	std::string path = _partial_path(iter, shard);
+	BinaryFileReader reader(path.c_str());
+	if (!reader.is_open()) return false;
+	bool ok = _read_partial_header(reader, iter, shard);
+	if (!ok)
+	{
+		printf("Ignoring partial bake %s of another job configuration\n", path.c_str());
+	}
+	return ok;
+}
+
+std::string LightmapBakeJob::_partial_path(int iter, int shard) const
+{
+	char filename[64];
+	sprintf(filename, "partial_%02d_%04d.bin", iter, shard);
+	return dir + "/" + filename;
+}
+
+std::string LightmapBakeJob::_merged_path(int iter) const
+{
+	char filename[64];
+	sprintf(filename, "merged_%02d.bin", iter);
+	return dir + "/" + filename;
+}
+
+bool LightmapBakeJob::bake_shard(Scene& scene, GLRenderer& renderer, int shard, int iter)
+{
+	std::string path = _partial_path(iter, shard);
+	if (_check_partial(iter, shard)) return true;
+
+	if (iter > 0)
+	{
+		if (!load_merged(iter - 1)) return false;
+	}
+
+	int num_pages = (int)targets.size();
+	std::vector<std::vector<uint32_t>> coords(num_pages);
+
+	for (int page = 0; page < num_pages; page++)
+	{
+		const LightmapRenderTarget& atlas = *targets[page];
+		int begin, end;
+		shard_range(atlas.count_valid, shard, num_shards, begin, end);
+		int count = end - begin;
+		if (count <= 0) continue;
+
+		// the shard is baked as a record set of its own, holding a copy of its range of records
+		LightmapRecords view;
+		view.page = atlas.page;
+		view.record_pos_min = atlas.record_pos_min;
+		view.record_pos_step = atlas.record_pos_step;
+		view.count_valid = count;
+
+		size_t record_size = sizeof(uint32_t) * 4;
+		view.texel_records = std::unique_ptr<GLBuffer>(new GLBuffer(record_size * count, GL_SHADER_STORAGE_BUFFER));
+
+		glBindBuffer(GL_COPY_READ_BUFFER, atlas.texel_records->m_id);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, view.texel_records->m_id);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, record_size * begin, 0, record_size * count);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		// jitter is keyed by the global texel index, so a rerun of the shard traces the same rays
+		int idx_texel = 0;
+		while (idx_texel < count)
+		{
+			unsigned key = hash_u32(seed ^ hash_u32((unsigned)iter * 1024u + (unsigned)page)) ^ (unsigned)(begin + idx_texel);
+			int jitter = (int)(hash_u32(key) & 0x7fffffff);
+			idx_texel += renderer.updateLightmap(scene, *lightmap, view, idx_texel, 8 << iter, jitter);
+		}
+
+		std::vector<uint32_t> records(count * 4);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, view.texel_records->m_id);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, record_size * count, records.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		coords[page].resize(count);
+		for (int i = 0; i < count; i++)
+		{
+			coords[page][i] = records[i * 4];
+		}
+	}
+
+	std::vector<uint16_t> texels;
+	if (!lightmap->readTexels(texels)) return false;
+
+	BinaryFileWriter writer(path.c_str());
+	if (!writer.is_open())
+	{
+		printf("Failed to write partial bake %s\n", path.c_str());
+		return false;
+	}
+
+	// each texel is followed by its values in every layer of its page
+	size_t layer_size = (size_t)lightmap->width * (size_t)lightmap->height;
+	std::vector<int> layers;
+	_write_partial_header(writer, iter, shard);
+	for (int page = 0; writer.ok() && page < num_pages; page++)
+	{
+		lightmap->page_layers(targets[page]->page, layers);
+		uint32_t count = (uint32_t)coords[page].size();
+		writer.write(count);
+		for (uint32_t i = 0; writer.ok() && i < count; i++)
+		{
+			uint32_t coord = coords[page][i];
+			size_t idx = (size_t)(coord >> 16) * (size_t)lightmap->width + (size_t)(coord & 0xffff);
+			writer.write(coord);
+			for (size_t j = 0; j < layers.size(); j++)
+			{
+				size_t idx_layer = (size_t)layers[j] * layer_size + idx;
+				writer.write(&texels[idx_layer * 4], sizeof(uint16_t), 4);
+			}
+		}
+	}
+	return writer.commit();
+}
+
+bool LightmapBakeJob::merge(GLRenderer& renderer, int iter)
+{
+	std::string path = _merged_path(iter);
+	if (exists_test(path.c_str())) return true;
+
+	// partial files of another job configuration count as missing, their shards bake them again
+	for (int shard = 0; shard < num_shards; shard++)
+	{
+		if (!_check_partial(iter, shard)) return false;
+	}
+
+	int width = lightmap->width;
+	int height = lightmap->height;
+	int num_pages = (int)targets.size();
+	int num_layers = lightmap->num_layers();
+	unsigned atlas_hash = _atlas_hash();
+	size_t layer_size = (size_t)width * (size_t)height;
+	std::vector<int> layers;
+
+	// every covered texel belongs to exactly one shard, the rest is left to the filter
+	std::vector<uint16_t> texels(layer_size * (size_t)num_layers * 4, 0);
+
+	for (int shard = 0; shard < num_shards; shard++)
+	{
+		std::string partial_path = _partial_path(iter, shard);
+		BinaryFileReader reader(partial_path.c_str());
+		if (!reader.is_open()) return false;
+
+		bool ok = _read_partial_header(reader, iter, shard);
+		for (int page = 0; ok && page < num_pages; page++)
+		{
+			lightmap->page_layers(targets[page]->page, layers);
+			uint32_t count;
+			ok = ok && reader.read(count);
+			for (uint32_t i = 0; ok && i < count; i++)
+			{
+				uint32_t coord;
+				ok = ok && reader.read(coord);
+				int x = (int)(coord & 0xffff);
+				int y = (int)(coord >> 16);
+				ok = ok && x < width && y < height;
+				size_t idx = (size_t)y * (size_t)width + (size_t)x;
+				for (size_t j = 0; ok && j < layers.size(); j++)
+				{
+					size_t idx_layer = (size_t)layers[j] * layer_size + idx;
+					ok = ok && reader.read(&texels[idx_layer * 4], sizeof(uint16_t), 4);
+				}
+			}
+		}
+
+		if (!ok)
+		{
+			printf("Corrupted partial bake %s\n", partial_path.c_str());
+			return false;
+		}
+	}
+
+	if (!lightmap->writeTexels(texels)) return false;
+	for (size_t page = 0; page < targets.size(); page++)
+	{
+		renderer.filterLightmap(*lightmap, *targets[page]);
+	}
+	lightmap->readTexels(texels);
+
+	BinaryFileWriter writer(path.c_str());
+	if (!writer.is_open())
+	{
+		printf("Failed to write merged bake %s\n", path.c_str());
+		return false;
+	}
+
+	writer.write_header(s_magic_merged, s_version);
+	writer.write(iter);
+	writer.write(width);
+	writer.write(height);
+	writer.write(num_layers);
+	writer.write(seed);
+	writer.write(atlas_hash);
+	writer.write(texels.data(), sizeof(uint16_t), texels.size());
+	return writer.commit();
+}
+
+bool LightmapBakeJob::load_merged(int iter)
+{
+	std::string path = _merged_path(iter);
+	BinaryFileReader reader(path.c_str());
+	if (!reader.is_open()) return false;
+
+	int width = lightmap->width;
+	int height = lightmap->height;
+	int num_layers = lightmap->num_layers();
+	unsigned atlas_hash = _atlas_hash();
+
+	bool ok = reader.read_header(s_magic_merged, s_version);
+	ok = ok && reader.read_expect(iter);
+	ok = ok && reader.read_expect(width);
+	ok = ok && reader.read_expect(height);
+	ok = ok && reader.read_expect(num_layers);
+	ok = ok && reader.read_expect(seed);
+	ok = ok && reader.read_expect(atlas_hash);
+
+	std::vector<uint16_t> texels;
+	if (ok)
+	{
+		texels.resize((size_t)width * (size_t)height * (size_t)num_layers * 4);
+		ok = reader.read(texels.data(), sizeof(uint16_t), texels.size());
+	}
+
+	if (!ok)
+	{
+		printf("Ignoring incompatible merged bake %s\n", path.c_str());
+		return false;
+	}
+
+	return lightmap->writeTexels(texels);
+}
+
+void LightmapBakeJob::run_worker(Scene& scene, GLRenderer& renderer, int shard, double poll_interval)
+{
+	if (!lightmap->check_bakeable("LightmapBakeJob::run_worker")) return;
+
+	std::chrono::milliseconds poll((int64_t)(poll_interval * 1000.0));
+	for (int iter = 0; iter < iterations; iter++)
+	{
+		while (!bake_shard(scene, renderer, shard, iter))
+		{
+			std::this_thread::sleep_for(poll);
+		}
+		printf("shard %d: iter %d baked\n", shard, iter);
+
+		if (shard == 0)
+		{
+			while (!merge(renderer, iter))
+			{
+				std::this_thread::sleep_for(poll);
+			}
+			printf("iter %d merged\n", iter);
+		}
+	}
+
+	while (!load_merged(iterations - 1))
+	{
+		std::this_thread::sleep_for(poll);
+	}
+}
+
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class Scene;
+class GLRenderer;
+class Lightmap;
+class LightmapRenderTarget;
+class BinaryFileWriter;
+class BinaryFileReader;
+
+// Splits a lightmap bake over worker processes which only share a job directory.
+// In every iteration each worker bakes its range of the texel records of every page into a partial file, 
+// then the merge step gathers the partial files, filters the pages and publishes the merged lightmap
+// that the next iteration bounces from. Every process builds the same scene and atlas.
+class LightmapBakeJob
+{
+public:
+	LightmapBakeJob(std::shared_ptr<Lightmap> lightmap, const std::vector<std::shared_ptr<LightmapRenderTarget>>& targets, const char* dir, int num_shards, int iterations = 6, unsigned seed = 0);
+
+	std::shared_ptr<Lightmap> lightmap;
+	std::vector<std::shared_ptr<LightmapRenderTarget>> targets;
+	std::string dir;
+	int num_shards;
+	int iterations;
+	unsigned seed;
+
+	static void shard_range(int count, int shard, int num_shards, int& begin, int& end);
+
+	// Returns false if the merged lightmap of the previous iteration is not there yet.
+	// A partial file already written is not baked again.
+	bool bake_shard(Scene& scene, GLRenderer& renderer, int shard, int iter);
+
+	// Returns false while partial files of the iteration are missing.
+	bool merge(GLRenderer& renderer, int iter);
+
+	// Loads the merged lightmap of an iteration, returns false if it is not there yet.
+	bool load_merged(int iter);
+
+	// Bakes all iterations of one shard, polling the job directory for the other workers.
+	// Shard 0 also merges. Ends with the final lightmap loaded.
+	void run_worker(Scene& scene, GLRenderer& renderer, int shard, double poll_interval = 1.0);
+
+private:
+	// hash of the atlas layout the records and texels belong to
+	unsigned _atlas_hash() const;
+
+	// Partial files record the job configuration: shard count, rays, seed and atlas hash. 
+	// A file written by a different configuration is rejected and baked again.
+	bool _write_partial_header(BinaryFileWriter& writer, int iter, int shard) const;
+	bool _read_partial_header(BinaryFileReader& reader, int iter, int shard) const;
+	bool _check_partial(int iter, int shard) const;
+
+	std::string _partial_path(int iter, int shard) const;
+	std::string _merged_path(int iter) const;
+};
+
@@ -0,0 +1,154 @@
+#include <GL/glew.h>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "LightmapBakeSession.h"
+#include "LightmapRenderTarget.h"
+#include "GLRenderer.h"
+#include "scenes/Scene.h"
+#include "models/ModelComponents.h"
+#include "utils/Utils.h"
+#include "utils/BinaryFile.h"
+
+static const char s_magic[4] = { 'L', 'M', 'B', 'K' };
+static const uint32_t s_version = 1;
+
+LightmapBakeSession::LightmapBakeSession(std::shared_ptr<Lightmap> lightmap, const std::vector<std::shared_ptr<LightmapRenderTarget>>& targets, int iterations, unsigned seed)
+	: lightmap(lightmap)
+	, targets(targets)
+	, iterations(iterations)
+	, seed(seed)
+	, m_last_checkpoint(time_sec())
+{
+
+}
+
+int LightmapBakeSession::step(Scene& scene, GLRenderer& renderer)
+{
+	if (finished() || targets.empty()) return 0;
+
+	LightmapRenderTarget& source = *targets[idx_page];
+	int num_texels = source.count_valid;
+
+	int jitter = (int)(hash_u32(seed ^ hash_u32(num_batches)) & 0x7fffffff);
+	int count = renderer.updateLightmap(scene, *lightmap, source, idx_texel, 8 << iter, jitter);
+	num_batches++;
+
+	idx_texel += count;
+	if (idx_texel >= num_texels)
+	{
+		renderer.filterLightmap(*lightmap, source);
+		idx_texel = 0;
+		idx_page++;
+		if (idx_page >= (int)targets.size())
+		{
+			idx_page = 0;
+			iter++;
+		}
+	}
+
+	if (!checkpoint_path.empty())
+	{
+		double t = time_sec();
+		if (finished() || t - m_last_checkpoint > checkpoint_interval)
+		{
+			save(checkpoint_path.c_str());
+			m_last_checkpoint = t;
+		}
+	}
+
+	return count;
+}
+
+bool LightmapBakeSession::save(const char* path) const
+{
+	int width = lightmap->width;
+	int height = lightmap->height;
+	int num_layers = lightmap->num_layers();
+	std::vector<uint16_t> texels;
+	if (!lightmap->readTexels(texels)) return false;
+
+	BinaryFileWriter writer(path);
+	if (!writer.is_open())
+	{
+		printf("Failed to write bake checkpoint %s\n", path);
+		return false;
+	}
+
+	uint32_t num_targets = (uint32_t)targets.size();
+	writer.write_header(s_magic, s_version);
+	writer.write(width);
+	writer.write(height);
+	writer.write(num_layers);
+	writer.write(num_targets);
+	for (uint32_t i = 0; i < num_targets; i++)
+	{
+		writer.write(targets[i]->count_valid);
+	}
+	writer.write(iterations);
+	writer.write(iter);
+	writer.write(idx_page);
+	writer.write(idx_texel);
+	writer.write(seed);
+	writer.write(num_batches);
+	writer.write(texels.data(), sizeof(uint16_t), texels.size());
+	return writer.commit();
+}
+
+bool LightmapBakeSession::load(const char* path)
+{
+	BinaryFileReader reader(path);
+	if (!reader.is_open()) return false;
+
+	int width = lightmap->width;
+	int height = lightmap->height;
+	int num_layers = lightmap->num_layers();
+	uint32_t num_targets = (uint32_t)targets.size();
+
+	// the checkpoint only resumes the bake of the same atlas
+	bool ok = reader.read_header(s_magic, s_version);
+	ok = ok && reader.read_expect(width);
+	ok = ok && reader.read_expect(height);
+	ok = ok && reader.read_expect(num_layers);
+	ok = ok && reader.read_expect(num_targets);
+	for (uint32_t i = 0; ok && i < num_targets; i++)
+	{
+		ok = ok && reader.read_expect(targets[i]->count_valid);
+	}
+
+	int file_iterations, file_iter, file_idx_page, file_idx_texel;
+	unsigned file_seed, file_num_batches;
+	ok = ok && reader.read(file_iterations);
+	ok = ok && reader.read(file_iter);
+	ok = ok && reader.read(file_idx_page);
+	ok = ok && reader.read(file_idx_texel);
+	ok = ok && reader.read(file_seed);
+	ok = ok && reader.read(file_num_batches);
+
+	size_t num_halfs = (size_t)width * (size_t)height * (size_t)num_layers * 4;
+	std::vector<uint16_t> texels;
+	if (ok)
+	{
+		texels.resize(num_halfs);
+		ok = reader.read(texels.data(), sizeof(uint16_t), num_halfs);
+	}
+
+	if (!ok)
+	{
+		printf("Ignoring incompatible bake checkpoint %s\n", path);
+		return false;
+	}
+
+	if (!lightmap->writeTexels(texels)) return false;
+
+	iterations = file_iterations;
+	iter = file_iter;
+	idx_page = file_idx_page;
+	idx_texel = file_idx_texel;
+	seed = file_seed;
+	num_batches = file_num_batches;
+
+	printf("Resumed bake at iter: %d, page: %d, texel: %d\n", iter, idx_page, idx_texel);
+	return true;
+}
+
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class Scene;
+class GLRenderer;
+class Lightmap;
+class LightmapRenderTarget;
+
+// Drives a progressive lightmap bake batch by batch and checkpoints it to disk,
+// so a bake interrupted at any point resumes with the same result.
+class LightmapBakeSession
+{
+public:
+	LightmapBakeSession(std::shared_ptr<Lightmap> lightmap, const std::vector<std::shared_ptr<LightmapRenderTarget>>& targets, int iterations = 6, unsigned seed = 0);
+
+	std::shared_ptr<Lightmap> lightmap;
+	std::vector<std::shared_ptr<LightmapRenderTarget>> targets;
+
+	// iteration i traces 8<<i directions per texel over all pages, then filters each page
+	int iterations;
+	int iter = 0;
+	int idx_page = 0;
+	int idx_texel = 0;
+
+	// jitter of batch n is derived from (seed, n), so the rays do not depend on when the bake was resumed
+	unsigned seed;
+	unsigned num_batches = 0;
+
+	// written every checkpoint_interval seconds by step(), empty to disable
+	std::string checkpoint_path;
+	double checkpoint_interval = 300.0;
+
+	bool finished() const { return iter >= iterations; }
+
+	// Bakes one batch of texels. Returns the number of texels baked.
+	int step(Scene& scene, GLRenderer& renderer);
+
+	// The file holds the cursor and the texels of all num_layers() lightmap layers, written to a temporary file first 
+	// so a preemption during the write keeps the previous checkpoint.
+	bool save(const char* path) const;
+	bool load(const char* path);
+
+private:
+	double m_last_checkpoint;
+};
+
@@ -0,0 +1,455 @@
+#include <GL/glew.h>
+#include <cstdio>
+#include <cfloat>
+#include <cstring>
+#include <cmath>
+#include <gtc/packing.hpp>
+#include "models/ModelComponents.h"
+#include "utils/Utils.h"
+#include "utils/BinaryFile.h"
+#include "LightmapCompressor.h"
+
+static const char s_magic[4] = { 'L', 'M', 'C', 'P' };
+static const uint32_t s_version = 1;
+
+const float LightmapCompressor::s_rgbm_range = 16.0f;
+
+// BC6H mode 11: one region, unsigned 10-bit endpoints stored without deltas, 4-bit indices
+static const int s_bc6h_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// half-float bit pattern to a 10-bit endpoint, inverse of bc6h_finish(bc6h_unquantize(q))
+inline int bc6h_quantize(float h)
+{
+	int q = (int)floorf((h - 15.0f) / 31.0f + 0.5f);
+	return glm::clamp(q, 0, 1023);
+}
+
+inline int bc6h_unquantize(int q)
+{
+	if (q == 0) return 0;
+	if (q == 1023) return 0xFFFF;
+	return ((q << 16) + 0x8000) >> 10;
+}
+
+inline int bc6h_finish(int u)
+{
+	return (u * 31) >> 6;
+}
+
+inline void put_bits(uint8_t* block, int& pos, uint32_t value, int num_bits)
+{
+	for (int i = 0; i < num_bits; i++, pos++)
+	{
+		if ((value >> i) & 1u) block[pos >> 3] |= (uint8_t)(1u << (pos & 7));
+	}
+}
+
+// texels: w = 1 chart, 0 < w < 1 padding, 0 empty
+static void s_encode_bc6h_block(const glm::vec4 texels[16], uint8_t* block)
+{
+	memset(block, 0, 16);
+
+	// BC6H interpolates the half-float bit patterns, so the fit works in that space
+	glm::vec3 h[16];
+	for (int i = 0; i < 16; i++)
+	{
+		glm::vec3 c = glm::clamp(glm::vec3(texels[i]), glm::vec3(0.0f), glm::vec3(65504.0f));
+		h[i] = glm::vec3((float)glm::packHalf1x16(c.x), (float)glm::packHalf1x16(c.y), (float)glm::packHalf1x16(c.z));
+	}
+
+	// endpoints are fitted to the chart texels, the padding only when the block has no chart texel
+	float min_weight = 1.0f;
+	int count = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		if (texels[i].w >= 1.0f) count++;
+	}
+	if (count == 0)
+	{
+		min_weight = 1e-6f;
+		for (int i = 0; i < 16; i++)
+		{
+			if (texels[i].w >= min_weight) count++;
+		}
+	}
+
+	int q0[3] = { 0, 0, 0 };
+	int q1[3] = { 0, 0, 0 };
+	if (count > 0)
+	{
+		glm::vec3 mean(0.0f);
+		for (int i = 0; i < 16; i++)
+		{
+			if (texels[i].w >= min_weight) mean += h[i];
+		}
+		mean /= (float)count;
+
+		glm::mat3 cov(0.0f);
+		for (int i = 0; i < 16; i++)
+		{
+			if (texels[i].w < min_weight) continue;
+			glm::vec3 d = h[i] - mean;
+			cov += glm::outerProduct(d, d);
+		}
+
+		// principal axis by power iteration
+		glm::vec3 axis(1.0f);
+		for (int k = 0; k < 8; k++)
+		{
+			glm::vec3 next = cov * axis;
+			float len = glm::length(next);
+			if (len < 1e-6f) break;
+			axis = next / len;
+		}
+		axis = glm::normalize(axis);
+
+		float t_min = FLT_MAX;
+		float t_max = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			if (texels[i].w < min_weight) continue;
+			float t = glm::dot(h[i] - mean, axis);
+			t_min = glm::min(t_min, t);
+			t_max = glm::max(t_max, t);
+		}
+
+		glm::vec3 e0 = glm::clamp(mean + axis * t_min, glm::vec3(0.0f), glm::vec3(31743.0f));
+		glm::vec3 e1 = glm::clamp(mean + axis * t_max, glm::vec3(0.0f), glm::vec3(31743.0f));
+		for (int c = 0; c < 3; c++)
+		{
+			q0[c] = bc6h_quantize(e0[c]);
+			q1[c] = bc6h_quantize(e1[c]);
+		}
+	}
+
+	glm::vec3 palette[16];
+	for (int j = 0; j < 16; j++)
+	{
+		int w = s_bc6h_weights[j];
+		for (int c = 0; c < 3; c++)
+		{
+			int u = (bc6h_unquantize(q0[c]) * (64 - w) + bc6h_unquantize(q1[c]) * w + 32) >> 6;
+			palette[j][c] = (float)bc6h_finish(u);
+		}
+	}
+
+	int indices[16];
+	for (int i = 0; i < 16; i++)
+	{
+		float best_err = FLT_MAX;
+		indices[i] = 0;
+		for (int j = 0; j < 16; j++)
+		{
+			glm::vec3 d = palette[j] - h[i];
+			float err = glm::dot(d, d);
+			if (err < best_err)
+			{
+				best_err = err;
+				indices[i] = j;
+			}
+		}
+	}
+
+	// the anchor index is stored with 3 bits, its MSB has to be 0
+	if (indices[0] >= 8)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			int t = q0[c]; q0[c] = q1[c]; q1[c] = t;
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			indices[i] = 15 - indices[i];
+		}
+	}
+
+	int pos = 0;
+	put_bits(block, pos, 3, 5);
+	for (int c = 0; c < 3; c++) put_bits(block, pos, (uint32_t)q0[c], 10);
+	for (int c = 0; c < 3; c++) put_bits(block, pos, (uint32_t)q1[c], 10);
+	put_bits(block, pos, (uint32_t)indices[0], 3);
+	for (int i = 1; i < 16; i++) put_bits(block, pos, (uint32_t)indices[i], 4);
+}
+
+LightmapCompressor::LightmapCompressor(int num_threads) : m_num_threads(num_threads)
+{
+
+}
+
+size_t LightmapCompressor::layer_size(int width, int height, LightmapFormat format)
+{
+	if (format == LightmapFormat::BC6H)
+	{
+		return (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4) * 16;
+	}
+	else if (format == LightmapFormat::RGBM8)
+	{
+		return (size_t)width * (size_t)height * 4;
+	}
+	return (size_t)width * (size_t)height * 8;
+}
+
+void LightmapCompressor::_prepare_layer(int width, int height, const glm::vec4* texels, std::vector<glm::vec4>& out) const
+{
+	size_t num_texels = (size_t)width * (size_t)height;
+	out.resize(num_texels);
+	for (size_t i = 0; i < num_texels; i++)
+	{
+		glm::vec4 t = texels[i];
+		out[i] = t.w > 0.0f ? glm::vec4(glm::vec3(t) / t.w, 1.0f) : glm::vec4(0.0f);
+	}
+
+	// two rings of padding, each empty texel takes the average of its filled neighbours
+	std::vector<glm::vec4> prev;
+	for (int ring = 0; ring < 2; ring++)
+	{
+		prev = out;
+		float w_ring = 0.5f / (float)(ring + 1);
+		parallel_for(m_num_threads, height, [&](int y)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				size_t idx = (size_t)x + (size_t)y * (size_t)width;
+				if (prev[idx].w > 0.0f) continue;
+
+				glm::vec3 sum(0.0f);
+				int count = 0;
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					int yy = y + dy;
+					if (yy < 0 || yy >= height) continue;
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						int xx = x + dx;
+						if (xx < 0 || xx >= width) continue;
+						const glm::vec4& n = prev[(size_t)xx + (size_t)yy * (size_t)width];
+						if (n.w > 0.0f)
+						{
+							sum += glm::vec3(n);
+							count++;
+						}
+					}
+				}
+				if (count > 0) out[idx] = glm::vec4(sum / (float)count, w_ring);
+			}
+		});
+	}
+}
+
+void LightmapCompressor::encode_bc6h(int width, int height, const glm::vec4* texels, uint8_t* blocks) const
+{
+	std::vector<glm::vec4> prepared;
+	_prepare_layer(width, height, texels, prepared);
+
+	int blocks_x = (width + 3) / 4;
+	int blocks_y = (height + 3) / 4;
+	parallel_for(m_num_threads, blocks_y, [&](int by)
+	{
+		for (int bx = 0; bx < blocks_x; bx++)
+		{
+			// blocks crossing the border of the layer repeat the last row / column
+			glm::vec4 block_texels[16];
+			for (int j = 0; j < 4; j++)
+			{
+				int y = glm::min(by * 4 + j, height - 1);
+				for (int i = 0; i < 4; i++)
+				{
+					int x = glm::min(bx * 4 + i, width - 1);
+					block_texels[i + j * 4] = prepared[(size_t)x + (size_t)y * (size_t)width];
+				}
+			}
+			s_encode_bc6h_block(block_texels, blocks + ((size_t)bx + (size_t)by * (size_t)blocks_x) * 16);
+		}
+	});
+}
+
+void LightmapCompressor::encode_rgbm(int width, int height, const glm::vec4* texels, uint8_t* out) const
+{
+	std::vector<glm::vec4> prepared;
+	_prepare_layer(width, height, texels, prepared);
+
+	parallel_for(m_num_threads, height, [&](int y)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			size_t idx = (size_t)x + (size_t)y * (size_t)width;
+			glm::vec3 c = glm::max(glm::vec3(prepared[idx]), glm::vec3(0.0f)) / s_rgbm_range;
+			float m = glm::min(glm::max(glm::max(c.x, c.y), c.z), 1.0f);
+			uint8_t* p = out + idx * 4;
+			if (m <= 0.0f)
+			{
+				p[0] = p[1] = p[2] = p[3] = 0;
+				continue;
+			}
+			// rounding the multiplier up keeps rgb inside [0, 1]
+			float a = ceilf(m * 255.0f) / 255.0f;
+			glm::vec3 rgb = glm::clamp(c / a, glm::vec3(0.0f), glm::vec3(1.0f));
+			p[0] = (uint8_t)(rgb.x * 255.0f + 0.5f);
+			p[1] = (uint8_t)(rgb.y * 255.0f + 0.5f);
+			p[2] = (uint8_t)(rgb.z * 255.0f + 0.5f);
+			p[3] = (uint8_t)(a * 255.0f + 0.5f);
+		}
+	});
+}
+
+bool LightmapCompressor::_encode(const Lightmap& lightmap, LightmapFormat format, std::vector<uint8_t>& data) const
+{
+	int width = lightmap.width;
+	int height = lightmap.height;
+	int num_layers = lightmap.num_layers();
+	size_t size = layer_size(width, height, format);
+	data.resize(size * (size_t)num_layers);
+
+	// the bake writes the lightmap through image stores
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+	if (lightmap.format == format)
+	{
+		glBindTexture(GL_TEXTURE_2D_ARRAY, lightmap.lightmap->tex_id);
+		if (format == LightmapFormat::BC6H)
+		{
+			glGetCompressedTexImage(GL_TEXTURE_2D_ARRAY, 0, data.data());
+		}
+		else
+		{
+			glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, format == LightmapFormat::RGBM8 ? GL_UNSIGNED_BYTE : GL_HALF_FLOAT, data.data());
+		}
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		return true;
+	}
+
+	if (lightmap.format != LightmapFormat::RGBA16F)
+	{
+		printf("Lightmap is already compressed\n");
+		return false;
+	}
+	if (lightmap.sh_l1)
+	{
+		printf("Directional lightmaps can only be stored as RGBA16F\n");
+		return false;
+	}
+
+	size_t num_texels = (size_t)width * (size_t)height;
+	std::vector<glm::vec4> texels(num_texels * (size_t)num_layers);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, lightmap.lightmap->tex_id);
+	glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_FLOAT, texels.data());
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	for (int i = 0; i < num_layers; i++)
+	{
+		const glm::vec4* src = texels.data() + num_texels * (size_t)i;
+		uint8_t* dst = data.data() + size * (size_t)i;
+		if (format == LightmapFormat::BC6H)
+		{
+			encode_bc6h(width, height, src, dst);
+		}
+		else
+		{
+			encode_rgbm(width, height, src, dst);
+		}
+	}
+	return true;
+}
+
+void LightmapCompressor::_upload(Lightmap& lightmap, LightmapFormat format, const uint8_t* data)
+{
+	int width = lightmap.width;
+	int height = lightmap.height;
+	int num_layers = lightmap.num_layers();
+
+	GLenum internal_format = GL_RGBA16F;
+	if (format == LightmapFormat::BC6H) internal_format = GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT;
+	else if (format == LightmapFormat::RGBM8) internal_format = GL_RGBA8;
+
+	lightmap.lightmap = std::unique_ptr<GLTexture2DArray>(new GLTexture2DArray);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, lightmap.lightmap->tex_id);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, internal_format, width, height, num_layers);
+	if (format == LightmapFormat::BC6H)
+	{
+		GLsizei size = (GLsizei)(layer_size(width, height, format) * (size_t)num_layers);
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, width, height, num_layers, internal_format, size, data);
+	}
+	else
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, width, height, num_layers, GL_RGBA, format == LightmapFormat::RGBM8 ? GL_UNSIGNED_BYTE : GL_HALF_FLOAT, data);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	lightmap.format = format;
+}
+
+bool LightmapCompressor::compress(Lightmap& lightmap, LightmapFormat format) const
+{
+	if (lightmap.format == format) return true;
+
+	std::vector<uint8_t> data;
+	if (!_encode(lightmap, format, data)) return false;
+	_upload(lightmap, format, data.data());
+	return true;
+}
+
+bool LightmapCompressor::save(const Lightmap& lightmap, const char* path, LightmapFormat format) const
+{
+	std::vector<uint8_t> data;
+	if (!_encode(lightmap, format, data)) return false;
+
+	BinaryFileWriter writer(path);
+	if (!writer.is_open())
+	{
+		printf("Failed to write lightmap %s\n", path);
+		return false;
+	}
+
+	int file_format = (int)format;
+	int sh_l1 = lightmap.sh_l1 ? 1 : 0;
+	writer.write_header(s_magic, s_version);
+	writer.write(file_format);
+	writer.write(lightmap.width);
+	writer.write(lightmap.height);
+	writer.write(lightmap.num_pages);
+	writer.write(lightmap.num_light_layers);
+	writer.write(sh_l1);
+	writer.write(data.data(), 1, data.size());
+	return writer.commit();
+}
+
+bool LightmapCompressor::load(Lightmap& lightmap, const char* path)
+{
+	BinaryFileReader reader(path);
+	if (!reader.is_open()) return false;
+
+	// the lightmap has to come from the same atlas
+	int file_format, num_light_layers, sh_l1;
+	bool ok = reader.read_header(s_magic, s_version);
+	ok = ok && reader.read(file_format) && file_format >= 0 && file_format <= (int)LightmapFormat::RGBM8;
+	ok = ok && reader.read_expect(lightmap.width);
+	ok = ok && reader.read_expect(lightmap.height);
+	ok = ok && reader.read_expect(lightmap.num_pages);
+	ok = ok && reader.read(num_light_layers) && num_light_layers >= 0;
+	ok = ok && reader.read(sh_l1);
+
+	std::vector<uint8_t> data;
+	if (ok)
+	{
+		int num_layers = lightmap.num_pages * (num_light_layers + 1 + (sh_l1 != 0 ? 3 : 0));
+		data.resize(layer_size(lightmap.width, lightmap.height, (LightmapFormat)file_format) * (size_t)num_layers);
+		ok = reader.read(data.data(), 1, data.size());
+	}
+
+	if (!ok)
+	{
+		printf("Ignoring incompatible lightmap %s\n", path);
+		return false;
+	}
+
+	lightmap.num_light_layers = num_light_layers;
+	lightmap.sh_l1 = sh_l1 != 0;
+	_upload(lightmap, (LightmapFormat)file_format, data.data());
+	return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm.hpp>
+
+class Lightmap;
+enum class LightmapFormat;
+
+// CPU encoder for finished lightmaps. Blocks are spread over worker threads.
+// Before encoding, the chart texels are normalized by their coverage (rgb / w) and the padding around the charts
+// is filled from the neighbouring chart texels, so blocks on chart borders fit the chart colors only and
+// bilinear fetches at the borders don't pull in black.
+// BC6H uses the unsigned format, so lightmaps with L1 layers (signed) stay RGBA16F.
+class LightmapCompressor
+{
+public:
+	LightmapCompressor(int num_threads = 0);
+
+	int m_num_threads;
+
+	// multiplier range of RGBM8, rgb = color.rgb * color.a * s_rgbm_range
+	static const float s_rgbm_range;
+
+	// texels: one layer as read back from the lightmap, w = 0 outside the charts
+	// blocks: 16 bytes per 4x4 block, (width + 3) / 4 * (height + 3) / 4 blocks
+	void encode_bc6h(int width, int height, const glm::vec4* texels, uint8_t* blocks) const;
+	// out: 4 bytes per texel
+	void encode_rgbm(int width, int height, const glm::vec4* texels, uint8_t* out) const;
+
+	// Reads back the RGBA16F lightmap, encodes every layer and replaces the texture by the encoded one.
+	// The compressed lightmap can only be sampled by the raster path, bakes need an RGBA16F lightmap.
+	bool compress(Lightmap& lightmap, LightmapFormat format) const;
+
+	// Writes the lightmap in the given format. A compressed lightmap is written as is.
+	bool save(const Lightmap& lightmap, const char* path, LightmapFormat format) const;
+	// Loads a lightmap written by save() into a lightmap of the same atlas, replacing its texture
+	static bool load(Lightmap& lightmap, const char* path);
+
+	static size_t layer_size(int width, int height, LightmapFormat format);
+
+private:
+	void _prepare_layer(int width, int height, const glm::vec4* texels, std::vector<glm::vec4>& out) const;
+	bool _encode(const Lightmap& lightmap, LightmapFormat format, std::vector<uint8_t>& data) const;
+	static void _upload(Lightmap& lightmap, LightmapFormat format, const uint8_t* data);
+};
@@ -1,6 +1,56 @@
 #include <GL/glew.h>
 #include "LightmapRayList.h"
 
+const char* LightmapRayList::s_glsl_random =
+R"(uint InitRandomSeed(uint val0, uint val1)
+{
+	uint v0 = val0, v1 = val1, s0 = 0u;
+
+	for (uint n = 0u; n < 16u; n++)
+	{
+		s0 += 0x9e3779b9u;
+		v0 += ((v1 << 4) + 0xa341316cu) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4u);
+		v1 += ((v0 << 4) + 0xad90777du) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761eu);
+	}
+
+	return v0;
+}
+
+uint RandomInt(inout uint seed)
+{
+    return (seed = 1664525u * seed + 1013904223u);
+}
+
+float RandomFloat(inout uint seed)
+{
+	return (float(RandomInt(seed) & 0x00FFFFFFu) / float(0x01000000));
+}
+
+vec3 RandomDirection(inout uint seed)
+{
+	float z = RandomFloat(seed) * 2.0 - 1.0;
+	float xy = sqrt(1.0 - z*z);
+	float alpha = RandomFloat(seed) * PI * 2.0;
+	return vec3(xy * cos(alpha), xy * sin(alpha), z);
+}
+
+vec3 RandomDiffuse(inout uint seed, in vec3 base_dir)
+{
+	vec3 dir = RandomDirection(seed);
+	float d = dot(dir, base_dir);
+	vec3 c = d * base_dir;
+	vec3 s = dir - c;
+	float z2 = clamp(abs(d), 0.0, 1.0);
+	float xy = sqrt(1.0 - z2);	
+	vec3 s_dir =  sqrt(z2) * base_dir;
+	if (length(s)>0.0)
+	{		
+		s_dir += xy * normalize(s);
+	}
+	return s_dir;
+}
+)";
+
 const double PI = 3.14159265359;
 
 inline double rand01()
@@ -22,10 +72,13 @@ struct ListConst
 	int texelsPerRow;
 	int numRows;
 	int jitter;
-	int padding[2];
+	int sphere;
+	int padding;
+	glm::vec4 recordPosMin;
+	glm::vec4 recordPosStep;
 };
 
-LightmapRayList::LightmapRayList(LightmapRenderTarget* src, BVHRenderTarget* dst, int begin, int end, int num_rays)
+LightmapRayList::LightmapRayList(LightmapRecords* src, BVHRenderTarget* dst, int begin, int end, int num_rays)
 	: m_constant(sizeof(ListConst), GL_UNIFORM_BUFFER)
 	, source(src)
 	, begin(begin)
@@ -47,6 +100,9 @@ void LightmapRayList::updateConstant()
 	c.texelsPerRow = texels_per_row;
 	c.numRows = num_rows;
 	c.jitter = jitter;
+	c.sphere = sphere ? 1 : 0;
+	c.recordPosMin = glm::vec4(source->record_pos_min, 0.0f);
+	c.recordPosStep = glm::vec4(source->record_pos_step, 0.0f);
 	m_constant.upload(&c);
 
 }
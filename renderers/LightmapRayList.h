@@ -7,18 +7,21 @@
 #include "renderers/LightmapRenderTarget.h"
 #include "renderers/BVHRenderTarget.h"
 #include "renderers/GLUtils.h"
+#include "lights/Lights.h"
 
 class LightmapRayList
 {
 public:
-	LightmapRayList(LightmapRenderTarget* src, BVHRenderTarget* dst, int begin, int end, int num_rays = 64);
+	LightmapRayList(LightmapRecords* src, BVHRenderTarget* dst, int begin, int end, int num_rays = 64);
 
 	// input
-	LightmapRenderTarget* source;
+	LightmapRecords* source;
 	int begin;
 	int end;	
 	int num_rays;
 	int jitter;
+	bool sphere = false; // directions over the whole sphere instead of the hemisphere of the record normal, for probes
+	LightmapPart part = LightmapPart::All;
 	
 	// output
 	int texels_per_row;
@@ -27,5 +30,9 @@ public:
 	GLDynBuffer m_constant;
 	void updateConstant();
 
+	// GLSL random numbers the ray directions are drawn from, shaders take them in place of a #RANDOM# line.
+	// Every pass regenerating the directions of a ray list must use them unchanged. Needs PI defined.
+	static const char* s_glsl_random;
+
 };
 
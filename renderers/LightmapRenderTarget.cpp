@@ -1,7 +1,136 @@
 #include <cstdio>
+#include <cmath>
 #include <GL/glew.h>
 #include "LightmapRenderTarget.h"
 
+const char* LightmapRecords::s_glsl_record =
+R"(vec2 oct_encode(vec3 n)
+{
+	float l1 = abs(n.x) + abs(n.y) + abs(n.z);
+	if (l1 <= 0.0) return vec2(0.0);
+	n /= l1;
+	return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec3 oct_decode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+// tangent frame of a unit normal, continuous except across n.z = 0
+void tangent_frame(vec3 n, out vec3 t, out vec3 bt)
+{
+	float s = n.z >= 0.0 ? 1.0 : -1.0;
+	float a = -1.0 / (s + n.z);
+	float b = n.x * n.y * a;
+	t = vec3(1.0 + s * n.x * n.x * a, s * b, -s * n.x);
+	bt = vec3(b, s + n.y * n.y * a, -n.y);
+}
+
+float record_step_size(vec3 pos_step)
+{
+	return max(max(pos_step.x, pos_step.y), pos_step.z);
+}
+
+// Texel footprint as a rectangle along dP/dx, with the area of the dP/dx, dP/dy parallelogram:
+// bits 0-5: 1 + length of dP/dx in third octaves of the quantization step, from 1 to 2^20.7 steps
+// bits 6-8: 4 + height across dP/dx over that length, in half octaves from 1/4 to 2.8
+// bits 9-11: direction of dP/dx in the tangent frame of n, in 8 steps over 180 degrees
+// n should be the decoded normal of the record so the frame matches footprint_offset().
+uint footprint_code(vec3 dpdx, vec3 dpdy, vec3 n, vec3 pos_step)
+{
+	vec3 t, bt;
+	tangent_frame(n, t, bt);
+	vec2 ax = vec2(dot(dpdx, t), dot(dpdx, bt));
+	vec2 ay = vec2(dot(dpdy, t), dot(dpdy, bt));
+	float len_x = length(ax);
+	float height = abs(ax.x * ay.y - ax.y * ay.x) / max(len_x, 1e-30);
+	if (len_x <= 0.0 || height <= 0.0) return 0u;
+
+	uint size = uint(clamp(round(log2(len_x / max(record_step_size(pos_step), 1e-30)) * 3.0), 0.0, 62.0)) + 1u;
+	uint aspect = uint(clamp(round(log2(height / len_x) * 2.0) + 4.0, 0.0, 7.0));
+	uint dir = uint(int(round(atan(ax.y, ax.x) * 2.546479089)) + 16) & 7u;
+	return size | (aspect << 6) | (dir << 9);
+}
+
+uvec4 pack_record(ivec2 coord, vec3 pos, vec3 norm, uint footprint, vec3 pos_min, vec3 pos_inv_step)
+{
+	uvec3 q = uvec3(clamp(round((pos - pos_min) * pos_inv_step), vec3(0.0), vec3(2097151.0)));
+	uvec2 e = uvec2(round(clamp(oct_encode(norm) * 0.5 + 0.5, 0.0, 1.0) * 1023.0));
+	uvec4 rec;
+	rec.x = uint(coord.x) | (uint(coord.y) << 16);
+	rec.y = e.x | (e.y << 10) | (footprint << 20);
+	rec.z = q.x | (q.y << 21);
+	rec.w = (q.y >> 11) | (q.z << 10);
+	return rec;
+}
+
+ivec2 record_coord(uvec4 rec)
+{
+	return ivec2(rec.x & 0xffffu, rec.x >> 16);
+}
+
+vec3 record_position(uvec4 rec, vec3 pos_min, vec3 pos_step)
+{
+	uvec3 q = uvec3(rec.z & 0x1fffffu, (rec.z >> 21) | ((rec.w & 0x3ffu) << 11), rec.w >> 10);
+	return pos_min + vec3(q) * pos_step;
+}
+
+vec3 record_normal(uvec4 rec)
+{
+	return oct_decode(vec2(rec.y & 0x3ffu, (rec.y >> 10) & 0x3ffu) * (2.0 / 1023.0) - 1.0);
+}
+
+// offset in [-0.5, 0.5]^2 texels, spread over the footprint rectangle in the tangent plane
+vec3 footprint_offset(uvec4 rec, vec2 offset, vec3 pos_step)
+{
+	uint code = rec.y >> 20;
+	if (code == 0u) return vec3(0.0);
+	float len_x = record_step_size(pos_step) * exp2(float((code & 63u) - 1u) / 3.0);
+	float len_y = len_x * exp2((float((code >> 6) & 7u) - 4.0) * 0.5);
+	float angle = float(code >> 9) * 0.392699082;
+
+	vec3 n = record_normal(rec);
+	vec3 t, bt;
+	tangent_frame(n, t, bt);
+	vec3 ax = cos(angle) * t + sin(angle) * bt;
+	vec3 ay = cross(n, ax);
+	return offset.x * len_x * ax + offset.y * len_y * ay;
+}
+
+float record_offset(vec3 pos_step)
+{
+	return 0.001 + length(pos_step);
+}
+)";
+
+glm::uvec4 LightmapRecords::pack_record(const glm::ivec2& coord, const glm::vec3& pos, const glm::vec3& norm, unsigned footprint, const glm::vec3& pos_min, const glm::vec3& pos_step)
+{
+	glm::vec2 e = glm::vec2(0.0f);
+	float l1 = fabsf(norm.x) + fabsf(norm.y) + fabsf(norm.z);
+	if (l1 > 0.0f)
+	{
+		glm::vec3 n = norm / l1;
+		e = glm::vec2(n.x, n.y);
+		if (n.z < 0.0f)
+		{
+			e.x = (1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+			e.y = (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+		}
+	}
+	glm::uvec2 u = glm::uvec2(glm::round(glm::clamp(e * 0.5f + 0.5f, 0.0f, 1.0f) * 1023.0f));
+	glm::uvec3 q = glm::uvec3(glm::clamp((pos - pos_min) / pos_step + 0.5f, glm::vec3(0.0f), glm::vec3((float)((1 << 21) - 1))));
+
+	glm::uvec4 rec;
+	rec.x = (unsigned)coord.x | ((unsigned)coord.y << 16);
+	rec.y = u.x | (u.y << 10) | (footprint << 20);
+	rec.z = q.x | (q.y << 21);
+	rec.w = (q.y >> 11) | (q.z << 10);
+	return rec;
+}
+
 LightmapRenderTarget::LightmapRenderTarget()
 {
 	glGenFramebuffers(1, &m_fbo);
@@ -15,12 +144,14 @@ LightmapRenderTarget::~LightmapRenderTarget()
 
 bool LightmapRenderTarget::update_framebuffer(int width, int height)
 {
-	if (m_width != width || m_height != height)
+	if (m_width != width || m_height != height || m_tex_position == nullptr)
 	{
 		glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
 
 		m_tex_position = std::unique_ptr<GLTexture2D>(new GLTexture2D);
 		m_tex_normal = std::unique_ptr<GLTexture2D>(new GLTexture2D);
+		m_tex_dpdx = std::unique_ptr<GLTexture2D>(new GLTexture2D);
+		m_tex_dpdy = std::unique_ptr<GLTexture2D>(new GLTexture2D);
 
 		glBindTexture(GL_TEXTURE_2D, m_tex_position->tex_id);
 		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
@@ -40,10 +171,40 @@ bool LightmapRenderTarget::update_framebuffer(int width, int height)
 		glBindTexture(GL_TEXTURE_2D, 0);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_tex_normal->tex_id, 0);
 
+		glBindTexture(GL_TEXTURE_2D, m_tex_dpdx->tex_id);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, m_tex_dpdx->tex_id, 0);
+
+		glBindTexture(GL_TEXTURE_2D, m_tex_dpdy->tex_id);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, m_tex_dpdy->tex_id, 0);
+
 		m_width = width;
 		m_height = height;
 
 		return true;
 	}
 	return false;
-}
\ No newline at end of file
+}
+
+void LightmapRenderTarget::release_framebuffer()
+{
+	// detach first, attached textures are not freed by glDeleteTextures
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, 0, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, 0, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	m_tex_position = nullptr;
+	m_tex_normal = nullptr;
+	m_tex_dpdx = nullptr;
+	m_tex_dpdy = nullptr;
+}
@@ -1,10 +1,41 @@
 #pragma once
 
 #include <memory>
+#include <glm.hpp>
 #include <renderers/GLUtils.h>
 
 class GLTexture2D;
-class LightmapRenderTarget
+
+// Set of texel records traced by a LightmapRayList: the texels of a lightmap page, a range of them,
+// or points without a texel like probes and vertices. Holds no GL object besides the record buffer.
+class LightmapRecords
+{
+public:
+	// lightmap page the records belong to
+	int page = 0;
+
+	// one packed record per texel, in valid-list order
+	// uvec4(texel coord x | y<<16, octahedral normal as 2x10 bit unorm | footprint code<<20, position quantized to 3x21 bits)
+	// The 12-bit footprint code is the size, aspect and direction of the texel in the tangent plane, relative to
+	// record_pos_step, used to jitter ray origins over it. It is 0 for texels on a chart border, whose origins stay
+	// at the texel center so they cannot leak into the padding or other charts.
+	int count_valid = 0;
+	std::unique_ptr<GLBuffer> texel_records;
+	glm::vec3 record_pos_min;
+	glm::vec3 record_pos_step;
+
+	// GLSL helpers for the record layout above, shaders take them in place of a #RECORD# line.
+	// record_offset() is how far to push ray origins off the surface so the 21-bit quantization
+	// of large pages cannot put them behind it.
+	static const char* s_glsl_record;
+
+	// CPU version of pack_record() for records built on the host, footprint is the 12-bit code (0: no jitter)
+	static glm::uvec4 pack_record(const glm::ivec2& coord, const glm::vec3& pos, const glm::vec3& norm, unsigned footprint, const glm::vec3& pos_min, const glm::vec3& pos_step);
+
+};
+
+// Rasterizes a lightmap page and compacts it into its texel records
+class LightmapRenderTarget : public LightmapRecords
 {
 public:
 	LightmapRenderTarget();
@@ -13,14 +44,19 @@ public:
 	int m_width = -1;
 	int m_height = -1;
 
+	// raster targets, only alive between rasterization and compaction
 	std::unique_ptr<GLTexture2D> m_tex_position;
 	std::unique_ptr<GLTexture2D> m_tex_normal;
+	// world-space position change over one texel step in x and y
+	std::unique_ptr<GLTexture2D> m_tex_dpdx;
+	std::unique_ptr<GLTexture2D> m_tex_dpdy;
 
 	unsigned m_fbo = 0;
 	bool update_framebuffer(int width, int height);
+	void release_framebuffer();
 
-	int count_valid;
-	std::unique_ptr<TextureBuffer> valid_list;
+	// R32UI, record index + 1 of each texel, 0 if not covered
+	std::unique_ptr<GLTexture2D> m_tex_record_index;
 
 };
 
@@ -3,6 +3,8 @@
 #include "BVHDepthOnly.h"
 #include "renderers/BVHRenderTarget.h"
 #include "renderers/LightmapRayList.h"
+#include "renderers/LightmapRenderTarget.h"
+#include "utils/Utils.h"
 
 static std::string g_compute =
 R"(#version 430
@@ -133,7 +135,7 @@ uint bvh8_node_intersect(in Ray ray, uint oct_inv4, in BVH8Node node)
 	return hit_mask;
 }
 
-bool triangle_intersect(int triangle_id, in Ray ray, out float t, out float u, out float v)
+bool triangle_intersect(int triangle_id, in Ray ray, out float t, out float u, out float v, out bool back)
 {
 	vec3 pos0 = texelFetch(uTexTriangles, triangle_id*3).xyz;
 	vec3 edge1 = texelFetch(uTexTriangles, triangle_id*3 + 1).xyz;
@@ -142,8 +144,12 @@ bool triangle_intersect(int triangle_id, in Ray ray, out float t, out float u, o
 	vec3 h = cross(ray.direction, edge2);
 	float a = dot(edge1, h);
 
+#if PROBE_BACKFACE
+	if (a==0.0) return false;
+#else
 	if (a==0.0 ||  (uDoubleSided==0 && a<0.0)) return false;
-	//if (a==0.0) return false;
+#endif
+	back = a<0.0;
 	
 	float f = 1.0 / a;
 	vec3 s = ray.origin - pos0;
@@ -196,6 +202,7 @@ uvec2 stack_pop(in uvec2 stack[LOCAL_STACK_SIZE], inout int stack_size)
 }
 
 Ray g_ray;
+bool g_hit_back = false;
 
 void intersect()
 {
@@ -256,9 +263,11 @@ void intersect()
 
 			int tri_idx = int(triangle_group.x + triangle_index);
 			float t,u,v;
-			if (triangle_intersect(tri_idx, g_ray, t, u, v))
+			bool back;
+			if (triangle_intersect(tri_idx, g_ray, t, u, v, back))
 			{				
-				g_ray.tmax = t;			
+				g_ray.tmax = t;
+				g_hit_back = back && uDoubleSided==0;
 			}
 		}			
 
@@ -271,6 +280,10 @@ void intersect()
 }
 
 layout (binding=0, r32f) uniform image2D uDepth;
+
+#if PROBE_BACKFACE
+layout (binding=1, rgba16f) uniform image2D uBackface;
+#endif
 layout(local_size_x = 32, local_size_y = 2) in;
 
 ivec2 g_id_io;
@@ -294,6 +307,9 @@ void render()
 	if (g_ray.tmax < tmax)
 	{		
 		imageStore(uDepth, g_id_io, vec4(g_ray.tmax));
+#if PROBE_BACKFACE
+		imageStore(uBackface, g_id_io, vec4(g_hit_back ? 1.0 : 0.0));
+#endif
 	}	
 }
 
@@ -339,61 +355,21 @@ layout (std140, binding = 1) uniform LightmapRayList
 	int uTexelsPerRow;
 	int uNumRows;
 	int uJitter;
+	int uSphere;
+	vec4 uRecordPosMin;
+	vec4 uRecordPosStep;
 };
 
-layout (location = 3) uniform sampler2D uTexPosition;
-layout (location = 4) uniform sampler2D uTexNormal;
-layout (location = 5) uniform usamplerBuffer uValidList;
-
-#define PI 3.14159265359
-
-uint InitRandomSeed(uint val0, uint val1)
+layout (std430, binding = 0) buffer TexelRecords
 {
-	uint v0 = val0, v1 = val1, s0 = 0u;
-
-	for (uint n = 0u; n < 16u; n++)
-	{
-		s0 += 0x9e3779b9u;
-		v0 += ((v1 << 4) + 0xa341316cu) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4u);
-		v1 += ((v0 << 4) + 0xad90777du) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761eu);
-	}
-
-	return v0;
-}
-
-uint RandomInt(inout uint seed)
-{
-    return (seed = 1664525u * seed + 1013904223u);
-}
+	uvec4 texel_records[];
+};
 
-float RandomFloat(inout uint seed)
-{
-	return (float(RandomInt(seed) & 0x00FFFFFFu) / float(0x01000000));
-}
+#RECORD#
 
-vec3 RandomDirection(inout uint seed)
-{
-	float z = RandomFloat(seed) * 2.0 - 1.0;
-	float xy = sqrt(1.0 - z*z);
-	float alpha = RandomFloat(seed) * PI * 2.0;
-	return vec3(xy * cos(alpha), xy * sin(alpha), z);
-}
+#define PI 3.14159265359
 
-vec3 RandomDiffuse(inout uint seed, in vec3 base_dir)
-{
-	vec3 dir = RandomDirection(seed);
-	float d = dot(dir, base_dir);
-	vec3 c = d * base_dir;
-	vec3 s = dir - c;
-	float z2 = clamp(abs(d), 0.0, 1.0);
-	float xy = sqrt(1.0 - z2);	
-	vec3 s_dir =  sqrt(z2) * base_dir;
-	if (length(s)>0.0)
-	{		
-		s_dir += xy * normalize(s);
-	}
-	return s_dir;
-}
+#RANDOM#
 
 void main()
 {
@@ -405,13 +381,20 @@ void main()
 	if (idx_texel_in >= uTexelEnd) return;
 
 	int idx_ray = g_id_io.x % uNumRays;
-	ivec2 texel_coord = ivec2(texelFetch(uValidList, idx_texel_in).xy);	
-	g_origin = texelFetch(uTexPosition, texel_coord, 0).xyz;
-	vec3 norm = texelFetch(uTexNormal, texel_coord, 0).xyz;
+	uvec4 rec = texel_records[idx_texel_in];
+	vec3 norm = record_normal(rec);
+	float surface_offset = record_offset(uRecordPosStep.xyz);
+	g_origin = record_position(rec, uRecordPosMin.xyz, uRecordPosStep.xyz) + norm * surface_offset;
 	uint seed = InitRandomSeed(uJitter, idx_texel_out * uNumRays +  idx_ray);
-	g_dir = RandomDiffuse(seed, norm);	
+	g_dir = uSphere != 0 ? RandomDirection(seed) : RandomDiffuse(seed, norm);	
+
+	// spread the origins over the texel, drawn after the direction so the sky passes see the same rays
+	float jitter_x = RandomFloat(seed);
+	float jitter_y = RandomFloat(seed);
+	vec2 offset = vec2(jitter_x, jitter_y) - 0.5;
+	g_origin += footprint_offset(rec, offset, uRecordPosStep.xyz);
 
-	g_tmin = 0.001;	
+	g_tmin = surface_offset;
 	g_tmax = 3.402823466e+38;
 	
 	render();
@@ -419,20 +402,6 @@ void main()
 #endif
 )";
 
-inline void replace(std::string& str, const char* target, const char* source)
-{
-	int start = 0;
-	size_t target_len = strlen(target);
-	size_t source_len = strlen(source);
-	while (true)
-	{
-		size_t pos = str.find(target, start);
-		if (pos == std::string::npos) break;
-		str.replace(pos, target_len, source);
-		start = pos + source_len;
-	}
-}
-
 BVHDepthOnly::BVHDepthOnly(int target_mode) : m_target_mode(target_mode)
 {	
 	std::string s_compute = g_compute;
@@ -447,7 +416,7 @@ BVHDepthOnly::BVHDepthOnly(int target_mode) : m_target_mode(target_mode)
 		defines += "#define TO_CAMERA 0\n";
 	}
 
-	if (target_mode == 2)
+	if (target_mode == 2 || target_mode == 3)
 	{
 		defines += "#define TO_LIGHTMAP 1\n";
 	}
@@ -456,7 +425,18 @@ BVHDepthOnly::BVHDepthOnly(int target_mode) : m_target_mode(target_mode)
 		defines += "#define TO_LIGHTMAP 0\n";
 	}
 
+	if (target_mode == 3)
+	{
+		defines += "#define PROBE_BACKFACE 1\n";
+	}
+	else
+	{
+		defines += "#define PROBE_BACKFACE 0\n";
+	}
+
 	replace(s_compute, "#DEFINES#", defines.c_str());
+	replace(s_compute, "#RECORD#", LightmapRenderTarget::s_glsl_record);
+	replace(s_compute, "#RANDOM#", LightmapRayList::s_glsl_random);
 
 	GLShader comp_shader(GL_COMPUTE_SHADER, s_compute.c_str());
 	m_prog = (std::unique_ptr<GLProgram>)(new GLProgram(comp_shader));
@@ -499,21 +479,16 @@ void BVHDepthOnly::render(const RenderParams& params)
 		glm::ivec2 blocks = { (width + 31) / 32, (height + 1) / 2 };
 		glDispatchCompute(blocks.x, blocks.y, 1);
 	}
-	else if (m_target_mode == 2)
+	else if (m_target_mode == 2 || m_target_mode == 3)
 	{
-		glBindBufferBase(GL_UNIFORM_BUFFER, 1, params.lmrl->m_constant.m_id);		
-
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, params.lmrl->source->m_tex_position->tex_id);
-		glUniform1i(3, 3);
+		if (m_target_mode == 3)
+		{
+			glBindImageTexture(1, target->m_tex_video->tex_id, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+		}
 
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, params.lmrl->source->m_tex_normal->tex_id);
-		glUniform1i(4, 4);
+		glBindBufferBase(GL_UNIFORM_BUFFER, 1, params.lmrl->m_constant.m_id);		
 
-		glActiveTexture(GL_TEXTURE5);
-		glBindTexture(GL_TEXTURE_BUFFER, params.lmrl->source->valid_list->tex_id);
-		glUniform1i(5, 5);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, params.lmrl->source->texel_records->m_id);
 
 		glm::ivec2 blocks = { (width + 63) / 64, height };
 		glDispatchCompute(blocks.x, blocks.y, 1);
@@ -3,7 +3,10 @@
 #include "lights/DirectionalLight.h"
 #include "BVHRoutine.h"
 #include "renderers/BVHRenderTarget.h"
+#include "renderers/LightmapCompressor.h"
 #include "renderers/LightmapRayList.h"
+#include "renderers/LightmapRenderTarget.h"
+#include "utils/Utils.h"
 
 static std::string g_compute_part0 =
 R"(#version 430
@@ -336,7 +339,7 @@ layout (std430, binding = BINDING_UV) buffer UVs
 #if HAS_LIGHTMAP
 layout (std430, binding = BINDING_ATLAS_UV) buffer AtlasUVs
 {
-	vec2 atlas_uvs[];
+	vec4 atlas_uvs[];
 };
 #endif
 
@@ -354,7 +357,7 @@ vec2 gUV;
 #endif
 
 #if HAS_LIGHTMAP
-vec2 gAtlasUV;
+vec3 gAtlasUV;
 #endif
 
 void interpolate_variants()
@@ -399,10 +402,10 @@ void interpolate_variants()
 		int vert_idx0 = int(texelFetch(uTexAtlasIndices, face_id*3).x);
 		int vert_idx1 = int(texelFetch(uTexAtlasIndices, face_id*3 + 1).x);
 		int vert_idx2 = int(texelFetch(uTexAtlasIndices, face_id*3 + 2).x);
-		vec2 uv0 = atlas_uvs[vert_idx0];
-		vec2 uv1 = atlas_uvs[vert_idx1];
-		vec2 uv2 = atlas_uvs[vert_idx2];
-		gAtlasUV = (1.0 - u - v) * uv0 + u * uv1 + v * uv2;
+		vec4 uv0 = atlas_uvs[vert_idx0];
+		vec4 uv1 = atlas_uvs[vert_idx1];
+		vec4 uv2 = atlas_uvs[vert_idx2];
+		gAtlasUV = vec3((1.0 - u - v) * uv0.xy + u * uv1.xy + v * uv2.xy, uv0.z);
 	}
 #endif
 }
@@ -522,7 +525,11 @@ struct DirectionalLight
 #if NUM_DIRECTIONAL_LIGHTS>0
 layout (std140, binding = BINDING_DIRECTIONAL_LIGHTS) uniform DirectionalLights
 {
+#if NUM_LIGHT_CONFIGS>0
+	DirectionalLight uDirectionalLights[NUM_DIRECTIONAL_LIGHTS*NUM_LIGHT_CONFIGS];
+#else
 	DirectionalLight uDirectionalLights[NUM_DIRECTIONAL_LIGHTS];
+#endif
 };
 #endif
 
@@ -541,10 +548,18 @@ struct DirectionalShadow
 
 layout (std140, binding = BINDING_DIRECTIONAL_SHADOWS) uniform DirectionalShadows
 {
+#if NUM_LIGHT_CONFIGS>0
+	DirectionalShadow uDirectionalShadows[NUM_DIRECTIONAL_SHADOWS*NUM_LIGHT_CONFIGS];
+#else
 	DirectionalShadow uDirectionalShadows[NUM_DIRECTIONAL_SHADOWS];
+#endif
 };
 
+#if NUM_LIGHT_CONFIGS>0
+layout (location = LOCATION_TEX_DIRECTIONAL_SHADOW) uniform sampler2DArrayShadow uDirectionalShadowTex[NUM_DIRECTIONAL_SHADOWS];
+#else
 layout (location = LOCATION_TEX_DIRECTIONAL_SHADOW) uniform sampler2DShadow uDirectionalShadowTex[NUM_DIRECTIONAL_SHADOWS];
+#endif
 
 vec3 computeShadowCoords(in mat4 VPSB)
 {
@@ -566,11 +581,30 @@ float computeShadowCoef(in mat4 VPSB, sampler2DShadow shadowTex)
 	shadowCoords = computeShadowCoords(VPSB);
 	return borderPCFTexture(shadowTex, shadowCoords);
 }
+
+#if NUM_LIGHT_CONFIGS>0
+float computeShadowCoef(in mat4 VPSB, sampler2DArrayShadow shadowTex, int layer)
+{
+	vec3 uvz = computeShadowCoords(VPSB);
+	return ((uvz.x <= 1.0) && (uvz.y <= 1.0) &&
+	 (uvz.x >= 0.0) && (uvz.y >= 0.0)) ? texture(shadowTex, vec4(uvz.xy, float(layer), uvz.z)) : 
+	 ((uvz.z <= 1.0) ? 1.0 : 0.0);
+}
+#endif
 #endif
 
 
 #if HAS_LIGHTMAP
-layout (location = LOCATION_TEX_LIGHTMAP) uniform sampler2D uTexLightmap;
+layout (location = LOCATION_TEX_LIGHTMAP) uniform sampler2DArray uTexLightmap;
+
+vec4 sample_lightmap(in vec3 uv)
+{
+	vec4 lm = texture(uTexLightmap, uv);
+#if LIGHTMAP_RGBM
+	lm = vec4(lm.xyz * lm.w * LIGHTMAP_RGBM_RANGE, 1.0);
+#endif
+	return lm;
+}
 #endif
 )";
 
@@ -578,6 +612,10 @@ static std::string g_compute_part1 =
 R"(
 vec4 out0;
 
+#if NUM_LIGHT_CONFIGS>0
+vec4 out_configs[NUM_LIGHT_CONFIGS];
+#endif
+
 #if ALPHA_BLEND
 vec4 out_oit_col;
 float out_oit_reveal;
@@ -656,6 +694,65 @@ bool calc_shading()
 #if HAS_EMISSIVE_MAP
 	emissive *= texture(uTexEmissive, gUV).xyz;
 #endif
+#if INDIRECT_ONLY
+	emissive = vec3(0.0);
+#endif
+
+#if NUM_LIGHT_CONFIGS>0
+	// the hit is shaded once per light setup, the layers of each setup follow those of the previous one
+	int lightmap_pages = 1;
+#if HAS_LIGHTMAP
+	lightmap_pages = max(textureSize(uTexLightmap, 0).z / NUM_LIGHT_CONFIGS, 1);
+#endif
+	for (int c = 0; c < NUM_LIGHT_CONFIGS; c++)
+	{
+		vec3 specular = vec3(0.0);
+		vec3 diffuse = vec3(0.0);
+
+#if NUM_DIRECTIONAL_LIGHTS>0
+		int shadow_id = 0;
+		for (int i=0; i< NUM_DIRECTIONAL_LIGHTS; i++)
+		{
+			DirectionalLight light_source = uDirectionalLights[c * NUM_DIRECTIONAL_LIGHTS + i];
+			float l_shadow = 1.0;
+#if NUM_DIRECTIONAL_SHADOWS>0
+			if (light_source.has_shadow!=0)
+			{
+				DirectionalShadow shadow = uDirectionalShadows[c * NUM_DIRECTIONAL_SHADOWS + shadow_id];
+				l_shadow = computeShadowCoef(shadow.VPSBMat, uDirectionalShadowTex[shadow_id], c);
+				shadow_id++;
+			}
+#endif
+			IncidentLight directLight = IncidentLight(light_source.color.xyz * l_shadow, light_source.direction.xyz, true);
+
+			float dotNL =  saturate(dot(norm, directLight.direction));
+			vec3 irradiance = dotNL * directLight.color;
+
+			diffuse += irradiance * BRDF_Lambert( material.diffuseColor );
+			specular += irradiance * BRDF_GGX( directLight.direction, gViewDir, norm, material.specularColor, material.specularF90, material.roughness );
+		}
+#endif
+
+#if HAS_LIGHTMAP
+		{
+			vec3 atlas_uv = vec3(gAtlasUV.xy, gAtlasUV.z + float(c * lightmap_pages));
+			vec4 lm = sample_lightmap(atlas_uv);
+			vec3 light_color = lm.w>0.0 ? lm.xyz/lm.w : vec3(0.0);
+			diffuse += material.diffuseColor * light_color;
+			specular += material.specularColor * light_color;
+		}
+#endif
+#if RELIGHT_LAYERS
+		if (c < NUM_LIGHT_CONFIGS - 1)
+		{
+			out_configs[c] = vec4(specular + diffuse, 1.0);
+			continue;
+		}
+#endif
+		out_configs[c] = vec4(emissive + specular + diffuse, 1.0);
+	}
+	return true;
+#endif
 
 	vec3 specular = vec3(0.0);
 	vec3 diffuse = vec3(0.0);
@@ -686,8 +783,22 @@ bool calc_shading()
 
 #if HAS_LIGHTMAP
 	{
-		vec4 lm = texture(uTexLightmap, gAtlasUV);
+#if LIGHTMAP_LIGHT_LAYERS>0
+		// relightable lightmap, the light layers are weighted by the current light colors
+		int lightmap_pages = textureSize(uTexLightmap, 0).z / (LIGHTMAP_LIGHT_LAYERS + 1);
+		vec4 lm = sample_lightmap(vec3(gAtlasUV.xy, gAtlasUV.z + float(LIGHTMAP_LIGHT_LAYERS * lightmap_pages)));
 		vec3 light_color = lm.w>0.0 ? lm.xyz/lm.w : vec3(0.0);
+#if NUM_DIRECTIONAL_LIGHTS>0
+		for (int i = 0; i < min(LIGHTMAP_LIGHT_LAYERS, NUM_DIRECTIONAL_LIGHTS); i++)
+		{
+			lm = sample_lightmap(vec3(gAtlasUV.xy, gAtlasUV.z + float(i * lightmap_pages)));
+			if (lm.w>0.0) light_color += lm.xyz/lm.w * uDirectionalLights[i].color.xyz;
+		}
+#endif
+#else
+		vec4 lm = sample_lightmap(gAtlasUV);
+		vec3 light_color = lm.w>0.0 ? lm.xyz/lm.w : vec3(0.0);
+#endif
 		diffuse += material.diffuseColor * light_color;
 		specular += material.specularColor * light_color;
 	}
@@ -714,7 +825,11 @@ bool calc_shading()
 }
 
 layout (binding=0, r32f) uniform image2D uImgDepth;
+#if NUM_LIGHT_CONFIGS>0
+layout (binding=1, rgba16f) uniform image2DArray uImgColorConfigs;
+#else
 layout (binding=1, rgba16f) uniform image2D uImgColor;
+#endif
 
 #if ALPHA_BLEND
 layout (binding=2, rgba16f) uniform image2D uImgOITColor;
@@ -757,6 +872,15 @@ void render()
 
 			float base_reveal = imageLoad(uImgOITReveal, g_id_io).x;
 			imageStore(uImgOITReveal, g_id_io, vec4((1-out_oit_reveal)*base_reveal));
+#elif NUM_LIGHT_CONFIGS>0
+			for (int c = 0; c < NUM_LIGHT_CONFIGS; c++)
+			{
+				imageStore(uImgColorConfigs, ivec3(g_id_io, c), out_configs[c]);
+			}
+#if ALPHA_MASK
+			imageStore(uImgDepth, g_id_io, vec4(g_ray_hit.t));
+#endif
+			break;
 #else
 			imageStore(uImgColor, g_id_io, out0);
 #if ALPHA_MASK
@@ -812,59 +936,19 @@ layout (std140, binding = BINDING_LIGHTMAP_RAY_LIST) uniform LightmapRayList
 	int uTexelsPerRow;
 	int uNumRows;
 	int uJitter;
+	int uSphere;
+	vec4 uRecordPosMin;
+	vec4 uRecordPosStep;
 };
 
-layout (location = LOCATION_TEX_LIGHTMAP_POS) uniform sampler2D uTexPosition;
-layout (location = LOCATION_TEX_LIGHTMAP_NORM) uniform sampler2D uTexNormal;
-layout (location = LOCATION_TEX_LIGHTMAP_VALID_LIST) uniform usamplerBuffer uValidList;
-
-uint InitRandomSeed(uint val0, uint val1)
-{
-	uint v0 = val0, v1 = val1, s0 = 0u;
-
-	for (uint n = 0u; n < 16u; n++)
-	{
-		s0 += 0x9e3779b9u;
-		v0 += ((v1 << 4) + 0xa341316cu) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4u);
-		v1 += ((v0 << 4) + 0xad90777du) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761eu);
-	}
-
-	return v0;
-}
-
-uint RandomInt(inout uint seed)
+layout (std430, binding = BINDING_LIGHTMAP_TEXEL_RECORDS) buffer TexelRecords
 {
-    return (seed = 1664525u * seed + 1013904223u);
-}
+	uvec4 texel_records[];
+};
 
-float RandomFloat(inout uint seed)
-{
-	return (float(RandomInt(seed) & 0x00FFFFFFu) / float(0x01000000));
-}
+#RECORD#
 
-vec3 RandomDirection(inout uint seed)
-{
-	float z = RandomFloat(seed) * 2.0 - 1.0;
-	float xy = sqrt(1.0 - z*z);
-	float alpha = RandomFloat(seed) * PI * 2.0;
-	return vec3(xy * cos(alpha), xy * sin(alpha), z);
-}
-
-vec3 RandomDiffuse(inout uint seed, in vec3 base_dir)
-{
-	vec3 dir = RandomDirection(seed);
-	float d = dot(dir, base_dir);
-	vec3 c = d * base_dir;
-	vec3 s = dir - c;
-	float z2 = clamp(abs(d), 0.0, 1.0);
-	float xy = sqrt(1.0 - z2);	
-	vec3 s_dir =  sqrt(z2) * base_dir;
-	if (length(s)>0.0)
-	{		
-		s_dir += xy * normalize(s);
-	}
-	return s_dir;
-}
+#RANDOM#
 
 void main()
 {
@@ -877,13 +961,20 @@ void main()
 
 	int idx_ray = g_id_io.x % uNumRays;
 
-	ivec2 texel_coord = ivec2(texelFetch(uValidList, idx_texel_in).xy);	
-	g_origin = texelFetch(uTexPosition, texel_coord, 0).xyz;
-	vec3 norm = texelFetch(uTexNormal, texel_coord, 0).xyz;
+	uvec4 rec = texel_records[idx_texel_in];
+	vec3 norm = record_normal(rec);
+	float surface_offset = record_offset(uRecordPosStep.xyz);
+	g_origin = record_position(rec, uRecordPosMin.xyz, uRecordPosStep.xyz) + norm * surface_offset;
 	uint seed = InitRandomSeed(uJitter, idx_texel_out * uNumRays +  idx_ray);
-	g_dir = RandomDiffuse(seed, norm);	
+	g_dir = uSphere != 0 ? RandomDirection(seed) : RandomDiffuse(seed, norm);	
+
+	// spread the origins over the texel, drawn after the direction so the sky passes see the same rays
+	float jitter_x = RandomFloat(seed);
+	float jitter_y = RandomFloat(seed);
+	vec2 offset = vec2(jitter_x, jitter_y) - 0.5;
+	g_origin += footprint_offset(rec, offset, uRecordPosStep.xyz);
 
-	g_tmin = 0.001;	
+	g_tmin = surface_offset;
 	g_tmax = 3.402823466e+38;
 	
 	render();
@@ -892,20 +983,6 @@ void main()
 )";
 
 
-inline void replace(std::string& str, const char* target, const char* source)
-{
-	int start = 0;
-	size_t target_len = strlen(target);
-	size_t source_len = strlen(source);
-	while (true)
-	{
-		size_t pos = str.find(target, start);
-		if (pos == std::string::npos) break;
-		str.replace(pos, target_len, source);
-		start = pos + source_len;
-	}
-}
-
 void BVHRoutine::s_generate_shaders(const Options& options, Bindings& bindings, std::string& s_compute)
 {		
 	s_compute = g_compute_part0 + g_compute_part1;
@@ -1183,6 +1260,48 @@ void BVHRoutine::s_generate_shaders(const Options& options, Bindings& bindings,
 		defines += line;
 	}
 
+	{
+		char line[64];
+		sprintf(line, "#define NUM_LIGHT_CONFIGS %d\n", options.num_light_configs);
+		defines += line;
+	}
+
+	if (options.relight_layers)
+	{
+		defines += "#define RELIGHT_LAYERS 1\n";
+	}
+	else
+	{
+		defines += "#define RELIGHT_LAYERS 0\n";
+	}
+
+	{
+		char line[64];
+		sprintf(line, "#define LIGHTMAP_LIGHT_LAYERS %d\n", options.lightmap_light_layers);
+		defines += line;
+	}
+
+	if (options.lightmap_rgbm)
+	{
+		defines += "#define LIGHTMAP_RGBM 1\n";
+		char line[64];
+		sprintf(line, "#define LIGHTMAP_RGBM_RANGE %f\n", LightmapCompressor::s_rgbm_range);
+		defines += line;
+	}
+	else
+	{
+		defines += "#define LIGHTMAP_RGBM 0\n";
+	}
+
+	if (options.indirect_only)
+	{
+		defines += "#define INDIRECT_ONLY 1\n";
+	}
+	else
+	{
+		defines += "#define INDIRECT_ONLY 0\n";
+	}
+
 	bindings.location_tex_directional_shadow = bindings.location_tex_glossiness + options.num_directional_shadows;
 
 	if (options.num_directional_shadows > 0)
@@ -1230,9 +1349,7 @@ void BVHRoutine::s_generate_shaders(const Options& options, Bindings& bindings,
 	else if (options.target_mode == 2)
 	{
 		bindings.binding_lightmap_ray_list = bindings.binding_directional_shadows + 1;
-		bindings.location_tex_lightmap_pos = bindings.location_tex_lightmap + 1;
-		bindings.location_tex_lightmap_norm = bindings.location_tex_lightmap_pos + 1;
-		bindings.location_tex_lightmap_valid_list = bindings.location_tex_lightmap_norm + 1;
+		bindings.binding_lightmap_texel_records = bindings.binding_lightmap_ray_list + 1;
 
 		{
 			char line[64];
@@ -1242,22 +1359,14 @@ void BVHRoutine::s_generate_shaders(const Options& options, Bindings& bindings,
 
 		{
 			char line[64];
-			sprintf(line, "#define LOCATION_TEX_LIGHTMAP_POS %d\n", bindings.location_tex_lightmap_pos);
-			defines += line;
-		}
-		{
-			char line[64];
-			sprintf(line, "#define LOCATION_TEX_LIGHTMAP_NORM %d\n", bindings.location_tex_lightmap_norm);
-			defines += line;
-		}
-		{
-			char line[64];
-			sprintf(line, "#define LOCATION_TEX_LIGHTMAP_VALID_LIST %d\n", bindings.location_tex_lightmap_valid_list);
+			sprintf(line, "#define BINDING_LIGHTMAP_TEXEL_RECORDS %d\n", bindings.binding_lightmap_texel_records);
 			defines += line;
 		}
 	}
 
 	replace(s_compute, "#DEFINES#", defines.c_str());
+	replace(s_compute, "#RECORD#", LightmapRenderTarget::s_glsl_record);
+	replace(s_compute, "#RANDOM#", LightmapRayList::s_glsl_random);
 }
 
 BVHRoutine::BVHRoutine(const Options& options) : m_options(options)
@@ -1391,37 +1500,71 @@ void BVHRoutine::render(const RenderParams& params)
 		texture_idx++;
 	}
 
-	if (m_options.num_directional_lights > 0)
+	if (m_options.num_light_configs > 0)
 	{
-		glBindBufferBase(GL_UNIFORM_BUFFER, m_bindings.binding_directional_lights, params.lights->constant_directional_lights->m_id);
-	}
+		const LightConfigs* configs = params.light_configs;
+		if (m_options.num_directional_lights > 0)
+		{
+			glBindBufferBase(GL_UNIFORM_BUFFER, m_bindings.binding_directional_lights, configs->constant_directional_lights->m_id);
+		}
 
-	if (m_options.num_directional_shadows > 0)
-	{		
-		glBindBufferBase(GL_UNIFORM_BUFFER, m_bindings.binding_directional_shadows, params.lights->constant_directional_shadows->m_id);
+		if (m_options.num_directional_shadows > 0)
+		{
+			glBindBufferBase(GL_UNIFORM_BUFFER, m_bindings.binding_directional_shadows, configs->constant_directional_shadows->m_id);
 
-		std::vector<int> values(m_options.num_directional_shadows);
-		for (int i = 0; i < m_options.num_directional_shadows; i++)
+			std::vector<int> values(m_options.num_directional_shadows);
+			for (int i = 0; i < m_options.num_directional_shadows; i++)
+			{
+				glActiveTexture(GL_TEXTURE0 + texture_idx);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, configs->directional_shadow_arrays[i]->tex_id);
+				values[i] = texture_idx;
+				texture_idx++;
+			}
+			int start_idx = m_bindings.location_tex_directional_shadow - m_options.num_directional_shadows + 1;
+			glUniform1iv(start_idx, m_options.num_directional_shadows, values.data());
+		}
+	}
+	else
+	{
+		if (m_options.num_directional_lights > 0)
 		{
-			glActiveTexture(GL_TEXTURE0 + texture_idx);			
-			glBindTexture(GL_TEXTURE_2D, params.lights->directional_shadow_texs[i]);
-			values[i] = texture_idx;
-			texture_idx++;
+			glBindBufferBase(GL_UNIFORM_BUFFER, m_bindings.binding_directional_lights, params.lights->constant_directional_lights->m_id);
+		}
+
+		if (m_options.num_directional_shadows > 0)
+		{		
+			glBindBufferBase(GL_UNIFORM_BUFFER, m_bindings.binding_directional_shadows, params.lights->constant_directional_shadows->m_id);
+
+			std::vector<int> values(m_options.num_directional_shadows);
+			for (int i = 0; i < m_options.num_directional_shadows; i++)
+			{
+				glActiveTexture(GL_TEXTURE0 + texture_idx);			
+				glBindTexture(GL_TEXTURE_2D, params.lights->directional_shadow_texs[i]);
+				values[i] = texture_idx;
+				texture_idx++;
+			}
+			int start_idx = m_bindings.location_tex_directional_shadow - m_options.num_directional_shadows + 1;
+			glUniform1iv(start_idx, m_options.num_directional_shadows, values.data());
 		}
-		int start_idx = m_bindings.location_tex_directional_shadow - m_options.num_directional_shadows + 1;
-		glUniform1iv(start_idx, m_options.num_directional_shadows, values.data());
 	}
 
 	if (m_options.has_lightmap)
 	{		
 		glActiveTexture(GL_TEXTURE0 + texture_idx);
-		glBindTexture(GL_TEXTURE_2D, params.tex_lightmap->tex_id);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, params.tex_lightmap->tex_id);
 		glUniform1i(m_bindings.location_tex_lightmap, texture_idx);
 		texture_idx++;
 	}
 
 	glBindImageTexture(0, target->m_tex_depth->tex_id, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32F);
-	glBindImageTexture(1, target->m_tex_video->tex_id, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	if (m_options.num_light_configs > 0)
+	{
+		glBindImageTexture(1, target->m_tex_video_configs->tex_id, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	}
+	else
+	{
+		glBindImageTexture(1, target->m_tex_video->tex_id, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	}
 
 	if (m_options.alpha_mode == AlphaMode::Blend)
 	{
@@ -1439,27 +1582,7 @@ void BVHRoutine::render(const RenderParams& params)
 	else if (m_options.target_mode == 2)
 	{
 		glBindBufferBase(GL_UNIFORM_BUFFER, m_bindings.binding_lightmap_ray_list, params.lmrl->m_constant.m_id);		
-
-		{
-			glActiveTexture(GL_TEXTURE0 + texture_idx);
-			glBindTexture(GL_TEXTURE_2D, params.lmrl->source->m_tex_position->tex_id);
-			glUniform1i(m_bindings.location_tex_lightmap_pos, texture_idx);
-			texture_idx++;
-		}
-
-		{
-			glActiveTexture(GL_TEXTURE0 + texture_idx);
-			glBindTexture(GL_TEXTURE_2D, params.lmrl->source->m_tex_normal->tex_id);
-			glUniform1i(m_bindings.location_tex_lightmap_norm, texture_idx);
-			texture_idx++;
-		}
-
-		{
-			glActiveTexture(GL_TEXTURE0 + texture_idx);
-			glBindTexture(GL_TEXTURE_BUFFER, params.lmrl->source->valid_list->tex_id);
-			glUniform1i(m_bindings.location_tex_lightmap_valid_list, texture_idx);
-			texture_idx++;
-		}
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, m_bindings.binding_lightmap_texel_records, params.lmrl->source->texel_records->m_id);
 
 		glm::ivec2 blocks = { (width + 63) / 64, height };
 		glDispatchCompute(blocks.x, blocks.y, 1);
@@ -32,6 +32,11 @@ public:
 		bool has_glossiness_map = false;
 		int num_directional_lights = 0;
 		int num_directional_shadows = 0;
+		int num_light_configs = 0;
+		bool relight_layers = false;
+		int lightmap_light_layers = 0;
+		bool lightmap_rgbm = false; // LightmapFormat::RGBM8, BC6H is sampled like RGBA16F
+		bool indirect_only = false; // hits return no emissive light
 	};
 
 	BVHRoutine(const Options& options);
@@ -43,11 +48,14 @@ public:
 		const GLDynBuffer* constant_model;
 		const Primitive* primitive;
 		const Lights* lights;
-		const GLTexture2D* tex_lightmap;
+		const GLTexture2DArray* tex_lightmap;
 
 		const BVHRenderTarget* target;
 		const GLDynBuffer* constant_camera;
 		const LightmapRayList* lmrl;
+		const LightConfigs* light_configs = nullptr;
+		int lightmap_light_layers = 0;
+		bool lightmap_rgbm = false;
 	};
 
 	void render(const RenderParams& params);
@@ -78,9 +86,7 @@ private:
 		int location_tex_lightmap;
 		int binding_camera;
 		int binding_lightmap_ray_list;		
-		int location_tex_lightmap_pos;
-		int location_tex_lightmap_norm;
-		int location_tex_lightmap_valid_list;
+		int binding_lightmap_texel_records;
 	};
 
 	Bindings m_bindings;
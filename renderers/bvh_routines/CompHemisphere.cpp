@@ -4,6 +4,8 @@
 #include "CompHemisphere.h"
 #include "renderers/BVHRenderTarget.h"
 #include "renderers/LightmapRayList.h"
+#include "renderers/LightmapRenderTarget.h"
+#include "utils/Utils.h"
 
 static std::string g_compute =
 R"(#version 430
@@ -66,61 +68,21 @@ layout (std140, binding = 1) uniform LightmapRayList
 	int uTexelsPerRow;
 	int uNumRows;
 	int uJitter;
+	int uSphere;
+	vec4 uRecordPosMin;
+	vec4 uRecordPosStep;
 };
 
-layout (location = 0) uniform sampler2D uTexNormal;
-layout (location = 1) uniform usamplerBuffer uValidList;
-
-#define PI 3.14159265359
-
-uint InitRandomSeed(uint val0, uint val1)
-{
-	uint v0 = val0, v1 = val1, s0 = 0u;
-
-	for (uint n = 0u; n < 16u; n++)
-	{
-		s0 += 0x9e3779b9u;
-		v0 += ((v1 << 4) + 0xa341316cu) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4u);
-		v1 += ((v0 << 4) + 0xad90777du) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761eu);
-	}
-
-	return v0;
-}
-
-uint RandomInt(inout uint seed)
+layout (std430, binding = 0) buffer TexelRecords
 {
-    return (seed = 1664525u * seed + 1013904223u);
-}
-
-float RandomFloat(inout uint seed)
-{
-	return (float(RandomInt(seed) & 0x00FFFFFFu) / float(0x01000000));
-}
+	uvec4 texel_records[];
+};
 
+#RECORD#
 
-vec3 RandomDirection(inout uint seed)
-{
-	float z = RandomFloat(seed) * 2.0 - 1.0;
-	float xy = sqrt(1.0 - z*z);
-	float alpha = RandomFloat(seed) * PI * 2.0;
-	return vec3(xy * cos(alpha), xy * sin(alpha), z);
-}
+#define PI 3.14159265359
 
-vec3 RandomDiffuse(inout uint seed, in vec3 base_dir)
-{
-	vec3 dir = RandomDirection(seed);
-	float d = dot(dir, base_dir);
-	vec3 c = d * base_dir;
-	vec3 s = dir - c;
-	float z2 = clamp(abs(d), 0.0, 1.0);
-	float xy = sqrt(1.0 - z2);	
-	vec3 s_dir =  sqrt(z2) * base_dir;
-	if (length(s)>0.0)
-	{		
-		s_dir += xy * normalize(s);
-	}
-	return s_dir;
-}
+#RANDOM#
 
 void main()
 {
@@ -133,10 +95,9 @@ void main()
 
 	int idx_ray = g_id_io.x % uNumRays;
 
-	ivec2 texel_coord = ivec2(texelFetch(uValidList, idx_texel_in).xy);
-	vec3 norm = texelFetch(uTexNormal, texel_coord, 0).xyz;
+	vec3 norm = record_normal(texel_records[idx_texel_in]);
 	uint seed = InitRandomSeed(uJitter, idx_texel_out * uNumRays +  idx_ray);
-	g_dir = RandomDiffuse(seed, norm);	
+	g_dir = uSphere != 0 ? RandomDirection(seed) : RandomDiffuse(seed, norm);	
 
 	render();	
 
@@ -146,20 +107,6 @@ void main()
 )";
 
 
-inline void replace(std::string& str, const char* target, const char* source)
-{
-	int start = 0;
-	size_t target_len = strlen(target);
-	size_t source_len = strlen(source);
-	while (true)
-	{
-		size_t pos = str.find(target, start);
-		if (pos == std::string::npos) break;
-		str.replace(pos, target_len, source);
-		start = pos + source_len;
-	}
-}
-
 CompHemisphere::CompHemisphere(int target_mode) : m_target_mode(target_mode)
 {
 	std::string s_compute = g_compute;
@@ -184,6 +131,8 @@ CompHemisphere::CompHemisphere(int target_mode) : m_target_mode(target_mode)
 	}
 	
 	replace(s_compute, "#DEFINES#", defines.c_str());
+	replace(s_compute, "#RECORD#", LightmapRenderTarget::s_glsl_record);
+	replace(s_compute, "#RANDOM#", LightmapRayList::s_glsl_random);
 
 	GLShader comp_shader(GL_COMPUTE_SHADER, s_compute.c_str());
 	m_prog = (std::unique_ptr<GLProgram>)(new GLProgram(comp_shader));
@@ -224,13 +173,7 @@ void CompHemisphere::render(const LightmapRayList* lmrl, const GLDynBuffer* cons
 
 	glBindBufferBase(GL_UNIFORM_BUFFER, 1, lmrl->m_constant.m_id);	
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, lmrl->source->m_tex_normal->tex_id);
-	glUniform1i(0, 0);
-
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_BUFFER, lmrl->source->valid_list->tex_id);
-	glUniform1i(1, 1);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, lmrl->source->texel_records->m_id);
 
 	int block_x = (target->m_width + 63) / 64;
 	glDispatchCompute(block_x, target->m_height, 1);
@@ -0,0 +1,93 @@
+#include <GL/glew.h>
+#include "FlagScan.h"
+
+static std::string g_compute =
+R"(#version 430
+
+layout (location = 0) uniform int uCount;
+
+layout (std430, binding = 0) buffer Flags
+{
+	uint flags[];
+};
+
+layout (std430, binding = 1) buffer Offsets
+{
+	uint offsets[];
+};
+
+layout (std430, binding = 2) buffer TotalCount
+{
+	uint total_count;
+};
+
+shared uint s_sums[1024];
+
+layout(local_size_x = 1024) in;
+
+void main()
+{
+	int id = int(gl_LocalInvocationID.x);
+	int per_thread = (uCount + 1023) / 1024;
+	int begin = min(id * per_thread, uCount);
+	int end = min(begin + per_thread, uCount);
+
+	uint sum = 0;
+	for (int i = begin; i < end; i++)
+	{
+		sum += flags[i];
+	}
+	s_sums[id] = sum;
+	barrier();
+
+	for (int offset = 1; offset < 1024; offset <<= 1)
+	{
+		uint v = id >= offset ? s_sums[id - offset] : 0;
+		barrier();
+		s_sums[id] += v;
+		barrier();
+	}
+
+	uint acc = s_sums[id] - sum;
+	for (int i = begin; i < end; i++)
+	{
+		offsets[i] = acc;
+		acc += flags[i];
+	}
+
+	if (id == 1023)
+	{
+		total_count = s_sums[id];
+	}
+}
+)";
+
+FlagScan::FlagScan()
+{
+	GLShader comp_shader(GL_COMPUTE_SHADER, g_compute.c_str());
+	m_prog = (std::unique_ptr<GLProgram>)(new GLProgram(comp_shader));
+}
+
+int FlagScan::scan(int count, const GLBuffer& flags, const GLBuffer& offsets)
+{
+	GLBuffer total_count(sizeof(unsigned), GL_SHADER_STORAGE_BUFFER);
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(m_prog->m_id);
+	glUniform1i(0, count);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, flags.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, offsets.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, total_count.m_id);
+	glDispatchCompute(1, 1, 1);
+	glUseProgram(0);
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	unsigned total = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, total_count.m_id);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(unsigned), &total);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	return (int)total;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "renderers/GLUtils.h"
+
+class FlagScan
+{
+public:
+	FlagScan();
+
+	// Exclusive prefix sum of count 0/1 flags into offsets, in a single workgroup.
+	// Returns the number of set flags, the only value read back.
+	int scan(int count, const GLBuffer& flags, const GLBuffer& offsets);
+
+private:
+	std::unique_ptr<GLProgram> m_prog;
+
+};
+
@@ -0,0 +1,645 @@
+#include <GL/glew.h>
+#include <cstring>
+#include <glm.hpp>
+#include "LightmapCompact.h"
+#include "renderers/LightmapRenderTarget.h"
+#include "utils/Utils.h"
+
+static std::string g_compute_common =
+R"(#version 430
+
+layout (location = 0) uniform sampler2D uTexPosition;
+layout (location = 1) uniform sampler2D uTexNormal;
+
+uint compact1by1(uint x)
+{
+	x &= 0x55555555u;
+	x = (x ^ (x >> 1)) & 0x33333333u;
+	x = (x ^ (x >> 2)) & 0x0f0f0f0fu;
+	x = (x ^ (x >> 4)) & 0x00ff00ffu;
+	x = (x ^ (x >> 8)) & 0x0000ffffu;
+	return x;
+}
+
+uint part1by1(uint x)
+{
+	x &= 0x0000ffffu;
+	x = (x ^ (x << 8)) & 0x00ff00ffu;
+	x = (x ^ (x << 4)) & 0x0f0f0f0fu;
+	x = (x ^ (x << 2)) & 0x33333333u;
+	x = (x ^ (x << 1)) & 0x55555555u;
+	return x;
+}
+
+ivec2 g_texel_coord;
+
+bool is_valid()
+{
+	uint local_code = gl_LocalInvocationIndex;
+	ivec2 local_id = ivec2(compact1by1(local_code), compact1by1(local_code >> 1));
+	g_texel_coord = ivec2(gl_WorkGroupID.xy) * 16 + local_id;
+
+	ivec2 size = textureSize(uTexPosition, 0);
+	if (g_texel_coord.x >= size.x || g_texel_coord.y >= size.y) return false;
+	return texelFetch(uTexPosition, g_texel_coord, 0).w > 0.5;
+}
+
+uint tile_code()
+{
+	return part1by1(gl_WorkGroupID.x) | (part1by1(gl_WorkGroupID.y) << 1);
+}
+
+// monotonic mapping of floats to uints, so bounds can be found with integer atomics
+uint float_to_ordered(float f)
+{
+	uint u = floatBitsToUint(f);
+	return (u & 0x80000000u) != 0u ? ~u : (u | 0x80000000u);
+}
+)";
+
+static std::string g_compute_count = g_compute_common +
+R"(
+layout (std430, binding = 0) buffer TileCounts
+{
+	uint tile_counts[];
+};
+
+layout (std430, binding = 1) buffer Summary
+{
+	uint total_count;
+	uint bounds_min[3];
+	uint bounds_max[3];
+};
+
+shared uint s_count;
+shared uint s_min[3];
+shared uint s_max[3];
+
+layout(local_size_x = 256) in;
+
+void main()
+{
+	if (gl_LocalInvocationIndex == 0)
+	{
+		s_count = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			s_min[i] = 0xffffffffu;
+			s_max[i] = 0u;
+		}
+	}
+	barrier();
+
+	if (is_valid())
+	{
+		atomicAdd(s_count, 1);
+		vec3 pos = texelFetch(uTexPosition, g_texel_coord, 0).xyz;
+		for (int i = 0; i < 3; i++)
+		{
+			uint v = float_to_ordered(pos[i]);
+			atomicMin(s_min[i], v);
+			atomicMax(s_max[i], v);
+		}
+	}
+	barrier();
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		tile_counts[tile_code()] = s_count;
+		if (s_count > 0)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				atomicMin(bounds_min[i], s_min[i]);
+				atomicMax(bounds_max[i], s_max[i]);
+			}
+		}
+	}
+}
+)";
+
+static std::string g_compute_scan =
+R"(#version 430
+
+layout (location = 0) uniform int uNumTiles;
+
+layout (std430, binding = 0) buffer TileCounts
+{
+	uint tile_counts[];
+};
+
+layout (std430, binding = 1) buffer TotalCount
+{
+	uint total_count;
+};
+
+shared uint s_sums[1024];
+
+layout(local_size_x = 1024) in;
+
+void main()
+{
+	int id = int(gl_LocalInvocationID.x);
+	int per_thread = (uNumTiles + 1023) / 1024;
+	int begin = min(id * per_thread, uNumTiles);
+	int end = min(begin + per_thread, uNumTiles);
+
+	uint sum = 0;
+	for (int i = begin; i < end; i++)
+	{
+		sum += tile_counts[i];
+	}
+	s_sums[id] = sum;
+	barrier();
+
+	for (int offset = 1; offset < 1024; offset <<= 1)
+	{
+		uint v = id >= offset ? s_sums[id - offset] : 0;
+		barrier();
+		s_sums[id] += v;
+		barrier();
+	}
+
+	uint acc = s_sums[id] - sum;
+	for (int i = begin; i < end; i++)
+	{
+		uint count = tile_counts[i];
+		tile_counts[i] = acc;
+		acc += count;
+	}
+
+	if (id == 1023)
+	{
+		total_count = s_sums[id];
+	}
+}
+)";
+
+static std::string g_compute_scatter = g_compute_common +
+R"(
+layout (std430, binding = 0) buffer TileOffsets
+{
+	uint tile_offsets[];
+};
+
+layout (std430, binding = 1) buffer TexelRecords
+{
+	uvec4 texel_records[];
+};
+
+layout (binding = 0, r32ui) uniform uimage2D uRecordIndex;
+layout (location = 4) uniform sampler2D uTexDpdx;
+layout (location = 5) uniform sampler2D uTexDpdy;
+
+layout (location = 2) uniform vec3 uPosMin;
+layout (location = 3) uniform vec3 uPosInvStep;
+layout (location = 6) uniform vec3 uPosStep;
+
+#RECORD#
+
+// texels touching the chart border get no footprint, so jittered origins stay on the chart
+bool is_interior()
+{
+	ivec2 size = textureSize(uTexPosition, 0);
+	for (int dy = -1; dy <= 1; dy++)
+	{
+		for (int dx = -1; dx <= 1; dx++)
+		{
+			ivec2 c = g_texel_coord + ivec2(dx, dy);
+			if (c.x < 0 || c.y < 0 || c.x >= size.x || c.y >= size.y) return false;
+			if (texelFetch(uTexPosition, c, 0).w <= 0.5) return false;
+		}
+	}
+	return true;
+}
+
+shared uint s_flags[256];
+
+layout(local_size_x = 256) in;
+
+void main()
+{
+	int id = int(gl_LocalInvocationIndex);
+	bool valid = is_valid();
+	s_flags[id] = valid ? 1 : 0;
+	barrier();
+
+	for (int offset = 1; offset < 256; offset <<= 1)
+	{
+		uint v = id >= offset ? s_flags[id - offset] : 0;
+		barrier();
+		s_flags[id] += v;
+		barrier();
+	}
+
+	if (valid)
+	{
+		uint idx = tile_offsets[tile_code()] + s_flags[id] - 1;
+		vec3 pos = texelFetch(uTexPosition, g_texel_coord, 0).xyz;
+		vec3 norm = texelFetch(uTexNormal, g_texel_coord, 0).xyz;
+		vec3 dpdx = texelFetch(uTexDpdx, g_texel_coord, 0).xyz;
+		vec3 dpdy = texelFetch(uTexDpdy, g_texel_coord, 0).xyz;
+		uvec4 rec = pack_record(g_texel_coord, pos, norm, 0u, uPosMin, uPosInvStep);
+		if (is_interior()) rec.y |= footprint_code(dpdx, dpdy, record_normal(rec), uPosStep) << 20;
+		texel_records[idx] = rec;
+		imageStore(uRecordIndex, g_texel_coord, uvec4(idx + 1));
+	}
+}
+)";
+
+// Charts are the 8-connected islands of covered texels, xatlas padding keeps them apart.
+// They are labelled by a union-find over the records, the root of a chart being its first record in Morton order.
+static std::string g_compute_chart_common =
+R"(#version 430
+
+layout (location = 0) uniform int uCount;
+
+layout (std430, binding = 0) coherent buffer ChartLabels
+{
+	uint labels[];
+};
+
+uint find_root(uint x)
+{
+	uint p = labels[x];
+	while (p != x)
+	{
+		x = p;
+		p = labels[x];
+	}
+	return x;
+}
+)";
+
+static std::string g_compute_chart_init = g_compute_chart_common +
+R"(
+layout(local_size_x = 256) in;
+
+void main()
+{
+	uint idx = gl_GlobalInvocationID.x;
+	if (idx >= uint(uCount)) return;
+	labels[idx] = idx;
+}
+)";
+
+static std::string g_compute_chart_link = g_compute_chart_common +
+R"(
+layout (location = 1) uniform usampler2D uTexRecordIndex;
+
+layout (std430, binding = 1) buffer TexelRecords
+{
+	uvec4 texel_records[];
+};
+
+#RECORD#
+
+// parents only ever move to lower indices, so the labels stay a forest
+void link(uint a, uint b)
+{
+	while (true)
+	{
+		a = find_root(a);
+		b = find_root(b);
+		if (a == b) return;
+		if (a > b)
+		{
+			uint t = a;
+			a = b;
+			b = t;
+		}
+		uint old = atomicMin(labels[b], a);
+		if (old == b) return;
+		b = old;
+	}
+}
+
+layout(local_size_x = 256) in;
+
+void main()
+{
+	uint idx = gl_GlobalInvocationID.x;
+	if (idx >= uint(uCount)) return;
+
+	ivec2 coord = record_coord(texel_records[idx]);
+	ivec2 size = textureSize(uTexRecordIndex, 0);
+
+	// the other 4 neighbors link from their side
+	const ivec2 offsets[4] = ivec2[4](ivec2(-1, 0), ivec2(-1, -1), ivec2(0, -1), ivec2(1, -1));
+	for (int k = 0; k < 4; k++)
+	{
+		ivec2 c = coord + offsets[k];
+		if (c.x < 0 || c.y < 0 || c.x >= size.x) continue;
+		uint idx1 = texelFetch(uTexRecordIndex, c, 0).x;
+		if (idx1 != 0u) link(idx, idx1 - 1u);
+	}
+}
+)";
+
+static std::string g_compute_chart_keys = g_compute_chart_common +
+R"(
+layout (location = 1) uniform int uNumKeys;
+
+layout (std430, binding = 1) buffer SortKeys
+{
+	uvec2 keys[];
+};
+
+layout(local_size_x = 256) in;
+
+void main()
+{
+	uint idx = gl_GlobalInvocationID.x;
+	if (idx >= uint(uNumKeys)) return;
+	keys[idx] = idx < uint(uCount) ? uvec2(find_root(idx), idx) : uvec2(0xffffffffu);
+}
+)";
+
+// one compare-exchange step of a bitonic sort over (chart, Morton rank) keys
+static std::string g_compute_bitonic =
+R"(#version 430
+
+layout (location = 0) uniform uint uBlock;
+layout (location = 1) uniform uint uStride;
+
+layout (std430, binding = 0) buffer SortKeys
+{
+	uvec2 keys[];
+};
+
+layout(local_size_x = 256) in;
+
+void main()
+{
+	uint idx = gl_GlobalInvocationID.x;
+	uint idx1 = idx ^ uStride;
+	if (idx1 <= idx) return;
+
+	uvec2 a = keys[idx];
+	uvec2 b = keys[idx1];
+	bool greater = a.x > b.x || (a.x == b.x && a.y > b.y);
+	bool ascending = (idx & uBlock) == 0u;
+	if (greater == ascending)
+	{
+		keys[idx] = b;
+		keys[idx1] = a;
+	}
+}
+)";
+
+static std::string g_compute_permute =
+R"(#version 430
+
+layout (location = 0) uniform int uCount;
+
+layout (std430, binding = 0) buffer SortKeys
+{
+	uvec2 keys[];
+};
+
+layout (std430, binding = 1) buffer RecordsIn
+{
+	uvec4 records_in[];
+};
+
+layout (std430, binding = 2) buffer RecordsOut
+{
+	uvec4 records_out[];
+};
+
+layout (binding = 0, r32ui) uniform uimage2D uRecordIndex;
+
+#RECORD#
+
+layout(local_size_x = 256) in;
+
+void main()
+{
+	uint idx = gl_GlobalInvocationID.x;
+	if (idx >= uint(uCount)) return;
+
+	uint idx_in = keys[idx].y;
+	uvec4 rec = records_in[idx_in];
+	records_out[idx] = rec;
+	imageStore(uRecordIndex, record_coord(rec), uvec4(idx + 1));
+}
+)";
+
+LightmapCompact::LightmapCompact()
+{
+	GLShader comp_count(GL_COMPUTE_SHADER, g_compute_count.c_str());
+	m_prog_count = (std::unique_ptr<GLProgram>)(new GLProgram(comp_count));
+
+	GLShader comp_scan(GL_COMPUTE_SHADER, g_compute_scan.c_str());
+	m_prog_scan = (std::unique_ptr<GLProgram>)(new GLProgram(comp_scan));
+
+	std::string s_scatter = g_compute_scatter;
+	replace(s_scatter, "#RECORD#", LightmapRenderTarget::s_glsl_record);
+	GLShader comp_scatter(GL_COMPUTE_SHADER, s_scatter.c_str());
+	m_prog_scatter = (std::unique_ptr<GLProgram>)(new GLProgram(comp_scatter));
+
+	GLShader comp_chart_init(GL_COMPUTE_SHADER, g_compute_chart_init.c_str());
+	m_prog_chart_init = (std::unique_ptr<GLProgram>)(new GLProgram(comp_chart_init));
+
+	std::string s_chart_link = g_compute_chart_link;
+	replace(s_chart_link, "#RECORD#", LightmapRenderTarget::s_glsl_record);
+	GLShader comp_chart_link(GL_COMPUTE_SHADER, s_chart_link.c_str());
+	m_prog_chart_link = (std::unique_ptr<GLProgram>)(new GLProgram(comp_chart_link));
+
+	GLShader comp_chart_keys(GL_COMPUTE_SHADER, g_compute_chart_keys.c_str());
+	m_prog_chart_keys = (std::unique_ptr<GLProgram>)(new GLProgram(comp_chart_keys));
+
+	GLShader comp_bitonic(GL_COMPUTE_SHADER, g_compute_bitonic.c_str());
+	m_prog_bitonic = (std::unique_ptr<GLProgram>)(new GLProgram(comp_bitonic));
+
+	std::string s_permute = g_compute_permute;
+	replace(s_permute, "#RECORD#", LightmapRenderTarget::s_glsl_record);
+	GLShader comp_permute(GL_COMPUTE_SHADER, s_permute.c_str());
+	m_prog_permute = (std::unique_ptr<GLProgram>)(new GLProgram(comp_permute));
+}
+
+inline float ordered_to_float(unsigned u)
+{
+	u = (u & 0x80000000u) != 0 ? (u & 0x7fffffffu) : ~u;
+	float f;
+	memcpy(&f, &u, sizeof(float));
+	return f;
+}
+
+int LightmapCompact::compact(const RenderParams& params, const Output& output)
+{
+	glm::ivec2 tiles = { (params.width + 15) / 16, (params.height + 15) / 16 };
+	int side = 1;
+	while (side < tiles.x || side < tiles.y) side <<= 1;
+	int num_tiles = side * side;
+
+	GLBuffer tile_counts(sizeof(unsigned) * num_tiles, GL_SHADER_STORAGE_BUFFER);
+
+	// total_count, bounds_min[3], bounds_max[3]
+	unsigned summary_init[7] = { 0, 0xffffffffu, 0xffffffffu, 0xffffffffu, 0, 0, 0 };
+	GLBuffer summary(sizeof(summary_init), GL_SHADER_STORAGE_BUFFER);
+	summary.upload(summary_init);
+
+	unsigned zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, tile_counts.m_id);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glUseProgram(m_prog_count->m_id);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, params.atlas_position->tex_id);
+	glUniform1i(0, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, tile_counts.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, summary.m_id);
+	glDispatchCompute(tiles.x, tiles.y, 1);
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(m_prog_scan->m_id);
+	glUniform1i(0, num_tiles);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, tile_counts.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, summary.m_id);
+	glDispatchCompute(1, 1, 1);
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	unsigned summary_out[7];
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, summary.m_id);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(summary_out), summary_out);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	unsigned count = summary_out[0];
+
+	glm::vec3 pos_min = glm::vec3(0.0f);
+	glm::vec3 pos_step = glm::vec3(0.0f);
+	glm::vec3 pos_inv_step = glm::vec3(0.0f);
+	if (count > 0)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			pos_min[i] = ordered_to_float(summary_out[1 + i]);
+			float extent = ordered_to_float(summary_out[4 + i]) - pos_min[i];
+			if (extent > 0.0f)
+			{
+				pos_step[i] = extent / 2097151.0f;
+				pos_inv_step[i] = 2097151.0f / extent;
+			}
+		}
+	}
+	*output.pos_min = pos_min;
+	*output.pos_step = pos_step;
+
+	std::unique_ptr<GLBuffer>& texel_records = *output.texel_records;
+	texel_records = std::unique_ptr<GLBuffer>(new GLBuffer(sizeof(unsigned) * 4 * (count > 0 ? count : 1), GL_SHADER_STORAGE_BUFFER));
+
+	std::unique_ptr<GLTexture2D>& tex_record_index = *output.tex_record_index;
+	tex_record_index = std::unique_ptr<GLTexture2D>(new GLTexture2D);
+	glBindTexture(GL_TEXTURE_2D, tex_record_index->tex_id);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, params.width, params.height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glClearTexImage(tex_record_index->tex_id, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+	if (count > 0)
+	{
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glUseProgram(m_prog_scatter->m_id);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, params.atlas_position->tex_id);
+		glUniform1i(0, 0);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, params.atlas_normal->tex_id);
+		glUniform1i(1, 1);
+		glUniform3fv(2, 1, (float*)&pos_min);
+		glUniform3fv(3, 1, (float*)&pos_inv_step);
+		glUniform3fv(6, 1, (float*)&pos_step);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, params.atlas_dpdx->tex_id);
+		glUniform1i(4, 2);
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D, params.atlas_dpdy->tex_id);
+		glUniform1i(5, 3);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, tile_counts.m_id);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, texel_records->m_id);
+		glBindImageTexture(0, tex_record_index->tex_id, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32UI);
+		glDispatchCompute(tiles.x, tiles.y, 1);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		_sort_by_chart((int)count, output);
+	}
+
+	glUseProgram(0);
+
+	return (int)count;
+}
+
+void LightmapCompact::_sort_by_chart(int count, const Output& output)
+{
+	int num_keys = 1;
+	while (num_keys < count) num_keys <<= 1;
+
+	GLBuffer labels(sizeof(unsigned) * count, GL_SHADER_STORAGE_BUFFER);
+	GLBuffer keys(sizeof(unsigned) * 2 * num_keys, GL_SHADER_STORAGE_BUFFER);
+
+	GLBuffer& records_in = **output.texel_records;
+	GLTexture2D& tex_record_index = **output.tex_record_index;
+
+	int num_blocks = (count + 255) / 256;
+
+	glUseProgram(m_prog_chart_init->m_id);
+	glUniform1i(0, count);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, labels.m_id);
+	glDispatchCompute(num_blocks, 1, 1);
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(m_prog_chart_link->m_id);
+	glUniform1i(0, count);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, tex_record_index.tex_id);
+	glUniform1i(1, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, labels.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, records_in.m_id);
+	glDispatchCompute(num_blocks, 1, 1);
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(m_prog_chart_keys->m_id);
+	glUniform1i(0, count);
+	glUniform1i(1, num_keys);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, labels.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, keys.m_id);
+	glDispatchCompute((num_keys + 255) / 256, 1, 1);
+
+	glUseProgram(m_prog_bitonic->m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, keys.m_id);
+	for (int block = 2; block <= num_keys; block <<= 1)
+	{
+		for (int stride = block >> 1; stride > 0; stride >>= 1)
+		{
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			glUniform1ui(0, (unsigned)block);
+			glUniform1ui(1, (unsigned)stride);
+			glDispatchCompute((num_keys + 255) / 256, 1, 1);
+		}
+	}
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	std::unique_ptr<GLBuffer> records_out(new GLBuffer(sizeof(unsigned) * 4 * count, GL_SHADER_STORAGE_BUFFER));
+
+	glUseProgram(m_prog_permute->m_id);
+	glUniform1i(0, count);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, keys.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, records_in.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, records_out->m_id);
+	glBindImageTexture(0, tex_record_index.tex_id, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32UI);
+	glDispatchCompute(num_blocks, 1, 1);
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	*output.texel_records = std::move(records_out);
+}
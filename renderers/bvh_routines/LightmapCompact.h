@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <glm.hpp>
+
+#include "renderers/GLUtils.h"
+
+class LightmapCompact
+{
+public:
+	LightmapCompact();
+
+	struct RenderParams
+	{
+		int width;
+		int height;
+		const GLTexture2D* atlas_position;
+		const GLTexture2D* atlas_normal;
+		const GLTexture2D* atlas_dpdx;
+		const GLTexture2D* atlas_dpdy;
+	};
+
+	struct Output
+	{
+		std::unique_ptr<GLBuffer>* texel_records;
+		std::unique_ptr<GLTexture2D>* tex_record_index;
+		glm::vec3* pos_min;
+		glm::vec3* pos_step;
+	};
+
+	// Builds the packed records of the covered texels on the GPU, ordered by chart, then by Morton code
+	// of 16x16 tiles and of the texels inside a tile. Only the texel count and the position bounds are read back.
+	int compact(const RenderParams& params, const Output& output);
+
+private:
+	std::unique_ptr<GLProgram> m_prog_count;
+	std::unique_ptr<GLProgram> m_prog_scan;
+	std::unique_ptr<GLProgram> m_prog_scatter;
+	std::unique_ptr<GLProgram> m_prog_chart_init;
+	std::unique_ptr<GLProgram> m_prog_chart_link;
+	std::unique_ptr<GLProgram> m_prog_chart_keys;
+	std::unique_ptr<GLProgram> m_prog_bitonic;
+	std::unique_ptr<GLProgram> m_prog_permute;
+
+	// reorders the Morton-ordered records by chart, keeping the Morton order inside each chart
+	void _sort_by_chart(int count, const Output& output);
+
+};
+
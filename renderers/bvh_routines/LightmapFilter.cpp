@@ -1,15 +1,35 @@
 #include <GL/glew.h>
 #include <glm.hpp>
 #include "LightmapFilter.h"
+#include "renderers/LightmapRenderTarget.h"
+#include "utils/Utils.h"
 
 static std::string g_compute =
 R"(#version 430
 
-layout (location = 0) uniform sampler2D uTexSource;
-layout (location = 1) uniform sampler2D uTexPosition;
+layout (location = 0) uniform sampler2DArray uTexSource;
+layout (location = 1) uniform usampler2D uTexRecordIndex;
 layout (binding=0, rgba16f) uniform image2D uOut;
 
 layout (location = 2) uniform float uTexelSize;
+layout (location = 3) uniform int uPageIn;
+layout (location = 4) uniform vec3 uRecordPosMin;
+layout (location = 5) uniform vec3 uRecordPosStep;
+
+layout (std430, binding = 0) buffer TexelRecords
+{
+	uvec4 texel_records[];
+};
+
+#RECORD#
+
+bool fetch_position(ivec2 id, out vec3 pos)
+{
+	uint idx = texelFetch(uTexRecordIndex, id, 0).x;
+	if (idx == 0u) return false;
+	pos = record_position(texel_records[idx - 1u], uRecordPosMin, uRecordPosStep);
+	return true;
+}
 
 layout(local_size_x = 8, local_size_y = 8) in;
 
@@ -19,10 +39,10 @@ void main()
 	ivec2 id = ivec3(gl_GlobalInvocationID).xy;	
 	if (id.x>= size.x || id.y >=size.y) return;
 
-	vec4 pos0 = texelFetch(uTexPosition, id, 0);
-	if (pos0.w < 0.5) return;
+	vec3 pos0;
+	if (!fetch_position(id, pos0)) return;
 
-	vec3 acc_col = vec3(0.0);
+	vec4 acc_col = vec4(0.0);
 	float acc_weight = 0.0;
 	
 	for (int dy = -1; dy<=1; dy++)
@@ -30,26 +50,29 @@ void main()
 		for (int dx = -1; dx<=1; dx++)
 		{			
 			ivec2 id1 = id + ivec2(dx, dy);
-			vec4 pos1 =  texelFetch(uTexPosition, id1, 0);
-			if (pos1.w < 0.5) continue;
+			if (id1.x < 0 || id1.y < 0 || id1.x >= size.x || id1.y >= size.y) continue;
+			vec3 pos1;
+			if (!fetch_position(id1, pos1)) continue;
 
-			float k = length(pos1.xyz - pos0.xyz)/uTexelSize;
+			float k = length(pos1 - pos0)/uTexelSize;
 			float w = pow(0.5, k);
 			if (w < 0.001) continue;
 
-			vec3 col = texelFetch(uTexSource, id1, 0).xyz;
+			vec4 col = texelFetch(uTexSource, ivec3(id1, uPageIn), 0);
 			acc_col += col * w;
 			acc_weight += w;	
 		}
 	}
 	
-	imageStore(uOut, id, vec4(acc_col/acc_weight, 1.0));
+	imageStore(uOut, id, acc_col/acc_weight);
 }
 )";
 
 LightmapFilter::LightmapFilter()
 {
-	GLShader comp_shader(GL_COMPUTE_SHADER, g_compute.c_str());
+	std::string s_compute = g_compute;
+	replace(s_compute, "#RECORD#", LightmapRenderTarget::s_glsl_record);
+	GLShader comp_shader(GL_COMPUTE_SHADER, s_compute.c_str());
 	m_prog = (std::unique_ptr<GLProgram>)(new GLProgram(comp_shader));
 }
 
@@ -63,14 +86,19 @@ void LightmapFilter::filter(const RenderParams& params)
 	glUseProgram(m_prog->m_id);
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, params.light_map_in->tex_id);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, params.light_map_in->tex_id);
 	glUniform1i(0, 0);
+	glUniform1i(3, params.page_in);
 
 	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, params.atlas_position->tex_id);
+	glBindTexture(GL_TEXTURE_2D, params.atlas_record_index->tex_id);
 	glUniform1i(1, 1);
 
-	glBindImageTexture(0, params.light_map_out->tex_id, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, params.texel_records->m_id);
+	glUniform3fv(4, 1, (float*)&params.record_pos_min);
+	glUniform3fv(5, 1, (float*)&params.record_pos_step);
+
+	glBindImageTexture(0, params.light_map_out->tex_id, 0, GL_FALSE, params.page_out, GL_READ_WRITE, GL_RGBA16F);
 
 	glUniform1f(2, params.texel_size);
 
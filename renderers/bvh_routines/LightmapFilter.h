@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <string>
+#include <glm.hpp>
 
 #include "renderers/GLUtils.h"
 
@@ -15,9 +16,14 @@ public:
 		int width;
 		int height;
 		float texel_size;
-		GLTexture2D* light_map_in;
-		GLTexture2D* light_map_out;
-		GLTexture2D* atlas_position;
+		GLTexture2DArray* light_map_in;
+		int page_in;
+		GLTexture2DArray* light_map_out;
+		int page_out;
+		const GLTexture2D* atlas_record_index;
+		const GLBuffer* texel_records;
+		glm::vec3 record_pos_min;
+		glm::vec3 record_pos_step;
 	};
 
 	void filter(const RenderParams& params);
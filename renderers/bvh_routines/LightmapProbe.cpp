@@ -0,0 +1,172 @@
+#include <GL/glew.h>
+#include "LightmapProbe.h"
+#include "renderers/BVHRenderTarget.h"
+#include "renderers/LightmapRayList.h"
+#include "renderers/LightmapRenderTarget.h"
+#include "utils/Utils.h"
+
+static std::string g_compute_reduce =
+R"(#version 430
+
+layout (location = 0) uniform sampler2D uTexSource;
+
+layout (std140, binding = 0) uniform LightmapRayList
+{
+	int uTexelBegin;
+	int uTexelEnd;
+	int uNumRays;
+	int uTexelsPerRow;
+	int uNumRows;
+};
+
+layout (location = 1) uniform float uThreshold;
+
+layout (std430, binding = 0) buffer KeepFlags
+{
+	uint keep_flags[];
+};
+
+layout(local_size_x = 64) in;
+
+void main()
+{
+	int idx_texel_in = int(gl_GlobalInvocationID.x);
+	int idx_texel_out = idx_texel_in + uTexelBegin;
+	if (idx_texel_out >= uTexelEnd) return;
+
+	float count = 0.0;
+	for (int i=0; i<uNumRays; i++)
+	{
+		int x_in = (idx_texel_in % uTexelsPerRow) * uNumRays + i;
+		int y_in = idx_texel_in / uTexelsPerRow;
+		count += texelFetch(uTexSource, ivec2(x_in, y_in), 0).x;
+	}
+
+	keep_flags[idx_texel_out] = count / float(uNumRays) > uThreshold ? 0u : 1u;
+}
+)";
+
+static std::string g_compute_scatter =
+R"(#version 430
+
+layout (location = 0) uniform int uCount;
+
+layout (std430, binding = 0) buffer KeepFlags
+{
+	uint keep_flags[];
+};
+
+layout (std430, binding = 1) buffer Offsets
+{
+	uint offsets[];
+};
+
+layout (std430, binding = 2) buffer RecordsIn
+{
+	uvec4 records_in[];
+};
+
+layout (std430, binding = 3) buffer RecordsOut
+{
+	uvec4 records_out[];
+};
+
+layout (binding = 0, r32ui) uniform uimage2D uRecordIndex;
+
+#RECORD#
+
+layout(local_size_x = 64) in;
+
+void main()
+{
+	int idx = int(gl_GlobalInvocationID.x);
+	if (idx >= uCount) return;
+
+	uvec4 rec = records_in[idx];
+	ivec2 texel_coord = record_coord(rec);
+
+	if (keep_flags[idx] != 0u)
+	{
+		uint idx_out = offsets[idx];
+		records_out[idx_out] = rec;
+		imageStore(uRecordIndex, texel_coord, uvec4(idx_out + 1));
+	}
+	else
+	{
+		imageStore(uRecordIndex, texel_coord, uvec4(0));
+	}
+}
+)";
+
+LightmapProbe::LightmapProbe()
+{
+	GLShader comp_reduce(GL_COMPUTE_SHADER, g_compute_reduce.c_str());
+	m_prog_reduce = (std::unique_ptr<GLProgram>)(new GLProgram(comp_reduce));
+
+	m_scan = std::unique_ptr<FlagScan>(new FlagScan);
+
+	std::string s_scatter = g_compute_scatter;
+	replace(s_scatter, "#RECORD#", LightmapRenderTarget::s_glsl_record);
+	GLShader comp_scatter(GL_COMPUTE_SHADER, s_scatter.c_str());
+	m_prog_scatter = (std::unique_ptr<GLProgram>)(new GLProgram(comp_scatter));
+}
+
+void LightmapProbe::reduce(const RenderParams& params)
+{
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	const BVHRenderTarget* source = params.source;
+	const LightmapRayList* lmrl = params.lmrl;
+
+	glUseProgram(m_prog_reduce->m_id);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, source->m_tex_video->tex_id);
+	glUniform1i(0, 0);
+
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, lmrl->m_constant.m_id);
+	glUniform1f(1, params.threshold);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, params.keep_flags->m_id);
+
+	int num_texels = lmrl->end - lmrl->begin;
+	int num_blocks = (num_texels + 63) / 64;
+	glDispatchCompute(num_blocks, 1, 1);
+
+	glUseProgram(0);
+}
+
+int LightmapProbe::drop(LightmapRenderTarget& atlas, const GLBuffer& keep_flags)
+{
+	int count = atlas.count_valid;
+	if (count <= 0) return 0;
+
+	GLBuffer offsets(sizeof(unsigned) * count, GL_SHADER_STORAGE_BUFFER);
+	int count_keep = m_scan->scan(count, keep_flags, offsets);
+	if (count_keep == count) return count;
+
+	size_t size_out = sizeof(unsigned) * 4 * (count_keep > 0 ? count_keep : 1);
+	std::unique_ptr<GLBuffer> records_out(new GLBuffer(size_out, GL_SHADER_STORAGE_BUFFER));
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(m_prog_scatter->m_id);
+	glUniform1i(0, count);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, keep_flags.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, offsets.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, atlas.texel_records->m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, records_out->m_id);
+	glBindImageTexture(0, atlas.m_tex_record_index->tex_id, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32UI);
+
+	int num_blocks = (count + 63) / 64;
+	glDispatchCompute(num_blocks, 1, 1);
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	glUseProgram(0);
+
+	atlas.texel_records = std::move(records_out);
+	atlas.count_valid = count_keep;
+
+	return atlas.count_valid;
+}
+
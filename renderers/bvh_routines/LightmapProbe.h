@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "renderers/GLUtils.h"
+#include "FlagScan.h"
+
+class BVHRenderTarget;
+class LightmapRayList;
+class LightmapRenderTarget;
+
+class LightmapProbe
+{
+public:
+	LightmapProbe();
+
+	struct RenderParams
+	{
+		float threshold;
+		const BVHRenderTarget* source;
+		const LightmapRayList* lmrl;
+		const GLBuffer* keep_flags;
+	};
+
+	// Marks the texels of the ray list to keep: those whose fraction of backface hits is not above the threshold.
+	void reduce(const RenderParams& params);
+
+	// Removes the unmarked texels from the records and index map of the atlas.
+	// Returns the number of texels left.
+	int drop(LightmapRenderTarget& atlas, const GLBuffer& keep_flags);
+
+private:
+	std::unique_ptr<GLProgram> m_prog_reduce;
+	std::unique_ptr<FlagScan> m_scan;
+	std::unique_ptr<GLProgram> m_prog_scatter;
+
+};
+
@@ -0,0 +1,157 @@
+#include <GL/glew.h>
+#include "LightmapSelect.h"
+#include "renderers/LightmapRenderTarget.h"
+#include "utils/Utils.h"
+
+static std::string g_compute_mark =
+R"(#version 430
+
+layout (location = 0) uniform int uCount;
+layout (location = 1) uniform int uNumBoxes;
+layout (location = 2) uniform vec3 uRecordPosMin;
+layout (location = 3) uniform vec3 uRecordPosStep;
+
+layout (std430, binding = 0) buffer TexelRecords
+{
+	uvec4 texel_records[];
+};
+
+#RECORD#
+
+layout (std430, binding = 1) buffer Boxes
+{
+	vec4 boxes[];
+};
+
+layout (std430, binding = 2) buffer SelectFlags
+{
+	uint select_flags[];
+};
+
+layout(local_size_x = 64) in;
+
+void main()
+{
+	int idx = int(gl_GlobalInvocationID.x);
+	if (idx >= uCount) return;
+
+	vec3 pos = record_position(texel_records[idx], uRecordPosMin, uRecordPosStep);
+
+	uint selected = 0u;
+	for (int i = 0; i < uNumBoxes; i++)
+	{
+		vec3 min_pos = boxes[i*2].xyz;
+		vec3 max_pos = boxes[i*2 + 1].xyz;
+		if (all(greaterThanEqual(pos, min_pos)) && all(lessThanEqual(pos, max_pos)))
+		{
+			selected = 1u;
+			break;
+		}
+	}
+	select_flags[idx] = selected;
+}
+)";
+
+static std::string g_compute_gather =
+R"(#version 430
+
+layout (location = 0) uniform int uCount;
+
+layout (std430, binding = 0) buffer SelectFlags
+{
+	uint select_flags[];
+};
+
+layout (std430, binding = 1) buffer Offsets
+{
+	uint offsets[];
+};
+
+layout (std430, binding = 2) buffer RecordsIn
+{
+	uvec4 records_in[];
+};
+
+layout (std430, binding = 3) buffer RecordsOut
+{
+	uvec4 records_out[];
+};
+
+layout(local_size_x = 64) in;
+
+void main()
+{
+	int idx = int(gl_GlobalInvocationID.x);
+	if (idx >= uCount) return;
+	if (select_flags[idx] == 0u) return;
+
+	uint idx_out = offsets[idx];
+	records_out[idx_out] = records_in[idx];
+}
+)";
+
+LightmapSelect::LightmapSelect()
+{
+	std::string s_mark = g_compute_mark;
+	replace(s_mark, "#RECORD#", LightmapRenderTarget::s_glsl_record);
+	GLShader comp_mark(GL_COMPUTE_SHADER, s_mark.c_str());
+	m_prog_mark = (std::unique_ptr<GLProgram>)(new GLProgram(comp_mark));
+
+	m_scan = std::unique_ptr<FlagScan>(new FlagScan);
+
+	GLShader comp_gather(GL_COMPUTE_SHADER, g_compute_gather.c_str());
+	m_prog_gather = (std::unique_ptr<GLProgram>)(new GLProgram(comp_gather));
+}
+
+int LightmapSelect::select(const RenderParams& params, LightmapRenderTarget& selection)
+{
+	const LightmapRenderTarget* atlas = params.atlas;
+
+	selection.m_width = atlas->m_width;
+	selection.m_height = atlas->m_height;
+	selection.page = atlas->page;
+	selection.record_pos_min = atlas->record_pos_min;
+	selection.record_pos_step = atlas->record_pos_step;
+	selection.count_valid = 0;
+
+	int count = atlas->count_valid;
+	if (count <= 0 || params.num_boxes <= 0) return 0;
+
+	GLBuffer select_flags(sizeof(unsigned) * count, GL_SHADER_STORAGE_BUFFER);
+	GLBuffer offsets(sizeof(unsigned) * count, GL_SHADER_STORAGE_BUFFER);
+
+	glUseProgram(m_prog_mark->m_id);
+	glUniform1i(0, count);
+	glUniform1i(1, params.num_boxes);
+	glUniform3fv(2, 1, &atlas->record_pos_min.x);
+	glUniform3fv(3, 1, &atlas->record_pos_step.x);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, atlas->texel_records->m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, params.boxes->m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, select_flags.m_id);
+
+	int num_blocks = (count + 63) / 64;
+	glDispatchCompute(num_blocks, 1, 1);
+
+	int count_selected = m_scan->scan(count, select_flags, offsets);
+	if (count_selected == 0) return 0;
+
+	size_t size_out = sizeof(unsigned) * 4 * count_selected;
+	selection.texel_records = std::unique_ptr<GLBuffer>(new GLBuffer(size_out, GL_SHADER_STORAGE_BUFFER));
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(m_prog_gather->m_id);
+	glUniform1i(0, count);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, select_flags.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, offsets.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, atlas->texel_records->m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, selection.texel_records->m_id);
+	glDispatchCompute(num_blocks, 1, 1);
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(0);
+
+	selection.count_valid = count_selected;
+	return selection.count_valid;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "renderers/GLUtils.h"
+#include "FlagScan.h"
+
+class LightmapRenderTarget;
+
+class LightmapSelect
+{
+public:
+	LightmapSelect();
+
+	struct RenderParams
+	{
+		const LightmapRenderTarget* atlas;
+		const GLBuffer* boxes; // vec4 pairs: min.xyz, max.xyz
+		int num_boxes;
+	};
+
+	// Gathers the records of the texels lying in any of the boxes into selection, 
+	// which can then be baked in place of the full atlas. Returns the number of texels selected.
+	int select(const RenderParams& params, LightmapRenderTarget& selection);
+
+private:
+	std::unique_ptr<GLProgram> m_prog_mark;
+	std::unique_ptr<FlagScan> m_scan;
+	std::unique_ptr<GLProgram> m_prog_gather;
+
+};
+
@@ -1,13 +1,20 @@
 #include <GL/glew.h>
+#include <cstring>
 #include "LightmapUpdate.h"
 #include "renderers/BVHRenderTarget.h"
 #include "renderers/LightmapRayList.h"
+#include "renderers/LightmapRenderTarget.h"
 #include "models/ModelComponents.h"
+#include "utils/Utils.h"
 
 
 static std::string g_compute =
 R"(#version 430
 
+#DEFINES#
+
+#define PI 3.14159265359
+
 layout (location = 0) uniform sampler2D uTexSource;
 
 layout (std140, binding = 0) uniform LightmapRayList
@@ -17,14 +24,40 @@ layout (std140, binding = 0) uniform LightmapRayList
 	int uNumRays;
 	int uTexelsPerRow;
 	int uNumRows;
+	int uJitter;
 };
 
-layout (location = 1) uniform usamplerBuffer uValidList;
+layout (std430, binding = 0) buffer TexelRecords
+{
+	uvec4 texel_records[];
+};
+
+#RECORD#
 
 layout (location = 2) uniform float uMixRate;
 
 layout (binding=0, rgba16f) uniform image2D uOut;
 
+#if SH_L1
+// L1 coefficients of the red, green and blue channels
+layout (binding=1, rgba16f) uniform image2D uOutR;
+layout (binding=2, rgba16f) uniform image2D uOutG;
+layout (binding=3, rgba16f) uniform image2D uOutB;
+
+// ray directions are regenerated the same way as BVHRoutine
+
+#RANDOM#
+
+// Fits L(w) = a + dot(b, w) to the cosine-distributed samples around the normal n, from 
+// m0 = E[L] and m = E[L*w]. Only b is stored, a follows from the irradiance in the normal direction: 
+// E(n')/PI = m0 + 2/3 * dot(b, n' - n)
+vec3 sh_l1(float m0, vec3 m, vec3 n)
+{
+	float m_n = dot(m, n);
+	return 4.0 * (m - m_n * n) + (18.0 * m_n - 12.0 * m0) * n;
+}
+#endif
+
 layout(local_size_x = 64) in;
 
 void main()
@@ -43,7 +76,39 @@ void main()
 	}
 	col/=float(uNumRays);
 	
-	ivec2 texel_coord = ivec2(texelFetch(uValidList, idx_texel_out).xy);
+	ivec2 texel_coord = record_coord(texel_records[idx_texel_out]);
+
+#if SH_L1
+	vec3 norm = record_normal(texel_records[idx_texel_out]);
+	vec3 m_r = vec3(0.0);
+	vec3 m_g = vec3(0.0);
+	vec3 m_b = vec3(0.0);
+	for (int i=0; i<uNumRays; i++)
+	{
+		int x_in = (idx_texel_in % uTexelsPerRow) * uNumRays + i;
+		int y_in = idx_texel_in / uTexelsPerRow;
+		vec3 col_in = texelFetch(uTexSource, ivec2(x_in, y_in),0).xyz;
+		uint seed = InitRandomSeed(uint(uJitter), uint(idx_texel_in * uNumRays + i));
+		vec3 dir = RandomDiffuse(seed, norm);
+		m_r += col_in.x * dir;
+		m_g += col_in.y * dir;
+		m_b += col_in.z * dir;
+	}
+	vec4 sh_r = vec4(sh_l1(col.x, m_r/float(uNumRays), norm), 0.0);
+	vec4 sh_g = vec4(sh_l1(col.y, m_g/float(uNumRays), norm), 0.0);
+	vec4 sh_b = vec4(sh_l1(col.z, m_b/float(uNumRays), norm), 0.0);
+
+	if (uMixRate<1.0)
+	{
+		sh_r = uMixRate * sh_r + (1.0 - uMixRate) * imageLoad(uOutR, texel_coord);
+		sh_g = uMixRate * sh_g + (1.0 - uMixRate) * imageLoad(uOutG, texel_coord);
+		sh_b = uMixRate * sh_b + (1.0 - uMixRate) * imageLoad(uOutB, texel_coord);
+	}
+
+	imageStore(uOutR, texel_coord, sh_r);
+	imageStore(uOutG, texel_coord, sh_g);
+	imageStore(uOutB, texel_coord, sh_b);
+#endif
 
 	if (uMixRate<1.0)
 	{
@@ -57,8 +122,22 @@ void main()
 
 LightmapUpdate::LightmapUpdate()
 {
-	GLShader comp_shader(GL_COMPUTE_SHADER, g_compute.c_str());
-	m_prog = (std::unique_ptr<GLProgram>)(new GLProgram(comp_shader));
+	{
+		std::string s_compute = g_compute;
+		replace(s_compute, "#DEFINES#", "#define SH_L1 0\n");
+		replace(s_compute, "#RECORD#", LightmapRenderTarget::s_glsl_record);
+	replace(s_compute, "#RANDOM#", LightmapRayList::s_glsl_random);
+		GLShader comp_shader(GL_COMPUTE_SHADER, s_compute.c_str());
+		m_prog = (std::unique_ptr<GLProgram>)(new GLProgram(comp_shader));
+	}
+	{
+		std::string s_compute = g_compute;
+		replace(s_compute, "#DEFINES#", "#define SH_L1 1\n");
+		replace(s_compute, "#RECORD#", LightmapRenderTarget::s_glsl_record);
+	replace(s_compute, "#RANDOM#", LightmapRayList::s_glsl_random);
+		GLShader comp_shader(GL_COMPUTE_SHADER, s_compute.c_str());
+		m_prog_sh = (std::unique_ptr<GLProgram>)(new GLProgram(comp_shader));
+	}
 }
 
 
@@ -69,7 +148,8 @@ void LightmapUpdate::update(const RenderParams& params)
 	const BVHRenderTarget* source = params.source;
 	const LightmapRayList* lmrl = params.lmrl;
 
-	glUseProgram(m_prog->m_id);
+	bool sh = params.sh_layer >= 0;
+	glUseProgram(sh ? m_prog_sh->m_id : m_prog->m_id);
 
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, source->m_tex_video->tex_id);
@@ -77,13 +157,19 @@ void LightmapUpdate::update(const RenderParams& params)
 
 	glBindBufferBase(GL_UNIFORM_BUFFER, 0, lmrl->m_constant.m_id);
 
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_BUFFER, lmrl->source->valid_list->tex_id);
-	glUniform1i(1, 1);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, lmrl->source->texel_records->m_id);
 
 	glUniform1f(2, params.mix_rate);
 
-	glBindImageTexture(0, params.target->lightmap->tex_id, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	// the page of the atlas being baked is bound as a single layer
+	glBindImageTexture(0, params.target->lightmap->tex_id, 0, GL_FALSE, params.layer, GL_READ_WRITE, GL_RGBA16F);
+	if (sh)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			glBindImageTexture(1 + i, params.target->lightmap->tex_id, 0, GL_FALSE, params.sh_layer + i, GL_READ_WRITE, GL_RGBA16F);
+		}
+	}
 
 	int num_texels = lmrl->end - lmrl->begin;
 	int num_blocks = (num_texels + 63) / 64;
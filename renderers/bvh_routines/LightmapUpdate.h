@@ -20,11 +20,14 @@ public:
 		const BVHRenderTarget* source;
 		const LightmapRayList* lmrl;
 		const Lightmap* target;
+		int layer; // layer of the target holding the page being baked
+		int sh_layer; // first of the 3 layers receiving the L1 coefficients of the page, -1 to skip
 	};
 
 	void update(const RenderParams& params);
 
 private:
 	std::unique_ptr<GLProgram> m_prog;
+	std::unique_ptr<GLProgram> m_prog_sh;
 
 };
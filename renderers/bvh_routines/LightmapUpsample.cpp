@@ -0,0 +1,151 @@
+#include <GL/glew.h>
+#include "LightmapUpsample.h"
+#include "renderers/LightmapRenderTarget.h"
+#include "utils/Utils.h"
+#include "models/ModelComponents.h"
+
+static std::string g_compute =
+R"(#version 430
+
+layout (location = 0) uniform sampler2DArray uTexDirect;
+layout (location = 1) uniform sampler2DArray uTexIndirect;
+layout (location = 2) uniform usampler2D uTexLowIndex;
+
+layout (location = 3) uniform int uCount;
+layout (location = 4) uniform int uLayer;
+layout (location = 5) uniform int uLayerLow;
+layout (location = 6) uniform vec2 uScale; // low density texels per full density texel
+layout (location = 7) uniform float uLowTexelSize; // world size of a low density texel
+
+layout (location = 8) uniform vec3 uRecordPosMin;
+layout (location = 9) uniform vec3 uRecordPosStep;
+layout (location = 10) uniform vec3 uLowPosMin;
+layout (location = 11) uniform vec3 uLowPosStep;
+
+layout (std430, binding = 0) buffer TexelRecords
+{
+	uvec4 texel_records[];
+};
+
+layout (std430, binding = 1) buffer LowRecords
+{
+	uvec4 low_records[];
+};
+
+layout (binding=0, rgba16f) uniform writeonly image2D uOut;
+
+#RECORD#
+
+layout(local_size_x = 64) in;
+
+void main()
+{
+	int idx = int(gl_GlobalInvocationID.x);
+	if (idx >= uCount) return;
+
+	uvec4 rec = texel_records[idx];
+	ivec2 coord = record_coord(rec);
+	vec3 pos = record_position(rec, uRecordPosMin, uRecordPosStep);
+	vec3 norm = record_normal(rec);
+
+	ivec2 size_low = textureSize(uTexLowIndex, 0);
+	vec2 p_low = (vec2(coord) + 0.5) * uScale - 0.5;
+	ivec2 base = ivec2(floor(p_low));
+	vec2 f = p_low - vec2(base);
+
+	// bilateral: bilinear weights, cut by normal disagreement and distance from the tangent plane, 
+	// so light does not leak across creases and thin walls
+	float inv_size2 = 1.0 / (uLowTexelSize * uLowTexelSize);
+	vec3 sum = vec3(0.0);
+	float sum_w = 0.0;
+	vec3 nearest = vec3(0.0);
+	float nearest_w = 0.0;
+	for (int j = 0; j < 2; j++)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			ivec2 c = clamp(base + ivec2(i, j), ivec2(0), size_low - 1);
+			uint idx_low = texelFetch(uTexLowIndex, c, 0).x;
+			if (idx_low == 0u) continue;
+
+			uvec4 rec_low = low_records[idx_low - 1u];
+			vec3 d = record_position(rec_low, uLowPosMin, uLowPosStep) - pos;
+			float dotNN = max(dot(norm, record_normal(rec_low)), 0.0);
+			float plane = dot(d, norm);
+
+			float w_geo = pow(dotNN, 8.0) / (1.0 + dot(d, d) * inv_size2) * exp(-plane * plane * inv_size2 * 4.0);
+			float w_bilinear = (i == 0 ? 1.0 - f.x : f.x) * (j == 0 ? 1.0 - f.y : f.y);
+
+			vec4 lm = texelFetch(uTexIndirect, ivec3(c, uLayerLow), 0);
+			vec3 col = lm.w > 0.0 ? lm.xyz / lm.w : vec3(0.0);
+
+			sum += col * w_geo * w_bilinear;
+			sum_w += w_geo * w_bilinear;
+			if (w_geo > nearest_w)
+			{
+				nearest = col;
+				nearest_w = w_geo;
+			}
+		}
+	}
+
+	// texels between charts at the low density may only see neighbors with zero bilinear weight
+	vec3 indirect = sum_w > 1e-4 ? sum / sum_w : nearest;
+
+	vec4 lm = texelFetch(uTexDirect, ivec3(coord, uLayer), 0);
+	vec3 direct = lm.w > 0.0 ? lm.xyz / lm.w : vec3(0.0);
+
+	imageStore(uOut, coord, vec4(direct + indirect, 1.0));
+}
+)";
+
+LightmapUpsample::LightmapUpsample()
+{
+	std::string s_compute = g_compute;
+	replace(s_compute, "#RECORD#", LightmapRenderTarget::s_glsl_record);
+	GLShader comp_shader(GL_COMPUTE_SHADER, s_compute.c_str());
+	m_prog = (std::unique_ptr<GLProgram>)(new GLProgram(comp_shader));
+}
+
+void LightmapUpsample::composite(const RenderParams& params)
+{
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	const LightmapRenderTarget* atlas = params.atlas;
+	const LightmapRenderTarget* atlas_low = params.atlas_low;
+
+	glUseProgram(m_prog->m_id);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, params.direct->lightmap->tex_id);
+	glUniform1i(0, 0);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, params.indirect->lightmap->tex_id);
+	glUniform1i(1, 1);
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, atlas_low->m_tex_record_index->tex_id);
+	glUniform1i(2, 2);
+
+	glUniform1i(3, atlas->count_valid);
+	glUniform1i(4, params.layer);
+	glUniform1i(5, params.layer_low);
+	glUniform2f(6, (float)params.indirect->width / (float)params.direct->width, (float)params.indirect->height / (float)params.direct->height);
+	glUniform1f(7, 1.0f / params.indirect->texels_per_unit);
+	glUniform3fv(8, 1, (const float*)&atlas->record_pos_min);
+	glUniform3fv(9, 1, (const float*)&atlas->record_pos_step);
+	glUniform3fv(10, 1, (const float*)&atlas_low->record_pos_min);
+	glUniform3fv(11, 1, (const float*)&atlas_low->record_pos_step);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, atlas->texel_records->m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, atlas_low->texel_records->m_id);
+
+	glBindImageTexture(0, params.target->lightmap->tex_id, 0, GL_FALSE, params.layer, GL_WRITE_ONLY, GL_RGBA16F);
+
+	int num_blocks = (atlas->count_valid + 63) / 64;
+	glDispatchCompute(num_blocks, 1, 1);
+
+	glUseProgram(0);
+}
+
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "renderers/GLUtils.h"
+
+class LightmapRenderTarget;
+class Lightmap;
+
+class LightmapUpsample
+{
+public:
+	LightmapUpsample();
+
+	struct RenderParams
+	{
+		const LightmapRenderTarget* atlas; // full density
+		const Lightmap* direct; // baked over atlas
+		const LightmapRenderTarget* atlas_low; // reduced density, same atlas layout
+		const Lightmap* indirect; // baked over atlas_low
+		const Lightmap* target; // same size as direct, must not be direct
+		int layer; // layer of direct and target holding the page
+		int layer_low; // layer of indirect holding the page
+	};
+
+	// Writes direct + indirect to each texel of the atlas, the indirect light is upsampled from 
+	// the 2x2 nearest low density texels weighted by their distance to the texel and normal agreement.
+	void composite(const RenderParams& params);
+
+private:
+	std::unique_ptr<GLProgram> m_prog;
+
+};
+
@@ -2,6 +2,7 @@
 #include <glm.hpp>
 #include <GL/glew.h>
 #include "PrimitiveBatch.h"
+#include "utils/Utils.h"
 
 static std::string g_compute =
 R"(#version 430
@@ -116,20 +117,6 @@ void main()
 )";
 
 
-inline void replace(std::string& str, const char* target, const char* source)
-{
-	int start = 0;
-	size_t target_len = strlen(target);
-	size_t source_len = strlen(source);
-	while (true)
-	{
-		size_t pos = str.find(target, start);
-		if (pos == std::string::npos) break;
-		str.replace(pos, target_len, source);
-		start = pos + source_len;
-	}
-}
-
 
 PrimitiveBatch::PrimitiveBatch(const Options& options) : m_options(options)
 {
@@ -0,0 +1,122 @@
+#include <GL/glew.h>
+#include "ProbeVolumeUpdate.h"
+#include "renderers/BVHRenderTarget.h"
+#include "renderers/LightmapRayList.h"
+#include "lights/ProbeVolume.h"
+#include "utils/Utils.h"
+
+static std::string g_compute =
+R"(#version 430
+
+#define PI 3.14159265359
+
+layout (location = 0) uniform sampler2D uTexSource;
+
+layout (std140, binding = 0) uniform LightmapRayList
+{
+	int uTexelBegin;
+	int uTexelEnd;
+	int uNumRays;
+	int uTexelsPerRow;
+	int uNumRows;
+	int uJitter;
+};
+
+layout (location = 1) uniform ivec3 uDims;
+layout (location = 2) uniform float uMixRate;
+
+layout (binding=0, rgba16f) uniform image3D uOut;
+
+// ray directions are regenerated the same way as BVHRoutine
+
+#RANDOM#
+
+layout(local_size_x = 64) in;
+
+void main()
+{
+	int idx_probe_in = int(gl_GlobalInvocationID.x);
+	int idx_probe_out = idx_probe_in + uTexelBegin;
+	if (idx_probe_out >= uTexelEnd) return;
+
+	vec3 sh[9];
+	for (int k=0; k<9; k++) sh[k] = vec3(0.0);
+
+	for (int i=0; i<uNumRays; i++)
+	{
+		int x_in = (idx_probe_in % uTexelsPerRow) * uNumRays + i;
+		int y_in = idx_probe_in / uTexelsPerRow;
+		vec3 col = texelFetch(uTexSource, ivec2(x_in, y_in), 0).xyz;
+
+		uint seed = InitRandomSeed(uint(uJitter), uint(idx_probe_in * uNumRays + i));
+		vec3 d = RandomDirection(seed);
+
+		sh[0] += col * 0.282095;
+		sh[1] += col * 0.488603 * d.y;
+		sh[2] += col * 0.488603 * d.z;
+		sh[3] += col * 0.488603 * d.x;
+		sh[4] += col * 1.092548 * d.x * d.y;
+		sh[5] += col * 1.092548 * d.y * d.z;
+		sh[6] += col * 0.315392 * (3.0 * d.z * d.z - 1.0);
+		sh[7] += col * 1.092548 * d.x * d.z;
+		sh[8] += col * 0.546274 * (d.x * d.x - d.y * d.y);
+	}
+
+	// uniform sphere samples: L_lm = 4PI/N * sum(L * Y_lm),
+	// then convolved with the clamped cosine and divided by PI: 1, 2/3, 1/4 per band
+	float w = 4.0 * PI / float(uNumRays);
+	sh[0] *= w;
+	for (int k=1; k<4; k++) sh[k] *= w * (2.0 / 3.0);
+	for (int k=4; k<9; k++) sh[k] *= w * 0.25;
+
+	ivec3 probe_coord = ivec3(idx_probe_out % uDims.x, (idx_probe_out / uDims.x) % uDims.y, idx_probe_out / (uDims.x * uDims.y));
+	for (int k=0; k<9; k++)
+	{
+		ivec3 coord = ivec3(probe_coord.xy, probe_coord.z + k * uDims.z);
+		vec4 col = vec4(sh[k], 1.0);
+		if (uMixRate<1.0)
+		{
+			vec4 last = imageLoad(uOut, coord);
+			col = uMixRate * col + (1.0 - uMixRate) * last;
+		}
+		imageStore(uOut, coord, col);
+	}
+}
+)";
+
+ProbeVolumeUpdate::ProbeVolumeUpdate()
+{
+	std::string s_compute = g_compute;
+	replace(s_compute, "#RANDOM#", LightmapRayList::s_glsl_random);
+	GLShader comp_shader(GL_COMPUTE_SHADER, s_compute.c_str());
+	m_prog = (std::unique_ptr<GLProgram>)(new GLProgram(comp_shader));
+}
+
+void ProbeVolumeUpdate::update(const RenderParams& params)
+{
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	const BVHRenderTarget* source = params.source;
+	const LightmapRayList* lmrl = params.lmrl;
+	const ProbeVolume* volume = params.target;
+
+	glUseProgram(m_prog->m_id);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, source->m_tex_video->tex_id);
+	glUniform1i(0, 0);
+
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, lmrl->m_constant.m_id);
+
+	glUniform3i(1, volume->dims.x, volume->dims.y, volume->dims.z);
+	glUniform1f(2, params.mix_rate);
+
+	glBindImageTexture(0, volume->irradiance->tex_id, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+
+	int num_probes = lmrl->end - lmrl->begin;
+	int num_blocks = (num_probes + 63) / 64;
+	glDispatchCompute(num_blocks, 1, 1);
+
+	glUseProgram(0);
+}
+
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "renderers/GLUtils.h"
+
+class BVHRenderTarget;
+class LightmapRayList;
+class ProbeVolume;
+
+class ProbeVolumeUpdate
+{
+public:
+	ProbeVolumeUpdate();
+
+	struct RenderParams
+	{
+		float mix_rate;
+		const BVHRenderTarget* source;
+		const LightmapRayList* lmrl;  // traced with sphere directions over the probe records
+		const ProbeVolume* target;
+	};
+
+	// Projects the radiance of the rays of each probe onto SH L2 and stores the irradiance coefficients.
+	void update(const RenderParams& params);
+
+private:
+	std::unique_ptr<GLProgram> m_prog;
+
+};
+
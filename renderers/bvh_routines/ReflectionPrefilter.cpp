@@ -0,0 +1,121 @@
+#include <GL/glew.h>
+#include "ReflectionPrefilter.h"
+
+static std::string g_compute =
+R"(#version 430
+
+#define PI 3.14159265359
+
+layout (location = 0) uniform samplerCube uTexSource;
+layout (location = 1) uniform float uRoughness;
+layout (location = 2) uniform int uSourceSize;
+layout (location = 3) uniform int uNumSamples;
+
+layout (binding=0, rgba16f) uniform writeonly imageCube uOut;
+
+vec3 face_direction(int face, vec2 st)
+{
+	if (face == 0) return vec3(1.0, -st.y, -st.x);
+	else if (face == 1) return vec3(-1.0, -st.y, st.x);
+	else if (face == 2) return vec3(st.x, 1.0, st.y);
+	else if (face == 3) return vec3(st.x, -1.0, -st.y);
+	else if (face == 4) return vec3(st.x, -st.y, 1.0);
+	return vec3(-st.x, -st.y, -1.0);
+}
+
+vec2 hammersley(uint i, uint n)
+{
+	return vec2(float(i) / float(n), float(bitfieldReverse(i)) * 2.3283064365386963e-10);
+}
+
+vec3 importance_sample_ggx(vec2 xi, float alpha, vec3 n)
+{
+	float phi = 2.0 * PI * xi.x;
+	float cos_theta = sqrt((1.0 - xi.y) / (1.0 + (alpha * alpha - 1.0) * xi.y));
+	float sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+	vec3 h = vec3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
+
+	vec3 up = abs(n.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+	vec3 t = normalize(cross(up, n));
+	vec3 b = cross(n, t);
+	return normalize(t * h.x + b * h.y + n * h.z);
+}
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+void main()
+{
+	ivec2 size = imageSize(uOut);
+	ivec3 id = ivec3(gl_GlobalInvocationID);
+	if (id.x >= size.x || id.y >= size.y) return;
+
+	vec2 st = (vec2(id.xy) + 0.5) / vec2(size) * 2.0 - 1.0;
+	vec3 n = normalize(face_direction(id.z, st));
+
+	// split-sum assumption: view and reflection along the normal
+	float alpha = uRoughness * uRoughness;
+	float sa_texel = 4.0 * PI / (6.0 * float(uSourceSize * uSourceSize));
+
+	vec3 col = vec3(0.0);
+	float weight = 0.0;
+	for (int i = 0; i < uNumSamples; i++)
+	{
+		vec3 h = importance_sample_ggx(hammersley(uint(i), uint(uNumSamples)), alpha, n);
+		vec3 l = 2.0 * dot(n, h) * h - n;
+		float dotNL = dot(n, l);
+		if (dotNL > 0.0)
+		{
+			// filtered importance sampling: read the source level matching the solid angle of the sample
+			float dotNH = max(dot(n, h), 0.0);
+			float d = alpha * alpha / (PI * pow(dotNH * dotNH * (alpha * alpha - 1.0) + 1.0, 2.0));
+			float pdf = d * 0.25;
+			float sa_sample = 1.0 / (float(uNumSamples) * pdf + 1e-4);
+			float lod = max(0.5 * log2(sa_sample / sa_texel), 0.0);
+
+			col += textureLod(uTexSource, l, lod).xyz * dotNL;
+			weight += dotNL;
+		}
+	}
+
+	imageStore(uOut, id, vec4(col / max(weight, 1e-4), 1.0));
+}
+)";
+
+ReflectionPrefilter::ReflectionPrefilter()
+{
+	GLShader comp_shader(GL_COMPUTE_SHADER, g_compute.c_str());
+	m_prog = (std::unique_ptr<GLProgram>)(new GLProgram(comp_shader));
+}
+
+void ReflectionPrefilter::filter(const RenderParams& params)
+{
+	const ReflectionMap* target = params.target;
+
+	glCopyImageSubData(params.source->tex_id, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0,
+		target->tex_id, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, target->size, target->size, 6);
+
+	glUseProgram(m_prog->m_id);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, params.source->tex_id);
+	glUniform1i(0, 0);
+	glUniform1i(2, params.source_size);
+	glUniform1i(3, params.num_samples);
+
+	for (int level = 1; level < target->num_levels; level++)
+	{
+		int size = target->size >> level;
+		if (size < 1) size = 1;
+
+		glUniform1f(1, (float)level / (float)(target->num_levels - 1));
+		glBindImageTexture(0, target->tex_id, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+		int num_blocks = (size + 7) / 8;
+		glDispatchCompute(num_blocks, num_blocks, 6);
+	}
+
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	glUseProgram(0);
+}
+
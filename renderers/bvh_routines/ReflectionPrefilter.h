@@ -0,0 +1,29 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "renderers/GLUtils.h"
+
+class ReflectionPrefilter
+{
+public:
+	ReflectionPrefilter();
+
+	struct RenderParams
+	{
+		const GLCubemap* source; // RGBA16F radiance with the full mip chain
+		int source_size;
+		const ReflectionMap* target;
+		int num_samples;
+	};
+
+	// Copies the radiance into level 0 of the target and convolves the following levels with GGX,
+	// roughness going linearly from 0 at level 0 to 1 at the last level.
+	void filter(const RenderParams& params);
+
+private:
+	std::unique_ptr<GLProgram> m_prog;
+
+};
+
@@ -0,0 +1,85 @@
+#include <GL/glew.h>
+#include "VertexGIUpdate.h"
+#include "renderers/BVHRenderTarget.h"
+#include "renderers/LightmapRayList.h"
+
+static std::string g_compute =
+R"(#version 430
+
+layout (location = 0) uniform sampler2D uTexSource;
+
+layout (std140, binding = 0) uniform LightmapRayList
+{
+	int uTexelBegin;
+	int uTexelEnd;
+	int uNumRays;
+	int uTexelsPerRow;
+	int uNumRows;
+	int uJitter;
+};
+
+layout (location = 1) uniform float uMixRate;
+
+layout (std430, binding = 0) buffer VertexGI
+{
+	vec4 vertex_gi[];
+};
+
+layout(local_size_x = 64) in;
+
+void main()
+{
+	int idx_vert_in = int(gl_GlobalInvocationID.x);
+	int idx_vert_out = idx_vert_in + uTexelBegin;
+	if (idx_vert_out >= uTexelEnd) return;
+
+	vec4 col = vec4(0.0);
+	for (int i=0; i<uNumRays; i++)
+	{
+		int x_in = (idx_vert_in % uTexelsPerRow) * uNumRays + i;
+		int y_in = idx_vert_in / uTexelsPerRow;
+		col += texelFetch(uTexSource, ivec2(x_in, y_in), 0);
+	}
+	col /= float(uNumRays);
+
+	if (uMixRate<1.0)
+	{
+		col = uMixRate * col + (1.0 - uMixRate) * vertex_gi[idx_vert_out];
+	}
+	vertex_gi[idx_vert_out] = col;
+}
+)";
+
+VertexGIUpdate::VertexGIUpdate()
+{
+	GLShader comp_shader(GL_COMPUTE_SHADER, g_compute.c_str());
+	m_prog = (std::unique_ptr<GLProgram>)(new GLProgram(comp_shader));
+}
+
+void VertexGIUpdate::update(const RenderParams& params)
+{
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	const BVHRenderTarget* source = params.source;
+	const LightmapRayList* lmrl = params.lmrl;
+
+	glUseProgram(m_prog->m_id);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, source->m_tex_video->tex_id);
+	glUniform1i(0, 0);
+
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, lmrl->m_constant.m_id);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, params.target->m_id);
+
+	glUniform1f(1, params.mix_rate);
+
+	int num_verts = lmrl->end - lmrl->begin;
+	int num_blocks = (num_verts + 63) / 64;
+	glDispatchCompute(num_blocks, 1, 1);
+
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(0);
+}
+
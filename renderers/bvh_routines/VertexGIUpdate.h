@@ -0,0 +1,31 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "renderers/GLUtils.h"
+
+class BVHRenderTarget;
+class LightmapRayList;
+
+class VertexGIUpdate
+{
+public:
+	VertexGIUpdate();
+
+	struct RenderParams
+	{
+		float mix_rate;
+		const BVHRenderTarget* source;
+		const LightmapRayList* lmrl; // one record per vertex, in vertex order
+		const GLBuffer* target; // vec4 per vertex
+	};
+
+	// Averages the rays of each vertex record into the per-vertex buffer.
+	void update(const RenderParams& params);
+
+private:
+	std::unique_ptr<GLProgram> m_prog;
+
+};
+
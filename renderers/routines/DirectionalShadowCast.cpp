@@ -1,6 +1,7 @@
 #include <GL/glew.h>
 #include "models/ModelComponents.h"
 #include "DirectionalShadowCast.h"
+#include "utils/Utils.h"
 
 static std::string g_vertex =
 R"(#version 430
@@ -126,20 +127,6 @@ void main()
 }
 )";
 
-inline void replace(std::string& str, const char* target, const char* source)
-{
-	int start = 0;
-	size_t target_len = strlen(target);
-	size_t source_len = strlen(source);
-	while (true)
-	{
-		size_t pos = str.find(target, start);
-		if (pos == std::string::npos) break;
-		str.replace(pos, target_len, source);
-		start = pos + source_len;
-	}
-}
-
 
 void DirectionalShadowCast::s_generate_shaders(const Options& options, Bindings& bindings, std::string& s_vertex, std::string& s_frag)
 {
@@ -2,6 +2,7 @@
 #include "models/ModelComponents.h"
 #include "lights/DirectionalLight.h"
 #include "RasterizeAtlas.h"
+#include "utils/Utils.h"
 
 static std::string g_vertex =
 R"(#version 430
@@ -32,6 +33,7 @@ layout (location = LOCATION_VARYING_UV) out vec2 vUV;
 #endif
 
 layout (location = LOCATION_TEX_ATLAS_UV) uniform samplerBuffer uTexAtlasUV;
+layout (location = LOCATION_PAGE) uniform int uPage;
 
 #if HAS_NORMAL_MAP
 layout (location = LOCATION_TEX_TANGENT) uniform samplerBuffer uTexTangent;
@@ -68,8 +70,11 @@ void main()
 	vBitangent =  world_bitangent.xyz;
 #endif
 
-	vec2 atlas_uv = texelFetch(uTexAtlasUV, atlas_index).xy;
-	gl_Position = vec4(atlas_uv * 2.0 - 1.0, 0.0, 1.0);
+	vec4 atlas_uv = texelFetch(uTexAtlasUV, atlas_index);
+	gl_Position = vec4(atlas_uv.xy * 2.0 - 1.0, 0.0, 1.0);
+	
+	// triangles of other pages are moved out of the clip volume
+	if (int(atlas_uv.z) != uPage) gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
 }
 )";
 
@@ -105,12 +110,16 @@ layout (location = LOCATION_VARYING_BITANGENT) in vec3 vBitangent;
 
 layout (location = 0) out vec4 out_pos;
 layout (location = 1) out vec4 out_norm;
+layout (location = 2) out vec4 out_dpdx;
+layout (location = 3) out vec4 out_dpdy;
 
 void main()
 {
 	out_pos = vec4(vWorldPos, 1.0);	
 	vec3 dx = dFdx(vWorldPos);
 	vec3 dy = dFdy(vWorldPos);
+	out_dpdx = vec4(dx, 0.0);
+	out_dpdy = vec4(dy, 0.0);
 	vec3 N = normalize(cross(dx, dy));
 	if (length(N)>0.0)
 	{
@@ -133,20 +142,6 @@ void main()
 }
 )";
 
-inline void replace(std::string& str, const char* target, const char* source)
-{
-	int start = 0;
-	size_t target_len = strlen(target);
-	size_t source_len = strlen(source);
-	while (true)
-	{
-		size_t pos = str.find(target, start);
-		if (pos == std::string::npos) break;
-		str.replace(pos, target_len, source);
-		start = pos + source_len;
-	}
-}
-
 void RasterizeAtlas::s_generate_shaders(const Options& options, Bindings& bindings, std::string& s_vertex, std::string& s_frag)
 {
 	s_vertex = g_vertex;
@@ -313,6 +308,15 @@ void RasterizeAtlas::s_generate_shaders(const Options& options, Bindings& bindin
 		bindings.location_varying_bitangent = bindings.location_varying_tangent;
 	}
 
+	{
+		bindings.location_page = bindings.location_tex_bitangent + 1;
+		{
+			char line[64];
+			sprintf(line, "#define LOCATION_PAGE %d\n", bindings.location_page);
+			defines += line;
+		}
+	}
+
 	replace(s_vertex, "#DEFINES#", defines.c_str());
 	replace(s_frag, "#DEFINES#", defines.c_str());
 }
@@ -371,6 +375,8 @@ void RasterizeAtlas::render(const RenderParams& params)
 		texture_idx++;
 	}
 
+	glUniform1i(m_bindings.location_page, params.page);
+
 	if (m_options.has_normal_map)
 	{
 		const GLTexture2D& tex = *params.tex_list[material.tex_idx_normalMap];
@@ -27,6 +27,7 @@ public:
 		const MeshStandardMaterial** material_list;
 		const GLDynBuffer* constant_model;
 		const Primitive* primitive;
+		int page;
 	};
 
 	void render(const RenderParams& params);
@@ -52,6 +53,7 @@ private:
 		int location_varying_tangent;
 		int location_tex_bitangent;
 		int location_varying_bitangent;
+		int location_page;
 	};
 
 	Bindings m_bindings;
@@ -1,7 +1,10 @@
 #include <GL/glew.h>
 #include "models/ModelComponents.h"
 #include "lights/DirectionalLight.h"
+#include "lights/ProbeVolume.h"
+#include "renderers/LightmapCompressor.h"
 #include "StandardRoutine.h"
+#include "utils/Utils.h"
 
 static std::string g_vertex =
 R"(#version 430
@@ -49,7 +52,7 @@ layout (location = LOCATION_VARYING_UV) out vec2 vUV;
 
 #if HAS_LIGHTMAP
 layout (location = LOCATION_TEX_ATLAS_UV) uniform samplerBuffer uTexAtlasUV;
-layout (location = LOCATION_VARYING_ATLAS_UV) out vec2 vAtlasUV;
+layout (location = LOCATION_VARYING_ATLAS_UV) out vec3 vAtlasUV;
 #endif
 
 #if HAS_NORMAL_MAP
@@ -61,6 +64,11 @@ layout (location = LOCATION_VARYING_BITANGENT) out vec3 vBitangent;
 
 layout (location = LOCATION_VARYING_WORLD_POS) out vec3 vWorldPos;
 
+#if HAS_VERTEX_GI
+layout (location = LOCATION_TEX_VERT_GI) uniform samplerBuffer uTexVertGI;
+layout (location = LOCATION_VARYING_VERTEX_GI) out vec3 vVertexGI;
+#endif
+
 void main()
 {
 #if HAS_INDICES
@@ -94,7 +102,11 @@ void main()
 
 #if HAS_LIGHTMAP
 	int atlas_index = int(aAtlasInd);
-	vAtlasUV = texelFetch(uTexAtlasUV, atlas_index).xy;
+	vAtlasUV = texelFetch(uTexAtlasUV, atlas_index).xyz;
+#endif
+
+#if HAS_VERTEX_GI
+	vVertexGI = texelFetch(uTexVertGI, index).xyz;
 #endif
 }
 )";
@@ -496,8 +508,73 @@ float computePCSSShadowCoef(in DirectionalShadow shadow, sampler2DShadow shadowT
 #endif
 
 #if HAS_LIGHTMAP
-layout (location = LOCATION_VARYING_ATLAS_UV) in vec2 vAtlasUV;
-layout (location = LOCATION_TEX_LIGHTMAP) uniform sampler2D uTexLightmap;
+layout (location = LOCATION_VARYING_ATLAS_UV) in vec3 vAtlasUV;
+layout (location = LOCATION_TEX_LIGHTMAP) uniform sampler2DArray uTexLightmap;
+
+vec4 sample_lightmap(in vec3 uv)
+{
+	vec4 lm = texture(uTexLightmap, uv);
+#if LIGHTMAP_RGBM
+	lm = vec4(lm.xyz * lm.w * LIGHTMAP_RGBM_RANGE, 1.0);
+#endif
+	return lm;
+}
+#endif
+
+#if HAS_VERTEX_GI
+layout (location = LOCATION_VARYING_VERTEX_GI) in vec3 vVertexGI;
+#endif
+
+#if HAS_PROBE_VOLUME
+layout (std140, binding = BINDING_PROBE_VOLUME) uniform ProbeVolume
+{
+	vec4 uProbeMin;
+	vec4 uProbeMax;
+	ivec4 uProbeDims;
+};
+
+layout (location = LOCATION_TEX_PROBE_VOLUME) uniform sampler3D uTexProbeVolume;
+
+// irradiance / PI from the SH L2 coefficients of the probes around pos, 
+// the 9 coefficients are stacked along z
+vec3 probe_irradiance(in vec3 pos, in vec3 n)
+{
+	vec3 t = clamp((pos - uProbeMin.xyz) / max(uProbeMax.xyz - uProbeMin.xyz, vec3(1e-6)), 0.0, 1.0);
+	vec3 dims = vec3(uProbeDims.xyz);
+	vec3 uvw = (t * (dims - 1.0) + 0.5) / dims;
+
+	vec3 sh[9];
+	for (int k = 0; k < 9; k++)
+	{
+		sh[k] = texture(uTexProbeVolume, vec3(uvw.xy, (uvw.z + float(k)) / 9.0)).xyz;
+	}
+
+	vec3 col = sh[0] * 0.282095;
+	col += sh[1] * 0.488603 * n.y;
+	col += sh[2] * 0.488603 * n.z;
+	col += sh[3] * 0.488603 * n.x;
+	col += sh[4] * 1.092548 * n.x * n.y;
+	col += sh[5] * 1.092548 * n.y * n.z;
+	col += sh[6] * 0.315392 * (3.0 * n.z * n.z - 1.0);
+	col += sh[7] * 1.092548 * n.x * n.z;
+	col += sh[8] * 0.546274 * (n.x * n.x - n.y * n.y);
+	return max(col, vec3(0.0));
+}
+#endif
+
+#if HAS_REFLECTION_MAP
+layout (location = LOCATION_TEX_REFLECTION) uniform samplerCube uTexReflection;
+
+// split-sum environment BRDF, analytic fit by Karis
+vec3 EnvBRDFApprox(in vec3 f0, in float f90, in float roughness, in float dotNV)
+{
+	const vec4 c0 = vec4(-1.0, -0.0275, -0.572, 0.022);
+	const vec4 c1 = vec4(1.0, 0.0425, 1.04, -0.04);
+	vec4 r = roughness * c0 + c1;
+	float a004 = min(r.x * r.x, exp2(-9.28 * dotNV)) * r.x + r.y;
+	vec2 AB = vec2(-1.04, 1.04) * a004 + r.zw;
+	return f0 * AB.x + f90 * AB.y;
+}
 #endif
 )";
 
@@ -560,6 +637,7 @@ void main()
 
 	vec3 viewDir = normalize(vViewDir);
 	vec3 norm = normalize(vNorm);	
+	vec3 geom_norm = norm;
 
 #if HAS_NORMAL_MAP
 	if (length(vTangent)>0.0 && length(vBitangent)>0.0)
@@ -575,6 +653,7 @@ void main()
     if (uDoubleSided!=0 && !gl_FrontFacing)
 	{		
 		norm = -norm;
+		geom_norm = -geom_norm;
 	}
 
     PhysicalMaterial material;
@@ -636,10 +715,69 @@ void main()
 
 #if HAS_LIGHTMAP
 	{
-		vec4 lm = texture(uTexLightmap, vAtlasUV);
+#if LIGHTMAP_LIGHT_LAYERS>0
+		// relightable lightmap, the light layers are weighted by the current light colors
+		int lightmap_pages = textureSize(uTexLightmap, 0).z / (LIGHTMAP_LIGHT_LAYERS + 1);
+		vec4 lm = sample_lightmap(vec3(vAtlasUV.xy, vAtlasUV.z + float(LIGHTMAP_LIGHT_LAYERS * lightmap_pages)));
+		vec3 light_color = lm.w>0.0 ? lm.xyz/lm.w : vec3(0.0);
+#if NUM_DIRECTIONAL_LIGHTS>0
+		for (int i = 0; i < min(LIGHTMAP_LIGHT_LAYERS, NUM_DIRECTIONAL_LIGHTS); i++)
+		{
+			lm = sample_lightmap(vec3(vAtlasUV.xy, vAtlasUV.z + float(i * lightmap_pages)));
+			if (lm.w>0.0) light_color += lm.xyz/lm.w * uDirectionalLights[i].color.xyz;
+		}
+#endif
+#else
+		vec4 lm = sample_lightmap(vAtlasUV);
 		vec3 light_color = lm.w>0.0 ? lm.xyz/lm.w : vec3(0.0);
+#if HAS_LIGHTMAP_SH
+		// directional lightmap, the L1 terms move the irradiance from the geometric to the mapped normal
+		{
+			int lightmap_pages = textureSize(uTexLightmap, 0).z / 4;
+			float sh_layer = float(lightmap_pages) + vAtlasUV.z * 3.0;
+			vec3 dn = norm - geom_norm;
+			light_color.x += 2.0 / 3.0 * dot(texture(uTexLightmap, vec3(vAtlasUV.xy, sh_layer)).xyz, dn);
+			light_color.y += 2.0 / 3.0 * dot(texture(uTexLightmap, vec3(vAtlasUV.xy, sh_layer + 1.0)).xyz, dn);
+			light_color.z += 2.0 / 3.0 * dot(texture(uTexLightmap, vec3(vAtlasUV.xy, sh_layer + 2.0)).xyz, dn);
+			light_color = max(light_color, vec3(0.0));
+		}
+#endif
+#endif
 		diffuse += material.diffuseColor * light_color;
+#if !HAS_REFLECTION_MAP
 		specular += material.specularColor * light_color;
+#endif
+	}
+#endif
+
+#if HAS_VERTEX_GI
+	{
+		vec3 light_color = max(vVertexGI, vec3(0.0));
+		diffuse += material.diffuseColor * light_color;
+#if !HAS_REFLECTION_MAP
+		specular += material.specularColor * light_color;
+#endif
+	}
+#endif
+
+#if HAS_PROBE_VOLUME
+	{
+		vec3 light_color = probe_irradiance(vWorldPos, norm);
+		diffuse += material.diffuseColor * light_color;
+#if !HAS_REFLECTION_MAP
+		specular += material.specularColor * light_color;
+#endif
+	}
+#endif
+
+#if HAS_REFLECTION_MAP
+	{
+		// baked reflection, the mip levels are prefiltered for roughness going linearly from 0 to 1
+		vec3 reflectDir = reflect(-viewDir, norm);
+		float lod = material.roughness * float(textureQueryLevels(uTexReflection) - 1);
+		vec3 radiance = textureLod(uTexReflection, reflectDir, lod).xyz;
+		float dotNV = saturate(dot(norm, viewDir));
+		specular += radiance * EnvBRDFApprox(material.specularColor, material.specularF90, material.roughness, dotNV);
 	}
 #endif
 
@@ -664,20 +802,6 @@ void main()
 }
 )";
 
-inline void replace(std::string& str, const char* target, const char* source)
-{
-	int start = 0;
-	size_t target_len = strlen(target);
-	size_t source_len = strlen(source);
-	while (true)
-	{
-		size_t pos = str.find(target, start);
-		if (pos == std::string::npos) break;
-		str.replace(pos, target_len, source);
-		start = pos + source_len;
-	}
-}
-
 void StandardRoutine::s_generate_shaders(const Options& options, Bindings& bindings, std::string& s_vertex, std::string& s_frag)
 {
 	s_vertex = g_vertex;
@@ -1078,6 +1202,33 @@ void StandardRoutine::s_generate_shaders(const Options& options, Bindings& bindi
 		defines += line;
 	}
 
+	{
+		char line[64];
+		sprintf(line, "#define LIGHTMAP_LIGHT_LAYERS %d\n", options.lightmap_light_layers);
+		defines += line;
+	}
+
+	if (options.has_lightmap_sh)
+	{
+		defines += "#define HAS_LIGHTMAP_SH 1\n";
+	}
+	else
+	{
+		defines += "#define HAS_LIGHTMAP_SH 0\n";
+	}
+
+	if (options.lightmap_rgbm)
+	{
+		defines += "#define LIGHTMAP_RGBM 1\n";
+		char line[64];
+		sprintf(line, "#define LIGHTMAP_RGBM_RANGE %f\n", LightmapCompressor::s_rgbm_range);
+		defines += line;
+	}
+	else
+	{
+		defines += "#define LIGHTMAP_RGBM 0\n";
+	}
+
 	bindings.location_tex_directional_shadow = bindings.location_tex_glossiness + options.num_directional_shadows;
 	bindings.location_tex_directional_shadow_depth = bindings.location_tex_directional_shadow + options.num_directional_shadows;
 
@@ -1119,6 +1270,68 @@ void StandardRoutine::s_generate_shaders(const Options& options, Bindings& bindi
 		bindings.location_tex_lightmap = bindings.location_tex_directional_shadow_depth;
 	}
 
+	if (options.has_probe_volume)
+	{
+		defines += "#define HAS_PROBE_VOLUME 1\n";
+		bindings.binding_probe_volume = bindings.binding_directional_shadows + 1;
+		{
+			char line[64];
+			sprintf(line, "#define BINDING_PROBE_VOLUME %d\n", bindings.binding_probe_volume);
+			defines += line;
+		}
+		bindings.location_tex_probe_volume = bindings.location_tex_lightmap + 1;
+		{
+			char line[64];
+			sprintf(line, "#define LOCATION_TEX_PROBE_VOLUME %d\n", bindings.location_tex_probe_volume);
+			defines += line;
+		}
+	}
+	else
+	{
+		defines += "#define HAS_PROBE_VOLUME 0\n";
+		bindings.binding_probe_volume = bindings.binding_directional_shadows;
+		bindings.location_tex_probe_volume = bindings.location_tex_lightmap;
+	}
+
+	if (options.has_reflection_map)
+	{
+		defines += "#define HAS_REFLECTION_MAP 1\n";
+		bindings.location_tex_reflection = bindings.location_tex_probe_volume + 1;
+		{
+			char line[64];
+			sprintf(line, "#define LOCATION_TEX_REFLECTION %d\n", bindings.location_tex_reflection);
+			defines += line;
+		}
+	}
+	else
+	{
+		defines += "#define HAS_REFLECTION_MAP 0\n";
+		bindings.location_tex_reflection = bindings.location_tex_probe_volume;
+	}
+
+	if (options.has_vertex_gi)
+	{
+		defines += "#define HAS_VERTEX_GI 1\n";
+		bindings.location_tex_vert_gi = bindings.location_tex_reflection + 1;
+		bindings.location_varying_vertex_gi = bindings.location_varying_world_pos + 1;
+		{
+			char line[64];
+			sprintf(line, "#define LOCATION_TEX_VERT_GI %d\n", bindings.location_tex_vert_gi);
+			defines += line;
+		}
+		{
+			char line[64];
+			sprintf(line, "#define LOCATION_VARYING_VERTEX_GI %d\n", bindings.location_varying_vertex_gi);
+			defines += line;
+		}
+	}
+	else
+	{
+		defines += "#define HAS_VERTEX_GI 0\n";
+		bindings.location_tex_vert_gi = bindings.location_tex_reflection;
+		bindings.location_varying_vertex_gi = bindings.location_varying_world_pos;
+	}
+
 	replace(s_vertex, "#DEFINES#", defines.c_str());
 	replace(s_frag, "#DEFINES#", defines.c_str());
 }
@@ -1290,7 +1503,7 @@ void StandardRoutine::_render_common(const RenderParams& params)
 	if (m_options.has_lightmap)
 	{
 		glActiveTexture(GL_TEXTURE0 + texture_idx);
-		glBindTexture(GL_TEXTURE_2D, params.tex_lightmap->tex_id);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, params.tex_lightmap->tex_id);
 		glUniform1i(m_bindings.location_tex_lightmap, texture_idx);
 		texture_idx++;
 
@@ -1298,6 +1511,33 @@ void StandardRoutine::_render_common(const RenderParams& params)
 		glVertexAttribIPointer(m_bindings.location_attrib_atlas_indices, 1, GL_UNSIGNED_INT, 0, nullptr);
 		glEnableVertexAttribArray(m_bindings.location_attrib_atlas_indices);
 	}
+
+	if (m_options.has_probe_volume)
+	{
+		const ProbeVolume* volume = params.lights->probe_volume;
+		glBindBufferBase(GL_UNIFORM_BUFFER, m_bindings.binding_probe_volume, volume->m_constant.m_id);
+
+		glActiveTexture(GL_TEXTURE0 + texture_idx);
+		glBindTexture(GL_TEXTURE_3D, volume->irradiance->tex_id);
+		glUniform1i(m_bindings.location_tex_probe_volume, texture_idx);
+		texture_idx++;
+	}
+
+	if (m_options.has_reflection_map)
+	{
+		glActiveTexture(GL_TEXTURE0 + texture_idx);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, params.tex_reflection->tex_id);
+		glUniform1i(m_bindings.location_tex_reflection, texture_idx);
+		texture_idx++;
+	}
+
+	if (m_options.has_vertex_gi)
+	{
+		glActiveTexture(GL_TEXTURE0 + texture_idx);
+		glBindTexture(GL_TEXTURE_BUFFER, params.primitive->vertex_gi_buf->tex_id);
+		glUniform1i(m_bindings.location_tex_vert_gi, texture_idx);
+		texture_idx++;
+	}
 }
 
 void StandardRoutine::render(const RenderParams& params)
@@ -31,6 +31,12 @@ public:
 		bool has_glossiness_map = false;
 		int num_directional_lights = 0;
 		int num_directional_shadows = 0;		
+		int lightmap_light_layers = 0;
+		bool has_lightmap_sh = false;
+		bool lightmap_rgbm = false;
+		bool has_probe_volume = false;
+		bool has_reflection_map = false;
+		bool has_vertex_gi = false;
 	};
 	StandardRoutine(const Options& options);
 
@@ -42,7 +48,11 @@ public:
 		const GLDynBuffer* constant_model;
 		const Primitive* primitive;
 		const Lights* lights;
-		const GLTexture2D* tex_lightmap;
+		const GLTexture2DArray* tex_lightmap;
+		int lightmap_light_layers = 0; // see Lightmap::num_light_layers
+		bool lightmap_sh = false; // see Lightmap::sh_l1
+		bool lightmap_rgbm = false; // LightmapFormat::RGBM8, BC6H is sampled like RGBA16F
+		const ReflectionMap* tex_reflection = nullptr; // prefiltered, replaces the specular of the lightmap / probe volume
 	};
 
 	void render(const RenderParams& params);
@@ -85,6 +95,11 @@ private:
 		int location_tex_directional_shadow;
 		int location_tex_directional_shadow_depth;		
 		int location_tex_lightmap;
+		int binding_probe_volume;
+		int location_tex_probe_volume;
+		int location_tex_reflection;
+		int location_tex_vert_gi;
+		int location_varying_vertex_gi;
 	};
 
 	Bindings m_bindings;
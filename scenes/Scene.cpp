@@ -1,5 +1,11 @@
+#include <GL/glew.h>
 #include "Scene.h"
 #include "models/SimpleModel.h"
+#include "models/GLTFModel.h"
+#include "renderers/LightmapRenderTarget.h"
+#include "renderers/AtlasRasterizerCPU.h"
+#include "renderers/GLRenderer.h"
+#include "lights/ReflectionProbe.h"
 
 void Scene::get_bounding_box(glm::vec3& min_pos, glm::vec3& max_pos, const glm::mat4& view_matrix)
 {
@@ -57,3 +63,278 @@ void Scene::get_bounding_box(glm::vec3& min_pos, glm::vec3& max_pos, const glm::
 	}
 }
 
+void Scene::_collect_lightmap_primitives(std::vector<Primitive*>& primitives, std::vector<glm::mat4>& trans)
+{
+	clear_lists();
+
+	auto* p_scene = this;
+	traverse([p_scene](Object3D* obj) {
+		do
+		{
+			{
+				SimpleModel* model = dynamic_cast<SimpleModel*>(obj);
+				if (model)
+				{
+					p_scene->simple_models.push_back(model);
+					break;
+				}
+			}
+			{
+				GLTFModel* model = dynamic_cast<GLTFModel*>(obj);
+				if (model)
+				{
+					p_scene->gltf_models.push_back(model);
+					break;
+				}
+			}
+		} while (false);
+
+		obj->updateWorldMatrix(false, false);
+	});
+
+	// texel density is measured in world space, so the atlas is packed with the world transforms
+	for (size_t i = 0; i < simple_models.size(); i++)
+	{
+		SimpleModel* model = simple_models[i];
+		size_t offset = trans.size();
+		model->get_lightmap_primitives(primitives, trans);
+		for (size_t j = offset; j < trans.size(); j++)
+		{
+			trans[j] = model->matrixWorld * trans[j];
+		}
+	}
+
+	for (size_t i = 0; i < gltf_models.size(); i++)
+	{
+		GLTFModel* model = gltf_models[i];
+		size_t offset = trans.size();
+		std::vector<int> mesh_ids;
+		model->get_lightmap_primitives(primitives, trans, mesh_ids);
+		for (size_t j = offset; j < trans.size(); j++)
+		{
+			trans[j] = model->matrixWorld * trans[j];
+		}
+	}
+}
+
+void Scene::init_lightmap(GLRenderer* renderer, int texelsPerUnit, int pageSize)
+{
+	std::vector<Primitive*> primitives;
+	std::vector<glm::mat4> trans;
+	_collect_lightmap_primitives(primitives, trans);
+	if (primitives.empty()) return;
+
+	lightmap = std::shared_ptr<Lightmap>(new Lightmap(primitives, trans, texelsPerUnit, pageSize));
+	_init_lightmap_target(renderer);
+}
+
+void Scene::init_lightmap(GLRenderer* renderer, const LightmapBudget& budget)
+{
+	std::vector<Primitive*> primitives;
+	std::vector<glm::mat4> trans;
+	_collect_lightmap_primitives(primitives, trans);
+	if (primitives.empty()) return;
+
+	lightmap = std::shared_ptr<Lightmap>(new Lightmap(primitives, trans, budget));
+	_init_lightmap_target(renderer);
+}
+
+void Scene::_init_lightmap_target(GLRenderer* renderer)
+{
+	lightmap_targets.resize(lightmap->num_pages);
+	for (int page = 0; page < lightmap->num_pages; page++)
+	{
+		lightmap_targets[page] = std::shared_ptr<LightmapRenderTarget>(new LightmapRenderTarget);
+		lightmap_targets[page]->page = page;
+		lightmap_targets[page]->update_framebuffer(lightmap->width, lightmap->height);
+	}
+
+	bool has_normal_map = false;
+	for (size_t i = 0; i < simple_models.size(); i++)
+	{
+		simple_models[i]->set_lightmap(lightmap, lightmap_targets);
+		has_normal_map = has_normal_map || simple_models[i]->has_normal_map();
+	}
+	for (size_t i = 0; i < gltf_models.size(); i++)
+	{
+		gltf_models[i]->set_lightmap(lightmap, lightmap_targets);
+		has_normal_map = has_normal_map || gltf_models[i]->has_normal_map();
+	}
+
+	for (int page = 0; page < lightmap->num_pages; page++)
+	{
+		LightmapRenderTarget& target = *lightmap_targets[page];
+
+		// the CPU rasterizer writes the whole page at once, so a single normal mapped model 
+		// moves the whole page to the GL path
+		if (has_normal_map)
+		{
+			bool clear = true;
+			for (size_t i = 0; i < simple_models.size(); i++)
+			{
+				renderer->rasterize_atlas(simple_models[i], page, clear);
+				clear = false;
+			}
+			for (size_t i = 0; i < gltf_models.size(); i++)
+			{
+				renderer->rasterize_atlas(gltf_models[i], page, clear);
+				clear = false;
+			}
+		}
+		else
+		{
+			AtlasRasterizerCPU rasterizer(lightmap->width, lightmap->height);
+			for (size_t i = 0; i < simple_models.size(); i++)
+			{
+				simple_models[i]->add_lightmap_primitives(rasterizer, page);
+			}
+			for (size_t i = 0; i < gltf_models.size(); i++)
+			{
+				gltf_models[i]->add_lightmap_primitives(rasterizer, page);
+			}
+			rasterizer.rasterize();
+			rasterizer.upload(target);
+		}
+
+		renderer->compact_atlas(target);
+	}
+
+	glm::vec4 zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+	glClearTexImage(lightmap->lightmap->tex_id, 0, GL_RGBA, GL_FLOAT, &zero);
+}
+
+void Scene::init_lightmap_split(GLRenderer* renderer, int downsample)
+{
+	if (lightmap == nullptr) return;
+	if (downsample < 1) downsample = 1;
+
+	lightmap_direct = std::shared_ptr<Lightmap>(new Lightmap(lightmap->width, lightmap->height, lightmap->num_pages));
+	lightmap_direct->texels_per_unit = lightmap->texels_per_unit;
+
+	int width = (lightmap->width + downsample - 1) / downsample;
+	int height = (lightmap->height + downsample - 1) / downsample;
+	lightmap_indirect = std::shared_ptr<Lightmap>(new Lightmap(width, height, lightmap->num_pages));
+	lightmap_indirect->texels_per_unit = lightmap->texels_per_unit / (float)downsample;
+
+	// the atlas uvs are normalized, so the same charts are rasterized at the lower density. 
+	// The padding between charts shrinks below a texel there, texels shared by several charts are dropped 
+	// and their full density texels take the indirect light of the neighbors on their own chart.
+	// The smooth indirect light does not need the normal maps, so the CPU rasterizer is used for every page
+	lightmap_indirect_targets.resize(lightmap->num_pages);
+	for (int page = 0; page < lightmap->num_pages; page++)
+	{
+		lightmap_indirect_targets[page] = std::shared_ptr<LightmapRenderTarget>(new LightmapRenderTarget);
+		LightmapRenderTarget& target = *lightmap_indirect_targets[page];
+		target.page = page;
+		target.update_framebuffer(width, height);
+
+		AtlasRasterizerCPU rasterizer(width, height);
+		rasterizer.mask_shared_texels = true;
+		for (size_t i = 0; i < simple_models.size(); i++)
+		{
+			if (simple_models[i]->lightmap != lightmap) continue;
+			simple_models[i]->add_lightmap_primitives(rasterizer, page);
+		}
+		for (size_t i = 0; i < gltf_models.size(); i++)
+		{
+			if (gltf_models[i]->lightmap != lightmap) continue;
+			gltf_models[i]->add_lightmap_primitives(rasterizer, page);
+		}
+		rasterizer.rasterize();
+		rasterizer.upload(target);
+
+		renderer->compact_atlas(target);
+	}
+
+	glm::vec4 zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+	glClearTexImage(lightmap_direct->lightmap->tex_id, 0, GL_RGBA, GL_FLOAT, &zero);
+	glClearTexImage(lightmap_indirect->lightmap->tex_id, 0, GL_RGBA, GL_FLOAT, &zero);
+}
+
+static void world_bounds(const glm::vec3& min_pos, const glm::vec3& max_pos, const glm::mat4& matrix, glm::vec3& world_min, glm::vec3& world_max)
+{
+	world_min = { FLT_MAX, FLT_MAX, FLT_MAX };
+	world_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int j = 0; j < 8; j++)
+	{
+		glm::vec3 corner = { (j & 1) ? max_pos.x : min_pos.x, (j & 2) ? max_pos.y : min_pos.y, (j & 4) ? max_pos.z : min_pos.z };
+		glm::vec3 pos = glm::vec3(matrix * glm::vec4(corner, 1.0f));
+		world_min = glm::min(world_min, pos);
+		world_max = glm::max(world_max, pos);
+	}
+}
+
+void Scene::mark_lightmap_dirty(const glm::vec3& min_pos, const glm::vec3& max_pos)
+{
+	m_lightmap_dirty_boxes.push_back(min_pos);
+	m_lightmap_dirty_boxes.push_back(max_pos);
+}
+
+void Scene::mark_lightmap_dirty(SimpleModel* model)
+{
+	model->updateWorldMatrix(true, false);
+	glm::vec3 min_pos, max_pos;
+	world_bounds(model->geometry.min_pos, model->geometry.max_pos, model->matrixWorld, min_pos, max_pos);
+	mark_lightmap_dirty(min_pos, max_pos);
+}
+
+void Scene::mark_lightmap_dirty(GLTFModel* model)
+{
+	model->updateWorldMatrix(true, false);
+	glm::vec3 min_pos, max_pos;
+	world_bounds(model->m_min_pos, model->m_max_pos, model->matrixWorld, min_pos, max_pos);
+	mark_lightmap_dirty(min_pos, max_pos);
+}
+
+void Scene::mark_lightmap_dirty()
+{
+	mark_lightmap_dirty(glm::vec3(-FLT_MAX), glm::vec3(FLT_MAX));
+}
+
+int Scene::update_lightmap_dirty(GLRenderer* renderer, float radius)
+{
+	lightmap_dirty_targets.clear();
+	if (lightmap == nullptr) return 0;
+
+	// anything within radius of a change can see it through shadows or bounces
+	std::vector<glm::vec3> boxes = m_lightmap_dirty_boxes;
+	for (size_t i = 0; i < boxes.size(); i += 2)
+	{
+		boxes[i] -= glm::vec3(radius);
+		boxes[i + 1] += glm::vec3(radius);
+	}
+	m_lightmap_dirty_boxes.clear();
+
+	int count = 0;
+	lightmap_dirty_targets.resize(lightmap_targets.size());
+	for (size_t page = 0; page < lightmap_targets.size(); page++)
+	{
+		lightmap_dirty_targets[page] = std::shared_ptr<LightmapRenderTarget>(new LightmapRenderTarget);
+		count += renderer->selectLightmapTexels(*lightmap_targets[page], boxes, *lightmap_dirty_targets[page]);
+	}
+	return count;
+}
+
+void Scene::place_reflection_probes(const glm::ivec3& dims, int size)
+{
+	glm::vec3 min_pos, max_pos;
+	get_bounding_box(min_pos, max_pos);
+
+	reflection_probes.clear();
+	if (min_pos.x > max_pos.x) return;
+
+	// probes at the cell centers, so none sits on the boundary walls
+	glm::ivec3 n = glm::max(dims, glm::ivec3(1));
+	for (int z = 0; z < n.z; z++)
+	{
+		for (int y = 0; y < n.y; y++)
+		{
+			for (int x = 0; x < n.x; x++)
+			{
+				glm::vec3 t = (glm::vec3(x, y, z) + 0.5f) / glm::vec3(n);
+				glm::vec3 pos = min_pos + (max_pos - min_pos) * t;
+				reflection_probes.push_back(std::shared_ptr<ReflectionProbe>(new ReflectionProbe(pos, size)));
+			}
+		}
+	}
+}
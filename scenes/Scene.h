@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <unordered_set>
 
 #include "core/Object3D.h"
@@ -9,6 +10,13 @@ class Background;
 class SimpleModel;
 class GLTFModel;
 class DirectionalLight;
+class Primitive;
+class Lightmap;
+class LightmapRenderTarget;
+struct LightmapBudget;
+class GLRenderer;
+class ProbeVolume;
+class ReflectionProbe;
 class Scene : public Object3D
 {
 public:
@@ -28,5 +36,46 @@ public:
 	}
 
 	void get_bounding_box(glm::vec3& min_pos, glm::vec3& max_pos, const glm::mat4& view_matrix = glm::identity<glm::mat4>());
+
+	// Packs all models of the scene into one atlas that the models share, 
+	// so a whole page of the scene is baked with a single updateLightmap() call.
+	std::shared_ptr<Lightmap> lightmap;
+	std::vector<std::shared_ptr<LightmapRenderTarget>> lightmap_targets; // one per lightmap page
+	void init_lightmap(GLRenderer* renderer, int texelsPerUnit = 128, int pageSize = 0);
+	void init_lightmap(GLRenderer* renderer, const LightmapBudget& budget);
+
+	// Split bake, after init_lightmap(): lightmap_direct is baked over lightmap_targets with LightmapPart::Direct, 
+	// lightmap_indirect over the atlas rasterized again at 1/downsample the density with LightmapPart::Indirect, 
+	// then GLRenderer::compositeLightmap() combines them into lightmap.
+	// "Direct" is only the light arriving straight from the sky and emissive surfaces: directional lights 
+	// stay dynamic and are in neither part, their bounces are in the indirect part.
+	std::shared_ptr<Lightmap> lightmap_direct;
+	std::shared_ptr<Lightmap> lightmap_indirect;
+	std::vector<std::shared_ptr<LightmapRenderTarget>> lightmap_indirect_targets; // one per lightmap page
+	void init_lightmap_split(GLRenderer* renderer, int downsample = 4);
+
+	// Incremental rebake: mark what changed (a moved model both before and after the move), 
+	// then update_lightmap_dirty() gathers the texels within radius of the marked boxes 
+	// into lightmap_dirty_targets, which are baked in place of lightmap_targets.
+	void mark_lightmap_dirty(const glm::vec3& min_pos, const glm::vec3& max_pos);
+	void mark_lightmap_dirty(SimpleModel* model);
+	void mark_lightmap_dirty(GLTFModel* model);
+	void mark_lightmap_dirty(); // everything, e.g. a light changed
+	std::vector<std::shared_ptr<LightmapRenderTarget>> lightmap_dirty_targets; // one per lightmap page
+	int update_lightmap_dirty(GLRenderer* renderer, float radius);
+
+	// Irradiance probes lighting the models without a lightmap, baked with GLRenderer::updateProbeVolume()
+	std::shared_ptr<ProbeVolume> probe_volume;
+
+	// Reflection probes, each model uses the nearest one. Baked with GLRenderer::bakeReflectionProbes()
+	std::vector<std::shared_ptr<ReflectionProbe>> reflection_probes;
+	// replaces the probes with a dims grid spanning the bounding box of the scene
+	void place_reflection_probes(const glm::ivec3& dims, int size = 128);
+
+private:
+	std::vector<glm::vec3> m_lightmap_dirty_boxes; // world-space min/max pairs
+
+	void _collect_lightmap_primitives(std::vector<Primitive*>& primitives, std::vector<glm::mat4>& trans);
+	void _init_lightmap_target(GLRenderer* renderer);
 };
 
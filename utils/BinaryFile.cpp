@@ -0,0 +1,81 @@
+#include <cstring>
+#include "BinaryFile.h"
+
+BinaryFileWriter::BinaryFileWriter(const char* path) : m_path(path), m_tmp_path(std::string(path) + ".tmp")
+{
+	m_fp = fopen(m_tmp_path.c_str(), "wb");
+	m_ok = m_fp != nullptr;
+}
+
+BinaryFileWriter::~BinaryFileWriter()
+{
+	// dropped without a commit
+	if (m_fp != nullptr)
+	{
+		fclose(m_fp);
+		remove(m_tmp_path.c_str());
+	}
+}
+
+bool BinaryFileWriter::write(const void* data, size_t size, size_t count)
+{
+	m_ok = m_ok && fwrite(data, size, count, m_fp) == count;
+	return m_ok;
+}
+
+bool BinaryFileWriter::write_header(const char magic[4], uint32_t version)
+{
+	write(magic, 1, 4);
+	return write(version);
+}
+
+bool BinaryFileWriter::commit()
+{
+	if (m_fp == nullptr)
+	{
+		printf("Failed to write %s\n", m_tmp_path.c_str());
+		return false;
+	}
+
+	bool ok = (fclose(m_fp) == 0) && m_ok;
+	m_fp = nullptr;
+	m_ok = false;
+
+	if (!ok)
+	{
+		printf("Failed to write %s\n", m_tmp_path.c_str());
+		remove(m_tmp_path.c_str());
+		return false;
+	}
+
+	remove(m_path.c_str());
+	if (rename(m_tmp_path.c_str(), m_path.c_str()) != 0)
+	{
+		printf("Failed to move %s to %s\n", m_tmp_path.c_str(), m_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+BinaryFileReader::BinaryFileReader(const char* path)
+{
+	m_fp = fopen(path, "rb");
+}
+
+BinaryFileReader::~BinaryFileReader()
+{
+	if (m_fp != nullptr) fclose(m_fp);
+}
+
+bool BinaryFileReader::read(void* data, size_t size, size_t count)
+{
+	return m_fp != nullptr && fread(data, size, count, m_fp) == count;
+}
+
+bool BinaryFileReader::read_header(const char magic[4], uint32_t version)
+{
+	char file_magic[4];
+	bool ok = read(file_magic, 1, 4) && memcmp(file_magic, magic, 4) == 0;
+	ok = ok && read_expect(version);
+	return ok;
+}
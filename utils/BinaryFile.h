@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Writes a binary file aside as <path>.tmp and moves it in place on commit(), so readers polling
+// for the file never see a partial write and a failed write keeps the previous file.
+// A failed write is remembered and makes the remaining writes and the commit fail.
+class BinaryFileWriter
+{
+public:
+	BinaryFileWriter(const char* path);
+	~BinaryFileWriter();
+
+	bool is_open() const { return m_fp != nullptr; }
+	bool ok() const { return m_ok; }
+
+	bool write(const void* data, size_t size, size_t count);
+	template<typename T>
+	bool write(const T& value) { return write(&value, sizeof(T), 1); }
+	bool write_header(const char magic[4], uint32_t version);
+
+	// closes the file and moves it to path, the temporary file is removed on failure
+	bool commit();
+
+private:
+	BinaryFileWriter(const BinaryFileWriter&);
+
+	std::string m_path;
+	std::string m_tmp_path;
+	FILE* m_fp = nullptr;
+	bool m_ok = false;
+};
+
+// Reads a binary file with checked reads, a short read counts as a failure.
+class BinaryFileReader
+{
+public:
+	BinaryFileReader(const char* path);
+	~BinaryFileReader();
+
+	bool is_open() const { return m_fp != nullptr; }
+
+	bool read(void* data, size_t size, size_t count);
+	template<typename T>
+	bool read(T& value) { return read(&value, sizeof(T), 1); }
+
+	// reads a value and compares it with the expected one
+	template<typename T>
+	bool read_expect(const T& expected)
+	{
+		T value;
+		return read(value) && value == expected;
+	}
+
+	bool read_header(const char magic[4], uint32_t version);
+
+private:
+	BinaryFileReader(const BinaryFileReader&);
+
+	FILE* m_fp = nullptr;
+};
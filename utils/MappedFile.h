@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file. Pages are loaded by the OS on first access
+// and belong to the page cache, so they don't add to the heap of the process.
+class MappedFile
+{
+public:
+	MappedFile(const char* filename);
+	~MappedFile();
+
+	bool is_open() const { return m_data != nullptr; }
+	const uint8_t* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	MappedFile(const MappedFile&);
+
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#endif
+};
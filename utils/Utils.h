@@ -3,6 +3,11 @@
 #include <cstdint>
 #include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
 
 inline uint64_t time_micro_sec()
 {
@@ -46,4 +51,62 @@ inline bool writable_test(const char* name)
 	{
 		return false;
 	}
-}
\ No newline at end of file
+}
+
+// integer hash, used to derive per-batch seeds
+inline unsigned hash_u32(unsigned x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+// Replaces every occurrence of target in str, used to fill shader placeholders
+inline void replace(std::string& str, const char* target, const char* source)
+{
+	int start = 0;
+	size_t target_len = strlen(target);
+	size_t source_len = strlen(source);
+	while (true)
+	{
+		size_t pos = str.find(target, start);
+		if (pos == std::string::npos) break;
+		str.replace(pos, target_len, source);
+		start = pos + source_len;
+	}
+}
+
+// Runs func(i) for i in [0, count) on num_threads threads, the calling thread included.
+// num_threads < 1 uses all hardware threads.
+template<typename Func>
+inline void parallel_for(int num_threads, int count, const Func& func)
+{
+	if (num_threads < 1) num_threads = (int)std::thread::hardware_concurrency();
+	if (num_threads < 1) num_threads = 1;
+	if (num_threads > count) num_threads = count;
+
+	std::atomic<int> next(0);
+	auto worker = [&]()
+	{
+		while (true)
+		{
+			int i = next.fetch_add(1);
+			if (i >= count) break;
+			func(i);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < num_threads; i++)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+}